@@ -7,11 +7,14 @@
 // CONSTRUCTOR & DESTRUCTOR
 //=================================================================================================
 P2PClient::P2PClient(const std::string& ip, int port) 
-    : my_ip(ip), my_port(port), logged_in(false), server_socket(-1), running(false) {
+    : my_ip(ip), my_port(port), logged_in(false), server_socket(-1), block_size(DEFAULT_BLOCK_SIZE),
+      peer_window(DEFAULT_PEER_WINDOW), running(false), heartbeat_stop(false), event_stop(false) {
     signal(SIGPIPE, SIG_IGN); 
 }
 
 P2PClient::~P2PClient() {
+    stop_heartbeat();
+    stop_events();
     running = false;
     if (server_socket != -1) {
         close(server_socket);
@@ -80,17 +83,21 @@ bool P2PClient::initialize(const std::string& tracker_file) {
         return false;
     }
     
+    // "<ip>:<port> [<shard>]": trackers are grouped by shard, and the shards
+    // put on a hash ring that tells which one serves a group
     std::string line;
     while (std::getline(file, line)) {
-        if (!line.empty()) {
-            size_t colon_pos = line.find(':');
-            if (colon_pos != std::string::npos) {
-                TrackerInfo tracker;
-                tracker.ip = line.substr(0, colon_pos);
-                tracker.port = std::stoi(line.substr(colon_pos + 1));
-                trackers.push_back(tracker);
-            }
+        TrackerAddress address;
+        if (!parse_tracker_line(line, address)) continue;
+        TrackerInfo tracker;
+        tracker.ip = address.ip;
+        tracker.port = address.port;
+        tracker.shard = std::find(shard_names.begin(), shard_names.end(), address.shard) - shard_names.begin();
+        if (tracker.shard == static_cast<int>(shard_names.size())) {
+            shard_names.push_back(address.shard);
+            shard_ring.add(address.shard);
         }
+        trackers.push_back(tracker);
     }
     file.close();
     
@@ -99,15 +106,38 @@ bool P2PClient::initialize(const std::string& tracker_file) {
         return false;
     }
     
+    // One session per shard, opened on first use
+    for (size_t shard = 0; shard < shard_names.size(); ++shard) {
+        std::vector<TrackerAddress> addresses;
+        for (const auto& tracker : trackers) {
+            if (tracker.shard != static_cast<int>(shard)) continue;
+            TrackerAddress address;
+            address.ip = tracker.ip;
+            address.port = tracker.port;
+            address.shard = shard_names[shard];
+            addresses.push_back(address);
+        }
+        sessions.push_back(std::unique_ptr<TrackerSession>(new TrackerSession(addresses)));
+    }
+    
     // Start server for peer-to-peer connections
     start_server();
     
     print_success("Client initialized successfully");
     print_info("Your IP: " + my_ip + ":" + std::to_string(my_port));
     print_info("Found " + std::to_string(trackers.size()) + " tracker(s)");
+    if (shard_names.size() > 1) {
+        print_info("Groups are spread over " + std::to_string(shard_names.size()) + " tracker shards");
+    }
     
     return true;
 }
+// Block size is kept within MIN_BLOCK_SIZE..DEFAULT_BLOCK_SIZE. The window is
+// best set to the link's bandwidth-delay product divided by the block size.
+void P2PClient::set_transfer_options(int block_size, int peer_window) {
+    this->block_size = std::max(MIN_BLOCK_SIZE, std::min(block_size, DEFAULT_BLOCK_SIZE));
+    this->peer_window = std::max(1, std::min(peer_window, MAX_PEER_WINDOW));
+}
 void P2PClient::start_server() {
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket < 0) {
@@ -163,30 +193,60 @@ void P2PClient::start_server() {
 //=================================================================================================
 // PEER CONNECTION HANDLING
 //=================================================================================================
+// Serves piece requests on one connection until the peer closes it or stays
+// quiet for PEER_IDLE_TIMEOUT_MS. Successive requests may name different files.
 void P2PClient::handle_peer_connection(int peer_socket) {
-    print_info("New peer connection received");
-    
-    char buffer[MAX_BUFFER_SIZE];
-    ssize_t bytes_received = recv(peer_socket, buffer, sizeof(buffer) - 1, 0);
-    
-    if (bytes_received > 0) {
-        buffer[bytes_received] = '\0';
-        std::string request(buffer);
-        
-        if (!request.empty() && request.back() == '\n') {
+    PeerConnection conn(peer_socket);
+    set_socket_timeouts(peer_socket, PEER_IDLE_TIMEOUT_MS);
+    int one = 1;
+    setsockopt(peer_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    // The file of the last request stays open for the next one
+    std::string open_name;
+    std::ifstream file;
+    long file_size = 0;
+    int pieces_sent = 0;
+    
+    std::string request;
+    while (conn.read_line(request)) {
+        if (!request.empty() && request.back() == '\r') {
             request.pop_back();
         }
         
-        print_info("Received request: " + request);
-        
-        // Parse request: "GET_PIECE <filename> <piece_index>"
+        // Parse request: "GET_PIECE <filename> <piece_index>", or
+        // "GET_BLOCK <filename> <piece_index> <offset> <length>" for part of a piece
         std::vector<std::string> tokens = split_string(request, ' ');
+        bool block = !tokens.empty() && tokens[0] == "GET_BLOCK";
+        int piece_index = -1;
+        long block_offset = 0;
+        long block_length = PIECE_SIZE;
+        if (tokens.size() >= (block ? 5u : 3u) && (block || tokens[0] == "GET_PIECE")) {
+            try {
+                piece_index = std::stoi(tokens[2]);
+                if (block) {
+                    block_offset = std::stol(tokens[3]);
+                    block_length = std::stol(tokens[4]);
+                }
+            } catch (const std::exception& e) {
+                piece_index = -1;
+            }
+        }
+        if (block_offset < 0 || block_length <= 0 || block_offset + block_length > PIECE_SIZE) {
+            piece_index = -1;
+        }
         
-        if (tokens.size() >= 3 && tokens[0] == "GET_PIECE") {
-            std::string filename = tokens[1];
-            int piece_index = std::stoi(tokens[2]);
-            
-            print_info("Request for piece " + std::to_string(piece_index) + " of file " + filename);
+        if (piece_index < 0) {
+            print_error("Invalid request format: " + request);
+            std::string response = "INVALID_REQUEST\n";
+            if (!send_all(peer_socket, response.data(), response.size())) break;
+            continue;
+        }
+        
+        const std::string& filename = tokens[1];
+        if (filename != open_name) {
+            open_name.clear();
+            file.close();
+            file.clear();
             
             std::vector<std::string> possible_paths = {
                 filename,                       // Current directory
@@ -195,180 +255,316 @@ void P2PClient::handle_peer_connection(int peer_socket) {
                 "../" + filename,               // Parent directory
             };
             
-            std::string file_path;
-            bool file_found = false;
-            
             for (const auto& path : possible_paths) {
-                std::ifstream test_file(path, std::ios::binary);
-                if (test_file.is_open()) {
-                    file_path = path;
-                    file_found = true;
-                    test_file.close();
-                    print_info("Found file at: " + file_path);
+                file.open(path, std::ios::binary);
+                if (file.is_open()) {
+                    file.seekg(0, std::ios::end);
+                    file_size = file.tellg();
+                    open_name = filename;
                     break;
                 }
+                file.clear();
             }
             
-            if (!file_found) {
+            if (open_name.empty()) {
                 print_error("File not found: " + filename);
-                std::string response = "PIECE_NOT_FOUND\n";
-                send(peer_socket, response.c_str(), response.length(), 0);
-                close(peer_socket);
-                return;
-            }
-            
-            std::ifstream file(file_path, std::ios::binary);
-            if (!file.is_open()) {
-                print_error("Failed to open file: " + file_path);
-                std::string response = "PIECE_NOT_FOUND\n";
-                send(peer_socket, response.c_str(), response.length(), 0);
-                close(peer_socket);
-                return;
-            }
-            
-            // Get file size first
-            file.seekg(0, std::ios::end);
-            long file_size = file.tellg();
-            file.seekg(0, std::ios::beg);
-            
-            print_info("File size: " + std::to_string(file_size) + " bytes");
-            
-            // Calculate piece offset and size
-            const size_t ACTUAL_PIECE_SIZE = 524288; // 512KB
-            long piece_offset = (long)piece_index * ACTUAL_PIECE_SIZE;
-            
-            // Check if this piece exists in the file
-            if (piece_offset >= file_size) {
-                print_info("Piece " + std::to_string(piece_index) + " is beyond file size");
-                std::string response = "PIECE_NOT_FOUND\n";
-                send(peer_socket, response.c_str(), response.length(), 0);
-                file.close();
-                close(peer_socket);
-                return;
             }
-            
-            // Seek to piece location
+        }
+        
+        // Calculate piece offset and size
+        long piece_offset = (long)piece_index * PIECE_SIZE + block_offset;
+        long piece_data_size = open_name.empty() ? 0 : std::min(block_length, file_size - piece_offset);
+        
+        // Header and data leave in one write
+        std::string response;
+        if (piece_data_size > 0) {
+            std::string header = (block ? "BLOCK_DATA " : "PIECE_DATA ") + std::to_string(piece_data_size) + "\n";
+            response.resize(header.size() + piece_data_size);
+            memcpy(&response[0], header.data(), header.size());
+            file.clear();
             file.seekg(piece_offset);
-            if (file.fail()) {
-                print_error("Failed to seek to piece " + std::to_string(piece_index));
-                std::string response = "PIECE_NOT_FOUND\n";
-                send(peer_socket, response.c_str(), response.length(), 0);
-                file.close();
-                close(peer_socket);
-                return;
+            file.read(&response[header.size()], piece_data_size);
+            if (file.gcount() != piece_data_size) {
+                print_error("Failed to read piece " + std::to_string(piece_index) + " of " + filename);
+                response.clear();
             }
+        }
+        if (response.empty()) {
+            // Also the answer for a piece or block past the end of the file
+            response = "PIECE_NOT_FOUND\n";
+        } else if (block_offset + block_length == PIECE_SIZE || piece_data_size < block_length) {
+            pieces_sent++;
+        }
+        
+        if (!send_all(peer_socket, response.data(), response.size())) {
+            print_error("Failed to send piece " + std::to_string(piece_index) + " of " + filename);
+            break;
+        }
+    }
+    
+    if (pieces_sent > 0) {
+        print_info("Peer connection closed after " + std::to_string(pieces_sent) + " piece(s)");
+    }
+}
+
+//=================================================================================================
+// TRACKER COMMUNICATION
+//=================================================================================================
+// Connects to the first reachable tracker of shard, or of any shard for -1.
+// Used for event connections; commands go through the shard's session.
+bool P2PClient::connect_to_tracker(int& tracker_socket, int shard) {
+    for (const auto& tracker : trackers) {
+        if (shard >= 0 && tracker.shard != shard) continue;
+        tracker_socket = connect_with_timeout(tracker.ip, tracker.port, TRACKER_CONNECT_TIMEOUT_MS);
+        if (tracker_socket >= 0) return true;
+    }
+    return false;
+}
+// Shard serving a group's commands; -1 (any tracker) with a single shard.
+int P2PClient::shard_of(const std::string& group_id) {
+    return shard_names.size() > 1 ? shard_ring.owner(group_id) : -1;
+}
+bool P2PClient::send_to_tracker(int socket, const std::string& message, const std::string& blob) {
+    // Commands travel as length-prefixed frames, so the trailing newline is not needed
+    std::string command = message;
+    if (!command.empty() && command.back() == '\n') {
+        command.pop_back();
+    }
+    return send_frame(socket, MSG_COMMAND, command, blob);
+}
+std::string P2PClient::receive_from_tracker(int socket) {
+    // Reads exactly one reply frame, however many segments it spans
+    Frame reply;
+    if (!recv_frame(socket, reply) || reply.type != MSG_REPLY) {
+        return "";
+    }
+    return reply.text;
+}
+// Runs one command on the shard's session (any shard for -1) and follows a
+// REDIRECT. False if no tracker of the shard could be reached.
+bool P2PClient::ask_tracker(int shard, const std::string& command, std::string& response, const std::string& blob) {
+    if (!sessions[shard < 0 ? 0 : shard]->request(command, response, blob)) return false;
+    follow_redirect(command, response, blob);
+    return true;
+}
+// "REDIRECT <group> <ip>:<port>..." comes from a tracker that does not serve
+// the group, which happens when our tracker_info.txt is out of date. The
+// command is sent again, on a connection of its own, to the trackers named.
+void P2PClient::follow_redirect(const std::string& command, std::string& response, const std::string& blob) {
+    if (response.compare(0, 9, "REDIRECT ") != 0) return;
+    std::vector<std::string> parts = split_string(response.substr(0, response.find('\n')), ' ');
+    print_info("Group '" + (parts.size() > 1 ? parts[1] : std::string()) +
+               "' is served by another shard, tracker_info.txt is out of date");
+    
+    response = "ERROR: The group's tracker shard is unreachable\n";
+    for (size_t i = 2; i < parts.size(); ++i) {
+        TrackerAddress address;
+        if (!parse_tracker_line(parts[i], address)) continue;
+        int fd = connect_with_timeout(address.ip, address.port, TRACKER_CONNECT_TIMEOUT_MS);
+        if (fd < 0) continue;
+        set_socket_timeouts(fd, TRACKER_REPLY_TIMEOUT_MS);
+        std::string reply;
+        if (send_to_tracker(fd, command, blob)) {
+            reply = receive_from_tracker(fd);
+        }
+        close(fd);
+        if (!reply.empty()) {
+            response = reply;
+            return;
+        }
+    }
+}
+// Account and session commands go to every shard, since each keeps every
+// account. The shards are asked at once. Returns the first reply that is not
+// a success ("" if a shard is unreachable), otherwise the last one.
+std::string P2PClient::send_to_every_shard(const std::string& command) {
+    std::vector<std::shared_ptr<TrackerSession::Pending>> pending;
+    for (const auto& session : sessions) {
+        pending.push_back(session->send(command));
+    }
+    std::string response;
+    std::string failure;
+    bool failed = false;
+    for (size_t shard = 0; shard < sessions.size(); ++shard) {
+        bool ok = sessions[shard]->wait(pending[shard], response);
+        if (!ok) response.clear();
+        if (!failed && response.find("SUCCESS") == std::string::npos) {
+            failure = response;
+            failed = true;
+        }
+    }
+    return failed ? failure : response;
+}
+// Runs a listing command page by page over the shard's session. Each page
+// goes to on_page without its "NEXT <cursor>" trailer as soon as it arrives,
+// so only one page is held at a time; on_page returns false to stop.
+bool P2PClient::request_pages(const std::string& command, const std::function<bool(const std::string&)>& on_page, int shard) {
+    bool ok = true;
+    std::string cursor;
+    do {
+        std::string page;
+        if (!ask_tracker(shard, cursor.empty() ? command : command + " " + cursor, page)) {
+            print_error("Failed to connect to tracker");
+            ok = false;
+            break;
+        }
+        
+        cursor.clear();
+        size_t last_line = page.rfind('\n', page.size() >= 2 ? page.size() - 2 : 0);
+        last_line = last_line == std::string::npos ? 0 : last_line + 1;
+        if (page.compare(last_line, 5, "NEXT ") == 0) {
+            cursor = page.substr(last_line + 5);
+            if (!cursor.empty() && cursor.back() == '\n') cursor.pop_back();
+            page.resize(last_line);
+        }
+        if (!on_page(page)) {
+            ok = false;
+            break;
+        }
+    } while (!cursor.empty());
+    
+    return ok;
+}
+// Renews the tracker lease so this client keeps being handed out as a peer.
+// The first renewal goes out at once to learn the lease, then three per lease.
+void P2PClient::start_heartbeat(const std::string& username) {
+    stop_heartbeat();
+    heartbeat_stop = false;
+    heartbeat_thread = std::thread([this, username]() {
+        int interval = 0;
+        std::unique_lock<std::mutex> lock(heartbeat_mutex);
+        while (!heartbeat_cv.wait_for(lock, std::chrono::seconds(interval), [this]() { return heartbeat_stop; })) {
+            lock.unlock();
+            std::string response = send_to_every_shard("HEARTBEAT " + username + "\n");
+            lock.lock();
             
-            // Calculate how much data to read
-            long remaining_file_size = file_size - piece_offset;
-            int piece_data_size = std::min((long)ACTUAL_PIECE_SIZE, remaining_file_size);
-            
-            if (piece_data_size <= 0) {
-                print_info("No data to read for piece " + std::to_string(piece_index));
-                std::string response = "PIECE_NOT_FOUND\n";
-                send(peer_socket, response.c_str(), response.length(), 0);
-                file.close();
-                close(peer_socket);
-                return;
-            }
-            
-            // Read the piece data
-            std::vector<char> piece_buffer(piece_data_size);
-            file.read(piece_buffer.data(), piece_data_size);
-            int actual_read = file.gcount();
-            file.close();
-            
-            if (actual_read <= 0) {
-                print_error("No data read for piece " + std::to_string(piece_index));
-                std::string response = "PIECE_NOT_FOUND\n";
-                send(peer_socket, response.c_str(), response.length(), 0);
-                close(peer_socket);
+            if (response.find("not logged in") != std::string::npos) {
+                print_error("Tracker ended the session, please login again");
                 return;
             }
-            
-            print_info("Sending piece " + std::to_string(piece_index) + 
-                      " (" + std::to_string(actual_read) + " bytes)");
-            
-            // Send response header FIRST
-            std::string response_header = "PIECE_DATA " + std::to_string(actual_read) + "\n";
-            ssize_t header_sent = send(peer_socket, response_header.c_str(), response_header.length(), 0);
-            
-            if (header_sent <= 0) {
-                print_error("Failed to send response header");
-                close(peer_socket);
-                return;
+            // "SUCCESS: Lease renewed for <seconds> seconds"
+            interval = HEARTBEAT_INTERVAL;
+            size_t at = response.find(" for ");
+            if (at != std::string::npos && atoi(response.c_str() + at + 5) > 0) {
+                interval = std::max(1, atoi(response.c_str() + at + 5) / 3);
             }
+        }
+    });
+}
+
+void P2PClient::stop_heartbeat() {
+    {
+        std::lock_guard<std::mutex> lock(heartbeat_mutex);
+        heartbeat_stop = true;
+    }
+    heartbeat_cv.notify_all();
+    if (heartbeat_thread.joinable()) {
+        heartbeat_thread.join();
+    }
+}
+// Subscribes to a group's events (every group of ours if none is given) on
+// connections that stay open while logged in, one to each shard. The tracker
+// pushes MSG_EVENT frames on them, so nothing needs to poll LIST_FILES or
+// LIST_REQUESTS.
+void P2PClient::subscribe_events(const std::string& group_id) {
+    std::lock_guard<std::mutex> lock(event_mutex);
+    if (event_threads.empty()) {
+        event_stop = false;
+        event_sockets.assign(shard_names.size(), -1);
+        for (size_t shard = 0; shard < shard_names.size(); ++shard) {
+            event_threads.push_back(std::thread(&P2PClient::event_loop, this, static_cast<int>(shard)));
+        }
+        return;
+    }
+    int owner = group_id.empty() ? -1 : shard_of(group_id);
+    for (size_t shard = 0; shard < event_sockets.size(); ++shard) {
+        if (event_sockets[shard] == -1 || (owner >= 0 && owner != static_cast<int>(shard))) continue;
+        send_to_tracker(event_sockets[shard], "SUBSCRIBE " + user_id + (group_id.empty() ? "" : " " + group_id));
+    }
+}
+
+// Keeps the event connection to one shard up. When the tracker closes it (it
+// restarted, or failed over), a new connection subscribes to all our groups
+// there again.
+void P2PClient::event_loop(int shard) {
+    std::unique_lock<std::mutex> lock(event_mutex);
+    while (!event_stop) {
+        lock.unlock();
+        int fd;
+        bool connected = connect_to_tracker(fd, shard);
+        lock.lock();
+        if (connected && event_stop) {
+            close(fd);
+            break;
+        }
+        if (connected) {
+            event_sockets[shard] = fd;
+            send_to_tracker(fd, "SUBSCRIBE " + user_id);
+            lock.unlock();
             
-            print_info("Sent header: '" + response_header.substr(0, response_header.length()-1) + "'");
-            
-            // THEN send piece data in chunks
-            int total_sent = 0;
-            int chunk_size = 1024;
-            
-            while (total_sent < actual_read) {
-                int to_send = std::min(chunk_size, actual_read - total_sent);
-                ssize_t sent = send(peer_socket, piece_buffer.data() + total_sent, to_send, 0);
-                
-                if (sent <= 0) {
-                    print_error("Failed to send piece data at offset " + std::to_string(total_sent));
-                    break;
+            Frame frame;
+            while (recv_frame(fd, frame)) {
+                // Replies to SUBSCRIBE come back here too; events are all that matter
+                if (frame.type != MSG_EVENT) continue;
+                size_t start = 0;
+                while (start < frame.text.size()) {
+                    size_t end = frame.text.find('\n', start);
+                    if (end == std::string::npos) end = frame.text.size();
+                    show_event(frame.text.substr(start, end - start));
+                    start = end + 1;
                 }
-                
-                total_sent += sent;
-                print_info("Sent " + std::to_string(sent) + " bytes, total: " + std::to_string(total_sent));
-            }
-            
-            if (total_sent == actual_read) {
-                print_success("Successfully sent piece " + std::to_string(piece_index) + 
-                             " (" + std::to_string(total_sent) + " bytes)");
-            } else {
-                print_error("Incomplete piece send: " + std::to_string(total_sent) + 
-                           "/" + std::to_string(actual_read));
             }
             
-        } else {
-            print_error("Invalid request format: " + request);
-            std::string response = "INVALID_REQUEST\n";
-            send(peer_socket, response.c_str(), response.length(), 0);
+            lock.lock();
+            close(fd);
+            event_sockets[shard] = -1;
         }
-    } else {
-        print_error("Failed to receive request from peer");
+        event_cv.wait_for(lock, std::chrono::milliseconds(EVENT_RECONNECT_MS), [this]() { return event_stop; });
     }
-    
-    close(peer_socket);
 }
 
-//=================================================================================================
-// TRACKER COMMUNICATION
-//=================================================================================================
-bool P2PClient::connect_to_tracker(int& tracker_socket) {
-    for (const auto& tracker : trackers) {
-        tracker_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (tracker_socket < 0) continue;
-        
-        struct sockaddr_in tracker_addr;
-        tracker_addr.sin_family = AF_INET;
-        tracker_addr.sin_port = htons(tracker.port);
-        inet_pton(AF_INET, tracker.ip.c_str(), &tracker_addr.sin_addr);
-        
-        if (connect(tracker_socket, (struct sockaddr*)&tracker_addr, sizeof(tracker_addr)) == 0) {
-            return true;
+void P2PClient::stop_events() {
+    {
+        std::lock_guard<std::mutex> lock(event_mutex);
+        event_stop = true;
+        for (int fd : event_sockets) {
+            if (fd != -1) shutdown(fd, SHUT_RDWR);
         }
-        
-        close(tracker_socket);
     }
-    return false;
-}
-bool P2PClient::send_to_tracker(int socket, const std::string& message) {
-    return send(socket, message.c_str(), message.length(), 0) > 0;
+    event_cv.notify_all();
+    for (std::thread& thread : event_threads) {
+        if (thread.joinable()) thread.join();
+    }
+    event_threads.clear();
 }
-std::string P2PClient::receive_from_tracker(int socket) {
-    char buffer[MAX_BUFFER_SIZE];
-    ssize_t bytes_received = recv(socket, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received > 0) {
-        buffer[bytes_received] = '\0';
-        return std::string(buffer);
+
+// "EVENT <group> <kind> <args>", as listed in tracker/events.h
+void P2PClient::show_event(const std::string& line) {
+    std::vector<std::string> parts = split_string(line, ' ');
+    if (parts.size() < 4 || parts[0] != "EVENT") return;
+    const std::string& group = parts[1];
+    const std::string& kind = parts[2];
+    std::string text;
+    if (kind == "FILE_ADDED") {
+        text = "New file '" + parts[3] + "'";
+    } else if (kind == "FILE_REMOVED") {
+        text = "'" + parts[3] + "' is no longer shared";
+    } else if (kind == "SEEDER_JOINED" && parts.size() >= 5) {
+        text = parts[4] + " is now seeding '" + parts[3] + "'";
+    } else if (kind == "SEEDER_LEFT" && parts.size() >= 5) {
+        text = parts[4] + " stopped seeding '" + parts[3] + "'";
+    } else if (kind == "REQUEST_PENDING") {
+        text = parts[3] + " asked to join";
+    } else if (kind == "MEMBER_JOINED") {
+        text = parts[3] == user_id ? "Your join request was accepted" : parts[3] + " joined the group";
+    } else if (kind == "MEMBER_LEFT") {
+        text = parts[3] + " left the group";
+    } else {
+        return;
     }
-    return "";
+    // Arrives while the menu waits for input, so start below the prompt
+    print_colored("\n🔔 [" + group + "] " + text, MAGENTA);
+    std::cout << std::endl;
 }
 //=================================================================================================
 // UTILITY FUNCTIONS
@@ -447,22 +643,12 @@ std::vector<std::string> P2PClient::calculate_piece_hashes(const std::string& fi
 // USER MANAGEMENT FUNCTIONS
 //=================================================================================================
 bool P2PClient::create_user(const std::string& username, const std::string& password) {
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
-        print_error("Failed to connect to tracker");
-        return false;
-    }
-    
-    std::string command = "CREATE_USER " + username + " " + password + "\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
+    std::string response = send_to_every_shard("CREATE_USER " + username + " " + password + "\n");
+    if (response.empty()) {
+        print_error("Failed to reach a tracker of every shard");
         return false;
     }
     
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
     if (response.find("SUCCESS") != std::string::npos) {
         print_success("User account created successfully!");
         return true;
@@ -472,30 +658,24 @@ bool P2PClient::create_user(const std::string& username, const std::string& pass
     }
 }
 bool P2PClient::login(const std::string& username, const std::string& password) {
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
-        print_error("Failed to connect to tracker");
-        return false;
-    }
-    
     print_info("Sending login with IP: " + my_ip + " and port: " + std::to_string(my_port));
     
     std::string command = "LOGIN " + username + " " + password + " " + my_ip + " " + std::to_string(my_port) + "\n";
     
     print_info("Login command: " + command.substr(0, command.length()-1)); // Remove \n for display
     
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
+    // Every shard hands us out as a peer, so every shard needs the session
+    std::string response = send_to_every_shard(command);
+    if (response.empty()) {
+        print_error("Failed to reach a tracker of every shard");
         return false;
     }
     
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
     if (response.find("SUCCESS") != std::string::npos) {
         logged_in = true;
         user_id = username;
+        start_heartbeat(username);
+        subscribe_events();
         print_success("Logged in successfully! Welcome, " + username + "!");
         return true;
     } else {
@@ -509,22 +689,14 @@ bool P2PClient::logout() {
         return false;
     }
     
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
+    std::string response = send_to_every_shard("LOGOUT " + user_id + "\n");
+    if (response.empty()) {
         print_error("Failed to connect to tracker");
         return false;
     }
     
-    std::string command = "LOGOUT " + user_id + "\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
-        return false;
-    }
-    
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
+    stop_heartbeat();
+    stop_events();
     logged_in = false;
     user_id = "";
     shared_files.clear();
@@ -542,23 +714,15 @@ bool P2PClient::create_group(const std::string& group_id) {
         return false;
     }
     
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
-        print_error("Failed to connect to tracker");
-        return false;
-    }
-    
     std::string command = "CREATE_GROUP " + user_id + " " + group_id + "\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
+    std::string response;
+    if (!ask_tracker(shard_of(group_id), command, response)) {
+        print_error("Failed to connect to tracker");
         return false;
     }
     
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
     if (response.find("SUCCESS") != std::string::npos) {
+        subscribe_events(group_id);
         print_success("Group '" + group_id + "' created successfully!");
         return true;
     } else {
@@ -572,23 +736,15 @@ bool P2PClient::join_group(const std::string& group_id) {
         return false;
     }
     
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
-        print_error("Failed to connect to tracker");
-        return false;
-    }
-    
     std::string command = "JOIN_GROUP " + user_id + " " + group_id + "\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
+    std::string response;
+    if (!ask_tracker(shard_of(group_id), command, response)) {
+        print_error("Failed to connect to tracker");
         return false;
     }
     
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
     if (response.find("SUCCESS") != std::string::npos) {
+        subscribe_events(group_id);
         print_success("Join request sent for group '" + group_id + "'");
         return true;
     } else {
@@ -602,22 +758,13 @@ bool P2PClient::leave_group(const std::string& group_id) {
         return false;
     }
     
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
-        print_error("Failed to connect to tracker");
-        return false;
-    }
-    
     std::string command = "LEAVE_GROUP " + user_id + " " + group_id + "\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
+    std::string response;
+    if (!ask_tracker(shard_of(group_id), command, response)) {
+        print_error("Failed to connect to tracker");
         return false;
     }
     
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
     if (response.find("SUCCESS") != std::string::npos) {
         print_success("Left group '" + group_id + "' successfully");
         return true;
@@ -627,32 +774,28 @@ bool P2PClient::leave_group(const std::string& group_id) {
     }
 }
 bool P2PClient::list_groups() {
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
-        print_error("Failed to connect to tracker");
-        return false;
-    }
-    
-    std::string command = "LIST_GROUPS\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
-        return false;
+    // Each shard lists the groups it serves
+    bool listed = false;
+    bool ok = true;
+    for (size_t shard = 0; shard < shard_names.size(); ++shard) {
+        ok = request_pages("LIST_GROUPS", [&](const std::string& page) {
+            if (page.empty() || page.compare(0, 19, "No groups available") == 0) return false;
+            if (!listed) {
+                print_info("Available Groups:");
+                print_separator();
+                listed = true;
+            }
+            std::cout << YELLOW << page << RESET;
+            return true;
+        }, static_cast<int>(shard)) && ok;
     }
     
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
-    if (!response.empty()) {
-        print_info("Available Groups:");
+    if (listed) {
         print_separator();
-        std::cout << YELLOW << response << RESET;
-        print_separator();
-        return true;
-    } else {
-        print_info("No groups available");
-        return false;
+        return ok;
     }
+    print_info("No groups available");
+    return false;
 }
 bool P2PClient::list_requests(const std::string& group_id) {
     if (!logged_in) {
@@ -660,22 +803,13 @@ bool P2PClient::list_requests(const std::string& group_id) {
         return false;
     }
     
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
-        print_error("Failed to connect to tracker");
-        return false;
-    }
-    
     std::string command = "LIST_REQUESTS " + user_id + " " + group_id + "\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
+    std::string response;
+    if (!ask_tracker(shard_of(group_id), command, response)) {
+        print_error("Failed to connect to tracker");
         return false;
     }
     
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
     if (!response.empty() && response.find("ERROR") == std::string::npos) {
         print_info("Pending requests for group '" + group_id + "':");
         print_separator();
@@ -693,22 +827,13 @@ bool P2PClient::accept_request(const std::string& group_id, const std::string& u
         return false;
     }
     
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
-        print_error("Failed to connect to tracker");
-        return false;
-    }
-    
     std::string command = "ACCEPT_REQUEST " + user_id + " " + group_id + " " + username + "\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
+    std::string response;
+    if (!ask_tracker(shard_of(group_id), command, response)) {
+        print_error("Failed to connect to tracker");
         return false;
     }
     
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
     if (response.find("SUCCESS") != std::string::npos) {
         print_success("Accepted join request from '" + username + "' for group '" + group_id + "'");
         return true;
@@ -726,32 +851,63 @@ bool P2PClient::list_files(const std::string& group_id) {
         return false;
     }
     
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
-        print_error("Failed to connect to tracker");
+    bool listed = false;
+    bool ok = request_pages("LIST_FILES " + user_id + " " + group_id, [&](const std::string& page) {
+        if (page.empty() || page.find("ERROR") != std::string::npos) return false;
+        if (!listed) {
+            print_info("Files available in group '" + group_id + "':");
+            print_separator();
+            listed = true;
+        }
+        std::cout << GREEN << page << RESET;
+        return true;
+    }, shard_of(group_id));
+    
+    if (listed) {
+        print_separator();
+        return ok;
+    }
+    print_info("No files available or access denied");
+    return false;
+}
+
+bool P2PClient::search_files(const std::string& query) {
+    if (!logged_in) {
+        print_error("Please login first");
         return false;
     }
-    
-    std::string command = "LIST_FILES " + user_id + " " + group_id + "\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
+    if (query.empty() || query.find(' ') != std::string::npos) {
+        print_error("Enter one word to search for");
         return false;
     }
     
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
-    if (!response.empty() && response.find("ERROR") == std::string::npos) {
-        print_info("Files available in group '" + group_id + "':");
-        print_separator();
-        std::cout << GREEN << response << RESET;
-        print_separator();
-        return true;
-    } else {
-        print_info("No files available or access denied");
-        return false;
+    // Every shard is asked at once: each ranks matches from the groups of ours
+    // it serves, and the lists are shown one after the other
+    std::string command = "SEARCH " + user_id + " " + query + "\n";
+    std::vector<std::shared_ptr<TrackerSession::Pending>> pending;
+    for (const auto& session : sessions) {
+        pending.push_back(session->send(command));
+    }
+    std::string matches;
+    std::string response;
+    for (size_t shard = 0; shard < sessions.size(); ++shard) {
+        if (!sessions[shard]->wait(pending[shard], response)) {
+            print_error("Failed to connect to tracker");
+            return false;
+        }
+        if (response.empty() || response.find("ERROR") == 0) {
+            print_error("Search failed: " + response);
+            return false;
+        }
+        if (response.compare(0, 17, "No matching files") != 0) matches += response;
     }
+    if (!matches.empty()) response = matches;
+    
+    print_info("Files matching '" + query + "':");
+    print_separator();
+    std::cout << GREEN << response << RESET;
+    print_separator();
+    return true;
 }
 
 bool P2PClient::upload_file(const std::string& filepath, const std::string& group_id) {
@@ -816,74 +972,70 @@ bool P2PClient::upload_file(const std::string& filepath, const std::string& grou
     }
    
     print_info("File hash calculated successfully");
-    print_info("Calculating piece hashes...");
     
-    // Calculate piece hashes with error handling
-    std::vector<std::string> piece_hashes;
-    try {
-        piece_hashes = calculate_piece_hashes(filepath);
-        if (piece_hashes.empty()) {
-            print_error("Failed to calculate piece hashes");
-            return false;
-        }
-    } catch (const std::exception& e) {
-        print_error("Error calculating piece hashes: " + std::string(e.what()));
-        return false;
-    }
-   
-    print_info("Calculated " + std::to_string(piece_hashes.size()) + " piece hashes");
+    // Offer the whole-file hash alone first ("?" for the piece hashes): content
+    // the tracker already knows, from any group, needs no piece hashes at all
+    std::string size_str = std::to_string(file_stat.st_size);
+    std::string command = "UPLOAD_FILE " + user_id + " " + group_id + " " + filename + " " +
+                          file_hash + " ? " + size_str + "\n";
+    
+    print_info("Sending upload request to tracker...");
     
-    // Connect to tracker
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
+    std::string response;
+    if (!ask_tracker(shard_of(group_id), command, response)) {
         print_error("Failed to connect to tracker");
         return false;
     }
     
-    // Create hash string (first 20 chars of each piece hash)
-    std::string hash_string = "";
-    try {
-        for (const auto& hash : piece_hashes) {
-            if (hash.length() >= 20) {
-                hash_string += hash.substr(0, 20);
-            } else {
-                hash_string += hash;
+    if (response.find("Unknown content") != std::string::npos) {
+        print_info("Calculating piece hashes...");
+        
+        // Calculate piece hashes with error handling
+        std::vector<std::string> piece_hashes;
+        try {
+            piece_hashes = calculate_piece_hashes(filepath);
+            if (piece_hashes.empty()) {
+                print_error("Failed to calculate piece hashes");
+                return false;
             }
+        } catch (const std::exception& e) {
+            print_error("Error calculating piece hashes: " + std::string(e.what()));
+            return false;
         }
-    } catch (const std::exception& e) {
-        print_error("Error creating hash string: " + std::string(e.what()));
-        close(tracker_socket);
-        return false;
-    }
-   
-    // Create command
-    std::string command;
-    try {
-        command = "UPLOAD_FILE " + user_id + " " + group_id + " " + filename + " " + 
-                    file_hash + " " + hash_string + " " + std::to_string(file_stat.st_size) + "\n";
-    } catch (const std::exception& e) {
-        print_error("Error creating upload command: " + std::string(e.what()));
-        close(tracker_socket);
-        return false;
-    }
-    
-    print_info("Sending upload request to tracker...");
-    
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
-        return false;
+        
+        print_info("Calculated " + std::to_string(piece_hashes.size()) + " piece hashes");
+        
+        // Full piece digests travel as raw bytes (20 per piece) in the frame's blob
+        std::string piece_digests;
+        try {
+            piece_digests.reserve(piece_hashes.size() * 20);
+            for (const auto& hash : piece_hashes) {
+                for (size_t i = 0; i + 1 < hash.length(); i += 2) {
+                    piece_digests.push_back(static_cast<char>(std::stoi(hash.substr(i, 2), nullptr, 16)));
+                }
+            }
+        } catch (const std::exception& e) {
+            print_error("Error encoding piece hashes: " + std::string(e.what()));
+            return false;
+        }
+        
+        // "-" stands in for the piece hashes carried in the blob
+        command = "UPLOAD_FILE " + user_id + " " + group_id + " " + filename + " " +
+                  file_hash + " - " + size_str + "\n";
+        if (!ask_tracker(shard_of(group_id), command, response, piece_digests)) {
+            print_error("Failed to connect to tracker");
+            return false;
+        }
+    } else if (response.find("SUCCESS") != std::string::npos) {
+        print_info("Content already known to the tracker, piece hashes not sent");
     }
-   
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
     
     if (response.find("SUCCESS") != std::string::npos) {
         shared_files.insert(filepath);
         print_success("File '" + filename + "' uploaded successfully to group '" + group_id + "'");
         print_info("File hash: " + file_hash.substr(0, 16) + "...");
-        print_info("File size: " + std::to_string(file_stat.st_size) + " bytes");
-        print_info("Total pieces: " + std::to_string(piece_hashes.size()));
+        print_info("File size: " + size_str + " bytes");
+        print_info("Total pieces: " + std::to_string((file_stat.st_size + PIECE_SIZE - 1) / PIECE_SIZE));
         return true;
     } else {
         print_error("Failed to upload file: " + response);
@@ -897,22 +1049,13 @@ bool P2PClient::stop_share(const std::string& group_id, const std::string& filen
         return false;
     }
    
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
-        print_error("Failed to connect to tracker");
-        return false;
-    }
-   
     std::string command = "STOP_SHARE " + user_id + " " + group_id + " " + filename + "\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
+    std::string response;
+    if (!ask_tracker(shard_of(group_id), command, response)) {
+        print_error("Failed to connect to tracker");
         return false;
     }
     
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
-    
     if (response.find("SUCCESS") != std::string::npos) {
         print_success("Stopped sharing '" + filename + "' in group '" + group_id + "'");
         return true;
@@ -932,21 +1075,13 @@ bool P2PClient::download_file(const std::string& group_id, const std::string& fi
         return false;
     }
    
-    int tracker_socket;
-    if (!connect_to_tracker(tracker_socket)) {
+    // SOURCES: also list holders of the same content shared in other groups
+    std::string command = "DOWNLOAD_FILE " + user_id + " " + group_id + " " + filename + " SOURCES\n";
+    std::string response;
+    if (!ask_tracker(shard_of(group_id), command, response)) {
         print_error("Failed to connect to tracker");
         return false;
     }
-   
-    std::string command = "DOWNLOAD_FILE " + user_id + " " + group_id + " " + filename + "\n";
-    if (!send_to_tracker(tracker_socket, command)) {
-        print_error("Failed to send command to tracker");
-        close(tracker_socket);
-        return false;
-    }
-   
-    std::string response = receive_from_tracker(tracker_socket);
-    close(tracker_socket);
     
     // DEBUG: Print raw response
     print_info("Raw tracker response: '" + response + "'");
@@ -972,9 +1107,30 @@ bool P2PClient::download_file(const std::string& group_id, const std::string& fi
     for (const auto& line : lines) {
         print_info("Processing line: '" + line + "'");
         
-        if (line.find("PEERS:") != std::string::npos) {
-            // Get everything after "PEERS: "
-            std::string peer_data = line.substr(7); // Skip "PEERS: "
+        if (line.compare(0, 7, "SOURCE ") == 0) {
+            // Same content in another group: "SOURCE <ip> <port> <user> <filename>"
+            std::vector<std::string> source_tokens = split_string(line.substr(7), ' ');
+            if (source_tokens.size() < 4) {
+                print_error("Malformed source line: " + line);
+                continue;
+            }
+            try {
+                PeerInfo peer;
+                peer.ip = source_tokens[0];
+                peer.port = std::stoi(source_tokens[1]);
+                peer.user_id = source_tokens[2];
+                peer.filename = source_tokens[3];
+                
+                print_info("Parsed source: " + peer.user_id + " at " + peer.ip + ":" + std::to_string(peer.port) +
+                           " (as " + peer.filename + ")");
+                file_info.peers.push_back(peer);
+            } catch (const std::exception& e) {
+                print_error("Error parsing source info: " + std::string(e.what()));
+            }
+        } else if (line.find("PEERS:") != std::string::npos) {
+            // Get everything after "PEERS: " (the list may be empty)
+            size_t data_start = line.find("PEERS:") + 6;
+            std::string peer_data = data_start < line.size() ? line.substr(data_start + 1) : std::string();
             print_info("Peer data: '" + peer_data + "'");
             
             // Remove any extra spaces
@@ -1159,24 +1315,27 @@ void P2PClient::piece_selection_algorithm(const FileInfo& file_info, const std::
     // Reserve space for progress display
     std::cout << "\n\n\n";
     
-    // Download pieces sequentially
+    // Download pieces in order, a run of them from each peer in turn
     std::vector<int> successful_pieces;
     int piece_index = 0;
     int consecutive_failures = 0;
     const int MAX_CONSECUTIVE_FAILURES = 3;
     const int MAX_PIECES = 1000;
+    const int PIECES_PER_TURN = 16;
+    size_t turn = 0;
    
     // Variables for throttling progress updates
     auto last_update_time = std::chrono::steady_clock::now();
     const auto update_interval = std::chrono::milliseconds(100); // Update every 100ms max
     
     while (piece_index < MAX_PIECES && consecutive_failures < MAX_CONSECUTIVE_FAILURES) {
-        const PeerInfo& selected_peer = working_peers[piece_index % working_peers.size()];
+        const PeerInfo& selected_peer = working_peers[turn++ % working_peers.size()];
         
-        bool success = download_piece_from_peer(selected_peer, file_info.filename, piece_index, dest_path);
+        // A single peer gets the rest of the file in one run, so its pipeline never drains
+        int run = working_peers.size() == 1 ? MAX_PIECES - piece_index : std::min(PIECES_PER_TURN, MAX_PIECES - piece_index);
         
-        if (success) {
-            successful_pieces.push_back(piece_index);
+        auto on_piece = [&](int index) {
+            successful_pieces.push_back(index);
             consecutive_failures = 0;
             download_state.successful_pieces++;
             
@@ -1198,7 +1357,7 @@ void P2PClient::piece_selection_algorithm(const FileInfo& file_info, const std::
             
             // Check if we should update the progress display
             auto now = std::chrono::steady_clock::now();
-            if (now - last_update_time >= update_interval || piece_index == 0) {
+            if (now - last_update_time >= update_interval || index == 0) {
                 last_update_time = now;
                 
                 // Calculate progress
@@ -1239,23 +1398,24 @@ void P2PClient::piece_selection_algorithm(const FileInfo& file_info, const std::
                 
                 // Show current activity
                 std::cout << "\033[K"; // Clear line
-                std::cout << "  " << BRIGHT_YELLOW << "Downloading piece " << piece_index 
+                std::cout << "  " << BRIGHT_YELLOW << "Downloading piece " << index 
                             << " from " << selected_peer.user_id << "..." << RESET << std::endl;
             }
-           
-        } else {
-            consecutive_failures++;
-            download_state.failed_pieces++;
-            
-            if (successful_pieces.empty() && consecutive_failures < MAX_CONSECUTIVE_FAILURES) {
-                // Continue trying if no pieces downloaded yet
-            } else if (!successful_pieces.empty()) {
-                break; // End of file reached
-            }
+        };
+        
+        int fetched = download_pieces_from_peer(selected_peer, file_info.filename, piece_index, run, dest_path, on_piece);
+        piece_index += fetched;
+        if (fetched == run) {
+            continue;
         }
         
-        piece_index++;
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        consecutive_failures++;
+        download_state.failed_pieces++;
+        
+        if (!successful_pieces.empty()) {
+            break; // End of file reached
+        }
+        // Otherwise the next peer is asked for the same piece
     }
    
     // Final display update
@@ -1368,113 +1528,184 @@ void P2PClient::piece_selection_algorithm(const FileInfo& file_info, const std::
 
 bool P2PClient::download_piece_from_peer(const PeerInfo& peer, const std::string& filename, 
                                         int piece_index, const std::string& dest_path) {
-
-    int peer_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (peer_socket < 0) {
-       return false;
-    }
-   
-    // Set socket timeout
-    struct timeval timeout;
-    timeout.tv_sec = 10;  
-    timeout.tv_usec = 0;
-    setsockopt(peer_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    setsockopt(peer_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-   
-    struct sockaddr_in peer_addr;
-    peer_addr.sin_family = AF_INET;
-    peer_addr.sin_port = htons(peer.port);
-   
-    if (inet_pton(AF_INET, peer.ip.c_str(), &peer_addr.sin_addr) <= 0) {
-        close(peer_socket);
-        return false;
-    }
-   
-    // Try to connect
-    if (connect(peer_socket, (struct sockaddr*)&peer_addr, sizeof(peer_addr)) < 0) {
-        close(peer_socket);
-        return false;
-    }
-   
-    std::string request = "GET_PIECE " + filename + " " + std::to_string(piece_index) + "\n";
-    ssize_t sent = send(peer_socket, request.c_str(), request.length(), 0);
-    if (sent <= 0) {
-        close(peer_socket);
-        return false;
-    }
-   
-    // Receive the entire response (header + data might come together)
-    char buffer[MAX_BUFFER_SIZE];
-    ssize_t bytes_received = recv(peer_socket, buffer, sizeof(buffer) - 1, 0);
-    if (bytes_received <= 0) {
-        close(peer_socket);
-        return false;
-    }
-   
-    buffer[bytes_received] = '\0';
-    std::string full_response(buffer, bytes_received);
+    // A source from another group may hold the content under its own name
+    const std::string& remote_name = peer.filename.empty() ? filename : peer.filename;
+    std::string request = "GET_PIECE " + remote_name + " " + std::to_string(piece_index) + "\n";
     
-    if (full_response.find("PIECE_NOT_FOUND") != std::string::npos) {
-        close(peer_socket);
-        return false;
+    std::string piece_data;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        std::unique_ptr<PeerConnection> conn = peer_pool.checkout(peer.ip, peer.port);
+        if (!conn) {
+            return false;
+        }
+        
+        std::string header;
+        if (!send_all(conn->fd, request.data(), request.size()) || !conn->read_line(header)) {
+            // The peer may have closed a pooled connection just before the request
+            if (conn->reused) continue;
+            return false;
+        }
+        
+        // A refusal leaves the connection in step for the next request
+        if (header == "PIECE_NOT_FOUND" || header == "INVALID_REQUEST") {
+            peer_pool.checkin(peer.ip, peer.port, std::move(conn));
+            return false;
+        }
+        
+        // Parse the header to get piece size
+        long expected_piece_size;
+        if (header.compare(0, 11, "PIECE_DATA ") != 0) {
+            return false;
+        }
+        try {
+            expected_piece_size = std::stol(header.substr(11));
+        } catch (const std::exception& e) {
+            return false;
+        }
+        if (expected_piece_size <= 0 || expected_piece_size > PIECE_SIZE) {
+            return false;
+        }
+        
+        if (!conn->read_exact(piece_data, expected_piece_size)) {
+            return false;
+        }
+        peer_pool.checkin(peer.ip, peer.port, std::move(conn));
+        break;
     }
     
-    if (full_response.find("PIECE_DATA") == std::string::npos) {
-        close(peer_socket);
-        return false;
-    }
-   
-    // Parse the header to get piece size
-    size_t header_end = full_response.find('\n');
-    if (header_end == std::string::npos) {
-        close(peer_socket);
+    if (piece_data.empty()) {
         return false;
     }
-   
-    std::string header = full_response.substr(0, header_end);
     
-    size_t space_pos = header.find(' ');
-    if (space_pos == std::string::npos) {
-        close(peer_socket);
-        return false;
-    }
-   
-    int expected_piece_size;
-    try {
-        expected_piece_size = std::stoi(header.substr(space_pos + 1));
-    } catch (const std::exception& e) {
-        close(peer_socket);
-        return false;
-    }
-   
-    // Extract data that came with the header
-    std::string piece_data;
-    if (header_end + 1 < full_response.length()) {
-        piece_data = full_response.substr(header_end + 1);
-    }
-   
-    // If we need more data, receive it
-    while ((int)piece_data.length() < expected_piece_size) {
-        int remaining = expected_piece_size - piece_data.length();
-        int to_receive = std::min(remaining, (int)sizeof(buffer));
+    return save_piece(filename, piece_index, dest_path, piece_data);
+}
+
+// Fetches count consecutive pieces, from first_piece on, in blocks of
+// block_size. Up to peer_window block requests are in flight on one
+// connection, so the link stays busy while earlier blocks are on their way.
+// Each piece is saved and passed to on_piece as soon as it is whole. Returns
+// the number of pieces fetched. Fewer than count means the peer has no more
+// (usually the end of the file) or the connection failed.
+int P2PClient::download_pieces_from_peer(const PeerInfo& peer, const std::string& filename, int first_piece,
+                                         int count, const std::string& dest_path,
+                                         const std::function<void(int)>& on_piece) {
+    const std::string& remote_name = peer.filename.empty() ? filename : peer.filename;
+    int completed = 0;
+    bool legacy = false;
+    
+    for (int attempt = 0; attempt < 2 && !legacy; ++attempt) {
+        std::unique_ptr<PeerConnection> conn = peer_pool.checkout(peer.ip, peer.port);
+        if (!conn) {
+            return completed;
+        }
         
-        bytes_received = recv(peer_socket, buffer, to_receive, 0);
-        if (bytes_received <= 0) {
-            close(peer_socket);
-            return false;
+        // Blocks requested and not yet answered, as (piece, offset), in the order written
+        std::deque<std::pair<int, int>> in_flight;
+        int next_piece = first_piece + completed;
+        int next_offset = 0;
+        int last_piece = first_piece + count;
+        bool at_end = false;            // the file ended; remaining replies are only drained
+        bool broken = false;
+        int replies = 0;
+        std::string piece_data;
+        std::string block_data;
+        
+        while (!broken) {
+            // Keep the window full
+            std::string requests;
+            while (!at_end && (int)in_flight.size() < peer_window && next_piece < last_piece) {
+                int length = std::min(block_size, PIECE_SIZE - next_offset);
+                requests += "GET_BLOCK " + remote_name + " " + std::to_string(next_piece) + " " +
+                            std::to_string(next_offset) + " " + std::to_string(length) + "\n";
+                in_flight.push_back(std::make_pair(next_piece, next_offset));
+                next_offset += length;
+                if (next_offset == PIECE_SIZE) {
+                    next_piece++;
+                    next_offset = 0;
+                }
+            }
+            if (!requests.empty() && !send_all(conn->fd, requests.data(), requests.size())) {
+                broken = true;
+                break;
+            }
+            if (in_flight.empty()) {
+                break;
+            }
+            
+            std::pair<int, int> block = in_flight.front();
+            in_flight.pop_front();
+            std::string header;
+            if (!conn->read_line(header)) {
+                broken = true;
+                break;
+            }
+            replies++;
+            
+            // Peers from before block requests answer INVALID_REQUEST and hang up
+            if (header == "INVALID_REQUEST" && replies == 1) {
+                legacy = true;
+                break;
+            }
+            
+            long length = 0;
+            if (header.compare(0, 11, "BLOCK_DATA ") == 0) {
+                try {
+                    length = std::stol(header.substr(11));
+                } catch (const std::exception& e) {
+                    length = -1;
+                }
+            } else if (header != "PIECE_NOT_FOUND") {
+                length = -1;
+            }
+            int requested = std::min(block_size, PIECE_SIZE - block.second);
+            if (length < 0 || length > requested || !conn->read_exact(block_data, length)) {
+                broken = true;
+                break;
+            }
+            if (at_end) {
+                continue;
+            }
+            
+            piece_data += block_data;
+            bool short_block = length < requested;
+            if (block.second + length < PIECE_SIZE && !short_block) {
+                continue;
+            }
+            
+            // The piece is whole, or ends the file
+            if (!piece_data.empty()) {
+                if (!save_piece(filename, block.first, dest_path, piece_data)) {
+                    at_end = true;
+                    continue;
+                }
+                completed++;
+                on_piece(block.first);
+                piece_data.clear();
+            }
+            at_end = short_block;
         }
         
-        piece_data.append(buffer, bytes_received);
+        if (!broken) {
+            if (!legacy) peer_pool.checkin(peer.ip, peer.port, std::move(conn));
+            break;
+        }
+        // The peer may have closed a pooled connection just before the requests
+        if (!conn->reused || replies > 0) {
+            break;
+        }
     }
     
-    close(peer_socket);
-    
-    // Verify we got the right amount of data
-    if ((int)piece_data.length() != expected_piece_size) {
-        return false;
+    if (legacy) {
+        while (completed < count && download_piece_from_peer(peer, filename, first_piece + completed, dest_path)) {
+            on_piece(first_piece + completed);
+            completed++;
+        }
     }
-    
-    // Save the piece data to file
+    return completed;
+}
+
+bool P2PClient::save_piece(const std::string& filename, int piece_index, const std::string& dest_path,
+                           const std::string& piece_data) {
     std::string piece_file = dest_path + "/" + filename + ".piece" + std::to_string(piece_index);
     std::ofstream piece_stream(piece_file, std::ios::binary);
     
@@ -1488,36 +1719,19 @@ bool P2PClient::download_piece_from_peer(const PeerInfo& peer, const std::string
     return true;
 }
 
+// Reaching the peer leaves a connection in the pool for the download itself.
 bool P2PClient::test_peer_connection(const PeerInfo& peer) {
     if (peer.ip.empty()) {
         return false;
     }
    
-    int test_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (test_socket < 0) {
-        return false;
-    }
-   
-    // Set timeout
-    struct timeval timeout;
-    timeout.tv_sec = 5;
-    timeout.tv_usec = 0;
-    setsockopt(test_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    setsockopt(test_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-   
-    struct sockaddr_in peer_addr;
-    peer_addr.sin_family = AF_INET;
-    peer_addr.sin_port = htons(peer.port);
-    
-    if (inet_pton(AF_INET, peer.ip.c_str(), &peer_addr.sin_addr) <= 0) {
-        close(test_socket);
+    std::unique_ptr<PeerConnection> conn = peer_pool.checkout(peer.ip, peer.port);
+    if (!conn) {
         return false;
     }
-   
-    bool connected = (connect(test_socket, (struct sockaddr*)&peer_addr, sizeof(peer_addr)) == 0);
-    close(test_socket);
+    peer_pool.checkin(peer.ip, peer.port, std::move(conn));
     
-    return connected;
+    return true;
 }
 
 bool P2PClient::show_downloads() {
@@ -1871,6 +2085,23 @@ void P2PClient::run() {
                 break;
             }
             
+            case 15: {
+                // SEARCH FILES
+                if (!logged_in) {
+                    NotificationSystem::error("Please login first!");
+                    break;
+                }
+                
+                std::cout << BRIGHT_CYAN << BOLD << "  🔍 SEARCH FILES" << RESET << std::endl;
+                std::cout << "  " << std::string(50, '-') << std::endl;
+                
+                std::string query;
+                NotificationSystem::prompt("Part of the file name");
+                std::getline(std::cin, query);
+                search_files(query);
+                break;
+            }
+            
             case 0:
                 // EXIT
                 ProfessionalUI::clear_screen();
@@ -1884,7 +2115,7 @@ void P2PClient::run() {
                 return;
                 
             default:
-                NotificationSystem::error("Invalid choice! Please enter a number from the menu (0-14).");
+                NotificationSystem::error("Invalid choice! Please enter a number from the menu (0-15).");
         }
         
         // Professional continue prompt
@@ -1897,14 +2128,37 @@ void P2PClient::run() {
 // MAIN FUNCTION
 //=================================================================================================
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <IP>:<PORT> <tracker_info.txt>" << std::endl;
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <IP>:<PORT> <tracker_info.txt> [options]" << std::endl;
+        std::cerr << "  --block-size=KB        Bytes per piece block request, 16 to 64 KB (default " << DEFAULT_BLOCK_SIZE / 1024 << ")" << std::endl;
+        std::cerr << "  --peer-window=N        Block requests in flight per peer (default " << DEFAULT_PEER_WINDOW << ")" << std::endl;
         return 1;
     }
     
     std::string address(argv[1]);
     std::string tracker_file(argv[2]);
     
+    int block_size = DEFAULT_BLOCK_SIZE;
+    int peer_window = DEFAULT_PEER_WINDOW;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg(argv[i]);
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        try {
+            if (name == "--block-size") {
+                block_size = std::stoi(value) * 1024;
+            } else if (name == "--peer-window") {
+                peer_window = std::stoi(value);
+            } else {
+                throw std::invalid_argument(name);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid option: " << arg << std::endl;
+            return 1;
+        }
+    }
+    
     size_t colon_pos = address.find(':');
     if (colon_pos == std::string::npos) {
         std::cerr << "Invalid address format. Use IP:PORT" << std::endl;
@@ -1915,6 +2169,7 @@ int main(int argc, char* argv[]) {
     int port = std::stoi(address.substr(colon_pos + 1));
     
     P2PClient client(ip, port);
+    client.set_transfer_options(block_size, peer_window);
     
     if (!client.initialize(tracker_file)) {
         std::cerr << "Failed to initialize client" << std::endl;
@@ -6,6 +6,7 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -24,13 +25,25 @@
 #include <signal.h>
 #include <chrono>
 #include <iomanip>
+#include <functional>
+#include <memory>
 #include "sha1.h"
 #include "ui.h"
+#include "protocol.h"
+#include "cluster.h"
+#include "tracker_session.h"
+#include "peer_pool.h"
 
 #define MAX_BUFFER_SIZE 1024
 #define PIECE_SIZE 524288  
+#define DEFAULT_BLOCK_SIZE 65536    // bytes per GET_BLOCK request
+#define MIN_BLOCK_SIZE 16384
+#define DEFAULT_PEER_WINDOW 32      // block requests in flight per peer (2 MB at the default block size)
+#define MAX_PEER_WINDOW 1024
 #define MAX_CLIENTS 100
 #define MAX_GROUPS 50
+#define HEARTBEAT_INTERVAL 20   // seconds between lease renewals if the tracker does not state its lease
+#define EVENT_RECONNECT_MS 500  // wait before reopening a group event connection the tracker closed
 
 //=================================================================================================
 // DATA STRUCTURES
@@ -39,12 +52,14 @@
 struct TrackerInfo {
     std::string ip;
     int port;
+    int shard;                  // index into P2PClient::shard_names
 };
 
 struct PeerInfo {
     std::string ip;
     int port;
     std::string user_id;
+    std::string filename;       // the peer's name for the file, when it differs (SOURCE lines)
 };
 
 struct FileInfo {
@@ -135,6 +150,12 @@ private:
     bool logged_in;
     int server_socket;
     std::vector<TrackerInfo> trackers;
+    std::vector<std::string> shard_names;   // in order of first appearance in tracker_info.txt
+    HashRing shard_ring;                    // which shard serves a group (see common/cluster.h)
+    std::vector<std::unique_ptr<TrackerSession>> sessions;  // one per shard, shared by all threads
+    PeerPool peer_pool;                     // idle piece connections, by peer
+    int block_size;                         // bytes per block request
+    int peer_window;                        // block requests in flight per peer
     std::map<std::string, DownloadInfo> active_downloads;
     std::set<std::string> shared_files;
     std::mutex client_mutex;
@@ -142,6 +163,19 @@ private:
     std::thread server_thread;
     bool running;
     
+    // Session lease: renewed from a background thread while logged in
+    std::thread heartbeat_thread;
+    std::mutex heartbeat_mutex;
+    std::condition_variable heartbeat_cv;
+    bool heartbeat_stop;
+    
+    // Group events: one tracker connection per shard kept open while logged in
+    std::vector<std::thread> event_threads;
+    std::mutex event_mutex;
+    std::condition_variable event_cv;
+    std::vector<int> event_sockets;
+    bool event_stop;
+    
     // Progress tracking
     std::map<std::string, ProgressStats> download_progress;
     std::mutex progress_mutex;
@@ -161,11 +195,23 @@ private:
     void print_info(const std::string& message);
     
     // Network Communication
-    bool connect_to_tracker(int& tracker_socket);
-    bool send_to_tracker(int socket, const std::string& message);
+    bool connect_to_tracker(int& tracker_socket, int shard = -1);
+    int shard_of(const std::string& group_id);
+    bool send_to_tracker(int socket, const std::string& message, const std::string& blob = std::string());
     std::string receive_from_tracker(int socket);
+    bool ask_tracker(int shard, const std::string& command, std::string& response,
+                     const std::string& blob = std::string());
+    void follow_redirect(const std::string& command, std::string& response, const std::string& blob);
+    std::string send_to_every_shard(const std::string& command);
+    bool request_pages(const std::string& command, const std::function<bool(const std::string&)>& on_page, int shard = -1);
     void start_server();
     void handle_peer_connection(int peer_socket);
+    void start_heartbeat(const std::string& username);
+    void stop_heartbeat();
+    void subscribe_events(const std::string& group_id = std::string());
+    void event_loop(int shard);
+    void stop_events();
+    void show_event(const std::string& line);
     bool test_peer_connection(const PeerInfo& peer);
     
     // File Operations
@@ -175,6 +221,11 @@ private:
     // Download Operations
     bool download_piece_from_peer(const PeerInfo& peer, const std::string& filename, 
                                   int piece_index, const std::string& dest_path);
+    int download_pieces_from_peer(const PeerInfo& peer, const std::string& filename, int first_piece,
+                                  int count, const std::string& dest_path,
+                                  const std::function<void(int)>& on_piece);
+    bool save_piece(const std::string& filename, int piece_index, const std::string& dest_path,
+                    const std::string& piece_data);
     void piece_selection_algorithm(const FileInfo& file_info, const std::string& dest_path);
     
     // Utility Functions
@@ -195,6 +246,7 @@ public:
     // CORE SYSTEM FUNCTIONS
     //=============================================================================================
     bool initialize(const std::string& tracker_file);
+    void set_transfer_options(int block_size, int peer_window);
     void run();
     
     //=============================================================================================
@@ -244,6 +296,7 @@ public:
     // FILE SHARING OPERATIONS
     //=============================================================================================
     bool list_files(const std::string& group_id);
+    bool search_files(const std::string& query);
     bool upload_file(const std::string& filepath, const std::string& group_id);
     bool download_file(const std::string& group_id, const std::string& filename, 
                       const std::string& dest_path);
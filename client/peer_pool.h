@@ -0,0 +1,123 @@
+#ifndef PEER_POOL_H
+#define PEER_POOL_H
+
+#include <string>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "protocol.h"
+
+//=================================================================================================
+// PEER CONNECTION POOL
+//
+// Piece requests travel over long-lived peer connections. A peer answers any
+// number of GET_PIECE requests, for any of its files, on one connection. A
+// download therefore costs one handshake per peer, not one per piece.
+//
+// A connection is checked out for one exchange and checked back in once the
+// reply has been read in full. A connection that failed mid-reply is closed
+// instead, since its stream may be out of step. Up to PEER_POOL_MAX_IDLE
+// connections per peer are kept. The serving side closes a connection after
+// PEER_IDLE_TIMEOUT_MS of silence. Such an idle connection is noticed and
+// dropped when it is checked out.
+//=================================================================================================
+
+#define PEER_CONNECT_TIMEOUT_MS 5000
+#define PEER_REPLY_TIMEOUT_MS 10000
+#define PEER_IDLE_TIMEOUT_MS 60000      // the serving side closes a connection this quiet
+#define PEER_POOL_MAX_IDLE 4            // idle connections kept per peer
+#define PEER_READ_CHUNK 65536
+#define PEER_MAX_LINE 1024              // longest request or reply header line
+
+// A connection to a peer, with any bytes read past the last message
+struct PeerConnection {
+    int fd;
+    bool reused;            // came from the pool, so the peer may have closed it meanwhile
+    std::string buffer;
+
+    explicit PeerConnection(int fd) : fd(fd), reused(false) {}
+    ~PeerConnection() { close(fd); }
+
+    // Reads the next line, without its '\n'.
+    bool read_line(std::string& line) {
+        size_t newline;
+        while ((newline = buffer.find('\n')) == std::string::npos) {
+            if (buffer.size() > PEER_MAX_LINE || !fill()) return false;
+        }
+        line.assign(buffer, 0, newline);
+        buffer.erase(0, newline + 1);
+        return true;
+    }
+
+    // Reads exactly length bytes.
+    bool read_exact(std::string& data, size_t length) {
+        size_t buffered = std::min(length, buffer.size());
+        data.assign(buffer, 0, buffered);
+        buffer.erase(0, buffered);
+        data.resize(length);
+        return buffered == length || recv_all(fd, &data[buffered], length - buffered);
+    }
+
+private:
+    bool fill() {
+        char chunk[PEER_READ_CHUNK];
+        ssize_t n;
+        do {
+            n = recv(fd, chunk, sizeof(chunk), 0);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+        return true;
+    }
+};
+
+class PeerPool {
+    std::mutex mutex;
+    std::map<std::string, std::vector<std::unique_ptr<PeerConnection>>> idle;  // by "ip:port"
+
+    static std::string key(const std::string& ip, int port) {
+        return ip + ":" + std::to_string(port);
+    }
+
+    // An idle connection the peer closed reads as EOF (or an error) without
+    // blocking.
+    static bool healthy(const PeerConnection& conn) {
+        char byte;
+        ssize_t n = recv(conn.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+public:
+    // An idle connection to the peer, or a new one. Null if the peer is
+    // unreachable.
+    std::unique_ptr<PeerConnection> checkout(const std::string& ip, int port) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = idle.find(key(ip, port));
+            while (it != idle.end() && !it->second.empty()) {
+                std::unique_ptr<PeerConnection> conn = std::move(it->second.back());
+                it->second.pop_back();
+                if (healthy(*conn)) {
+                    conn->reused = true;
+                    return conn;
+                }
+            }
+        }
+        int fd = connect_with_timeout(ip, port, PEER_CONNECT_TIMEOUT_MS);
+        if (fd < 0) return std::unique_ptr<PeerConnection>();
+        set_socket_timeouts(fd, PEER_REPLY_TIMEOUT_MS);
+        return std::unique_ptr<PeerConnection>(new PeerConnection(fd));
+    }
+
+    // Hands back a connection whose last reply was read in full.
+    void checkin(const std::string& ip, int port, std::unique_ptr<PeerConnection> conn) {
+        if (!conn || !conn->buffer.empty()) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::unique_ptr<PeerConnection>>& list = idle[key(ip, port)];
+        if (list.size() < PEER_POOL_MAX_IDLE) list.push_back(std::move(conn));
+    }
+};
+
+#endif // PEER_POOL_H
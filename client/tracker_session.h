@@ -0,0 +1,168 @@
+#ifndef TRACKER_SESSION_H
+#define TRACKER_SESSION_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "protocol.h"
+#include "cluster.h"
+
+//=================================================================================================
+// TRACKER SESSION
+//
+// One long-lived connection to a tracker of one shard, shared by every
+// thread of the client. Requests are pipelined. A thread writes its command
+// at once, even while replies to earlier commands are still due. The tracker
+// answers a connection's commands in order, so each reply matches the oldest
+// request still waiting. The first waiting thread reads replies and hands each
+// to its request. The other waiting threads sleep until theirs arrives.
+//
+// The connection opens on first use. It is checked before each request
+// that finds it idle. When the tracker has closed it (a restart, a failover or
+// the idle timeout), it is replaced. The last tracker that answered is tried
+// first, and a dead address costs at most TRACKER_CONNECT_TIMEOUT_MS. A
+// request that fails while it is written is sent again on the new
+// connection. A request that fails after it was written is not sent again,
+// since the tracker may already have applied it.
+//=================================================================================================
+
+#define TRACKER_CONNECT_TIMEOUT_MS 1000     // per tracker address
+#define TRACKER_REPLY_TIMEOUT_MS 30000      // a connection this slow to answer is dropped
+
+class TrackerSession {
+public:
+    struct Connection;
+
+    // One request written on a connection, waiting for its reply
+    struct Pending {
+        bool done;
+        bool ok;
+        std::string reply;
+        std::shared_ptr<Connection> connection;
+
+        Pending() : done(false), ok(false) {}
+    };
+
+    struct Connection {
+        int fd;
+        bool reading;                               // a thread is reading replies off it
+        std::deque<std::shared_ptr<Pending>> waiting;   // in the order written
+
+        explicit Connection(int fd) : fd(fd), reading(false) {}
+        ~Connection() { close(fd); }
+    };
+
+private:
+    std::vector<TrackerAddress> trackers;
+    size_t preferred;                   // the tracker that answered last
+    std::mutex mutex;                   // guards everything below and writes to the socket
+    std::condition_variable replied;
+    std::shared_ptr<Connection> connection;
+
+    // Caller holds mutex. An idle connection the tracker closed reads as EOF
+    // (or an error) without blocking.
+    bool healthy(const Connection& conn) {
+        if (!conn.waiting.empty()) return true;
+        char byte;
+        ssize_t n = recv(conn.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    // Caller holds mutex.
+    bool reconnect() {
+        connection.reset();
+        for (size_t attempt = 0; attempt < trackers.size(); ++attempt) {
+            size_t index = (preferred + attempt) % trackers.size();
+            int fd = connect_with_timeout(trackers[index].ip, trackers[index].port, TRACKER_CONNECT_TIMEOUT_MS);
+            if (fd < 0) continue;
+            set_socket_timeouts(fd, TRACKER_REPLY_TIMEOUT_MS);
+            preferred = index;
+            connection = std::make_shared<Connection>(fd);
+            return true;
+        }
+        return false;
+    }
+
+    // Caller holds mutex. Fails every request still waiting on conn. The
+    // socket closes once no thread uses it any more.
+    void fail(const std::shared_ptr<Connection>& conn) {
+        shutdown(conn->fd, SHUT_RDWR);
+        for (const auto& pending : conn->waiting) {
+            pending->done = true;
+            pending->connection.reset();
+        }
+        conn->waiting.clear();
+        if (connection == conn) connection.reset();
+        replied.notify_all();
+    }
+
+public:
+    explicit TrackerSession(const std::vector<TrackerAddress>& trackers)
+        : trackers(trackers), preferred(0) {}
+
+    ~TrackerSession() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (connection) fail(connection);
+    }
+
+    // Writes a command and returns at once; wait() collects the reply. The
+    // frame carries the length, so a trailing newline is dropped.
+    std::shared_ptr<Pending> send(const std::string& command, const std::string& blob = std::string()) {
+        std::shared_ptr<Pending> pending = std::make_shared<Pending>();
+        size_t length = !command.empty() && command[command.size() - 1] == '\n' ? command.size() - 1 : command.size();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if ((!connection || !healthy(*connection)) && !reconnect()) break;
+            if (send_frame(connection->fd, MSG_COMMAND, command.substr(0, length), blob)) {
+                pending->connection = connection;
+                connection->waiting.push_back(pending);
+                return pending;
+            }
+            fail(connection);
+        }
+        pending->done = true;
+        return pending;
+    }
+
+    // Blocks until the reply to pending arrives. False if the connection
+    // broke first.
+    bool wait(const std::shared_ptr<Pending>& pending, std::string& reply) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!pending->done) {
+            std::shared_ptr<Connection> conn = pending->connection;
+            if (conn->reading) {
+                replied.wait(lock);
+                continue;
+            }
+            conn->reading = true;
+            lock.unlock();
+            Frame frame;
+            bool ok = recv_frame(conn->fd, frame);
+            lock.lock();
+            conn->reading = false;
+            if (!ok) {
+                fail(conn);
+            } else if (frame.type == MSG_REPLY && !conn->waiting.empty()) {
+                std::shared_ptr<Pending> first = conn->waiting.front();
+                conn->waiting.pop_front();
+                first->reply.swap(frame.text);
+                first->ok = true;
+                first->done = true;
+                first->connection.reset();
+            }
+            // Wakes the owner of the reply, and a thread to read the next one
+            replied.notify_all();
+        }
+        reply.swap(pending->reply);
+        return pending->ok;
+    }
+
+    bool request(const std::string& command, std::string& reply, const std::string& blob = std::string()) {
+        return wait(send(command, blob), reply);
+    }
+};
+
+#endif // TRACKER_SESSION_H
@@ -104,6 +104,7 @@ public:
         print_menu_item("12", "📥 Download File", "Download files from peers");
         print_menu_item("13", "🛑 Stop Sharing", "Stop sharing a file");
         print_menu_item("14", "📊 Show Downloads", "Monitor active transfers");
+        print_menu_item("15", "🔍 Search Files", "Find files across your groups");
         
         std::cout << std::endl;
         print_menu_item("0", "❌ Exit", "Close the application");
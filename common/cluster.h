@@ -0,0 +1,107 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+//=================================================================================================
+// TRACKER CLUSTER (tracker_info.txt)
+//
+// Each line names one tracker, optionally followed by the shard it serves:
+//
+//   127.0.0.1:8080 a
+//   127.0.0.1:8081 a
+//   127.0.0.1:8090 b
+//
+// Trackers of one shard replicate with each other (see tracker/replication.h).
+// Lines without a shard name all belong to one unnamed shard, so a file that
+// names none describes a single set of replicas, as before sharding.
+//
+// Groups are spread over the shards by a consistent-hash ring: each shard puts
+// HASH_RING_POINTS points on a 64-bit circle, and a group belongs to the shard
+// of the first point at or after the hash of its name. A shard added to the
+// file takes over only the groups that land just before its own points, about
+// 1/N of them; every other group stays where it is. Clients and trackers build
+// the same ring from the same file, so both know where a group lives.
+//=================================================================================================
+
+#define HASH_RING_POINTS 64             // per shard; more spread groups more evenly
+
+struct TrackerAddress {
+    std::string ip;
+    int port;
+    std::string shard;                  // empty: the unnamed shard
+
+    TrackerAddress() : port(0) {}
+};
+
+// Parses "<ip>:<port> [<shard>]". False for blank or malformed lines.
+inline bool parse_tracker_line(const std::string& line, TrackerAddress& address) {
+    size_t colon = line.find(':');
+    if (colon == std::string::npos || colon == 0) return false;
+    char* end = NULL;
+    long port = strtol(line.c_str() + colon + 1, &end, 10);
+    if (port <= 0 || port > 65535) return false;
+
+    address.ip = line.substr(0, colon);
+    address.port = static_cast<int>(port);
+    address.shard.clear();
+    const char* at = end;
+    while (*at == ' ' || *at == '\t') ++at;
+    while (*at != '\0' && *at != ' ' && *at != '\t' && *at != '\r' && *at != '\n') {
+        address.shard.push_back(*at++);
+    }
+    return true;
+}
+
+// 64-bit FNV-1a, finished with a mix so that similar names land far apart
+inline uint64_t ring_hash(const char* data, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+class HashRing {
+private:
+    std::vector<std::pair<uint64_t, int>> points;   // (position, shard index), sorted
+    int shard_count;
+
+    static bool point_before(const std::pair<uint64_t, int>& point, uint64_t position) { return point.first < position; }
+
+public:
+    HashRing() : shard_count(0) {}
+
+    // Shards are numbered in the order they are added
+    void add(const std::string& shard_name) {
+        for (int i = 0; i < HASH_RING_POINTS; ++i) {
+            std::string key = shard_name + "#" + std::to_string(i);
+            points.push_back(std::make_pair(ring_hash(key.data(), key.size()), shard_count));
+        }
+        std::sort(points.begin(), points.end());
+        shard_count++;
+    }
+
+    // Shard that owns key; 0 when there are no shards
+    int owner(const char* key, size_t length) const {
+        if (points.empty()) return 0;
+        std::vector<std::pair<uint64_t, int>>::const_iterator it =
+            std::lower_bound(points.begin(), points.end(), ring_hash(key, length), point_before);
+        return it == points.end() ? points.front().second : it->second;
+    }
+    int owner(const std::string& key) const { return owner(key.data(), key.size()); }
+
+    int shards() const { return shard_count; }
+};
+
+#endif // CLUSTER_H
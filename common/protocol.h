@@ -0,0 +1,350 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+//=================================================================================================
+// FRAMED WIRE PROTOCOL (client <-> tracker)
+//
+// Every message is an 8-byte header followed by the payload:
+//
+//   u8  magic    FRAME_MAGIC, never a printable character, so the tracker can
+//                tell framed peers from legacy newline-terminated ones
+//   u8  type     MessageType
+//   u16 flags    FrameFlags
+//   u32 length   payload bytes that follow the header
+//
+// All integers are in network byte order. With FRAME_FLAG_BLOB the payload is
+// a u32 text length, the text, then raw binary bytes (e.g. 20-byte digests);
+// otherwise the whole payload is text.
+//=================================================================================================
+
+#define FRAME_MAGIC 0xB7
+#define FRAME_HEADER_SIZE 8
+#define MAX_FRAME_PAYLOAD (64u * 1024 * 1024)
+
+enum MessageType {
+    MSG_COMMAND = 1,        // client -> tracker, text is a command line
+    MSG_REPLY = 2,          // tracker -> client, text is the response
+    MSG_FORWARD = 3,        // backup tracker -> primary, a client's command to run there
+    MSG_REPLICATE = 4,      // tracker <-> tracker replication stream (see tracker/replication.h)
+    MSG_EVENT = 5,          // tracker -> subscribed client, group events (see tracker/events.h)
+    MSG_HANDOFF = 6,        // running tracker <-> its replacement, hot restart (see tracker/handoff.h)
+    MSG_MIGRATE = 7,        // tracker -> tracker of another shard, groups moving there (see tracker/sharding.h)
+    MSG_CLUSTER = 8         // tracker -> tracker, opens a connection with the cluster key (see tracker/replication.h)
+};
+
+enum FrameFlags {
+    FRAME_FLAG_BLOB = 0x0001
+};
+
+struct Frame {
+    uint8_t type;
+    uint16_t flags;
+    std::string text;
+    std::string blob;
+
+    Frame() : type(MSG_COMMAND), flags(0) {}
+};
+
+inline void put_u16(std::string& out, uint16_t value) {
+    uint16_t be = htons(value);
+    out.append(reinterpret_cast<const char*>(&be), sizeof(be));
+}
+
+inline void put_u32(std::string& out, uint32_t value) {
+    uint32_t be = htonl(value);
+    out.append(reinterpret_cast<const char*>(&be), sizeof(be));
+}
+
+inline void put_u64(std::string& out, uint64_t value) {
+    put_u32(out, static_cast<uint32_t>(value >> 32));
+    put_u32(out, static_cast<uint32_t>(value));
+}
+
+inline uint16_t get_u16(const char* data) {
+    uint16_t be;
+    memcpy(&be, data, sizeof(be));
+    return ntohs(be);
+}
+
+inline uint32_t get_u32(const char* data) {
+    uint32_t be;
+    memcpy(&be, data, sizeof(be));
+    return ntohl(be);
+}
+
+inline uint64_t get_u64(const char* data) {
+    return (static_cast<uint64_t>(get_u32(data)) << 32) | get_u32(data + 4);
+}
+
+// Appends one encoded frame to out (so several frames can share a send()).
+inline void append_frame(std::string& out, uint8_t type, const std::string& text,
+                         const std::string& blob = std::string()) {
+    bool has_blob = !blob.empty();
+    uint32_t length = text.size() + (has_blob ? 4 + blob.size() : 0);
+
+    out.reserve(out.size() + FRAME_HEADER_SIZE + length);
+    out.push_back(static_cast<char>(FRAME_MAGIC));
+    out.push_back(static_cast<char>(type));
+    put_u16(out, has_blob ? FRAME_FLAG_BLOB : 0);
+    put_u32(out, length);
+    if (has_blob) {
+        put_u32(out, text.size());
+    }
+    out += text;
+    out += blob;
+}
+
+// Reserves a header for a frame whose payload the caller appends in place
+// (avoids building the payload in a temporary). Returns a mark for end_frame().
+inline size_t begin_frame(std::string& out, uint8_t type) {
+    size_t mark = out.size();
+    out.append(FRAME_HEADER_SIZE, '\0');
+    out[mark] = static_cast<char>(FRAME_MAGIC);
+    out[mark + 1] = static_cast<char>(type);
+    return mark;
+}
+
+inline void end_frame(std::string& out, size_t mark) {
+    uint32_t length = htonl(out.size() - mark - FRAME_HEADER_SIZE);
+    memcpy(&out[mark + 4], &length, sizeof(length));
+}
+
+inline std::string encode_frame(uint8_t type, const std::string& text,
+                                const std::string& blob = std::string()) {
+    std::string out;
+    append_frame(out, type, text, blob);
+    return out;
+}
+
+// Splits a frame payload into text and blob according to its flags.
+inline bool decode_payload(const char* data, size_t length, uint16_t flags, Frame& frame) {
+    if (!(flags & FRAME_FLAG_BLOB)) {
+        frame.text.assign(data, length);
+        frame.blob.clear();
+        return true;
+    }
+    if (length < 4) return false;
+    uint32_t text_length = get_u32(data);
+    if (text_length > length - 4) return false;
+    frame.text.assign(data + 4, text_length);
+    frame.blob.assign(data + 4 + text_length, length - 4 - text_length);
+    return true;
+}
+
+//=================================================================================================
+// STREAM REASSEMBLY
+//=================================================================================================
+
+// Incremental decoder for one connection. Bytes are fed as they arrive from
+// recv(); complete messages are popped with next(), however the stream was
+// segmented. The first byte decides the mode: FRAME_MAGIC selects framed
+// messages, anything else selects legacy newline-terminated text commands.
+class FrameDecoder {
+private:
+    enum Mode { MODE_UNKNOWN, MODE_FRAMED, MODE_LINES };
+
+    std::string buffer;
+    size_t offset;          // start of unconsumed bytes in buffer
+    Mode mode;
+    size_t max_message;
+    bool broken;
+
+    void compact() {
+        if (offset == buffer.size()) {
+            buffer.clear();
+            offset = 0;
+        } else if (offset > 4096 && offset * 2 > buffer.size()) {
+            buffer.erase(0, offset);
+            offset = 0;
+        }
+    }
+
+public:
+    explicit FrameDecoder(size_t max_message = MAX_FRAME_PAYLOAD)
+        : offset(0), mode(MODE_UNKNOWN), max_message(max_message), broken(false) {}
+
+    void feed(const char* data, size_t length) {
+        buffer.append(data, length);
+    }
+
+    bool is_framed() const { return mode == MODE_FRAMED; }
+
+    // True once the peer sent something that can never become a valid message
+    // (bad magic, oversized frame, malformed blob). The connection should be dropped.
+    bool is_broken() const { return broken; }
+
+    size_t buffered() const { return buffer.size() - offset; }
+
+    // Pops the next complete message. Returns false if more bytes are needed
+    // or the stream is broken.
+    bool next(Frame& frame) {
+        while (!broken && offset < buffer.size()) {
+            if (mode == MODE_UNKNOWN) {
+                mode = static_cast<unsigned char>(buffer[offset]) == FRAME_MAGIC ? MODE_FRAMED : MODE_LINES;
+            }
+
+            if (mode == MODE_LINES) {
+                size_t newline = buffer.find('\n', offset);
+                if (newline == std::string::npos) {
+                    if (buffered() > max_message) broken = true;
+                    return false;
+                }
+                size_t end = newline;
+                if (end > offset && buffer[end - 1] == '\r') end--;
+                size_t start = offset;
+                offset = newline + 1;
+                if (end == start) continue;         // skip blank lines
+
+                frame.type = MSG_COMMAND;
+                frame.flags = 0;
+                frame.text.assign(buffer, start, end - start);
+                frame.blob.clear();
+                compact();
+                return true;
+            }
+
+            if (buffered() < FRAME_HEADER_SIZE) return false;
+            const char* header = buffer.data() + offset;
+            if (static_cast<unsigned char>(header[0]) != FRAME_MAGIC) {
+                broken = true;
+                return false;
+            }
+            uint32_t length = get_u32(header + 4);
+            if (length > max_message) {
+                broken = true;
+                return false;
+            }
+            if (buffered() < FRAME_HEADER_SIZE + length) return false;
+
+            frame.type = static_cast<uint8_t>(header[1]);
+            frame.flags = get_u16(header + 2);
+            if (!decode_payload(header + FRAME_HEADER_SIZE, length, frame.flags, frame)) {
+                broken = true;
+                return false;
+            }
+            offset += FRAME_HEADER_SIZE + length;
+            compact();
+            return true;
+        }
+        return false;
+    }
+};
+
+//=================================================================================================
+// BLOCKING SOCKET HELPERS
+//=================================================================================================
+
+inline bool send_all(int fd, const char* data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = send(fd, data + sent, length - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, char* data, size_t length) {
+    size_t received = 0;
+    while (received < length) {
+        ssize_t n = recv(fd, data + received, length - received, 0);
+        if (n > 0) {
+            received += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool send_frame(int fd, uint8_t type, const std::string& text,
+                       const std::string& blob = std::string()) {
+    std::string encoded = encode_frame(type, text, blob);
+    return send_all(fd, encoded.data(), encoded.size());
+}
+
+// Reads exactly one frame from a blocking socket.
+inline bool recv_frame(int fd, Frame& frame) {
+    char header[FRAME_HEADER_SIZE];
+    if (!recv_all(fd, header, sizeof(header))) return false;
+    if (static_cast<unsigned char>(header[0]) != FRAME_MAGIC) return false;
+
+    uint32_t length = get_u32(header + 4);
+    if (length > MAX_FRAME_PAYLOAD) return false;
+
+    std::string payload(length, '\0');
+    if (length > 0 && !recv_all(fd, &payload[0], length)) return false;
+
+    frame.type = static_cast<uint8_t>(header[1]);
+    frame.flags = get_u16(header + 2);
+    return decode_payload(payload.data(), payload.size(), frame.flags, frame);
+}
+
+// Blocking TCP connection with a bounded connect time and I/O timeouts.
+inline int connect_with_timeout(const std::string& ip, int port, int timeout_ms) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1) {
+        close(fd);
+        return -1;
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int result = connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    if (result < 0 && errno == EINPROGRESS) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (poll(&pfd, 1, timeout_ms) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+            result = 0;
+        }
+    }
+    if (result < 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, flags);
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+inline void set_socket_timeouts(int fd, int timeout_ms) {
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+#endif // PROTOCOL_H
@@ -0,0 +1,215 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include "intern.h"
+
+//=================================================================================================
+// GROUP EVENTS
+//
+// SUBSCRIBE keeps a client connection listening to a group. Commands that
+// change the group publish an event while they hold its lock, so events of one
+// group are queued in the order the changes were made. A dispatcher thread
+// drains the queue and appends each subscriber's events to its connection:
+// events that queued up while it was busy writing go out together, as one
+// MSG_EVENT frame (or one run of lines for a client that does not frame):
+//
+//   EVENT <group> FILE_ADDED <file>
+//   EVENT <group> FILE_REMOVED <file>
+//   EVENT <group> SEEDER_JOINED <file> <user>
+//   EVENT <group> SEEDER_LEFT <file> <user>
+//   EVENT <group> REQUEST_PENDING <user>   only to the owner
+//   EVENT <group> MEMBER_JOINED <user>
+//   EVENT <group> MEMBER_LEFT <user>
+//
+// Subscribing and unsubscribing travel through the same queue, so only the
+// dispatcher touches the subscription table and needs no lock for it. A user
+// with a pending join request may subscribe too: they hear only of their own
+// acceptance, and from then on everything a member hears.
+//=================================================================================================
+
+#define EVENT_MAX_BACKLOG (1024 * 1024)     // unsent bytes after which a subscriber is dropped
+#define EVENT_RETRY_MS 20                   // retry interval for subscribers whose socket is full
+
+struct Connection;
+
+enum EventKind {
+    EVENT_FILE_ADDED,
+    EVENT_FILE_REMOVED,
+    EVENT_SEEDER_JOINED,
+    EVENT_SEEDER_LEFT,
+    EVENT_REQUEST_PENDING,
+    EVENT_MEMBER_JOINED,
+    EVENT_MEMBER_LEFT,
+    EVENT_SUBSCRIBE,                    // not sent: adds a subscription
+    EVENT_UNSUBSCRIBE,                  // not sent: removes one, or all of a connection's for NO_NAME
+    EVENT_HANG_UP                       // not sent: closes every subscribed connection (hot restart)
+};
+
+inline const char* event_kind_name(EventKind kind) {
+    static const char* names[] = { "FILE_ADDED", "FILE_REMOVED", "SEEDER_JOINED", "SEEDER_LEFT",
+                                   "REQUEST_PENDING", "MEMBER_JOINED", "MEMBER_LEFT" };
+    return kind <= EVENT_MEMBER_LEFT ? names[kind] : "";
+}
+
+struct GroupEvent {
+    EventKind kind;
+    NameId group;
+    NameId user;                        // who the event is about; the subscriber for (UN)SUBSCRIBE
+    NameId file;                        // NO_NAME unless a file or seeder event
+    NameId audience;                    // NO_NAME: every member listening, else only this user
+    bool member;                        // SUBSCRIBE: the subscriber is a member, not only pending
+    bool framed;                        // SUBSCRIBE: the connection frames its messages
+    std::weak_ptr<Connection> connection;   // (UN)SUBSCRIBE only
+
+    GroupEvent(EventKind kind, NameId group, NameId user)
+        : kind(kind), group(group), user(user), file(NO_NAME), audience(NO_NAME), member(false), framed(false) {}
+};
+
+// Events waiting for the dispatcher. Publishers only append under the mutex.
+class EventQueue {
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::vector<GroupEvent> events;
+    bool stopping;
+
+public:
+    EventQueue() : stopping(false) {}
+
+    void publish(const GroupEvent& event) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            events.push_back(event);
+        }
+        ready.notify_one();
+    }
+
+    // Swaps the queued events into out (cleared first), waiting up to timeout
+    // for one. Returns false once stopped.
+    bool take(std::vector<GroupEvent>& out, std::chrono::milliseconds timeout) {
+        out.clear();
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait_for(lock, timeout, [this] { return stopping || !events.empty(); });
+        out.swap(events);
+        return !stopping;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+    }
+};
+
+// One listening connection, owned by the dispatcher.
+struct Subscriber {
+    std::weak_ptr<Connection> connection;
+    NameId user;
+    bool framed;
+    std::vector<NameId> groups;         // groups subscribed to, unordered
+    std::string batch;                  // events formatted since the last write
+    bool queued;                        // on the dispatcher's list of subscribers to write to
+
+    Subscriber() : user(NO_NAME), framed(false), queued(false) {}
+};
+
+// Subscriptions by group and by connection. Only the dispatcher uses it.
+// Subscribers are shared so that one dropped from the table can still be
+// handed the events it was sent before it left.
+class SubscriptionTable {
+public:
+    struct Listener {
+        std::shared_ptr<Subscriber> subscriber;
+        bool member;                    // false while only a join request is pending
+    };
+
+private:
+    std::unordered_map<NameId, std::vector<Listener>> by_group;
+    std::map<std::weak_ptr<Connection>, std::shared_ptr<Subscriber>, std::owner_less<std::weak_ptr<Connection>>> by_connection;
+    size_t count;
+
+    bool erase_listener(Subscriber* subscriber, NameId group) {
+        std::unordered_map<NameId, std::vector<Listener>>::iterator it = by_group.find(group);
+        if (it == by_group.end()) return false;
+        std::vector<Listener>& listeners = it->second;
+        for (size_t i = 0; i < listeners.size(); ++i) {
+            if (listeners[i].subscriber.get() != subscriber) continue;
+            listeners[i] = listeners.back();
+            listeners.pop_back();
+            if (listeners.empty()) by_group.erase(it);
+            count--;
+            return true;
+        }
+        return false;
+    }
+
+public:
+    SubscriptionTable() : count(0) {}
+
+    // False if the connection already listens to the group (member is updated)
+    bool subscribe(const GroupEvent& request) {
+        std::shared_ptr<Subscriber>& subscriber = by_connection[request.connection];
+        if (!subscriber) {
+            subscriber = std::make_shared<Subscriber>();
+            subscriber->connection = request.connection;
+            subscriber->framed = request.framed;
+        }
+        subscriber->user = request.user;
+        std::vector<Listener>& listeners = by_group[request.group];
+        for (Listener& listener : listeners) {
+            if (listener.subscriber != subscriber) continue;
+            listener.member = request.member;
+            return false;
+        }
+        Listener added = { subscriber, request.member };
+        listeners.push_back(added);
+        subscriber->groups.push_back(request.group);
+        count++;
+        return true;
+    }
+
+    // Removes the connection's subscription to group (every one for NO_NAME)
+    // and appends the groups it left to left.
+    void unsubscribe(const std::weak_ptr<Connection>& connection, NameId group, std::vector<NameId>& left) {
+        auto it = by_connection.find(connection);
+        if (it == by_connection.end()) return;
+        Subscriber* subscriber = it->second.get();
+        std::vector<NameId>& groups = subscriber->groups;
+        for (size_t i = 0; i < groups.size(); ) {
+            if (group != NO_NAME && groups[i] != group) {
+                ++i;
+                continue;
+            }
+            if (erase_listener(subscriber, groups[i])) left.push_back(groups[i]);
+            groups[i] = groups.back();
+            groups.pop_back();
+        }
+        if (groups.empty()) by_connection.erase(it);
+    }
+
+    // Listeners of group, NULL if none. Valid until the table changes.
+    std::vector<Listener>* listeners(NameId group) {
+        std::unordered_map<NameId, std::vector<Listener>>::iterator it = by_group.find(group);
+        return it == by_group.end() ? NULL : &it->second;
+    }
+
+    void list_connections(std::vector<std::weak_ptr<Connection>>& out) const {
+        for (const auto& entry : by_connection) out.push_back(entry.first);
+    }
+
+    size_t connections() const { return by_connection.size(); }
+    size_t size() const { return count; }
+};
+
+#endif // EVENTS_H
@@ -0,0 +1,151 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "protocol.h"
+
+//=================================================================================================
+// HOT RESTART
+//
+// A tracker started with --handoff=PATH listens on a Unix domain socket at
+// PATH. A new tracker binary started later with the same PATH connects there
+// and takes over instead of binding the port itself. The exchange uses
+// MSG_HANDOFF frames:
+//
+//   new -> old   HANDOFF
+//   old -> new   LISTENERS <count>   + the listening sockets (SCM_RIGHTS):
+//                                      the client port, then the metrics port
+//   old -> new   STATE + blob...     the state as WAL records, as for a full sync
+//   old -> new   HANDED <role> <term> <previous_term> <promotion_lsn> <last_lsn>
+//   new -> old   READY               the new tracker is up and accepting
+//   old -> new   DRAINING            the old tracker has let go of the port
+//
+// Once asked, the old tracker stops changing state and makes no further local
+// changes. It waits for running commands to finish and sends what it holds.
+// Connections that reach the port meanwhile wait in the listen backlog for
+// the new process, so none are refused. Until READY, the old tracker can still
+// take the port back: if the new one fails to start, it carries on as before.
+// After READY it forwards commands that arrive on its remaining connections to
+// the new tracker. It closes event subscriptions and exits once the last
+// connection is gone or --drain seconds have passed.
+//=================================================================================================
+
+#define HANDOFF_TIMEOUT_MS 10000        // old tracker: wait this long for the new one to be ready
+#define HANDOFF_MAX_LISTENERS 2
+#define DEFAULT_DRAIN_SECONDS 30
+
+inline bool handoff_address(const std::string& path, struct sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+// Listens at path, replacing a socket left there by the previous tracker.
+inline int handoff_listen(const std::string& path) {
+    struct sockaddr_un addr;
+    if (!handoff_address(path, addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// -1 when no tracker listens at path (a cold start)
+inline int handoff_connect(const std::string& path) {
+    struct sockaddr_un addr;
+    if (!handoff_address(path, addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends one frame with fds attached to its first byte.
+inline bool send_frame_with_fds(int sock, uint8_t type, const std::string& text, const int* fds, int count) {
+    std::string encoded = encode_frame(type, text);
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_LISTENERS)];
+    memset(control, 0, sizeof(control));
+
+    struct iovec iov;
+    iov.iov_base = &encoded[0];
+    iov.iov_len = encoded.size();
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(header), fds, sizeof(int) * count);
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &message, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return false;
+    return static_cast<size_t>(n) == encoded.size() ||
+           send_all(sock, encoded.data() + n, encoded.size() - n);
+}
+
+// Reads one frame and the fds sent with it (up to max; extras are closed).
+inline bool recv_frame_with_fds(int sock, Frame& frame, int* fds, int max, int& count) {
+    char header[FRAME_HEADER_SIZE];
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_LISTENERS)];
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = sizeof(header);
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    count = 0;
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&message); c != NULL; c = CMSG_NXTHDR(&message, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        int received = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < received; ++i) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if (count < max) fds[count++] = fd;
+            else close(fd);
+        }
+    }
+
+    if (static_cast<size_t>(n) < sizeof(header) && !recv_all(sock, header + n, sizeof(header) - n)) return false;
+    if (static_cast<unsigned char>(header[0]) != FRAME_MAGIC) return false;
+    uint32_t length = get_u32(header + 4);
+    if (length > MAX_FRAME_PAYLOAD) return false;
+    std::string payload(length, '\0');
+    if (length > 0 && !recv_all(sock, &payload[0], length)) return false;
+    frame.type = static_cast<uint8_t>(header[1]);
+    frame.flags = get_u16(header + 2);
+    return decode_payload(payload.data(), payload.size(), frame.flags, frame);
+}
+
+#endif // HANDOFF_H
@@ -0,0 +1,167 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "rwlock.h"
+
+//=================================================================================================
+// NAME INTERNING
+//
+// User, group and file names are turned into dense integer IDs once, where a
+// command is parsed; tracker state behind that point is indexed and compared by
+// ID. IDs are handed out in creation order and never reused. They are local to
+// one tracker process: the WAL and the replication stream carry names.
+//=================================================================================================
+
+typedef uint32_t NameId;
+#define NO_NAME 0xFFFFFFFFu
+
+// 1024 names (32KB) per chunk. Larger chunks come from mmap page-aligned, and
+// names with the same index in different tables then compete for cache sets.
+#define NAME_CHUNK_BITS 10
+#define NAME_CHUNKS 16384                       // up to 16M names per table
+
+inline uint32_t hash_name(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;        // FNV-1a
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// Name <-> ID table: an open-addressed hash table of IDs (with their hashes,
+// so probing rarely touches the names) over chunks of names indexed by ID.
+// Chunks never move, so name() needs no lock: whoever holds an ID got it,
+// through some lock, after the name was stored.
+class NameTable {
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t id_plus_one;           // 0 marks an empty slot
+    };
+
+    mutable RWLock lock;
+    std::vector<Slot> slots;            // power-of-two size, kept at most half full
+    std::string* chunks[NAME_CHUNKS];   // name of id is chunks[id >> NAME_CHUNK_BITS][id & mask]
+    size_t count;
+
+    NameTable(const NameTable&);
+    NameTable& operator=(const NameTable&);
+
+    // Caller holds lock. Returns the ID, or NO_NAME with slot at the free slot.
+    NameId probe(const char* data, size_t length, uint32_t hash, size_t& slot) const {
+        size_t mask = slots.size() - 1;
+        for (slot = hash & mask; slots[slot].id_plus_one != 0; slot = (slot + 1) & mask) {
+            if (slots[slot].hash != hash) continue;
+            const std::string& name = this->name(slots[slot].id_plus_one - 1);
+            if (name.size() == length && memcmp(name.data(), data, length) == 0) {
+                return slots[slot].id_plus_one - 1;
+            }
+        }
+        return NO_NAME;
+    }
+
+    void grow() {
+        std::vector<Slot> old(slots.size() * 2);
+        old.swap(slots);
+        size_t mask = slots.size() - 1;
+        for (const Slot& entry : old) {
+            if (entry.id_plus_one == 0) continue;
+            size_t i = entry.hash & mask;
+            while (slots[i].id_plus_one != 0) i = (i + 1) & mask;
+            slots[i] = entry;
+        }
+    }
+
+public:
+    NameTable() : slots(1024), count(0) {
+        memset(chunks, 0, sizeof(chunks));
+    }
+
+    ~NameTable() {
+        for (size_t i = 0; i < NAME_CHUNKS && chunks[i] != NULL; ++i) delete[] chunks[i];
+    }
+
+    NameId find(const char* data, size_t length) const {
+        uint32_t hash = hash_name(data, length);
+        size_t slot;
+        ReadGuard guard(lock);
+        return probe(data, length, hash, slot);
+    }
+    NameId find(const std::string& name) const { return find(name.data(), name.size()); }
+
+    // Returns the name's ID, assigning the next one if it is new.
+    NameId intern(const char* data, size_t length) {
+        NameId id = find(data, length);
+        if (id != NO_NAME) return id;
+
+        uint32_t hash = hash_name(data, length);
+        size_t slot;
+        WriteGuard guard(lock);
+        id = probe(data, length, hash, slot);
+        if (id != NO_NAME) return id;
+
+        if (count == static_cast<size_t>(NAME_CHUNKS) << NAME_CHUNK_BITS) return NO_NAME;
+        id = count++;
+        std::string*& chunk = chunks[id >> NAME_CHUNK_BITS];
+        if (chunk == NULL) chunk = new std::string[1 << NAME_CHUNK_BITS];
+        chunk[id & ((1 << NAME_CHUNK_BITS) - 1)].assign(data, length);
+        slots[slot].hash = hash;
+        slots[slot].id_plus_one = id + 1;
+        if (count * 2 > slots.size()) grow();
+        return id;
+    }
+    NameId intern(const std::string& name) { return intern(name.data(), name.size()); }
+
+    // Names are never removed, so the reference stays valid.
+    const std::string& name(NameId id) const {
+        return chunks[id >> NAME_CHUNK_BITS][id & ((1 << NAME_CHUNK_BITS) - 1)];
+    }
+
+    size_t size() const {
+        ReadGuard guard(lock);
+        return count;
+    }
+
+    void track_waits(LatencyHistogram* histogram) { lock.track_waits(histogram); }
+};
+
+// Set of IDs as a sorted vector: membership is a binary search over a few
+// contiguous cache lines instead of a walk through tree nodes.
+class IdSet {
+private:
+    std::vector<NameId> ids;
+
+public:
+    typedef std::vector<NameId>::const_iterator const_iterator;
+
+    bool contains(NameId id) const { return std::binary_search(ids.begin(), ids.end(), id); }
+
+    bool insert(NameId id) {
+        std::vector<NameId>::iterator it = std::lower_bound(ids.begin(), ids.end(), id);
+        if (it != ids.end() && *it == id) return false;
+        ids.insert(it, id);
+        return true;
+    }
+
+    bool erase(NameId id) {
+        std::vector<NameId>::iterator it = std::lower_bound(ids.begin(), ids.end(), id);
+        if (it == ids.end() || *it != id) return false;
+        ids.erase(it);
+        return true;
+    }
+
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+    size_t capacity() const { return ids.capacity(); }
+    void clear() { ids.clear(); }
+    NameId front() const { return ids.front(); }
+    const_iterator begin() const { return ids.begin(); }
+    const_iterator end() const { return ids.end(); }
+};
+
+#endif // INTERN_H
@@ -0,0 +1,203 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdint>
+
+//=================================================================================================
+// ASYNCHRONOUS LOGGER
+//
+// Request threads format a line straight into a slot of a fixed-size ring
+// (bounded MPSC queue, Vyukov style) and return; a background thread drains
+// the ring into stdout and flushes once per batch. When the ring is full the
+// line is dropped and counted rather than stalling a request on the terminal.
+//=================================================================================================
+
+#define LOG_RING_SIZE 8192          // must be a power of two
+#define LOG_LINE_MAX 480
+
+enum LogLevel {
+    LOG_DEBUG = 0,
+    LOG_INFO = 1,
+    LOG_WARN = 2,
+    LOG_ERROR = 3,
+    LOG_OFF = 4
+};
+
+class Logger {
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        int length;
+        char text[LOG_LINE_MAX];
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<size_t> tail;               // next slot producers claim
+    size_t head;                            // next slot the writer drains
+    std::atomic<int> level;
+    std::atomic<unsigned> sample_every;     // keep 1 of N sampled lines
+    std::atomic<unsigned> sample_counter;
+    std::atomic<unsigned long> dropped;
+    std::atomic<bool> writer_sleeping;
+    std::atomic<bool> stopping;
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    std::thread writer;
+
+    Logger() : slots(new Slot[LOG_RING_SIZE]), tail(0), head(0), level(LOG_INFO),
+               sample_every(1), sample_counter(0), dropped(0), writer_sleeping(false), stopping(false) {
+        for (size_t i = 0; i < LOG_RING_SIZE; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        writer = std::thread(&Logger::writer_loop, this);
+    }
+
+    ~Logger() {
+        stopping = true;
+        wake_cv.notify_one();
+        if (writer.joinable()) writer.join();
+    }
+
+    Logger(const Logger&);
+    Logger& operator=(const Logger&);
+
+    bool drain_one() {
+        Slot& slot = slots[head & (LOG_RING_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+            return false;
+        }
+        fwrite(slot.text, 1, slot.length, stdout);
+        slot.sequence.store(head + LOG_RING_SIZE, std::memory_order_release);
+        head++;
+        return true;
+    }
+
+    void writer_loop() {
+        unsigned long reported_drops = 0;
+        while (true) {
+            bool wrote = false;
+            while (drain_one()) {
+                wrote = true;
+            }
+
+            unsigned long drops = dropped.load(std::memory_order_relaxed);
+            if (drops != reported_drops) {
+                fprintf(stdout, "\033[33m⚠ Logger dropped %lu line(s)\033[0m\n", drops - reported_drops);
+                reported_drops = drops;
+                wrote = true;
+            }
+            if (wrote) {
+                fflush(stdout);
+            }
+            if (stopping) {
+                return;
+            }
+
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            writer_sleeping = true;
+            wake_cv.wait_for(lock, std::chrono::milliseconds(10));
+            writer_sleeping = false;
+        }
+    }
+
+public:
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    void set_level(LogLevel new_level) { level = new_level; }
+    LogLevel get_level() const { return static_cast<LogLevel>(level.load()); }
+
+    // 1 keeps every sampled line, N keeps one in N, 0 suppresses them entirely.
+    void set_sample_rate(unsigned every) { sample_every = every; }
+
+    unsigned long dropped_lines() const { return dropped.load(); }
+
+    bool enabled(LogLevel line_level) const {
+        return line_level >= level.load(std::memory_order_relaxed);
+    }
+
+    // Sampling is for per-request lines that would otherwise dominate output.
+    bool sampled(LogLevel line_level) {
+        if (!enabled(line_level)) return false;
+        unsigned every = sample_every.load(std::memory_order_relaxed);
+        if (every == 0) return false;
+        return every == 1 || sample_counter.fetch_add(1, std::memory_order_relaxed) % every == 0;
+    }
+
+    void write(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & (LOG_RING_SIZE - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(slot->text, LOG_LINE_MAX - 1, format, args);
+        va_end(args);
+        if (length < 0) length = 0;
+        if (length > LOG_LINE_MAX - 2) length = LOG_LINE_MAX - 2;
+        slot->text[length++] = '\n';
+        slot->length = length;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+
+        if (writer_sleeping.load(std::memory_order_relaxed)) {
+            wake_cv.notify_one();
+        }
+    }
+
+    // Blocks until everything logged so far has reached stdout.
+    void flush() {
+        size_t target = tail.load();
+        while (!stopping) {
+            Slot& slot = slots[(target - 1) & (LOG_RING_SIZE - 1)];
+            if (target == 0 || slot.sequence.load(std::memory_order_acquire) >= target - 1 + LOG_RING_SIZE) {
+                break;
+            }
+            wake_cv.notify_one();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        fflush(stdout);
+    }
+};
+
+inline bool parse_log_level(const std::string& name, LogLevel& level) {
+    if (name == "debug") level = LOG_DEBUG;
+    else if (name == "info") level = LOG_INFO;
+    else if (name == "warn") level = LOG_WARN;
+    else if (name == "error") level = LOG_ERROR;
+    else if (name == "off") level = LOG_OFF;
+    else return false;
+    return true;
+}
+
+// The format arguments are not evaluated when the level is filtered out.
+#define TLOG(level, ...) \
+    do { if (Logger::instance().enabled(level)) Logger::instance().write(__VA_ARGS__); } while (0)
+
+// Per-request lines: subject to both the level and the sample rate.
+#define TLOG_SAMPLED(level, ...) \
+    do { if (Logger::instance().sampled(level)) Logger::instance().write(__VA_ARGS__); } while (0)
+
+#endif // LOGGER_H
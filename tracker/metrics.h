@@ -0,0 +1,128 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+//=================================================================================================
+// LATENCY HISTOGRAMS
+//
+// HDR-style log-linear buckets: each power of two is split into
+// 2^HISTOGRAM_SUB_BITS equal sub-buckets, so any recorded value is known to
+// within 12.5% whatever its magnitude, from nanoseconds to hours. Recording is
+// one relaxed atomic add per counter, so request threads never lock; readers
+// take a snapshot that may be a few records behind.
+//=================================================================================================
+
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+inline uint64_t monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class LatencyHistogram {
+private:
+    std::atomic<uint64_t> counts[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> total;        // sum of recorded values
+    std::atomic<uint64_t> largest;
+
+    LatencyHistogram(const LatencyHistogram&);
+    LatencyHistogram& operator=(const LatencyHistogram&);
+
+public:
+    LatencyHistogram() : total(0), largest(0) {
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) counts[i].store(0, std::memory_order_relaxed);
+    }
+
+    static size_t bucket(uint64_t value) {
+        if (value < (1u << HISTOGRAM_SUB_BITS)) return value;
+        int msb = 63 - __builtin_clzll(value);
+        return ((msb - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) +
+               ((value >> (msb - HISTOGRAM_SUB_BITS)) & ((1u << HISTOGRAM_SUB_BITS) - 1));
+    }
+
+    // Largest value that lands in bucket index
+    static uint64_t bucket_limit(size_t index) {
+        if (index < (1u << HISTOGRAM_SUB_BITS)) return index;
+        int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+        uint64_t lower = static_cast<uint64_t>((1u << HISTOGRAM_SUB_BITS) + (index & ((1u << HISTOGRAM_SUB_BITS) - 1))) << shift;
+        return lower + ((1ull << shift) - 1);
+    }
+
+    void record(uint64_t value) {
+        counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = largest.load(std::memory_order_relaxed);
+        while (value > seen && !largest.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+    }
+
+    struct Snapshot {
+        uint64_t counts[HISTOGRAM_BUCKETS];
+        uint64_t count;
+        uint64_t total;
+        uint64_t largest;
+
+        // Upper bound of the bucket holding the q-quantile (0 < q <= 1)
+        uint64_t quantile(double q) const {
+            if (count == 0) return 0;
+            uint64_t rank = static_cast<uint64_t>(q * count + 0.5);
+            if (rank == 0) rank = 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+                seen += counts[i];
+                if (seen >= rank) return std::min(bucket_limit(i), largest);
+            }
+            return largest;
+        }
+
+        // Values not above limit (for cumulative Prometheus buckets)
+        uint64_t count_up_to(uint64_t limit) const {
+            uint64_t seen = 0;
+            for (size_t i = 0; i < HISTOGRAM_BUCKETS && bucket_limit(i) <= limit; ++i) seen += counts[i];
+            return seen;
+        }
+    };
+
+    void snapshot(Snapshot& out) const {
+        out.count = 0;
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+            out.counts[i] = counts[i].load(std::memory_order_relaxed);
+            out.count += out.counts[i];
+        }
+        out.total = total.load(std::memory_order_relaxed);
+        out.largest = largest.load(std::memory_order_relaxed);
+    }
+};
+
+// Appends a histogram of nanosecond values in Prometheus text format, in
+// seconds, with one bucket per power of two from about 1us to 17s.
+inline void append_prometheus_histogram(std::string& out, const char* name, const std::string& labels,
+                                        const LatencyHistogram::Snapshot& snapshot) {
+    char line[256];
+    const char* comma = labels.empty() ? "" : ",";
+    for (int power = 10; power <= 34; ++power) {
+        uint64_t limit = (1ull << power) - 1;
+        snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%.9g\"} %llu\n", name, labels.c_str(), comma,
+                 (limit + 1) / 1e9, static_cast<unsigned long long>(snapshot.count_up_to(limit)));
+        out += line;
+    }
+    snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels.c_str(), comma,
+             static_cast<unsigned long long>(snapshot.count));
+    out += line;
+    const char* open = labels.empty() ? "" : "{";
+    const char* close = labels.empty() ? "" : "}";
+    snprintf(line, sizeof(line), "%s_sum%s%s%s %.9f\n", name, open, labels.c_str(), close, snapshot.total / 1e9);
+    out += line;
+    snprintf(line, sizeof(line), "%s_count%s%s%s %llu\n", name, open, labels.c_str(), close,
+             static_cast<unsigned long long>(snapshot.count));
+    out += line;
+}
+
+#endif // METRICS_H
@@ -0,0 +1,168 @@
+// Single-core request-path microbenchmark for the tracker.
+//
+// Drives Tracker::execute_command() in-process (no sockets, logging off) over a
+// preloaded state and reports requests per second on one core together with
+// heap allocations per request, so parsing/dispatch/reply-building changes can
+// be compared before and after.
+//
+//   make microbench && ./microbench [requests_per_workload]
+
+#include "tracker.h"
+#include <cstdlib>
+#include <new>
+
+//=================================================================================================
+// ALLOCATION COUNTING
+//=================================================================================================
+
+static std::atomic<unsigned long> allocation_count(0);
+
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size ? size : 1);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+//=================================================================================================
+// WORKLOADS
+//=================================================================================================
+
+#define BENCH_USERS 1000
+#define BENCH_GROUPS 50
+#define BENCH_FILES_PER_GROUP 20
+#define BENCH_SEEDERS_PER_FILE 5
+
+static const std::string BENCH_IP = "127.0.0.1";
+
+static std::string user_name(int i) { return "user" + std::to_string(i); }
+static std::string group_name(int i) { return "group" + std::to_string(i); }
+static std::string file_name(int g, int f) { return "file_" + std::to_string(g) + "_" + std::to_string(f) + ".bin"; }
+
+static void run(Tracker& tracker, const std::string& command, std::string& out) {
+    out.clear();
+    tracker.execute_command(command.data(), command.size(), BENCH_IP, 0, out);
+}
+
+// Users are spread round-robin over groups; every file has a few seeders.
+static void preload(Tracker& tracker) {
+    std::string out;
+    for (int u = 0; u < BENCH_USERS; ++u) {
+        run(tracker, "CREATE_USER " + user_name(u) + " secret", out);
+        run(tracker, "LOGIN " + user_name(u) + " secret 127.0.0.1 " + std::to_string(10000 + u), out);
+    }
+    for (int g = 0; g < BENCH_GROUPS; ++g) {
+        std::string owner = user_name(g);
+        run(tracker, "CREATE_GROUP " + owner + " " + group_name(g), out);
+        for (int u = g + BENCH_GROUPS; u < BENCH_USERS; u += BENCH_GROUPS) {
+            run(tracker, "JOIN_GROUP " + user_name(u) + " " + group_name(g), out);
+            run(tracker, "ACCEPT_REQUEST " + owner + " " + group_name(g) + " " + user_name(u), out);
+        }
+    }
+    std::string piece_hashes(40 * (20971520 / PIECE_SIZE), 'a');   // one hex SHA1 per piece
+    for (int g = 0; g < BENCH_GROUPS; ++g) {
+        for (int f = 0; f < BENCH_FILES_PER_GROUP; ++f) {
+            for (int s = 0; s < BENCH_SEEDERS_PER_FILE; ++s) {
+                int u = g + s * BENCH_GROUPS;
+                run(tracker, "UPLOAD_FILE " + user_name(u) + " " + group_name(g) + " " + file_name(g, f) +
+                             " hash_" + std::to_string(g) + "_" + std::to_string(f) + " " + piece_hashes + " 20971520", out);
+            }
+        }
+    }
+}
+
+struct Workload {
+    const char* name;
+    std::vector<std::string> commands;
+};
+
+static std::vector<Workload> build_workloads() {
+    std::vector<Workload> workloads(5);
+    workloads[0].name = "LOGIN";
+    workloads[1].name = "LIST_FILES";
+    workloads[2].name = "DOWNLOAD_FILE";
+    workloads[3].name = "LIST_GROUPS";
+    workloads[4].name = "MIX";
+
+    for (int i = 0; i < 256; ++i) {
+        int g = i % BENCH_GROUPS;
+        int u = g + (i % 4) * BENCH_GROUPS;
+        std::string login = "LOGIN " + user_name(u) + " secret 127.0.0.1 " + std::to_string(10000 + u);
+        std::string list_files = "LIST_FILES " + user_name(u) + " " + group_name(g);
+        std::string download = "DOWNLOAD_FILE " + user_name(u) + " " + group_name(g) + " " + file_name(g, i % BENCH_FILES_PER_GROUP);
+
+        workloads[0].commands.push_back(login);
+        workloads[1].commands.push_back(list_files);
+        workloads[2].commands.push_back(download);
+        workloads[3].commands.push_back("LIST_GROUPS");
+
+        // Read-heavy mix resembling a swarm: mostly peer lookups
+        workloads[4].commands.push_back(i % 8 == 0 ? login : (i % 8 < 3 ? list_files : download));
+    }
+    return workloads;
+}
+
+int main(int argc, char* argv[]) {
+    long requests = argc > 1 ? atol(argv[1]) : 200000;
+    if (requests <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [requests_per_workload]" << std::endl;
+        return 1;
+    }
+
+    TrackerConfig config;
+    config.log_level = LOG_OFF;
+    Tracker tracker(0, 0, config);
+    preload(tracker);
+    std::vector<Workload> workloads = build_workloads();
+
+    std::cout << "Tracker microbenchmark: " << BENCH_USERS << " users, " << BENCH_GROUPS << " groups, "
+              << BENCH_GROUPS * BENCH_FILES_PER_GROUP << " files, " << requests << " requests per workload (1 thread)" << std::endl;
+
+    std::string out;
+    for (const Workload& workload : workloads) {
+        const std::vector<std::string>& commands = workload.commands;
+
+        // Warm-up pass so thread-local buffers reach their steady-state size
+        for (size_t i = 0; i < commands.size(); ++i) {
+            run(tracker, commands[i], out);
+        }
+
+        size_t reply_bytes = 0;
+        unsigned long allocations_before = allocation_count.load();
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < requests; ++i) {
+            run(tracker, commands[i % commands.size()], out);
+            reply_bytes += out.size();
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        unsigned long allocations = allocation_count.load() - allocations_before;
+
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        char line[160];
+        snprintf(line, sizeof(line), "  %-14s %12.0f req/s  %8.1f ns/req  %6.2f allocs/req  %6.0f reply bytes/req",
+                 workload.name, requests / seconds, seconds * 1e9 / requests,
+                 static_cast<double>(allocations) / requests, static_cast<double>(reply_bytes) / requests);
+        std::cout << line << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+//=================================================================================================
+// PRIMARY/BACKUP REPLICATION
+//
+// One tracker is primary and the only one that changes state; the others are
+// backups that serve reads from a replica and forward writes (MSG_FORWARD) to
+// the primary. The primary ships its WAL records (wal.h) to each backup over a
+// MSG_REPLICATE stream, batched and without waiting for acknowledgements:
+//
+//   backup  -> primary   SUBSCRIBE <tracker_number> <term> <lsn>
+//   primary -> backup    RESET <term>, STATE + blob..., SYNCED <lsn>   (full sync)
+//                        LOG + blob                                   (records)
+//                        PING <lsn>                                   (idle keepalive)
+//   backup  -> primary   ACK <lsn>
+//
+// A backup whose (term, lsn) lies on the primary's history and within its
+// retained window resumes from there; anything else gets a full state copy.
+// "ROLE" asks a tracker what it is; it is used to find the primary at start
+// and after the primary goes away. The term grows on every promotion.
+//
+// Only trackers may send MSG_REPLICATE, MSG_FORWARD and MSG_MIGRATE (see
+// sharding.h): the stream carries every account, and forwarded commands and
+// imported records change state with the primary's authority.
+// With --cluster-key, a tracker opens each connection to another tracker with
+// a MSG_CLUSTER frame carrying the key, and takes these frames only on
+// connections that did. Without a key, they are taken only from the addresses
+// listed in tracker_info.txt. Anything else is answered with an ERROR and the
+// connection is closed.
+//=================================================================================================
+
+#define REPL_RETAIN_BYTES (64u * 1024 * 1024)   // recent records kept for catch-up
+#define REPL_BATCH_BYTES (1u * 1024 * 1024)
+#define REPL_PING_MS 1000
+#define REPL_TIMEOUT_MS 3000                    // silence before a peer is presumed dead
+#define REPL_CONNECT_TIMEOUT_MS 500
+#define REPL_FORWARD_TIMEOUT_MS 5000
+
+enum TrackerRole {
+    ROLE_STARTING,          // looking for a primary; serves reads only
+    ROLE_PRIMARY,
+    ROLE_BACKUP
+};
+
+inline const char* role_name(TrackerRole role) {
+    switch (role) {
+        case ROLE_PRIMARY: return "PRIMARY";
+        case ROLE_BACKUP: return "BACKUP";
+        default: return "STARTING";
+    }
+}
+
+struct TrackerPeer {
+    int number;             // line in tracker_info.txt
+    std::string ip;
+    int port;
+};
+
+// Most recent sealed records, kept so backups can stream from memory and a
+// briefly disconnected backup can resume without a full copy.
+class ReplicationLog {
+private:
+    std::mutex mutex;
+    std::condition_variable published;
+    std::deque<std::string> records;    // records[i] carries lsn first_lsn + i
+    uint64_t first_lsn;
+    size_t bytes;
+
+public:
+    ReplicationLog() : first_lsn(1), bytes(0) {}
+
+    void publish(const char* sealed, size_t length, uint64_t lsn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (lsn != first_lsn + records.size()) {
+            // Not contiguous (after a reset): restart the window here
+            records.clear();
+            bytes = 0;
+            first_lsn = lsn;
+        }
+        records.push_back(std::string(sealed, length));
+        bytes += length;
+        while (bytes > REPL_RETAIN_BYTES && records.size() > 1) {
+            bytes -= records.front().size();
+            records.pop_front();
+            first_lsn++;
+        }
+        published.notify_all();
+    }
+
+    // Forgets everything; the next published record starts a new window.
+    void reset(uint64_t next_lsn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        records.clear();
+        bytes = 0;
+        first_lsn = next_lsn;
+    }
+
+    // True if every record after lsn is still retained.
+    bool covers(uint64_t lsn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return lsn + 1 >= first_lsn;
+    }
+
+    // Appends records after lsn to batch (up to max_bytes), waiting up to
+    // wait_ms for one to appear. Updates lsn to the last record taken.
+    // Returns false if records after lsn were already evicted.
+    bool read_after(uint64_t& lsn, std::string& batch, size_t max_bytes, int wait_ms) {
+        std::unique_lock<std::mutex> lock(mutex);
+        published.wait_for(lock, std::chrono::milliseconds(wait_ms), [this, lsn] {
+            return lsn + 1 < first_lsn || lsn + 1 < first_lsn + records.size();
+        });
+        if (lsn + 1 < first_lsn) return false;
+
+        for (size_t i = lsn + 1 - first_lsn; i < records.size(); ++i) {
+            if (!batch.empty() && batch.size() + records[i].size() > max_bytes) break;
+            batch += records[i];
+            lsn = first_lsn + i;
+        }
+        return true;
+    }
+};
+
+#endif // REPLICATION_H
@@ -0,0 +1,64 @@
+#ifndef RWLOCK_H
+#define RWLOCK_H
+
+#include <pthread.h>
+#include "metrics.h"
+
+// Reader/writer lock (std::shared_mutex needs C++17; the tracker builds as C++11).
+// With track_waits(), time spent blocked on the lock goes into a histogram;
+// an uncontended acquire costs the same as before and is not recorded.
+class RWLock {
+private:
+    pthread_rwlock_t rwlock;
+    LatencyHistogram* waits;
+
+    RWLock(const RWLock&);
+    RWLock& operator=(const RWLock&);
+
+public:
+    RWLock() : waits(NULL) { pthread_rwlock_init(&rwlock, NULL); }
+    ~RWLock() { pthread_rwlock_destroy(&rwlock); }
+
+    void track_waits(LatencyHistogram* histogram) { waits = histogram; }
+
+    void lock_shared() {
+        if (pthread_rwlock_tryrdlock(&rwlock) == 0) return;
+        uint64_t started = waits != NULL ? monotonic_ns() : 0;
+        pthread_rwlock_rdlock(&rwlock);
+        if (waits != NULL) waits->record(monotonic_ns() - started);
+    }
+    void unlock_shared() { pthread_rwlock_unlock(&rwlock); }
+    void lock() {
+        if (pthread_rwlock_trywrlock(&rwlock) == 0) return;
+        uint64_t started = waits != NULL ? monotonic_ns() : 0;
+        pthread_rwlock_wrlock(&rwlock);
+        if (waits != NULL) waits->record(monotonic_ns() - started);
+    }
+    void unlock() { pthread_rwlock_unlock(&rwlock); }
+};
+
+class ReadGuard {
+private:
+    RWLock& lock;
+
+    ReadGuard(const ReadGuard&);
+    ReadGuard& operator=(const ReadGuard&);
+
+public:
+    explicit ReadGuard(RWLock& lock) : lock(lock) { lock.lock_shared(); }
+    ~ReadGuard() { lock.unlock_shared(); }
+};
+
+class WriteGuard {
+private:
+    RWLock& lock;
+
+    WriteGuard(const WriteGuard&);
+    WriteGuard& operator=(const WriteGuard&);
+
+public:
+    explicit WriteGuard(RWLock& lock) : lock(lock) { lock.lock(); }
+    ~WriteGuard() { lock.unlock(); }
+};
+
+#endif // RWLOCK_H
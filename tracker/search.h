@@ -0,0 +1,278 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include "rwlock.h"
+#include "intern.h"
+
+//=================================================================================================
+// FILENAME SEARCH
+//
+// SEARCH looks names of shared files up in two in-memory indexes, both kept
+// per group and over the lowercased name, so that a search only ever touches
+// the groups its caller belongs to:
+//   - a prefix trie, its depth capped at SEARCH_TRIE_DEPTH, with one root per
+//     group. Each node keeps the files whose name ends there (or runs past the
+//     cap), so a breadth-first walk below the query's node yields its prefix
+//     matches, shortest names first;
+//   - trigram posting lists of file IDs, keyed by group and trigram. A query of
+//     three or more bytes intersects the lists of its trigrams, smallest first,
+//     and checks what is left, so it matches anywhere in a name.
+// File IDs grow as names are interned, so lists mostly grow at the end. The
+// index lock is innermost, like the NameTable locks.
+//=================================================================================================
+
+#define SEARCH_TRIE_DEPTH 8
+#define SEARCH_DEFAULT_LIMIT 20
+#define SEARCH_MAX_LIMIT 200
+#define SEARCH_CANDIDATES_PER_RESULT 4  // matches gathered per result shown, for ranking
+
+// Better matches sort first
+enum SearchMatch {
+    MATCH_EXACT,
+    MATCH_PREFIX,
+    MATCH_WORD,                         // starts a word: after a character that is not a letter or digit
+    MATCH_SUBSTRING
+};
+
+struct SearchHit {
+    NameId file;
+    NameId group;
+    SearchMatch match;
+};
+
+inline char fold_case(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+inline bool is_word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+class SearchIndex {
+private:
+    struct TrieNode {
+        uint32_t child;                 // first child, 0 if none (node 0 is unused)
+        uint32_t sibling;               // next child of the same parent, 0 if last
+        uint32_t bucket;                // index into buckets, NO_BUCKET if no name ends here
+        unsigned char byte;
+    };
+    static const uint32_t NO_BUCKET = 0xFFFFFFFFu;
+
+    const NameTable& names;
+    mutable RWLock lock;
+    std::vector<TrieNode> nodes;        // nodes are never freed
+    std::vector<uint32_t> roots;        // by group ID, 0 until the group shares a file
+    std::vector<IdSet> buckets;
+    std::unordered_map<uint64_t, std::vector<NameId>> trigrams;     // (group, trigram) -> sorted file IDs
+    size_t indexed;                     // (group, file) pairs
+
+    SearchIndex(const SearchIndex&);
+    SearchIndex& operator=(const SearchIndex&);
+
+    static uint64_t trigram_key(NameId group, const char* data) {
+        return static_cast<uint64_t>(group) << 24 |
+               static_cast<uint64_t>(static_cast<unsigned char>(fold_case(data[0]))) << 16 |
+               static_cast<uint64_t>(static_cast<unsigned char>(fold_case(data[1]))) << 8 |
+               static_cast<unsigned char>(fold_case(data[2]));
+    }
+
+    uint32_t new_node(uint32_t sibling, unsigned char byte) {
+        TrieNode added = { 0, sibling, NO_BUCKET, byte };
+        nodes.push_back(added);
+        return nodes.size() - 1;
+    }
+
+    uint32_t find_child(uint32_t node, unsigned char byte) const {
+        for (uint32_t child = nodes[node].child; child != 0; child = nodes[child].sibling) {
+            if (nodes[child].byte == byte) return child;
+        }
+        return 0;
+    }
+
+    // Node for name under group's root: its full path, or its first
+    // SEARCH_TRIE_DEPTH bytes. 0 if absent.
+    uint32_t find_node(NameId group, const std::string& name) const {
+        uint32_t node = group < roots.size() ? roots[group] : 0;
+        size_t depth = std::min(name.size(), static_cast<size_t>(SEARCH_TRIE_DEPTH));
+        for (size_t i = 0; i < depth && node != 0; ++i) {
+            node = find_child(node, static_cast<unsigned char>(fold_case(name[i])));
+        }
+        return node;
+    }
+
+    uint32_t add_node(NameId group, const std::string& name) {
+        if (group >= roots.size()) roots.resize(group + 1, 0);
+        if (roots[group] == 0) roots[group] = new_node(0, 0);
+        uint32_t node = roots[group];
+        size_t depth = std::min(name.size(), static_cast<size_t>(SEARCH_TRIE_DEPTH));
+        for (size_t i = 0; i < depth; ++i) {
+            unsigned char byte = static_cast<unsigned char>(fold_case(name[i]));
+            uint32_t child = find_child(node, byte);
+            if (child == 0) {
+                child = new_node(nodes[node].child, byte);
+                nodes[node].child = child;
+            }
+            node = child;
+        }
+        return node;
+    }
+
+    // Where query (already lowercased) occurs in name, ignoring case
+    static size_t find_folded(const std::string& name, const std::string& query) {
+        if (query.size() > name.size()) return std::string::npos;
+        for (size_t at = 0; at + query.size() <= name.size(); ++at) {
+            size_t i = 0;
+            while (i < query.size() && fold_case(name[at + i]) == query[i]) ++i;
+            if (i == query.size()) return at;
+        }
+        return std::string::npos;
+    }
+
+    // Caller holds lock
+    void search_group(const std::string& query, NameId group, size_t max, std::vector<SearchHit>& out) const {
+        size_t start = out.size();
+        bool trie_covers_prefixes = query.size() <= SEARCH_TRIE_DEPTH;
+        if (trie_covers_prefixes) {
+            uint32_t node = find_node(group, query);
+            std::deque<uint32_t> pending;
+            if (node != 0) pending.push_back(node);
+            while (!pending.empty() && out.size() - start < max) {
+                const TrieNode& at = nodes[pending.front()];
+                pending.pop_front();
+                if (at.bucket != NO_BUCKET) {
+                    for (NameId file : buckets[at.bucket]) {
+                        SearchMatch match = names.name(file).size() == query.size() ? MATCH_EXACT : MATCH_PREFIX;
+                        SearchHit hit = { file, group, match };
+                        out.push_back(hit);
+                    }
+                }
+                for (uint32_t child = at.child; child != 0; child = nodes[child].sibling) pending.push_back(child);
+            }
+        }
+        if (query.size() < 3 || out.size() - start >= max) return;
+
+        // Posting lists of the query's trigrams, shortest first; one missing means no match
+        static thread_local std::vector<const std::vector<NameId>*> lists;
+        lists.clear();
+        for (size_t i = 0; i + 3 <= query.size(); ++i) {
+            std::unordered_map<uint64_t, std::vector<NameId>>::const_iterator list = trigrams.find(trigram_key(group, query.data() + i));
+            if (list == trigrams.end()) return;
+            lists.push_back(&list->second);
+        }
+        std::sort(lists.begin(), lists.end(),
+                  [](const std::vector<NameId>* a, const std::vector<NameId>* b) { return a->size() < b->size(); });
+
+        for (NameId file : *lists[0]) {
+            if (out.size() - start >= max) break;
+            bool in_all = true;
+            for (size_t i = 1; i < lists.size() && in_all; ++i) {
+                in_all = std::binary_search(lists[i]->begin(), lists[i]->end(), file);
+            }
+            if (!in_all) continue;
+
+            const std::string& name = names.name(file);
+            size_t at = find_folded(name, query);
+            if (at == std::string::npos) continue;
+            if (at == 0 && trie_covers_prefixes) continue;          // listed by the trie already
+            SearchMatch match = at == 0 ? (name.size() == query.size() ? MATCH_EXACT : MATCH_PREFIX)
+                              : !is_word_char(name[at - 1]) ? MATCH_WORD : MATCH_SUBSTRING;
+            SearchHit hit = { file, group, match };
+            out.push_back(hit);
+        }
+    }
+
+public:
+    explicit SearchIndex(const NameTable& names) : names(names), indexed(0) {
+        TrieNode unused = { 0, 0, NO_BUCKET, 0 };
+        nodes.push_back(unused);
+    }
+
+    // A file named file is now shared in group
+    void add(NameId file, NameId group) {
+        const std::string& name = names.name(file);
+        WriteGuard guard(lock);
+        uint32_t node = add_node(group, name);
+        if (nodes[node].bucket == NO_BUCKET) {
+            nodes[node].bucket = buckets.size();
+            buckets.push_back(IdSet());
+        }
+        if (!buckets[nodes[node].bucket].insert(file)) return;
+        indexed++;
+
+        for (size_t i = 0; i + 3 <= name.size(); ++i) {
+            std::vector<NameId>& list = trigrams[trigram_key(group, name.data() + i)];
+            if (list.empty() || list.back() < file) {
+                list.push_back(file);
+                continue;
+            }
+            std::vector<NameId>::iterator it = std::lower_bound(list.begin(), list.end(), file);
+            if (*it != file) list.insert(it, file);
+        }
+    }
+
+    // The file named file in group is gone
+    void remove(NameId file, NameId group) {
+        const std::string& name = names.name(file);
+        WriteGuard guard(lock);
+        uint32_t node = find_node(group, name);
+        if (node == 0 || nodes[node].bucket == NO_BUCKET || !buckets[nodes[node].bucket].erase(file)) return;
+        indexed--;
+
+        for (size_t i = 0; i + 3 <= name.size(); ++i) {
+            std::unordered_map<uint64_t, std::vector<NameId>>::iterator list = trigrams.find(trigram_key(group, name.data() + i));
+            if (list == trigrams.end()) continue;
+            std::vector<NameId>::iterator it = std::lower_bound(list->second.begin(), list->second.end(), file);
+            if (it != list->second.end() && *it == file) list->second.erase(it);
+            if (list->second.empty()) trigrams.erase(list);
+        }
+    }
+
+    void clear() {
+        WriteGuard guard(lock);
+        nodes.resize(1);
+        roots.clear();
+        buckets.clear();
+        trigrams.clear();
+        indexed = 0;
+    }
+
+    // Appends matches of query (lowercase) in the given groups, up to max:
+    // per group, prefix matches from the trie first, shortest names first,
+    // then other matches found through trigrams. Queries under three bytes
+    // match prefixes only.
+    void search(const std::string& query, const IdSet& groups, size_t max, std::vector<SearchHit>& out) const {
+        if (query.empty()) return;
+        size_t start = out.size();
+        ReadGuard guard(lock);
+        for (NameId group : groups) {
+            if (out.size() - start >= max) break;
+            search_group(query, group, max - (out.size() - start), out);
+        }
+    }
+
+    size_t size() const {
+        ReadGuard guard(lock);
+        return indexed;
+    }
+
+    // Bytes held by the index, counting vector capacity
+    size_t memory_usage() const {
+        ReadGuard guard(lock);
+        size_t bytes = nodes.capacity() * sizeof(TrieNode) + roots.capacity() * sizeof(uint32_t) +
+                       buckets.capacity() * sizeof(IdSet);
+        for (const IdSet& bucket : buckets) bytes += bucket.capacity() * sizeof(NameId);
+        // A hash node is about the entry plus two pointers
+        for (const auto& list : trigrams) bytes += sizeof(list) + 2 * sizeof(void*) + list.second.capacity() * sizeof(NameId);
+        return bytes;
+    }
+
+    void track_waits(LatencyHistogram* histogram) { lock.track_waits(histogram); }
+};
+
+#endif // SEARCH_H
@@ -0,0 +1,120 @@
+#ifndef SHARDING_H
+#define SHARDING_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include "cluster.h"
+#include "replication.h"
+
+//=================================================================================================
+// SHARDING
+//
+// With more than one shard in tracker_info.txt (see common/cluster.h), each
+// shard keeps only the groups the ring assigns to it. Every shard keeps every
+// user account, because peer lists need the address of each member. A command
+// that names a group is served by that group's shard. Any other tracker
+// replies with the trackers of the right shard:
+//
+//   REDIRECT <group> <ip>:<port> [<ip>:<port>...]
+//
+// Clients build the same ring and send each command to the right shard, so
+// they only see a REDIRECT when their tracker_info.txt is out of date. The
+// account and session commands (CREATE_USER, LOGIN, LOGOUT, HEARTBEAT) go to
+// every shard. Clients send LIST_GROUPS and SEARCH to each shard and merge
+// the results.
+//
+// A tracker re-reads tracker_info.txt when it changes. The primary of each
+// shard then moves the groups that now belong elsewhere, one at a time, to
+// the primary of their new shard:
+//
+//   source -> target   IMPORT <shard> [<n>/<count>] + records
+//                                                 (MSG_MIGRATE) the group as WAL records,
+//                                                 with the accounts it refers to
+//   target -> source   SUCCESS | ERROR: <reason>
+//
+// Like replication, MSG_MIGRATE is only taken from trackers of the cluster
+// (see replication.h). It takes only account records and the records of
+// groups its own copy of the file assigns to it. This also means trackers with
+// different files never pass a group back and forth. Records too large for one
+// frame go in numbered batches. The target checks and keeps each one, and
+// applies them all, logged as its own changes, when the last arrives. Batch 1
+// drops whatever an earlier, unfinished import from that shard left, so the
+// target holds a group in full or not at all.
+//
+// The source keeps serving the group until the target answers the last batch.
+// Reads go on as usual; commands that change the group wait for the move. Then
+// the group leaves the source's directory and the source logs WAL_GROUP_DROP.
+// Commands that waited on it get "Group not found", and later ones a REDIRECT.
+// If the import fails, the group stays where it was and the move is retried at
+// the next check. A shard new to the file first receives every account the
+// same way.
+//=================================================================================================
+
+#define SHARD_CHECK_MS 1000             // how often tracker_info.txt is checked for changes
+
+struct Shard {
+    std::string name;
+    std::vector<TrackerPeer> trackers;  // numbered by their line in tracker_info.txt
+};
+
+// Immutable once built; a changed tracker_info.txt yields a new one.
+struct ShardMap {
+    std::vector<Shard> shards;          // in order of first appearance in the file
+    HashRing ring;
+    int self;                           // index of this tracker's shard
+
+    ShardMap() : self(0) {}
+
+    int owner(const char* group, size_t length) const {
+        return shards.size() <= 1 ? self : ring.owner(group, length);
+    }
+    int owner(const std::string& group) const { return owner(group.data(), group.size()); }
+};
+
+enum MoveResult {
+    MOVE_DONE,
+    MOVE_REFUSED                        // the target shard was unreachable or said no
+};
+
+// Target side: the batches of one IMPORT received so far from a source shard
+struct StagedImport {
+    std::string records;
+    int batches;
+    uint64_t connection;                // the rest must come on the same connection
+
+    StagedImport() : batches(0), connection(0) {}
+};
+
+// Reads every tracker in path, grouped by shard. False if the file cannot be
+// read or has no line for tracker_number.
+inline bool read_shard_map(const std::string& path, int tracker_number, ShardMap& map) {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+
+    bool found = false;
+    std::string line;
+    for (int number = 0; std::getline(file, line); ++number) {
+        TrackerAddress address;
+        if (!parse_tracker_line(line, address)) continue;
+        size_t shard = 0;
+        while (shard < map.shards.size() && map.shards[shard].name != address.shard) ++shard;
+        if (shard == map.shards.size()) {
+            map.shards.push_back(Shard());
+            map.shards.back().name = address.shard;
+            map.ring.add(address.shard);
+        }
+        TrackerPeer peer;
+        peer.number = number;
+        peer.ip = address.ip;
+        peer.port = address.port;
+        map.shards[shard].trackers.push_back(peer);
+        if (number == tracker_number) {
+            map.self = shard;
+            found = true;
+        }
+    }
+    return found;
+}
+
+#endif // SHARDING_H
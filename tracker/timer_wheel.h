@@ -0,0 +1,90 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+//=================================================================================================
+// HIERARCHICAL TIMER WHEEL
+//
+// A timer is an ID due at an absolute tick. Level 0 has one slot per tick for
+// the next TIMER_SLOTS ticks, level 1 one slot per TIMER_SLOTS ticks, and so on.
+// A timer sits at the lowest level whose range reaches it and drops a level
+// each time its slot comes round, so scheduling is O(1) and a timer is touched
+// at most TIMER_LEVELS times before it fires. Timers cannot be cancelled: the
+// owner checks, when one fires, whether it is still wanted. Not thread-safe.
+//=================================================================================================
+
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1u << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4                          // 2^24 ticks ahead at most
+
+class TimerWheel {
+private:
+    struct Timer {
+        uint64_t due;
+        uint32_t id;
+    };
+
+    std::vector<Timer> slots[TIMER_LEVELS][TIMER_SLOTS];
+    std::vector<Timer> cascading;
+    uint64_t current;                   // last tick advanced to
+    size_t count;
+
+    // due >= current; a timer due now lands in the level 0 slot fired next
+    void place(const Timer& timer) {
+        uint64_t delta = timer.due - current;
+        int level = 0;
+        while (level < TIMER_LEVELS - 1 && delta >> (TIMER_SLOT_BITS * (level + 1)) != 0) level++;
+        slots[level][(timer.due >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1)].push_back(timer);
+    }
+
+public:
+    explicit TimerWheel(uint64_t now = 0) : current(now), count(0) {}
+
+    // Schedules id at tick due (the next tick if due has passed; the end of the
+    // wheel's range if due lies beyond it). Returns the tick it will fire at.
+    uint64_t schedule(uint64_t due, uint32_t id) {
+        const uint64_t range = (1ull << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+        if (due <= current) due = current + 1;
+        if (due - current > range) due = current + range;
+        Timer timer = { due, id };
+        place(timer);
+        count++;
+        return due;
+    }
+
+    // Moves time forward to now, appending (id, due tick) for every timer that came due.
+    void advance(uint64_t now, std::vector<std::pair<uint32_t, uint64_t>>& fired) {
+        while (current < now && count > 0) {
+            current++;
+            for (int level = 1; level < TIMER_LEVELS; ++level) {
+                if (current & ((1ull << (TIMER_SLOT_BITS * level)) - 1)) break;
+                cascading.swap(slots[level][(current >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1)]);
+                for (const Timer& timer : cascading) place(timer);
+                cascading.clear();
+            }
+            std::vector<Timer>& slot = slots[0][current & (TIMER_SLOTS - 1)];
+            for (const Timer& timer : slot) fired.push_back(std::make_pair(timer.id, timer.due));
+            count -= slot.size();
+            slot.clear();
+        }
+        if (current < now) current = now;   // empty: nothing to step through
+    }
+
+    // Drops every timer and restarts the wheel at now.
+    void reset(uint64_t now) {
+        for (int level = 0; level < TIMER_LEVELS; ++level) {
+            for (unsigned i = 0; i < TIMER_SLOTS; ++i) slots[level][i].clear();
+        }
+        current = now;
+        count = 0;
+    }
+
+    uint64_t now() const { return current; }
+    size_t size() const { return count; }
+};
+
+#endif // TIMER_WHEEL_H
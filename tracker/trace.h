@@ -0,0 +1,228 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+//=================================================================================================
+// COMMAND TRACES
+//
+// With --trace=FILE the tracker appends every client command it receives to a
+// binary trace, for tracker/trace_replay to play back against another tracker:
+//
+//   "AOSTRC01"                         file header
+//   varint  delay                      nanoseconds since the previous record
+//   varint  connection                 ID of the client connection, in accept order
+//   varint  text length, varint blob length, text, blob
+//
+// Varints are LEB128 (7 bits per byte, low bits first), so a small command
+// costs its text plus about 6 bytes. Recording appends to a memory buffer that
+// a background thread writes out; if the disk falls TRACE_MAX_PENDING bytes
+// behind, records are dropped and counted rather than stalling requests.
+//
+// The file is readable by its owner only, and passwords are never written:
+// the password of LOGIN and CREATE_USER is recorded as TRACE_REDACTED. A
+// replay creates and logs in those users with that password, so it still
+// succeeds.
+//=================================================================================================
+
+#define TRACE_MAGIC "AOSTRC01"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_MAX_PENDING (64u * 1024 * 1024)
+#define TRACE_FLUSH_MS 100
+#define TRACE_REDACTED "*"
+
+inline void trace_put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline bool trace_get_varint(const char*& data, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && data < end; shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(*data++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Fills redacted and returns true if text carries a password.
+inline bool trace_redact(const std::string& text, std::string& redacted) {
+    static const char SPACE[] = " \t\r\n";
+    size_t command = text.find_first_not_of(SPACE);
+    if (command == std::string::npos) return false;
+    size_t command_end = text.find_first_of(SPACE, command);
+    if (command_end == std::string::npos) return false;
+    std::string name = text.substr(command, command_end - command);
+    if (name != "LOGIN" && name != "CREATE_USER") return false;
+
+    // The third word: LOGIN <user> <password> ..., CREATE_USER <user> <password>
+    size_t user = text.find_first_not_of(SPACE, command_end);
+    size_t user_end = user == std::string::npos ? user : text.find_first_of(SPACE, user);
+    size_t password = user_end == std::string::npos ? user_end : text.find_first_not_of(SPACE, user_end);
+    if (password == std::string::npos) return false;
+    size_t password_end = text.find_first_of(SPACE, password);
+    redacted.assign(text, 0, password);
+    redacted += TRACE_REDACTED;
+    if (password_end != std::string::npos) redacted.append(text, password_end, std::string::npos);
+    return true;
+}
+
+class TraceWriter {
+private:
+    int fd;
+    std::mutex mutex;
+    std::condition_variable flush_cv;
+    std::string pending;                // guarded by mutex
+    uint64_t last_ns;                   // time of the previous record, guarded by mutex
+    bool stopping;
+    std::atomic<unsigned long> dropped;
+    std::thread flusher;
+
+    TraceWriter(const TraceWriter&);
+    TraceWriter& operator=(const TraceWriter&);
+
+    void flusher_loop() {
+        std::string batch;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                flush_cv.wait_for(lock, std::chrono::milliseconds(TRACE_FLUSH_MS), [this] { return stopping; });
+                batch.swap(pending);
+                if (batch.empty() && stopping) return;
+            }
+            const char* data = batch.data();
+            size_t length = batch.size();
+            while (length > 0) {
+                ssize_t n = write(fd, data, length);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                data += n;
+                length -= n;
+            }
+            batch.clear();
+        }
+    }
+
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+public:
+    TraceWriter() : fd(-1), last_ns(0), stopping(false), dropped(0) {}
+    ~TraceWriter() { close(); }
+
+    bool open(const std::string& path) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
+        // An existing file keeps its mode through O_CREAT
+        if (fchmod(fd, 0600) != 0) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        pending.assign(TRACE_MAGIC, TRACE_MAGIC_SIZE);
+        last_ns = now_ns();
+        flusher = std::thread(&TraceWriter::flusher_loop, this);
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        flush_cv.notify_one();
+        if (flusher.joinable()) flusher.join();
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    bool is_open() const { return fd >= 0; }
+    unsigned long dropped_records() const { return dropped.load(); }
+
+    void record(uint64_t connection, const std::string& command, const std::string& blob) {
+        std::string redacted;
+        const std::string& text = trace_redact(command, redacted) ? redacted : command;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.size() + text.size() + blob.size() > TRACE_MAX_PENDING) {
+            dropped++;
+            return;
+        }
+        uint64_t now = now_ns();
+        trace_put_varint(pending, now - last_ns);
+        last_ns = now;
+        trace_put_varint(pending, connection);
+        trace_put_varint(pending, text.size());
+        trace_put_varint(pending, blob.size());
+        pending += text;
+        pending += blob;
+    }
+};
+
+struct TraceRecord {
+    uint64_t at_ns;                     // since the start of the trace
+    uint64_t connection;
+    const char* text;
+    size_t text_length;
+    const char* blob;
+    size_t blob_length;
+};
+
+// Walks a trace held in memory. A record cut short by a crash ends the trace.
+class TraceReader {
+private:
+    const char* data;
+    const char* end;
+    uint64_t at_ns;
+
+public:
+    TraceReader(const char* data, size_t length) : data(data), end(data + length), at_ns(0) {}
+
+    bool valid_header() {
+        if (end - data < TRACE_MAGIC_SIZE || memcmp(data, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) return false;
+        data += TRACE_MAGIC_SIZE;
+        return true;
+    }
+
+    bool next(TraceRecord& record) {
+        const char* cursor = data;
+        uint64_t delay, text_length, blob_length;
+        if (!trace_get_varint(cursor, end, delay) || !trace_get_varint(cursor, end, record.connection) ||
+            !trace_get_varint(cursor, end, text_length) || !trace_get_varint(cursor, end, blob_length)) {
+            return false;
+        }
+        if (text_length > static_cast<uint64_t>(end - cursor) ||
+            blob_length > static_cast<uint64_t>(end - cursor) - text_length) {
+            return false;
+        }
+        at_ns += delay;
+        record.at_ns = at_ns;
+        record.text = cursor;
+        record.text_length = text_length;
+        record.blob = cursor + text_length;
+        record.blob_length = blob_length;
+        data = cursor + text_length + blob_length;
+        return true;
+    }
+};
+
+#endif // TRACE_H
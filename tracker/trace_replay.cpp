@@ -0,0 +1,321 @@
+// Replays a command trace recorded with `tracker --trace=FILE` (see trace.h)
+// against a tracker, normally a fresh one, and reports throughput and latency.
+//
+// Every traced connection gets its own connection, opened when its first
+// command is due and every command recorded before it has been answered (so a
+// JOIN_GROUP never overtakes the CREATE_GROUP another client sent earlier).
+// Commands on it go out in their recorded order at their recorded offsets
+// divided by --speed; commands that are due together are pipelined, as the
+// client pipelined them. With "max" each connection sends its next burst as
+// soon as the previous one is answered. Connections that were open at the same
+// time run concurrently, so at high speeds one of their commands can still
+// overtake another it depended on. When the tracker cannot keep up, commands
+// fall behind schedule; the lag is reported next to the latencies.
+//
+//   make trace_replay
+//   ./trace_replay commands.trace --tracker=127.0.0.1:8080 --speed=1
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "protocol.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define REPLAY_MAX_BATCH 256
+#define REPLAY_BURST_NS 1000000                 // at max speed, commands this close were one burst
+
+//=================================================================================================
+// TRACE LOADING
+//=================================================================================================
+
+struct CommandStats {
+    std::atomic<long> calls;
+    std::atomic<long> errors;
+    LatencyHistogram latency;
+
+    CommandStats() : calls(0), errors(0) {}
+};
+
+struct ReplayStep {
+    TraceRecord record;
+    CommandStats* stats;
+};
+
+// The commands of one traced connection, in order
+struct Lane {
+    std::vector<ReplayStep> steps;
+    std::atomic<size_t> answered;       // steps done (all of them once the connection fails)
+
+    Lane() : answered(0) {}
+};
+
+struct ReplayConfig {
+    std::string host;
+    int port;
+    double speed;                       // 0: no pacing
+
+    ReplayConfig() : host("127.0.0.1"), port(8080), speed(1) {}
+};
+
+static void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " <trace> [options]\n"
+              << "  --tracker=IP:PORT   tracker to replay against (default 127.0.0.1:8080)\n"
+              << "  --speed=N|max       N times the recorded rate, e.g. 1, 4x or 0.5; max sends\n"
+              << "                      each burst as soon as the previous one is answered (default 1)\n";
+}
+
+static bool parse_option(const char* arg, ReplayConfig& config) {
+    if (strncmp(arg, "--tracker=", 10) == 0) {
+        const char* colon = strrchr(arg + 10, ':');
+        if (colon == NULL) return false;
+        char* end;
+        long port = strtol(colon + 1, &end, 10);
+        if (*end != '\0' || port <= 0 || port > 65535) return false;
+        config.host.assign(arg + 10, colon - (arg + 10));
+        config.port = port;
+        return true;
+    }
+    if (strncmp(arg, "--speed=", 8) == 0) {
+        if (strcmp(arg + 8, "max") == 0) {
+            config.speed = 0;
+            return true;
+        }
+        char* end;
+        config.speed = strtod(arg + 8, &end);
+        if (*end == 'x') end++;
+        return *end == '\0' && end != arg + 8 && config.speed > 0;
+    }
+    return false;
+}
+
+// Splits the trace into lanes ordered by their first command. The steps point
+// into trace, which must outlive them.
+static bool load_trace(const std::string& trace, std::vector<std::unique_ptr<Lane>>& lanes,
+                       std::map<std::string, std::unique_ptr<CommandStats>>& commands, long& records) {
+    TraceReader reader(trace.data(), trace.size());
+    if (!reader.valid_header()) return false;
+
+    std::map<uint64_t, size_t> lane_of;
+    ReplayStep step;
+    records = 0;
+    while (reader.next(step.record)) {
+        size_t word = 0;
+        while (word < step.record.text_length && step.record.text[word] != ' ' && step.record.text[word] != '\n') word++;
+        std::unique_ptr<CommandStats>& stats = commands[std::string(step.record.text, word)];
+        if (!stats) stats.reset(new CommandStats);
+        step.stats = stats.get();
+
+        std::map<uint64_t, size_t>::iterator it = lane_of.find(step.record.connection);
+        if (it == lane_of.end()) {
+            it = lane_of.insert(std::make_pair(step.record.connection, lanes.size())).first;
+            lanes.push_back(std::unique_ptr<Lane>(new Lane));
+        }
+        lanes[it->second]->steps.push_back(step);
+        records++;
+    }
+    return true;
+}
+
+//=================================================================================================
+// REPLAY
+//=================================================================================================
+
+static int connect_to(const ReplayConfig& config) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(config.port);
+    if (inet_pton(AF_INET, config.host.c_str(), &address.sin_addr) != 1 ||
+        connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static std::chrono::steady_clock::time_point due_at(const ReplayConfig& config, std::chrono::steady_clock::time_point start,
+                                                    uint64_t at_ns) {
+    return start + std::chrono::nanoseconds(static_cast<uint64_t>(at_ns / config.speed));
+}
+
+static void replay_lane(const ReplayConfig& config, Lane& lane, std::chrono::steady_clock::time_point start,
+                        LatencyHistogram& lag, std::atomic<long>& failures) {
+    int fd = connect_to(config);
+    if (fd < 0) {
+        failures++;
+        lane.answered = lane.steps.size();
+        return;
+    }
+    std::string out;
+    Frame reply;
+    size_t next = 0;
+    while (next < lane.steps.size()) {
+        // Commands that are due (or, at max speed, were recorded in one burst) go out pipelined
+        size_t first = next;
+        if (config.speed > 0) {
+            std::chrono::steady_clock::time_point due = due_at(config, start, lane.steps[first].record.at_ns);
+            std::this_thread::sleep_until(due);
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            while (next < lane.steps.size() && next - first < REPLAY_MAX_BATCH &&
+                   due_at(config, start, lane.steps[next].record.at_ns) <= now) {
+                lag.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now - due_at(config, start, lane.steps[next].record.at_ns)).count());
+                next++;
+            }
+        } else {
+            while (next < lane.steps.size() && next - first < REPLAY_MAX_BATCH &&
+                   lane.steps[next].record.at_ns - lane.steps[first].record.at_ns <= REPLAY_BURST_NS) {
+                next++;
+            }
+        }
+
+        out.clear();
+        for (size_t i = first; i < next; ++i) {
+            const TraceRecord& record = lane.steps[i].record;
+            append_frame(out, MSG_COMMAND, std::string(record.text, record.text_length),
+                         std::string(record.blob, record.blob_length));
+        }
+        uint64_t sent_at = monotonic_ns();
+        bool sent = send_all(fd, out.data(), out.size());
+        for (size_t i = first; sent && i < next; ++i) {
+            // Events pushed to a subscribed connection are not replies
+            bool received = recv_frame(fd, reply);
+            while (received && reply.type != MSG_REPLY) received = recv_frame(fd, reply);
+            if (!received) {
+                sent = false;
+                break;
+            }
+            CommandStats* stats = lane.steps[i].stats;
+            stats->latency.record(monotonic_ns() - sent_at);
+            stats->calls++;
+            if (reply.text.compare(0, 5, "ERROR") == 0) stats->errors++;
+            lane.answered = i + 1;
+        }
+        if (!sent) {
+            failures++;
+            break;
+        }
+    }
+    lane.answered = lane.steps.size();
+    close(fd);
+}
+
+static void print_row(const char* name, long calls, long errors, double seconds, const LatencyHistogram::Snapshot& snapshot) {
+    char line[200];
+    snprintf(line, sizeof(line), "  %-16s %10ld %8ld %12.0f %10.1f %10.1f %10.1f %10.1f", name, calls, errors,
+             calls / seconds, snapshot.quantile(0.50) / 1e3, snapshot.quantile(0.99) / 1e3,
+             snapshot.quantile(0.999) / 1e3, snapshot.largest / 1e3);
+    std::cout << line << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    ReplayConfig config;
+    for (int i = 2; i < argc; ++i) {
+        if (!parse_option(argv[i], config)) {
+            std::cerr << "Unknown or invalid option: " << argv[i] << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open trace " << argv[1] << std::endl;
+        return 1;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string trace = contents.str();
+
+    std::vector<std::unique_ptr<Lane>> lanes;
+    std::map<std::string, std::unique_ptr<CommandStats>> commands;
+    long records;
+    if (!load_trace(trace, lanes, commands, records)) {
+        std::cerr << argv[1] << " is not a tracker command trace" << std::endl;
+        return 1;
+    }
+    uint64_t span_ns = 0;
+    for (const std::unique_ptr<Lane>& lane : lanes) span_ns = std::max(span_ns, lane->steps.back().record.at_ns);
+
+    std::cout << "Replaying " << records << " command(s) on " << lanes.size() << " connection(s), recorded over "
+              << span_ns / 1e9 << " s, against " << config.host << ":" << config.port << " at ";
+    if (config.speed > 0) std::cout << config.speed << "x" << std::endl;
+    else std::cout << "max speed" << std::endl;
+
+    LatencyHistogram lag;
+    std::atomic<long> failures(0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t l = 0; l < lanes.size(); ++l) {
+        uint64_t first_at = lanes[l]->steps.front().record.at_ns;
+        if (config.speed > 0) std::this_thread::sleep_until(due_at(config, start, first_at));
+        for (size_t earlier = 0; earlier < l; ++earlier) {
+            // Nor before the commands recorded ahead of it are answered
+            const Lane& other = *lanes[earlier];
+            ReplayStep bound;
+            bound.record.at_ns = first_at;
+            size_t ahead = std::lower_bound(other.steps.begin(), other.steps.end(), bound,
+                                            [](const ReplayStep& a, const ReplayStep& b) { return a.record.at_ns < b.record.at_ns; }) -
+                           other.steps.begin();
+            while (other.answered.load() < ahead) std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        threads.push_back(std::thread(replay_lane, std::cref(config), std::ref(*lanes[l]), start, std::ref(lag), std::ref(failures)));
+    }
+    for (std::thread& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::unique_ptr<LatencyHistogram::Snapshot> snapshot(new LatencyHistogram::Snapshot);
+    std::unique_ptr<LatencyHistogram::Snapshot> all(new LatencyHistogram::Snapshot);
+    memset(all.get(), 0, sizeof(*all));
+    long calls = 0;
+    long errors = 0;
+
+    std::cout << "  Command               Calls   Errors        req/s     p50 us     p99 us    p999 us     max us" << std::endl;
+    for (const auto& command : commands) {
+        const CommandStats& stats = *command.second;
+        stats.latency.snapshot(*snapshot);
+        print_row(command.first.c_str(), stats.calls, stats.errors, seconds, *snapshot);
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) all->counts[i] += snapshot->counts[i];
+        all->count += snapshot->count;
+        all->total += snapshot->total;
+        all->largest = std::max(all->largest, snapshot->largest);
+        calls += stats.calls;
+        errors += stats.errors;
+    }
+    print_row("TOTAL", calls, errors, seconds, *all);
+
+    if (config.speed > 0) {
+        lag.snapshot(*snapshot);
+        char line[160];
+        snprintf(line, sizeof(line), "  Behind schedule: p50 %.1f us, p99 %.1f us, max %.1f us",
+                 snapshot->quantile(0.50) / 1e3, snapshot->quantile(0.99) / 1e3, snapshot->largest / 1e3);
+        std::cout << line << std::endl;
+    }
+    if (failures > 0) {
+        std::cerr << failures << " connection(s) failed; their remaining commands were not sent" << std::endl;
+        return 1;
+    }
+    return 0;
+}
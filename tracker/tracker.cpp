@@ -10,73 +10,247 @@
 #define BOLD    "\033[1m"
 #define MAGENTA "\033[35m"
 
-Tracker::Tracker(int port, int tracker_number)
-    : port(port), tracker_number(tracker_number), server_socket(-1), running(false) {
+// LSN of the last record logged by the command running on this thread
+static thread_local uint64_t request_lsn = 0;
+
+// Set while running a command relayed by a backup (it must not be relayed again)
+static thread_local bool forwarded_request = false;
+
+// Client connection the command running on this thread arrived on (for
+// SUBSCRIBE), and whether it frames its messages. NULL outside a connection.
+static thread_local const std::shared_ptr<Connection>* serving_connection = NULL;
+static thread_local bool serving_framed = false;
+
+static uint64_t lease_tick() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count() / LEASE_TICK_MS;
+}
+
+Tracker::Tracker(int port, int tracker_number, const TrackerConfig& config)
+    : port(port), tracker_number(tracker_number), server_socket(-1), config(config),
+      search_index(file_names), running(false), active_connections(0), last_lsn(0), records_since_snapshot(0), snapshot_requested(false),
+      snapshot_stopping(false), replicating(false), role(ROLE_PRIMARY), term(0), previous_term(0), promotion_lsn(0),
+      primary_number(tracker_number), applied_lsn(0), replication_stopping(false), lease_wheel(lease_tick()),
+      lease_stopping(false), started_at(std::chrono::steady_clock::now()), metrics_socket(-1), metrics_stopping(false),
+      events_published(0), events_sent(0), subscriber_count(0), next_connection_id(0), handoff_socket(-1),
+      handoff_peer(-1), handing_off(false), handed_over(false), local_changes(0), sharded(false), shard_stopping(false),
+      groups_moved_out(0), groups_moved_in(0) {
     signal(SIGPIPE, SIG_IGN);
+    Logger::instance().set_level(config.log_level);
+    Logger::instance().set_sample_rate(config.log_sample_every);
+    
+    groups_lock.track_waits(&lock_waits[LOCK_GROUP_DIRECTORY]);
+    for (int i = 0; i < USER_SHARDS; ++i) user_shards[i].lock.track_waits(&lock_waits[LOCK_USER_SHARD]);
+    for (int i = 0; i < FILE_SHARDS; ++i) file_shards[i].lock.track_waits(&lock_waits[LOCK_FILE_SHARD]);
+    user_names.track_waits(&lock_waits[LOCK_NAMES]);
+    group_names.track_waits(&lock_waits[LOCK_NAMES]);
+    file_names.track_waits(&lock_waits[LOCK_NAMES]);
+    search_index.track_waits(&lock_waits[LOCK_SEARCH]);
+    
+    memset(command_table, 0, sizeof(command_table));
+    register_command("CREATE_USER", &Tracker::handle_create_user, true);
+    register_command("LOGIN", &Tracker::handle_login, true);
+    register_command("CREATE_GROUP", &Tracker::handle_create_group, true, 2);
+    register_command("JOIN_GROUP", &Tracker::handle_join_group, true, 2);
+    register_command("LEAVE_GROUP", &Tracker::handle_leave_group, true, 2);
+    register_command("LIST_GROUPS", &Tracker::handle_list_groups, false);
+    register_command("LIST_REQUESTS", &Tracker::handle_list_requests, false, 2);
+    register_command("ACCEPT_REQUEST", &Tracker::handle_accept_request, true, 2);
+    register_command("LIST_FILES", &Tracker::handle_list_files, false, 2);
+    register_command("SEARCH", &Tracker::handle_search, false);
+    register_command("UPLOAD_FILE", &Tracker::handle_upload_file, true, 2);
+    register_command("DOWNLOAD_FILE", &Tracker::handle_download_file, false, 2);
+    register_command("LOGOUT", &Tracker::handle_logout, true);
+    register_command("HAVE", &Tracker::handle_have, true, 2);
+    register_command("STOP_SHARE", &Tracker::handle_stop_share, true, 2);
+    register_command("SUBSCRIBE", &Tracker::handle_subscribe, false, 2);
+    register_command("UNSUBSCRIBE", &Tracker::handle_unsubscribe, false, 2);
+    register_command("HEARTBEAT", &Tracker::handle_heartbeat, true);
+    register_command("STATS", &Tracker::handle_stats, false);
 }
 
 Tracker::~Tracker() {
     running = false;
+    work_cv.notify_all();
+    for (auto& worker : workers) {
+        if (worker.joinable()) worker.join();
+    }
+    for (auto& loop : io_loops) {
+        if (loop->thread.joinable()) loop->thread.join();
+        if (loop->epoll_fd != -1) close(loop->epoll_fd);
+    }
     if (server_socket != -1) {
         close(server_socket);
     }
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        snapshot_stopping = true;
+    }
+    snapshot_cv.notify_one();
+    if (snapshot_thread.joinable()) snapshot_thread.join();
+    replication_stopping = true;
+    if (replication_thread.joinable()) replication_thread.join();
+    shard_stopping = true;
+    if (shard_thread.joinable()) shard_thread.join();
+    lease_stopping = true;
+    if (lease_thread.joinable()) lease_thread.join();
+    metrics_stopping = true;
+    if (metrics_thread.joinable()) metrics_thread.join();
+    event_queue.stop();
+    if (event_thread.joinable()) event_thread.join();
+    if (metrics_socket != -1) close(metrics_socket);
+    if (handoff_socket != -1) close(handoff_socket);
+    if (handoff_peer != -1) close(handoff_peer);
+    if (trace.is_open() && trace.dropped_records() > 0) {
+        std::cerr << YELLOW << "⚠ Trace dropped " << trace.dropped_records() << " command(s) while the disk fell behind" << RESET << std::endl;
+    }
+    trace.close();
+    wal.close();
 }
 
 bool Tracker::initialize(const std::string& tracker_file) {
-    std::ifstream file(tracker_file);
-    if (!file.is_open()) {
-        std::cerr << RED << "Failed to open tracker info file: " << tracker_file << RESET << std::endl;
+    std::shared_ptr<ShardMap> map = std::make_shared<ShardMap>();
+    if (!read_shard_map(tracker_file, tracker_number, *map)) {
+        std::cerr << RED << "Failed to read tracker " << tracker_number << " from tracker info file: " << tracker_file << RESET << std::endl;
         return false;
     }
     
-    std::string line;
-    int current_tracker = 0;
-    while (std::getline(file, line)) {
-        if (!line.empty() && current_tracker != tracker_number) {
-            other_trackers.push_back(line);
-        }
-        current_tracker++;
+    // Replicas are the other trackers of our shard
+    for (const TrackerPeer& peer : map->shards[map->self].trackers) {
+        if (peer.number != tracker_number) other_trackers.push_back(peer);
     }
-    file.close();
+    this->tracker_file = tracker_file;
+    sharded = map->shards.size() > 1;
+    std::atomic_store(&shard_map, std::shared_ptr<const ShardMap>(map));
     
     std::cout << GREEN << "✓ Tracker " << tracker_number << " initialized on port " << port << RESET << std::endl;
     std::cout << BLUE << "ℹ Found " << other_trackers.size() << " other tracker(s)" << RESET << std::endl;
+    if (sharded) {
+        std::cout << BLUE << "ℹ Serving shard '" << map->shards[map->self].name << "' of " << map->shards.size() << RESET << std::endl;
+    }
+    
+    // A tracker already running on our port hands us its state and socket
+    if (!config.handoff_path.empty()) {
+        handoff_peer = handoff_connect(config.handoff_path);
+    }
+    if (handoff_peer >= 0) {
+        if (!take_over()) return false;
+    } else if (!config.data_dir.empty() && !recover()) {
+        return false;
+    }
+    
+    if (config.replication && !other_trackers.empty()) {
+        replicating = true;
+        if (handoff_peer < 0) {
+            load_term();
+            role = ROLE_STARTING;
+        }
+        replication_log.reset(last_lsn + 1);
+        replication_thread = std::thread(&Tracker::replication_loop, this);
+    }
+    
+    if (config.lease_seconds > 0) {
+        lease_thread = std::thread(&Tracker::lease_loop, this);
+    }
+    shard_thread = std::thread(&Tracker::shard_loop, this);
+    event_thread = std::thread(&Tracker::event_loop, this);
+    if (config.metrics_port > 0 && !start_metrics_server()) {
+        return false;
+    }
+    if (!config.trace_path.empty()) {
+        if (!trace.open(config.trace_path)) {
+            std::cerr << RED << "Failed to open trace file " << config.trace_path << ": " << strerror(errno) << RESET << std::endl;
+            return false;
+        }
+        std::cout << YELLOW << "📼 Recording client commands to " << config.trace_path << RESET << std::endl;
+    }
     return true;
 }
 
 void Tracker::run() {
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        std::cerr << RED << "Failed to create server socket" << RESET << std::endl;
-        return;
+    if (server_socket >= 0) {
+        // Inherited from the tracker we took over from, which may have made it non-blocking
+        int flags = fcntl(server_socket, F_GETFL, 0);
+        fcntl(server_socket, F_SETFL, flags & ~O_NONBLOCK);
+    } else {
+        server_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_socket < 0) {
+            std::cerr << RED << "Failed to create server socket" << RESET << std::endl;
+            return;
+        }
+        
+        int opt = 1;
+        setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        
+        struct sockaddr_in server_addr;
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = INADDR_ANY;
+        server_addr.sin_port = htons(port);
+        
+        if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            std::cerr << RED << "Failed to bind to port " << port << RESET << std::endl;
+            close(server_socket);
+            return;
+        }
+        
+        if (listen(server_socket, config.listen_backlog) < 0) {
+            std::cerr << RED << "Failed to listen on socket" << RESET << std::endl;
+            close(server_socket);
+            return;
+        }
     }
     
-    int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
-    
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        std::cerr << RED << "Failed to bind to port " << port << RESET << std::endl;
-        close(server_socket);
-        return;
+    if (!config.handoff_path.empty()) {
+        handoff_socket = handoff_listen(config.handoff_path);
+        if (handoff_socket < 0) {
+            std::cerr << RED << "Failed to listen for hot restarts at " << config.handoff_path << ": " << strerror(errno) << RESET << std::endl;
+            return;
+        }
     }
-    
-    if (listen(server_socket, 10) < 0) {
-        std::cerr << RED << "Failed to listen on socket" << RESET << std::endl;
-        close(server_socket);
+    if (handoff_peer >= 0 && !finish_take_over()) {
         return;
     }
     
     running = true;
     std::cout << BOLD << CYAN << "🚀 Tracker " << tracker_number << " running on port " << port << RESET << std::endl;
     std::cout << YELLOW << "💾 Ready to handle large file uploads (20GB+)" << RESET << std::endl;
+    
+    if (config.mode == MODE_REACTOR) {
+        run_reactor();
+    } else {
+        run_threaded();
+    }
+    if (handed_over) {
+        drain_connections();
+    }
+}
+
+// Replies are written whole, so Nagle only delays them: the second reply to a
+// pipelined batch would otherwise wait ~40ms for the client's delayed ACK.
+static void set_nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+void Tracker::run_threaded() {
     std::cout << YELLOW << "📡 Waiting for client connections..." << RESET << std::endl;
     
+    // Polled along with the hot restart socket: a handoff is served on this
+    // thread, so the socket is never handed away while accept() waits on it
+    struct pollfd listeners[2];
+    listeners[0].fd = server_socket;
+    listeners[0].events = POLLIN;
+    listeners[1].fd = handoff_socket;
+    listeners[1].events = POLLIN;
     while (running) {
+        listeners[0].revents = listeners[1].revents = 0;
+        if (poll(listeners, handoff_socket >= 0 ? 2 : 1, 1000) <= 0) continue;
+        if (listeners[1].revents & POLLIN) {
+            int peer = accept4(handoff_socket, NULL, NULL, SOCK_CLOEXEC);
+            if (peer >= 0 && hand_off(peer)) return;
+            continue;
+        }
+        
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
         int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
@@ -85,8 +259,9 @@ void Tracker::run() {
             char client_ip[INET_ADDRSTRLEN];
             inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
             int client_port = ntohs(client_addr.sin_port);
+            set_nodelay(client_socket);
             
-            std::cout << GREEN << "📞 New client connected: " << client_ip << ":" << client_port << RESET << std::endl;
+            TLOG(LOG_INFO, GREEN "📞 New client connected: %s:%d" RESET, client_ip, client_port);
             
             std::thread client_thread(&Tracker::handle_client, this, client_socket, std::string(client_ip), client_port);
             client_thread.detach();
@@ -94,572 +269,4664 @@ void Tracker::run() {
     }
 }
 
+// Thread-per-connection mode: the client's thread writes replies and the event
+// thread writes events, so both go through the connection's mutex. Events the
+// socket had no room for are sent first.
+static bool send_replies(Connection& conn, const std::string& replies) {
+    std::lock_guard<std::mutex> lock(conn.mutex);
+    if (!conn.out_buffer.empty()) {
+        if (!send_all(conn.fd, conn.out_buffer.data(), conn.out_buffer.size())) return false;
+        conn.out_buffer.clear();
+    }
+    return send_all(conn.fd, replies.data(), replies.size());
+}
+
+// The answer to a tracker-to-tracker frame from a connection that may not send one
+static void append_refusal(std::string& out) {
+    size_t mark = begin_frame(out, MSG_REPLY);
+    out += "ERROR: Only trackers of this cluster may send that\n";
+    end_frame(out, mark);
+}
+
 void Tracker::handle_client(int client_socket, const std::string& client_ip, int client_port) {
     const int LARGE_BUFFER_SIZE = 65536;            // 64KB buffer
     char* buffer = new char[LARGE_BUFFER_SIZE];
+    active_connections++;
+    std::shared_ptr<Connection> conn = std::make_shared<Connection>();
+    conn->fd = client_socket;
+    conn->id = next_connection_id++;
+    conn->ip = client_ip;
+    conn->port = client_port;
+    conn->loop_index = -1;
+    FrameDecoder decoder(MAX_COMMAND_SIZE);
+    Frame request;              // reused for every command on this connection
+    std::string replies;        // per-connection output buffer, keeps its capacity
     
     try {
-        while (true) {
-            ssize_t bytes_received = recv(client_socket, buffer, LARGE_BUFFER_SIZE - 1, 0);
+        bool connected = true;
+        while (connected) {
+            ssize_t bytes_received = recv(client_socket, buffer, LARGE_BUFFER_SIZE, 0);
             if (bytes_received <= 0) break;
             
-            buffer[bytes_received] = '\0';
-            std::string command(buffer);
+            // One recv() may hold a partial command or several complete ones
+            decoder.feed(buffer, bytes_received);
             
-            // Remove trailing newline
-            if (!command.empty() && command.back() == '\n') {
-                command.pop_back();
+            replies.clear();
+            bool subscribed = false;
+            bool refused = false;
+            while (!subscribed && !refused && decoder.next(request)) {
+                if (!admit_frame(*conn, request)) {
+                    refused = true;
+                } else if (request.type == MSG_CLUSTER) {
+                    continue;
+                } else if (request.type == MSG_REPLICATE && request.text.compare(0, 9, "SUBSCRIBE") == 0) {
+                    subscribed = true;
+                } else {
+                    trace_command(conn->id, request);
+                    serving_connection = &conn;
+                    serving_framed = decoder.is_framed();
+                    serve_frame(request, client_ip, client_port, decoder.is_framed(), replies);
+                    serving_connection = NULL;
+                }
             }
             
-            // Log command (truncated for large commands)
-            std::string log_command = command.length() > 100 ? 
-                command.substr(0, 100) + "... [" + std::to_string(command.length()) + " chars]" : command;
-            std::cout << BLUE << "📨 Command from " << client_ip << ": " << log_command << RESET << std::endl;
-            
-            std::string response = process_command(command, client_ip, client_port);
-            
-            if (send(client_socket, response.c_str(), response.length(), 0) <= 0) {
+            if (subscribed) {
+                // A backup tracker: this connection now carries its replication stream
+                if (replies.empty() || send_all(client_socket, replies.data(), replies.size())) {
+                    serve_backup(client_socket, request.text, client_ip);
+                }
                 break;
             }
             
-            std::string log_response = response.length() > 50 ? 
-                response.substr(0, 50) + "... [" + std::to_string(response.length()) + " chars]" : response;
-            std::cout << GREEN << "📤 Response sent: " << log_response << RESET << std::endl;
+            if (refused) {
+                TLOG(LOG_WARN, RED "❌ Tracker-only message from %s, which is not a tracker of this cluster" RESET, client_ip.c_str());
+                append_refusal(replies);
+                connected = false;
+            }
+            if (decoder.is_broken()) {
+                TLOG(LOG_WARN, RED "❌ Malformed or oversized message from %s" RESET, client_ip.c_str());
+                connected = false;
+            }
+            if (!replies.empty() && !send_replies(*conn, replies)) {
+                connected = false;
+            }
         }
     } catch (const std::exception& e) {
-        std::cout << RED << "❌ Error handling client " << client_ip << ": " << e.what() << RESET << std::endl;
+        TLOG(LOG_ERROR, RED "❌ Error handling client %s: %s" RESET, client_ip.c_str(), e.what());
     }
     
-    std::cout << YELLOW << "📞 Client disconnected: " << client_ip << ":" << client_port << RESET << std::endl;
+    TLOG(LOG_INFO, YELLOW "📞 Client disconnected: %s:%d" RESET, client_ip.c_str(), client_port);
     delete[] buffer;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        conn->fd = -1;
+    }
     close(client_socket);
+    end_subscriptions(conn);
+    active_connections--;
 }
 
-std::vector<std::string> Tracker::split_string(const std::string& str, char delimiter) {
-    std::vector<std::string> tokens;
-    std::stringstream ss(str);
-    std::string token;
-    while (std::getline(ss, token, delimiter)) {
-        tokens.push_back(token);
+void Tracker::execute_command(const char* data, size_t length, const std::string& client_ip, int client_port, std::string& out,
+                              const StrView& blob) {
+    // Log command (truncated for large commands)
+    if (length > 100) {
+        TLOG_SAMPLED(LOG_INFO, BLUE "📨 Command from %s: %.100s... [%zu chars]" RESET,
+                     client_ip.c_str(), data, length);
+    } else {
+        TLOG_SAMPLED(LOG_INFO, BLUE "📨 Command from %s: %.*s" RESET, client_ip.c_str(), (int)length, data);
     }
-    return tokens;
-}
-
-std::string Tracker::process_command(const std::string& command, const std::string& client_ip, int client_port) {
-    std::vector<std::string> tokens = split_string(command, ' ');
-    if (tokens.empty()) return "ERROR: Empty command\n";
-    
-    std::lock_guard<std::mutex> lock(tracker_mutex);
     
-    if (tokens[0] == "CREATE_USER") {
-        return handle_create_user(tokens);
-    } else if (tokens[0] == "LOGIN") {
-        return handle_login(tokens, client_ip, client_port);
-    } else if (tokens[0] == "CREATE_GROUP") {
-        return handle_create_group(tokens);
-    } else if (tokens[0] == "JOIN_GROUP") {
-        return handle_join_group(tokens);
-    } else if (tokens[0] == "LEAVE_GROUP") {
-        return handle_leave_group(tokens);
-    } else if (tokens[0] == "LIST_GROUPS") {
-        return handle_list_groups(tokens);
-    } else if (tokens[0] == "LIST_REQUESTS") {
-        return handle_list_requests(tokens);
-    } else if (tokens[0] == "ACCEPT_REQUEST") {
-        return handle_accept_request(tokens);
-    } else if (tokens[0] == "LIST_FILES") {
-        return handle_list_files(tokens);
-    } else if (tokens[0] == "UPLOAD_FILE") {
-        return handle_upload_file(tokens);
-    } else if (tokens[0] == "DOWNLOAD_FILE") {
-        return handle_download_file(tokens);
-    } else if (tokens[0] == "LOGOUT") {
-        return handle_logout(tokens);
+    size_t reply_start = out.size();
+    try {
+        process_command(data, length, blob, client_ip, client_port, out);
+    } catch (const std::exception& e) {
+        TLOG(LOG_ERROR, RED "❌ Error processing command from %s: %s" RESET, client_ip.c_str(), e.what());
+        out.resize(reply_start);
+        out += "ERROR: Malformed command\n";
     }
     
-    return "ERROR: Unknown command\n";
+    const char* response = out.data() + reply_start;
+    size_t response_length = out.size() - reply_start;
+    if (response_length > 50) {
+        TLOG_SAMPLED(LOG_INFO, GREEN "📤 Response sent: %.50s... [%zu chars]" RESET, response, response_length);
+    } else {
+        int shown = (response_length > 0 && response[response_length - 1] == '\n') ? response_length - 1 : response_length;
+        TLOG_SAMPLED(LOG_INFO, GREEN "📤 Response sent: %.*s" RESET, shown, response);
+    }
 }
 
-std::string Tracker::handle_create_user(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 3) {
-        return "ERROR: Invalid CREATE_USER command\n";
-    }
-    
-    std::string user_id = tokens[1];
-    std::string password = tokens[2];
-    
-    if (users.find(user_id) != users.end()) {
-        return "ERROR: User already exists\n";
+// Only commands from clients: forwarded commands were traced where they arrived.
+void Tracker::trace_command(uint64_t connection, const Frame& request) {
+    if (trace.is_open() && request.type == MSG_COMMAND) {
+        trace.record(connection, request.text, request.blob);
     }
-    
-    User user;
-    user.user_id = user_id;
-    user.password = password;
-    user.online = false;
-    users[user_id] = user;
-    
-    std::cout << GREEN << "✓ User created: " << user_id << RESET << std::endl;
-    return "SUCCESS: User created\n";
 }
 
-std::string Tracker::handle_login(const std::vector<std::string>& tokens, const std::string& client_ip, int client_port) {
-    (void)client_ip;
-    (void)client_port;
-    
-    if (tokens.size() < 5) {
-        return "ERROR: Invalid LOGIN command\n";
-    }
-    
-    std::string user_id = tokens[1];
-    std::string password = tokens[2];
-    std::string ip = tokens[3];
-    int port = std::stoi(tokens[4]);
-    
-    std::cout << BLUE << "📝 Login attempt: " << user_id << " from " << ip << ":" << port << RESET << std::endl;
-    
-    if (users.find(user_id) == users.end()) {
-        return "ERROR: User not found\n";
-    }
-    
-    if (users[user_id].password != password) {
-        return "ERROR: Invalid password\n";
+// Tracker-to-tracker frames come only from trackers of this cluster (see
+// replication.h). Consumes MSG_CLUSTER. False: refuse and close the connection.
+bool Tracker::admit_frame(Connection& conn, const Frame& frame) {
+    if (frame.type == MSG_CLUSTER) {
+        const std::string& key = config.cluster_key;
+        unsigned char differs = key.empty() || frame.text.size() != key.size();
+        for (size_t i = 0; i < key.size() && i < frame.text.size(); ++i) {
+            differs |= key[i] ^ frame.text[i];
+        }
+        conn.cluster_peer = differs == 0;
+        return conn.cluster_peer;
     }
-    
-    users[user_id].online = true;
-    users[user_id].ip = ip;
-    users[user_id].port = port;
-    
-    std::cout << GREEN << "✓ " << user_id << " logged in successfully at " << ip << ":" << port << RESET << std::endl;
-    return "SUCCESS: Login successful\n";
+    if (frame.type != MSG_REPLICATE && frame.type != MSG_FORWARD && frame.type != MSG_MIGRATE) return true;
+    if (conn.cluster_peer) return true;
+    return config.cluster_key.empty() && is_tracker_address(conn.ip);
 }
 
-std::string Tracker::handle_create_group(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 3) {
-        return "ERROR: Invalid CREATE_GROUP command\n";
-    }
-    
-    std::string user_id = tokens[1];
-    std::string group_id = tokens[2];
-    
-    if (users.find(user_id) == users.end() || !users[user_id].online) {
-        return "ERROR: User not logged in\n";
-    }
-    
-    if (groups.find(group_id) != groups.end()) {
-        return "ERROR: Group already exists\n";
+bool Tracker::is_tracker_address(const std::string& ip) {
+    std::shared_ptr<const ShardMap> map = current_shards();
+    for (const Shard& shard : map->shards) {
+        for (const TrackerPeer& peer : shard.trackers) {
+            if (peer.ip == ip) return true;
+        }
     }
-    
-    Group group;
-    group.group_id = group_id;
-    group.owner = user_id;
-    group.members.insert(user_id);
-    groups[group_id] = group;
-    users[user_id].groups.insert(group_id);
-    
-    std::cout << GREEN << "✓ Group created: " << group_id << " by " << user_id << RESET << std::endl;
-    return "SUCCESS: Group created\n";
+    return false;
 }
 
-std::string Tracker::handle_join_group(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 3) {
-        return "ERROR: Invalid JOIN_GROUP command\n";
-    }
-    
-    std::string user_id = tokens[1];
-    std::string group_id = tokens[2];
-    
-    if (users.find(user_id) == users.end() || !users[user_id].online) {
-        return "ERROR: User not logged in\n";
+// Connects to another tracker, opening with the cluster key if there is one.
+int Tracker::connect_tracker(const std::string& ip, int port) {
+    int fd = connect_with_timeout(ip, port, REPL_CONNECT_TIMEOUT_MS);
+    if (fd >= 0 && !config.cluster_key.empty() && !send_frame(fd, MSG_CLUSTER, config.cluster_key)) {
+        close(fd);
+        return -1;
     }
-    
-    if (groups.find(group_id) == groups.end()) {
-        return "ERROR: Group not found\n";
-    }
-    
-    if (groups[group_id].members.find(user_id) != groups[group_id].members.end()) {
-        return "ERROR: Already a member\n";
-    }
-    
-    groups[group_id].pending_requests.insert(user_id);
-    return "SUCCESS: Join request sent\n";
+    return fd;
 }
 
-std::string Tracker::handle_leave_group(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 3) {
-        return "ERROR: Invalid LEAVE_GROUP command\n";
-    }
-    
-    std::string user_id = tokens[1];
-    std::string group_id = tokens[2];
-    
-    if (users.find(user_id) == users.end() || !users[user_id].online) {
-        return "ERROR: User not logged in\n";
-    }
-    
-    if (groups.find(group_id) == groups.end()) {
-        return "ERROR: Group not found\n";
-    }
-    
-    if (groups[group_id].members.find(user_id) == groups[group_id].members.end()) {
-        return "ERROR: Not a member\n";
-    }
-    
-    groups[group_id].members.erase(user_id);
-    users[user_id].groups.erase(group_id);
-    
-    if (groups[group_id].owner == user_id && !groups[group_id].members.empty()) {
-        groups[group_id].owner = *groups[group_id].members.begin();
+void Tracker::serve_frame(const Frame& request, const std::string& client_ip, int client_port, bool framed, std::string& out) {
+    StrView blob(request.blob.data(), request.blob.size());
+    if (request.type == MSG_REPLICATE) {
+        size_t mark = begin_frame(out, MSG_REPLICATE);
+        describe_role(out);
+        end_frame(out, mark);
+    } else if (request.type == MSG_MIGRATE) {
+        size_t mark = begin_frame(out, MSG_MIGRATE);
+        import_records(request, out);
+        end_frame(out, mark);
+    } else if (request.type == MSG_FORWARD) {
+        // Reply text plus, as the blob, the LSN the backup must apply before answering
+        size_t mark = begin_frame(out, MSG_REPLY);
+        out[mark + 3] = static_cast<char>(FRAME_FLAG_BLOB);
+        size_t text_at = out.size();
+        put_u32(out, 0);
+        
+        forwarded_request = true;
+        request_lsn = 0;
+        execute_command(request.text.data(), request.text.size(), client_ip, client_port, out, blob);
+        forwarded_request = false;
+        
+        uint32_t text_length = htonl(out.size() - text_at - 4);
+        memcpy(&out[text_at], &text_length, sizeof(text_length));
+        put_u64(out, request_lsn);
+        end_frame(out, mark);
+    } else if (framed) {
+        size_t mark = begin_frame(out, MSG_REPLY);
+        execute_command(request.text.data(), request.text.size(), client_ip, client_port, out, blob);
+        end_frame(out, mark);
+    } else {
+        execute_command(request.text.data(), request.text.size(), client_ip, client_port, out);
     }
-    
-    return "SUCCESS: Left group\n";
 }
 
-std::string Tracker::handle_list_groups(const std::vector<std::string>& tokens) {
-    (void)tokens;
-    
-    if (groups.empty()) {
-        return "No groups available\n";
-    }
-    
-    std::string result;
-    for (const auto& group : groups) {
-        result += group.first + " (Owner: " + group.second.owner +
-                  ", Members: " + std::to_string(group.second.members.size()) + ")\n";
-    }
-    return result;
+//=================================================================================================
+// EPOLL REACTOR
+//=================================================================================================
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
 }
 
-std::string Tracker::handle_list_requests(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 3) {
-        return "ERROR: Invalid LIST_REQUESTS command\n";
-    }
-    
-    std::string user_id = tokens[1];
-    std::string group_id = tokens[2];
-    
-    if (users.find(user_id) == users.end() || !users[user_id].online) {
-        return "ERROR: User not logged in\n";
-    }
-    
-    if (groups.find(group_id) == groups.end()) {
-        return "ERROR: Group not found\n";
-    }
-    
-    if (groups[group_id].owner != user_id) {
-        return "ERROR: Not group owner\n";
-    }
-    
-    if (groups[group_id].pending_requests.empty()) {
-        return "No pending requests\n";
-    }
-    
-    std::string result;
-    for (const auto& request : groups[group_id].pending_requests) {
-        result += request + "\n";
+// Writes as much of out_buffer as the socket accepts, without blocking even on
+// a thread-per-connection socket. Caller holds conn->mutex.
+// Returns false when the connection is broken.
+static bool drain_output(Connection& conn) {
+    size_t written = 0;
+    while (written < conn.out_buffer.size()) {
+        ssize_t n = send(conn.fd, conn.out_buffer.data() + written, conn.out_buffer.size() - written, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            written += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return false;
+        }
     }
-    return result;
+    conn.out_buffer.erase(0, written);
+    return true;
 }
 
-std::string Tracker::handle_accept_request(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 4) {
-        return "ERROR: Invalid ACCEPT_REQUEST command\n";
-    }
-    
-    std::string owner_id = tokens[1];
-    std::string group_id = tokens[2];
-    std::string user_id = tokens[3];
-    
-    if (users.find(owner_id) == users.end() || !users[owner_id].online) {
-        return "ERROR: Owner not logged in\n";
-    }
-    
-    if (groups.find(group_id) == groups.end()) {
-        return "ERROR: Group not found\n";
-    }
-    
-    if (groups[group_id].owner != owner_id) {
-        return "ERROR: Not group owner\n";
-    }
-    
-    if (groups[group_id].pending_requests.find(user_id) == groups[group_id].pending_requests.end()) {
-        return "ERROR: No pending request from user\n";
+static void append_reply(Connection& conn, const char* response, size_t length) {
+    if (conn.decoder.is_framed()) {
+        size_t mark = begin_frame(conn.out_buffer, MSG_REPLY);
+        conn.out_buffer.append(response, length);
+        end_frame(conn.out_buffer, mark);
+    } else {
+        conn.out_buffer.append(response, length);
     }
-    
-    groups[group_id].pending_requests.erase(user_id);
-    groups[group_id].members.insert(user_id);
-    users[user_id].groups.insert(group_id);
-    
-    return "SUCCESS: Request accepted\n";
 }
 
-std::string Tracker::handle_list_files(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 3) {
-        return "ERROR: Invalid LIST_FILES command\n";
+static void arm_events(int epoll_fd, Connection& conn, bool want_write) {
+    if (conn.want_write == want_write) return;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (want_write) ev.events |= EPOLLOUT;
+    ev.data.fd = conn.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+    conn.want_write = want_write;
+}
+
+void Tracker::run_reactor() {
+    if (!set_nonblocking(server_socket)) {
+        std::cerr << RED << "Failed to make listening socket non-blocking" << RESET << std::endl;
+        return;
     }
     
-    std::string user_id = tokens[1];
-    std::string group_id = tokens[2];
+    int io_count = std::max(1, config.io_threads);
+    int worker_count = std::max(1, config.worker_threads);
     
-    if (users.find(user_id) == users.end() || !users[user_id].online) {
-        return "ERROR: User not logged in\n";
+    for (int i = 0; i < io_count; ++i) {
+        std::unique_ptr<IoLoop> loop(new IoLoop());
+        loop->epoll_fd = epoll_create1(0);
+        if (loop->epoll_fd < 0) {
+            std::cerr << RED << "Failed to create epoll instance" << RESET << std::endl;
+            running = false;
+            return;
+        }
+        io_loops.push_back(std::move(loop));
     }
-    
-    if (groups.find(group_id) == groups.end()) {
-        return "ERROR: Group not found\n";
+    for (auto& loop : io_loops) {
+        loop->thread = std::thread(&Tracker::io_loop, this, loop.get());
     }
-    
-    if (groups[group_id].members.find(user_id) == groups[group_id].members.end()) {
-        return "ERROR: Not a group member\n";
+    for (int i = 0; i < worker_count; ++i) {
+        workers.push_back(std::thread(&Tracker::worker_loop, this));
     }
     
-    if (groups[group_id].shared_files.empty()) {
-        return "No files shared in this group\n";
+    std::cout << YELLOW << "⚡ Reactor mode: " << io_count << " I/O thread(s), " << worker_count
+              << " worker(s), backlog " << config.listen_backlog << ", idle timeout "
+              << config.idle_timeout_seconds << "s" << RESET << std::endl;
+    std::cout << YELLOW << "📡 Waiting for client connections..." << RESET << std::endl;
+    
+    int accept_epoll = epoll_create1(0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = server_socket;
+    epoll_ctl(accept_epoll, EPOLL_CTL_ADD, server_socket, &ev);
+    if (handoff_socket >= 0) {
+        ev.data.fd = handoff_socket;
+        epoll_ctl(accept_epoll, EPOLL_CTL_ADD, handoff_socket, &ev);
     }
     
-    std::string result;
-    for (const auto& file : groups[group_id].shared_files) {
-        result += file.first + " (Shared by: ";
-        for (size_t i = 0; i < file.second.size(); ++i) {
-            if (i > 0) result += ", ";
-            result += file.second[i];
+    while (running) {
+        struct epoll_event ready;
+        int n = epoll_wait(accept_epoll, &ready, 1, 1000);
+        if (n <= 0) continue;
+        if (ready.data.fd == handoff_socket) {
+            int peer = accept4(handoff_socket, NULL, NULL, SOCK_CLOEXEC);
+            if (peer >= 0 && hand_off(peer)) break;
+            continue;
+        }
+        
+        // Drain the whole accept queue in one wakeup
+        while (true) {
+            struct sockaddr_in client_addr;
+            socklen_t client_len = sizeof(client_addr);
+            int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
+            if (client_socket < 0) break;
+            
+            char client_ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+            register_connection(client_socket, client_ip, ntohs(client_addr.sin_port));
         }
-        result += ")\n";
     }
-    return result;
+    close(accept_epoll);
 }
 
-std::string Tracker::handle_upload_file(const std::vector<std::string>& tokens) {
-    std::cout << BOLD << MAGENTA << "📤 LARGE FILE UPLOAD REQUEST" << RESET << std::endl;
-    std::cout << BLUE << "📤 Upload request received with " << tokens.size() << " tokens" << RESET << std::endl;
-    
-    if (tokens.size() < 7) {
-        std::cout << RED << "❌ Invalid token count: " << tokens.size() << RESET << std::endl;
-        return "ERROR: Invalid UPLOAD_FILE command - insufficient parameters\n";
-    }
-    
-    std::string user_id = tokens[1];
-    std::string group_id = tokens[2];
-    std::string filename = tokens[3];
-    std::string file_hash = tokens[4];
-    std::string piece_hashes_str = tokens[5];
-    
-    long file_size;
-    try {
-        file_size = std::stol(tokens[6]);
-    } catch (const std::exception& e) {
-        std::cout << RED << "❌ Invalid file size: " << tokens[6] << RESET << std::endl;
-        return "ERROR: Invalid file size\n";
-    }
-    
-    // Calculate file size in different units for display
-    double file_size_mb = file_size / (1024.0 * 1024.0);
-    double file_size_gb = file_size_mb / 1024.0;
-    
-    std::cout << BOLD << CYAN << "📤 LARGE FILE UPLOAD DETAILS:" << RESET << std::endl;
-    std::cout << "   👤 User: " << user_id << std::endl;
-    std::cout << "   👥 Group: " << group_id << std::endl;
-    std::cout << "   📁 File: " << filename << std::endl;
-    std::cout << "   📊 Size: " << file_size << " bytes";
-    
-    if (file_size_gb >= 1.0) {
-        std::cout << " (" << std::fixed << std::setprecision(2) << file_size_gb << " GB)" << std::endl;
-    } else {
-        std::cout << " (" << std::fixed << std::setprecision(2) << file_size_mb << " MB)" << std::endl;
-    }
-    
-    std::cout << "   🔐 Hash: " << file_hash.substr(0, 16) << "..." << std::endl;
-    std::cout << "   🧩 Piece hashes length: " << piece_hashes_str.length() << " chars" << std::endl;
-    
-    // Estimate number of pieces
-    const long PIECE_SIZE = 524288;     // 512KB
-    long estimated_pieces = (file_size + PIECE_SIZE - 1) / PIECE_SIZE;
-    std::cout << "   🧩 Estimated pieces: " << estimated_pieces << std::endl;
-    
-    // Validate user and group
-    if (users.find(user_id) == users.end() || !users[user_id].online) {
-        std::cout << RED << "❌ User not logged in: " << user_id << RESET << std::endl;
-        return "ERROR: User not logged in\n";
+void Tracker::register_connection(int client_socket, const std::string& client_ip, int client_port) {
+    if (!set_nonblocking(client_socket)) {
+        close(client_socket);
+        return;
     }
+    set_nodelay(client_socket);
     
-    if (groups.find(group_id) == groups.end()) {
-        std::cout << RED << "❌ Group not found: " << group_id << RESET << std::endl;
-        return "ERROR: Group not found\n";
-    }
+    static std::atomic<unsigned> next_loop(0);
+    int loop_index = next_loop++ % io_loops.size();
+    IoLoop* loop = io_loops[loop_index].get();
     
-    if (groups[group_id].members.find(user_id) == groups[group_id].members.end()) {
-        std::cout << RED << "❌ User not in group: " << user_id << RESET << std::endl;
-        return "ERROR: Not a group member\n";
-    }
+    std::shared_ptr<Connection> conn = std::make_shared<Connection>();
+    conn->fd = client_socket;
+    conn->loop_index = loop_index;
+    conn->ip = client_ip;
+    conn->port = client_port;
+    conn->id = next_connection_id++;
+    conn->last_active = std::chrono::steady_clock::now();
     
-    // Add file to group's shared files
-    if (groups[group_id].shared_files.find(filename) == groups[group_id].shared_files.end()) {
-        groups[group_id].shared_files[filename] = std::vector<std::string>();
+    {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        loop->connections[client_socket] = conn;
     }
+    active_connections++;
     
-    // Add user to the list of users who have this file (avoid duplicates)
-    auto& file_users = groups[group_id].shared_files[filename];
-    if (std::find(file_users.begin(), file_users.end(), user_id) == file_users.end()) {
-        file_users.push_back(user_id);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = client_socket;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) < 0) {
+        close_connection(loop, conn);
+        return;
     }
     
-    // Store file entry with optimized hash handling
-    FileEntry file_entry;
-    file_entry.filename = filename;
-    file_entry.file_hash = file_hash;
-    file_entry.file_size = file_size;
-    file_entry.owner = user_id;
-    file_entry.group_id = group_id;
+    TLOG(LOG_INFO, GREEN "📞 New client connected: %s:%d" RESET, client_ip.c_str(), client_port);
+}
+
+void Tracker::io_loop(IoLoop* loop) {
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+    auto last_reap = std::chrono::steady_clock::now();
     
-    // Parse piece hashes intelligently
-    try {
-        bool is_truncated = piece_hashes_str.find("TRUNCATED") != std::string::npos;
+    while (running) {
+        int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, 1000);
         
-        if (is_truncated) {
-            std::string clean_hashes = piece_hashes_str;
-            size_t truncated_pos = clean_hashes.find("TRUNCATED");
-            if (truncated_pos != std::string::npos) {
-                clean_hashes = clean_hashes.substr(0, truncated_pos);
+        for (int i = 0; i < n; ++i) {
+            std::shared_ptr<Connection> conn;
+            {
+                std::lock_guard<std::mutex> lock(loop->mutex);
+                auto it = loop->connections.find(events[i].data.fd);
+                if (it == loop->connections.end()) continue;
+                conn = it->second;
             }
             
-            // Parse available hashes (8 characters each)
-            for (size_t i = 0; i < clean_hashes.length(); i += 8) {
-                if (i + 8 <= clean_hashes.length()) {
-                    file_entry.piece_hashes.push_back(clean_hashes.substr(i, 8));
-                }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                on_readable(loop, conn);
             }
-            
-            std::cout << YELLOW << "⚠ Hash info truncated. Stored " << file_entry.piece_hashes.size() 
-                      << " piece hashes out of " << estimated_pieces << " total pieces" << RESET << std::endl;
-        } else {
-            // Check hash length to determine format
-            if (piece_hashes_str.length() % 8 == 0) {
-                // 8-character hashes
-                for (size_t i = 0; i < piece_hashes_str.length(); i += 8) {
-                    file_entry.piece_hashes.push_back(piece_hashes_str.substr(i, 8));
-                }
-            } else if (piece_hashes_str.length() % 20 == 0) {
-                // 20-character hashes (legacy format)
-                for (size_t i = 0; i < piece_hashes_str.length(); i += 20) {
-                    file_entry.piece_hashes.push_back(piece_hashes_str.substr(i, 20));
-                }
-            } else {
-                // Flexible parsing - try to extract what we can
-                std::cout << YELLOW << "⚠ Non-standard hash format, using flexible parsing" << RESET << std::endl;
-                
-                for (size_t i = 0; i < piece_hashes_str.length(); i += 8) {
-                    if (i + 8 <= piece_hashes_str.length()) {
-                        file_entry.piece_hashes.push_back(piece_hashes_str.substr(i, 8));
-                    }
-                }
+            if (events[i].events & EPOLLOUT) {
+                flush_connection(loop, conn);
             }
         }
-    } catch (const std::exception& e) {
-        std::cout << RED << "❌ Error parsing piece hashes: " << e.what() << RESET << std::endl;
-        return "ERROR: Failed to parse piece hashes\n";
-    }
-    
-    files[file_hash] = file_entry;
-    
-    // Success message with detailed stats
-    std::cout << BOLD << GREEN << "✅ LARGE FILE UPLOAD SUCCESSFUL:" << RESET << std::endl;
-    std::cout << GREEN << "   📁 File: " << filename << RESET << std::endl;
-    std::cout << GREEN << "   📊 Size: ";
-    if (file_size_gb >= 1.0) {
-        std::cout << std::fixed << std::setprecision(2) << file_size_gb << " GB";
-    } else {
-        std::cout << std::fixed << std::setprecision(2) << file_size_mb << " MB";
+        
+        auto now = std::chrono::steady_clock::now();
+        if (config.idle_timeout_seconds > 0 && now - last_reap >= std::chrono::seconds(1)) {
+            reap_idle_connections(loop);
+            last_reap = now;
+        }
     }
-    std::cout << " (" << file_size << " bytes)" << RESET << std::endl;
-    std::cout << GREEN << "   🧩 Piece hashes stored: " << file_entry.piece_hashes.size() << RESET << std::endl;
-    std::cout << GREEN << "   🧩 Estimated total pieces: " << estimated_pieces << RESET << std::endl;
-    std::cout << GREEN << "   👥 Available in group: " << group_id << RESET << std::endl;
-    
-    return "SUCCESS: Large file uploaded successfully\n";
 }
 
-std::string Tracker::handle_download_file(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 4) {
-        return "ERROR: Invalid DOWNLOAD_FILE command\n";
-    }
+void Tracker::on_readable(IoLoop* loop, const std::shared_ptr<Connection>& conn) {
+    char chunk[READ_CHUNK_SIZE];
+    bool peer_closed = false;
     
-    std::string user_id = tokens[1];
-    std::string group_id = tokens[2];
-    std::string filename = tokens[3];
+    std::unique_lock<std::mutex> lock(conn->mutex);
+    if (conn->fd < 0) return;
     
-    std::cout << BLUE << "📥 Download request for " << filename << " from " << user_id << RESET << std::endl;
-    
-    if (users.find(user_id) == users.end() || !users[user_id].online) {
-        return "ERROR: User not logged in\n";
+    while (true) {
+        ssize_t n = recv(conn->fd, chunk, sizeof(chunk), 0);
+        if (n > 0) {
+            conn->decoder.feed(chunk, n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            peer_closed = true;
+            break;
+        }
     }
+    conn->last_active = std::chrono::steady_clock::now();
     
-    if (groups.find(group_id) == groups.end()) {
-        return "ERROR: Group not found\n";
+    // A partial command stays buffered in the decoder until the rest arrives
+    bool subscribed = false;
+    bool refused = false;
+    while (conn->decoder.next(conn->pending.next_slot())) {
+        const Frame& frame = conn->pending.next_slot();
+        if (!admit_frame(*conn, frame)) {
+            refused = true;
+            break;
+        }
+        if (frame.type == MSG_CLUSTER) continue;
+        if (frame.type == MSG_REPLICATE && frame.text.compare(0, 9, "SUBSCRIBE") == 0) {
+            subscribed = true;
+            break;
+        }
+        trace_command(conn->id, frame);
+        conn->pending.commit();
     }
     
-    if (groups[group_id].members.find(user_id) == groups[group_id].members.end()) {
-        return "ERROR: Not a group member\n";
+    if (subscribed && !peer_closed) {
+        // A backup tracker: hand the socket to a dedicated streaming thread
+        std::string subscribe = conn->pending.next_slot().text;
+        std::string backup_ip = conn->ip;
+        lock.unlock();
+        int fd = detach_connection(loop, conn);
+        if (fd >= 0) {
+            std::thread([this, fd, subscribe, backup_ip]() {
+                serve_backup(fd, subscribe, backup_ip);
+                close(fd);
+            }).detach();
+        }
+        return;
     }
     
-    if (groups[group_id].shared_files.find(filename) == groups[group_id].shared_files.end()) {
-        return "ERROR: File not found in group\n";
+    if (refused) {
+        // Commands decoded before it are dropped along with the connection
+        TLOG(LOG_WARN, RED "❌ Tracker-only message from %s, which is not a tracker of this cluster" RESET, conn->ip.c_str());
+        append_refusal(conn->out_buffer);
+        drain_output(*conn);
+        peer_closed = true;
+    }
+    if (conn->decoder.is_broken()) {
+        TLOG(LOG_WARN, RED "❌ Malformed or oversized message from %s, dropping connection" RESET, conn->ip.c_str());
+        peer_closed = true;
     }
     
-    // Build peer list with correct format
-    std::string result = "PEERS: ";
-    int peer_count = 0;
+    if (peer_closed) {
+        // A worker still running a command for this connection sees fd == -1
+        // when it finishes and simply drops the reply.
+        lock.unlock();
+        close_connection(loop, conn);
+        return;
+    }
     
-    for (const auto& peer_id : groups[group_id].shared_files[filename]) {
-        auto user_it = users.find(peer_id);
-        if (user_it != users.end() && user_it->second.online) {
-            // Format: IP PORT USERNAME (space-separated)
-            result += user_it->second.ip + " " + std::to_string(user_it->second.port) + " " + peer_id + " ";
-            peer_count++;
-            
-            std::cout << GREEN << "✓ Added peer: " << peer_id
-                      << " (" << user_it->second.ip << ":" << user_it->second.port << ")"
-                      << RESET << std::endl;
+    if (!conn->busy && !conn->pending.empty()) {
+        if (submit_work(conn)) {
+            conn->busy = true;
         } else {
-            std::cout << YELLOW << "⚠ Peer offline: " << peer_id << RESET << std::endl;
+            // Worker queue full: shed load instead of queueing without bound
+            static const char BUSY_REPLY[] = "ERROR: Tracker busy, retry later\n";
+            for (size_t i = 0; i < conn->pending.size(); ++i) {
+                append_reply(*conn, BUSY_REPLY, sizeof(BUSY_REPLY) - 1);
+            }
+            conn->pending.clear();
+            if (!drain_output(*conn)) {
+                lock.unlock();
+                close_connection(loop, conn);
+                return;
+            }
+            arm_events(loop->epoll_fd, *conn, !conn->out_buffer.empty());
         }
     }
+}
+
+void Tracker::flush_connection(IoLoop* loop, const std::shared_ptr<Connection>& conn) {
+    std::unique_lock<std::mutex> lock(conn->mutex);
+    if (conn->fd < 0) return;
     
-    if (peer_count == 0) {
-        return "ERROR: No online peers available\n";
+    if (!drain_output(*conn)) {
+        lock.unlock();
+        close_connection(loop, conn);
+        return;
     }
-    
-    // Remove trailing space and add newline
-    if (!result.empty() && result.back() == ' ') {
-        result.pop_back();
+    arm_events(loop->epoll_fd, *conn, !conn->out_buffer.empty());
+}
+
+void Tracker::close_connection(IoLoop* loop, const std::shared_ptr<Connection>& conn) {
+    {
+        std::lock_guard<std::mutex> loop_lock(loop->mutex);
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        if (conn->fd < 0) return;
+        
+        auto it = loop->connections.find(conn->fd);
+        if (it != loop->connections.end() && it->second == conn) {
+            loop->connections.erase(it);
+        }
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->fd = -1;
+        conn->pending.clear();
+        active_connections--;
     }
-    result += "\n";
+    end_subscriptions(conn);
     
-    std::cout << CYAN << "📤 Sending " << peer_count << " peer(s) for " << filename << RESET << std::endl;
-    return result;
+    TLOG(LOG_INFO, YELLOW "📞 Client disconnected: %s:%d" RESET, conn->ip.c_str(), conn->port);
 }
 
-std::string Tracker::handle_logout(const std::vector<std::string>& tokens) {
-    if (tokens.size() < 2) {
-        return "ERROR: Invalid LOGOUT command\n";
-    }
+// Takes a connection out of the reactor without closing it; returns its fd.
+int Tracker::detach_connection(IoLoop* loop, const std::shared_ptr<Connection>& conn) {
+    std::lock_guard<std::mutex> loop_lock(loop->mutex);
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    int fd = conn->fd;
+    if (fd < 0) return -1;
     
-    std::string user_id = tokens[1];
-    if (users.find(user_id) != users.end()) {
-        users[user_id].online = false;
-        std::cout << YELLOW << "👋 User logged out: " << user_id << RESET << std::endl;
+    auto it = loop->connections.find(fd);
+    if (it != loop->connections.end() && it->second == conn) {
+        loop->connections.erase(it);
     }
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    conn->fd = -1;
+    conn->pending.clear();
+    active_connections--;
     
-    return "SUCCESS: Logged out\n";
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    return fd;
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <tracker_info.txt> <tracker_number>" << std::endl;
-        return 1;
-    }
+void Tracker::reap_idle_connections(IoLoop* loop) {
+    auto deadline = std::chrono::steady_clock::now() - std::chrono::seconds(config.idle_timeout_seconds);
+    std::vector<std::shared_ptr<Connection>> idle;
     
-    std::string tracker_file(argv[1]);
+    {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        for (const auto& entry : loop->connections) {
+            Connection& conn = *entry.second;
+            std::lock_guard<std::mutex> conn_lock(conn.mutex);
+            if (!conn.busy && !conn.subscribed && conn.pending.empty() && conn.out_buffer.empty() &&
+                conn.last_active < deadline) {
+                idle.push_back(entry.second);
+            }
+        }
+    }
+    
+    for (const auto& conn : idle) {
+        TLOG(LOG_INFO, YELLOW "⏱ Reaping idle connection %s:%d" RESET, conn->ip.c_str(), conn->port);
+        close_connection(loop, conn);
+    }
+}
+
+bool Tracker::submit_work(const std::shared_ptr<Connection>& conn) {
+    {
+        std::lock_guard<std::mutex> lock(work_mutex);
+        if (work_queue.size() >= config.worker_queue_limit) {
+            return false;
+        }
+        work_queue.push_back(conn);
+    }
+    work_cv.notify_one();
+    return true;
+}
+
+void Tracker::worker_loop() {
+    // Reused across requests so the steady-state path does not allocate
+    Frame request;
+    std::string reply;
+    bool framed = false;
+    
+    while (running) {
+        std::shared_ptr<Connection> conn;
+        {
+            std::unique_lock<std::mutex> lock(work_mutex);
+            work_cv.wait(lock, [this]() { return !running || !work_queue.empty(); });
+            if (!running) return;
+            conn = work_queue.front();
+            work_queue.pop_front();
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            if (conn->fd < 0 || conn->pending.empty()) {
+                conn->busy = false;
+                continue;
+            }
+            // Swap rather than copy: both sides keep their buffers
+            Frame& queued = conn->pending.front();
+            request.type = queued.type;
+            request.flags = queued.flags;
+            request.text.swap(queued.text);
+            request.blob.swap(queued.blob);
+            conn->pending.pop();
+            framed = conn->decoder.is_framed();
+        }
+        
+        reply.clear();
+        serving_connection = &conn;
+        serving_framed = framed;
+        serve_frame(request, conn->ip, conn->port, framed, reply);
+        serving_connection = NULL;
+        
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        if (conn->fd < 0) {
+            conn->busy = false;
+            continue;
+        }
+        
+        conn->out_buffer += reply;
+        conn->last_active = std::chrono::steady_clock::now();
+        IoLoop* loop = io_loops[conn->loop_index].get();
+        if (!drain_output(*conn)) {
+            // Wake the owning I/O thread so it tears the connection down
+            shutdown(conn->fd, SHUT_RDWR);
+            conn->pending.clear();
+        } else {
+            arm_events(loop->epoll_fd, *conn, !conn->out_buffer.empty());
+        }
+        
+        if (!conn->pending.empty()) {
+            // Already admitted: requeue behind other connections for fairness
+            {
+                std::lock_guard<std::mutex> queue_lock(work_mutex);
+                work_queue.push_back(conn);
+            }
+            work_cv.notify_one();
+        } else {
+            conn->busy = false;
+        }
+    }
+}
+
+//=================================================================================================
+// STATE ACCESS
+//=================================================================================================
+
+UserShard& Tracker::user_shard(NameId user) {
+    return user_shards[user % USER_SHARDS];
+}
+
+// Caller holds the shard lock. NULL unless the user is registered.
+static User* find_user(UserShard& shard, NameId user) {
+    size_t index = user / USER_SHARDS;
+    return user != NO_NAME && index < shard.users.size() && shard.users[index].exists ? &shard.users[index] : NULL;
+}
+
+// Caller holds the shard lock for writing. The slot may not be registered yet.
+static User& user_slot(UserShard& shard, NameId user) {
+    size_t index = user / USER_SHARDS;
+    if (index >= shard.users.size()) shard.users.resize(index + 1);
+    return shard.users[index];
+}
+
+FileShard& Tracker::file_shard(const std::string& file_hash) {
+    return file_shards[std::hash<std::string>()(file_hash) % FILE_SHARDS];
+}
+
+std::shared_ptr<GroupSlot> Tracker::find_group(NameId group) {
+    ReadGuard lock(groups_lock);
+    return group < groups.size() ? groups[group] : std::shared_ptr<GroupSlot>();
+}
+
+bool Tracker::is_online(NameId user) {
+    if (user == NO_NAME) return false;
+    UserShard& shard = user_shard(user);
+    ReadGuard lock(shard.lock);
+    User* found = find_user(shard, user);
+    return found != NULL && found->online;
+}
+
+// Adds (or finds) a file in a group and makes its name searchable. Caller
+// holds the group's write lock.
+SharedFile& Tracker::share_file(Group& group, NameId file) {
+    size_t files = group.shared_files.size();
+    SharedFile& shared = group.add_file(file);
+    if (group.shared_files.size() != files) {
+        search_index.add(file, group.id);
+        publish_event(group, EVENT_FILE_ADDED, NO_NAME, file);
+    }
+    return shared;
+}
+
+// Points a shared file at the catalog entry for file_hash (creating it if the
+// content is not known yet) and drops its old entry once nothing else shares
+// that content. Caller holds the group's write lock.
+void Tracker::link_content(Group& group, SharedFile& shared, const std::string& file_hash) {
+    if (shared.file_hash == file_hash) return;
+    FileShare share = { group.id, shared.file };
+    
+    if (!shared.file_hash.empty()) {
+        FileShard& shard = file_shard(shared.file_hash);
+        WriteGuard lock(shard.lock);
+        std::map<std::string, FileEntry>::iterator it = shard.files.find(shared.file_hash);
+        if (it != shard.files.end()) {
+            std::vector<FileShare>& shares = it->second.shares;
+            shares.erase(std::remove(shares.begin(), shares.end(), share), shares.end());
+            if (shares.empty()) shard.files.erase(it);
+        }
+    }
+    
+    shared.file_hash = file_hash;
+    if (file_hash.empty()) return;
+    FileShard& shard = file_shard(file_hash);
+    WriteGuard lock(shard.lock);
+    FileEntry& file = shard.files[file_hash];
+    file.file_hash = file_hash;
+    if (std::find(file.shares.begin(), file.shares.end(), share) == file.shares.end()) {
+        file.shares.push_back(share);
+    }
+}
+
+// Adds a file to (or removes it from) the user's share index, which lets
+// LEAVE_GROUP and LOGOUT find the user's files without scanning any group.
+// Caller holds the file's group lock.
+void Tracker::index_share(NameId user, const FileShare& share, bool present) {
+    UserShard& shard = user_shard(user);
+    WriteGuard lock(shard.lock);
+    User* found = find_user(shard, user);
+    if (found == NULL) return;
+    if (present) found->shares.insert(share); else found->shares.erase(share);
+}
+
+// Moves the user's indexed shares in group (in every group for NO_NAME) to out.
+void Tracker::take_shares(NameId user, NameId group, std::vector<FileShare>& out) {
+    UserShard& shard = user_shard(user);
+    WriteGuard lock(shard.lock);
+    User* found = find_user(shard, user);
+    if (found != NULL) found->shares.take(group, out);
+}
+
+// Removes user as a seeder and partial holder of a file. A file nobody holds
+// any more leaves the group and its catalog entry. Caller holds the group's
+// write lock and updates the share index.
+bool Tracker::drop_share(Group& group, NameId file, NameId user) {
+    SharedFile* shared = group.find_file(file);
+    if (shared == NULL) return false;
+    bool seeded = shared->seeders.erase(user);
+    bool held = shared->pieces.holders.erase(user) > 0;
+    if (!seeded && !held) return false;
+    if (seeded) publish_event(group, EVENT_SEEDER_LEFT, user, file);
+    
+    if (shared->seeders.empty() && shared->pieces.holders.empty()) {
+        link_content(group, *shared, std::string());
+        group.remove_file(file);
+        search_index.remove(file, group.id);
+        publish_event(group, EVENT_FILE_REMOVED, NO_NAME, file);
+    }
+    group.peers_changed();
+    return true;
+}
+
+// A user's address or online state changed: cached peer lists in each of their
+// groups may name them. Called after the change, with no locks held.
+void Tracker::user_peers_changed(NameId user) {
+    if (user == NO_NAME) return;
+    static thread_local std::vector<NameId> group_ids;
+    {
+        UserShard& shard = user_shard(user);
+        ReadGuard lock(shard.lock);
+        User* found = find_user(shard, user);
+        if (found == NULL) return;
+        group_ids.assign(found->groups.begin(), found->groups.end());
+    }
+    for (NameId group : group_ids) {
+        std::shared_ptr<GroupSlot> slot = find_group(group);
+        if (slot) slot->group.peers_changed();
+    }
+}
+
+//=================================================================================================
+// PERSISTENCE (write-ahead log + snapshots, see wal.h)
+//=================================================================================================
+
+// Records are built in a per-thread buffer that keeps its capacity
+static thread_local WalRecord record_buffer;
+
+static WalRecord& user_record(WalRecordType type, const std::string& user_id, const User& user) {
+    record_buffer.begin(type);
+    record_buffer.add(user_id);
+    if (type == WAL_USER_CREATE) {
+        record_buffer.add(user.password);
+    } else {
+        record_buffer.add_u64(user.online ? 1 : 0);
+        record_buffer.add(user.ip);
+        record_buffer.add_u64(user.port);
+    }
+    return record_buffer;
+}
+
+// WAL_GROUP_CREATE / OWNER / MEMBER / PENDING
+static WalRecord& group_record(WalRecordType type, const std::string& group_id, const std::string& user_id, bool present = true) {
+    record_buffer.begin(type);
+    record_buffer.add(group_id);
+    record_buffer.add(user_id);
+    if (type == WAL_GROUP_MEMBER || type == WAL_GROUP_PENDING) {
+        record_buffer.add_u64(present ? 1 : 0);
+    }
+    return record_buffer;
+}
+
+static WalRecord& share_record(const std::string& group_id, const std::string& filename, const std::string& user_id) {
+    record_buffer.begin(WAL_GROUP_SHARE);
+    record_buffer.add(group_id);
+    record_buffer.add(filename);
+    record_buffer.add(user_id);
+    return record_buffer;
+}
+
+static WalRecord& unshare_record(const std::string& group_id, const std::string& filename, const std::string& user_id) {
+    record_buffer.begin(WAL_GROUP_UNSHARE);
+    record_buffer.add(group_id);
+    record_buffer.add(filename);
+    record_buffer.add(user_id);
+    return record_buffer;
+}
+
+// The group and file name are those of one share, linked on replay (older
+// logs have no WAL_FILE_LINK records), or empty.
+static WalRecord& file_record(const FileEntry& file, const std::string& group_id, const std::string& filename) {
+    record_buffer.begin(WAL_FILE_PUT);
+    record_buffer.add(file.file_hash);
+    record_buffer.add(filename);
+    record_buffer.add(file.owner);
+    record_buffer.add(group_id);
+    record_buffer.add_u64(file.file_size);
+    record_buffer.add(file.piece_digests);
+    return record_buffer;
+}
+
+static WalRecord& link_record(const std::string& group_id, const std::string& filename, const std::string& file_hash) {
+    record_buffer.begin(WAL_FILE_LINK);
+    record_buffer.add(group_id);
+    record_buffer.add(filename);
+    record_buffer.add(file_hash);
+    return record_buffer;
+}
+
+static WalRecord& drop_record(const std::string& group_id) {
+    record_buffer.begin(WAL_GROUP_DROP);
+    record_buffer.add(group_id);
+    return record_buffer;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decodes full-length hex SHA1s (40 characters each) into raw digests. Fails
+// on anything else, e.g. the truncated fragments older clients sent.
+static bool decode_hex_digests(const char* hex, size_t length, std::string& digests) {
+    if (length == 0 || length % (PIECE_DIGEST_SIZE * 2) != 0) return false;
+    digests.resize(length / 2);
+    for (size_t i = 0; i < length; i += 2) {
+        int high = hex_value(hex[i]);
+        int low = hex_value(hex[i + 1]);
+        if (high < 0 || low < 0) {
+            digests.clear();
+            return false;
+        }
+        digests[i / 2] = static_cast<char>(high << 4 | low);
+    }
+    return true;
+}
+
+static WalRecord& piece_count_record(const std::string& group_id, const std::string& filename, long piece_count) {
+    record_buffer.begin(WAL_FILE_PIECES);
+    record_buffer.add(group_id);
+    record_buffer.add(filename);
+    record_buffer.add_u64(piece_count);
+    return record_buffer;
+}
+
+// Carries the holder's whole bitfield, not the delta, so replay stays idempotent
+static WalRecord& piece_record(const std::string& group_id, const std::string& filename,
+                               const std::string& user_id, const std::string& bitfield) {
+    record_buffer.begin(WAL_PIECE_HAVE);
+    record_buffer.add(group_id);
+    record_buffer.add(filename);
+    record_buffer.add(user_id);
+    record_buffer.add(bitfield);
+    return record_buffer;
+}
+
+// Called with the lock guarding the mutated object still held.
+void Tracker::log_record(WalRecord& record) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    const std::string& sealed = record.seal(last_lsn + 1);
+    append_record(sealed.data(), sealed.size(), last_lsn + 1);
+    request_lsn = last_lsn;
+}
+
+// Caller holds log_mutex. Sends a sealed record to the WAL and to backups.
+void Tracker::append_record(const char* sealed, size_t length, uint64_t lsn) {
+    last_lsn = lsn;
+    if (persistent()) wal.append(sealed, length, lsn);
+    if (replicating) replication_log.publish(sealed, length, lsn);
+    
+    if (persistent() && config.snapshot_every > 0 && records_since_snapshot.fetch_add(1) + 1 == config.snapshot_every) {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        snapshot_requested = true;
+        snapshot_cv.notify_one();
+    }
+}
+
+// Replays one record. Every record sets state rather than changing it
+// relatively, so replaying log records already reflected in a snapshot is
+// harmless.
+void Tracker::apply_record(WalReader& record) {
+    switch (record.type) {
+        case WAL_USER_CREATE: {
+            std::string user_id = record.next();
+            std::string password = record.next();
+            if (!record.ok()) break;
+            
+            NameId id = user_names.intern(user_id);
+            UserShard& shard = user_shard(id);
+            WriteGuard lock(shard.lock);
+            User& user = user_slot(shard, id);
+            if (!user.exists) {
+                user.exists = true;
+                user.password = password;
+                user.port = 0;
+                user.online = false;
+            }
+            return;
+        }
+        
+        case WAL_USER_SESSION: {
+            std::string user_id = record.next();
+            bool online = record.next_u64() != 0;
+            std::string ip = record.next();
+            int user_port = record.next_u64();
+            if (!record.ok()) break;
+            
+            NameId id = user_names.find(user_id);
+            {
+                UserShard& shard = user_shard(id);
+                WriteGuard lock(shard.lock);
+                User* user = find_user(shard, id);
+                if (user == NULL) return;
+                user->online = online;
+                user->ip = ip;
+                user->port = user_port;
+            }
+            user_peers_changed(id);
+            return;
+        }
+        
+        case WAL_GROUP_CREATE: {
+            std::string group_id = record.next();
+            std::string owner = record.next();
+            if (!record.ok()) break;
+            
+            NameId id = group_names.intern(group_id);
+            NameId owner_id = user_names.intern(owner);
+            {
+                WriteGuard lock(groups_lock);
+                if (id < groups.size() && groups[id]) return;
+                if (id >= groups.size()) groups.resize(id + 1);
+                std::shared_ptr<GroupSlot> slot = std::make_shared<GroupSlot>(&lock_waits[LOCK_GROUP]);
+                slot->group.id = id;
+                slot->group.owner = owner_id;
+                slot->group.members.insert(owner_id);
+                groups[id] = slot;
+            }
+            UserShard& shard = user_shard(owner_id);
+            WriteGuard lock(shard.lock);
+            User* user = find_user(shard, owner_id);
+            if (user != NULL) user->groups.insert(id);
+            return;
+        }
+        
+        case WAL_GROUP_OWNER:
+        case WAL_GROUP_MEMBER:
+        case WAL_GROUP_PENDING:
+        case WAL_GROUP_SHARE:
+        case WAL_GROUP_UNSHARE: {
+            std::string group_id = record.next();
+            std::string name = record.next();
+            bool names_file = record.type == WAL_GROUP_SHARE || record.type == WAL_GROUP_UNSHARE;
+            std::string user_id = names_file ? record.next() : name;
+            bool present = record.type == WAL_GROUP_MEMBER || record.type == WAL_GROUP_PENDING ? record.next_u64() != 0 : true;
+            if (!record.ok()) break;
+            
+            std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+            if (!slot) return;
+            NameId user = user_names.intern(user_id);
+            WriteGuard lock(slot->lock);
+            Group& group = slot->group;
+            
+            if (record.type == WAL_GROUP_OWNER) {
+                group.owner = user;
+            } else if (record.type == WAL_GROUP_PENDING) {
+                if (!present) {
+                    group.pending_requests.erase(user);
+                } else if (group.pending_requests.insert(user)) {
+                    publish_event(group, EVENT_REQUEST_PENDING, user, NO_NAME, group.owner);
+                }
+            } else if (record.type == WAL_GROUP_SHARE) {
+                SharedFile& shared = share_file(group, file_names.intern(name));
+                if (shared.seeders.insert(user)) {
+                    FileShare share = { group.id, shared.file };
+                    index_share(user, share);
+                    group.peers_changed();
+                    publish_event(group, EVENT_SEEDER_JOINED, user, shared.file);
+                }
+            } else if (record.type == WAL_GROUP_UNSHARE) {
+                FileShare share = { group.id, file_names.find(name) };
+                if (drop_share(group, share.file, user)) index_share(user, share, false);
+            } else {
+                bool changed = present ? group.members.insert(user) : group.members.erase(user);
+                if (changed) publish_event(group, present ? EVENT_MEMBER_JOINED : EVENT_MEMBER_LEFT, user);
+                group.peers_changed();
+                UserShard& shard = user_shard(user);
+                WriteGuard user_lock(shard.lock);
+                User* found = find_user(shard, user);
+                if (found != NULL) {
+                    if (present) found->groups.insert(group.id); else found->groups.erase(group.id);
+                }
+            }
+            return;
+        }
+        
+        case WAL_GROUP_DROP: {
+            std::string group_id = record.next();
+            if (!record.ok()) break;
+            
+            NameId id = group_names.find(group_id);
+            std::shared_ptr<GroupSlot> slot;
+            {
+                WriteGuard lock(groups_lock);
+                if (id < groups.size()) slot.swap(groups[id]);
+            }
+            if (!slot) return;
+            WriteGuard lock(slot->lock);
+            drop_group(slot->group);
+            return;
+        }
+        
+        case WAL_FILE_PUT:
+        case WAL_FILE_PUT_V1: {
+            std::string file_hash = record.next();
+            std::string filename = record.next();
+            std::string owner = record.next();
+            std::string group_id = record.next();
+            long file_size = record.next_u64();
+            std::string piece_digests;
+            if (record.type == WAL_FILE_PUT) {
+                piece_digests = record.next();
+            } else {
+                // Hex fragments; only complete SHA1s are worth keeping
+                std::string hex;
+                uint64_t pieces = record.next_u64();
+                for (uint64_t i = 0; i < pieces && record.ok(); ++i) {
+                    hex += record.next();
+                }
+                decode_hex_digests(hex.data(), hex.size(), piece_digests);
+            }
+            if (!record.ok()) break;
+            
+            {
+                // The entry may exist already: created by a link, or uploaded before
+                FileShard& shard = file_shard(file_hash);
+                WriteGuard lock(shard.lock);
+                FileEntry& file = shard.files[file_hash];
+                if (file.file_hash.empty() || file.piece_digests.empty()) {
+                    file.file_hash = file_hash;
+                    file.file_size = file_size;
+                    file.piece_digests.swap(piece_digests);
+                    if (file.owner.empty()) file.owner = owner;
+                }
+            }
+            
+            std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+            if (!slot) return;
+            WriteGuard lock(slot->lock);
+            SharedFile* shared = slot->group.find_file(file_names.find(filename));
+            if (shared != NULL) link_content(slot->group, *shared, file_hash);
+            return;
+        }
+        
+        case WAL_FILE_LINK: {
+            std::string group_id = record.next();
+            std::string filename = record.next();
+            std::string file_hash = record.next();
+            if (!record.ok()) break;
+            
+            std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+            if (!slot) return;
+            WriteGuard lock(slot->lock);
+            link_content(slot->group, share_file(slot->group, file_names.intern(filename)), file_hash);
+            return;
+        }
+        
+        case WAL_FILE_PIECES:
+        case WAL_PIECE_HAVE: {
+            std::string group_id = record.next();
+            std::string filename = record.next();
+            std::string user_id;
+            std::string bitfield;
+            long piece_count = 0;
+            if (record.type == WAL_FILE_PIECES) {
+                piece_count = record.next_u64();
+            } else {
+                user_id = record.next();
+                bitfield = record.next();
+            }
+            if (!record.ok()) break;
+            
+            std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+            if (!slot) return;
+            WriteGuard lock(slot->lock);
+            SharedFile* shared = slot->group.find_file(file_names.find(filename));
+            if (shared == NULL) return;
+            PieceAvailability& availability = shared->pieces;
+            
+            if (record.type == WAL_FILE_PIECES) {
+                if (availability.piece_count != piece_count) {
+                    availability.piece_count = piece_count;
+                    availability.holders.clear();
+                }
+            } else if (bitfield.empty()) {
+                availability.holders.erase(user_names.find(user_id));
+            } else {
+                NameId user = user_names.intern(user_id);
+                availability.holders[user] = bitfield;
+                FileShare share = { slot->group.id, shared->file };
+                index_share(user, share);
+            }
+            slot->group.peers_changed();
+            return;
+        }
+    }
+    TLOG(LOG_WARN, YELLOW "⚠ Skipping malformed log record (lsn %llu, type %d)" RESET,
+         static_cast<unsigned long long>(record.lsn), static_cast<int>(record.type));
+}
+
+// Loads the newest snapshot, then replays every log segment after it.
+bool Tracker::recover() {
+    auto started = std::chrono::steady_clock::now();
+    const std::string& dir = config.data_dir;
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << RED << "Failed to create data directory " << dir << ": " << strerror(errno) << RESET << std::endl;
+        return false;
+    }
+    
+    uint64_t snapshot_lsn = 0;
+    uint64_t recovered_lsn = 0;
+    unsigned long snapshot_records = 0;
+    unsigned long log_records = 0;
+    
+    std::string snapshot_path = dir + "/snapshot";
+    int fd = open(snapshot_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        char header[16];
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0 && read(fd, header, sizeof(header)) == sizeof(header) &&
+                  memcmp(header, SNAPSHOT_MAGIC, 8) == 0;
+        if (ok) {
+            memcpy(&snapshot_lsn, header + 8, sizeof(snapshot_lsn));
+            off_t end = wal_read_records(fd, sizeof(header), [&](WalReader& record) {
+                apply_record(record);
+                snapshot_records++;
+            });
+            ok = end == info.st_size;
+        }
+        close(fd);
+        if (!ok) {
+            std::cerr << RED << "Snapshot " << snapshot_path << " is corrupt; refusing to start" << RESET << std::endl;
+            return false;
+        }
+        recovered_lsn = snapshot_lsn;
+    }
+    
+    std::vector<std::pair<uint64_t, std::string>> segments = wal_list_segments(dir);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        fd = open(segments[i].second.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << RED << "Failed to open " << segments[i].second << ": " << strerror(errno) << RESET << std::endl;
+            return false;
+        }
+        off_t end = wal_read_records(fd, 0, [&](WalReader& record) {
+            if (record.lsn <= recovered_lsn) return;
+            apply_record(record);
+            recovered_lsn = record.lsn;
+            log_records++;
+        });
+        
+        struct stat info;
+        if (fstat(fd, &info) == 0 && end < info.st_size) {
+            if (i + 1 < segments.size()) {
+                // Later segments would replay on top of a gap
+                std::cerr << RED << "Log segment " << segments[i].second << " is corrupt at offset " << end
+                          << "; refusing to start" << RESET << std::endl;
+                close(fd);
+                return false;
+            }
+            // A crash mid-write leaves a torn record at the tail; it was never acknowledged
+            TLOG(LOG_WARN, YELLOW "⚠ Truncating torn log tail: %s at offset %lld" RESET,
+                 segments[i].second.c_str(), static_cast<long long>(end));
+            if (ftruncate(fd, end) != 0 || fsync(fd) != 0) {
+                std::cerr << RED << "Failed to truncate " << segments[i].second << RESET << std::endl;
+                close(fd);
+                return false;
+            }
+        }
+        close(fd);
+    }
+    
+    last_lsn = recovered_lsn;
+    if (!wal.open(dir, last_lsn + 1, config.wal_sync)) {
+        std::cerr << RED << "Failed to open write-ahead log in " << dir << ": " << strerror(errno) << RESET << std::endl;
+        return false;
+    }
+    records_since_snapshot = log_records;
+    snapshot_thread = std::thread(&Tracker::snapshot_loop, this);
+    
+    size_t user_count = 0, group_count = 0, file_count = 0, file_bytes = 0;
+    for (int i = 0; i < USER_SHARDS; ++i) {
+        for (const auto& user : user_shards[i].users) user_count += user.exists;
+    }
+    for (const auto& slot : groups) group_count += slot ? 1 : 0;
+    for (int i = 0; i < FILE_SHARDS; ++i) {
+        file_count += file_shards[i].files.size();
+        for (const auto& entry : file_shards[i].files) file_bytes += entry.second.memory_usage();
+    }
+    long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+    
+    std::cout << GREEN << "✓ Recovered " << user_count << " user(s), " << group_count << " group(s), "
+              << file_count << " file(s) from " << dir << " in " << elapsed_ms << " ms" << RESET << std::endl;
+    std::cout << BLUE << "ℹ Snapshot records: " << snapshot_records << " (lsn " << snapshot_lsn
+              << "), log records replayed: " << log_records << ", file metadata: " << file_bytes / 1024 << " KB" << RESET << std::endl;
+    return true;
+}
+
+// Emits one group as records. Caller holds the group's lock.
+template <typename Emit>
+void Tracker::dump_group(const Group& group, Emit emit) {
+    const std::string& group_id = group_names.name(group.id);
+    emit(group_record(WAL_GROUP_CREATE, group_id, user_names.name(group.owner)));
+    if (!group.members.contains(group.owner)) {
+        emit(group_record(WAL_GROUP_MEMBER, group_id, user_names.name(group.owner), false));
+    }
+    for (NameId member : group.members) {
+        emit(group_record(WAL_GROUP_MEMBER, group_id, user_names.name(member), true));
+    }
+    for (NameId pending : group.pending_requests) {
+        emit(group_record(WAL_GROUP_PENDING, group_id, user_names.name(pending), true));
+    }
+    for (const SharedFile& shared : group.shared_files) {
+        const std::string& filename = file_names.name(shared.file);
+        for (NameId seeder : shared.seeders) {
+            emit(share_record(group_id, filename, user_names.name(seeder)));
+        }
+        emit(piece_count_record(group_id, filename, shared.pieces.piece_count));
+        if (!shared.file_hash.empty()) emit(link_record(group_id, filename, shared.file_hash));
+        for (const auto& holder : shared.pieces.holders) {
+            emit(piece_record(group_id, filename, user_names.name(holder.first), holder.second));
+        }
+    }
+}
+
+// Emits the whole state as records, one shard/group at a time while requests
+// keep running. Used for snapshots and for full syncs of a backup.
+template <typename Emit>
+void Tracker::dump_state(Emit emit) {
+    for (int i = 0; i < USER_SHARDS; ++i) {
+        ReadGuard lock(user_shards[i].lock);
+        const std::vector<User>& users = user_shards[i].users;
+        for (size_t index = 0; index < users.size(); ++index) {
+            if (!users[index].exists) continue;
+            const std::string& user_id = user_names.name(index * USER_SHARDS + i);
+            emit(user_record(WAL_USER_CREATE, user_id, users[index]));
+            emit(user_record(WAL_USER_SESSION, user_id, users[index]));
+        }
+    }
+    
+    std::vector<std::shared_ptr<GroupSlot>> slots;
+    {
+        ReadGuard lock(groups_lock);
+        for (const auto& slot : groups) {
+            if (slot) slots.push_back(slot);
+        }
+    }
+    for (const auto& slot : slots) {
+        ReadGuard lock(slot->lock);
+        if (!slot->moved) dump_group(slot->group, emit);     // another shard's by now
+    }
+    
+    for (int i = 0; i < FILE_SHARDS; ++i) {
+        ReadGuard lock(file_shards[i].lock);
+        for (const auto& entry : file_shards[i].files) {
+            const FileEntry& file = entry.second;
+            bool shared = !file.shares.empty();
+            emit(file_record(file, shared ? group_names.name(file.shares[0].group) : std::string(),
+                             shared ? file_names.name(file.shares[0].file) : std::string()));
+        }
+    }
+}
+
+// Drops all users, groups and files (a backup about to receive a full copy).
+// Interned names stay: IDs are never reused.
+void Tracker::reset_state() {
+    {
+        WriteGuard lock(groups_lock);
+        groups.clear();
+    }
+    for (int i = 0; i < USER_SHARDS; ++i) {
+        WriteGuard lock(user_shards[i].lock);
+        user_shards[i].users.clear();
+    }
+    for (int i = 0; i < FILE_SHARDS; ++i) {
+        WriteGuard lock(file_shards[i].lock);
+        file_shards[i].files.clear();
+    }
+    search_index.clear();
+}
+
+// Writes a snapshot of the current state, then drops the log segments it
+// covers. The state is copied one shard/group at a time while requests keep
+// running; records logged meanwhile land in the new segment and are replayed
+// on top during recovery.
+bool Tracker::write_snapshot() {
+    auto started = std::chrono::steady_clock::now();
+    uint64_t covered_lsn = wal.rotate();
+    
+    std::string temp_path = config.data_dir + "/snapshot.tmp";
+    std::string final_path = config.data_dir + "/snapshot";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    
+    std::string buffer(SNAPSHOT_MAGIC);
+    buffer.append(reinterpret_cast<const char*>(&covered_lsn), sizeof(covered_lsn));
+    bool ok = true;
+    unsigned long records = 0;
+    auto emit = [&](WalRecord& record) {
+        buffer += record.seal(0);
+        records++;
+        if (buffer.size() >= (1u << 20)) {
+            ok = wal_write_all(fd, buffer.data(), buffer.size()) && ok;
+            buffer.clear();
+        }
+    };
+    
+    dump_state(emit);
+    
+    ok = wal_write_all(fd, buffer.data(), buffer.size()) && ok;
+    ok = fsync(fd) == 0 && ok;
+    close(fd);
+    if (!ok || rename(temp_path.c_str(), final_path.c_str()) != 0 || !wal_sync_directory(config.data_dir)) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    wal.remove_segments_through(covered_lsn);
+    
+    long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+    TLOG(LOG_INFO, CYAN "💾 Snapshot written: %lu records through lsn %llu in %ld ms" RESET,
+         records, static_cast<unsigned long long>(covered_lsn), elapsed_ms);
+    return true;
+}
+
+void Tracker::snapshot_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(snapshot_mutex);
+            snapshot_cv.wait(lock, [this] { return snapshot_requested || snapshot_stopping; });
+            if (snapshot_stopping) return;
+            snapshot_requested = false;
+        }
+        if (!begin_local_change()) continue;        // the log is being handed over
+        records_since_snapshot = 0;
+        if (!write_snapshot()) {
+            TLOG(LOG_ERROR, RED "❌ Snapshot failed: %s" RESET, strerror(errno));
+        }
+        end_local_change();
+    }
+}
+
+//=================================================================================================
+// COMMAND PARSING & DISPATCH
+//=================================================================================================
+
+// Splits on runs of spaces without copying; returns the token count.
+static size_t tokenize(const char* data, size_t length, StrView* tokens, size_t max_tokens) {
+    size_t count = 0;
+    size_t i = 0;
+    while (i < length && count < max_tokens) {
+        while (i < length && data[i] == ' ') i++;
+        if (i == length) break;
+        size_t start = i;
+        while (i < length && data[i] != ' ') i++;
+        tokens[count++] = StrView(data + start, i - start);
+    }
+    return count;
+}
+
+static bool parse_long(const StrView& token, long& value) {
+    if (token.size == 0 || token.size > 18) return false;
+    value = 0;
+    for (size_t i = 0; i < token.size; ++i) {
+        if (token.data[i] < '0' || token.data[i] > '9') return false;
+        value = value * 10 + (token.data[i] - '0');
+    }
+    return true;
+}
+
+// Appends a decimal number without going through a temporary std::string.
+static void append_number(std::string& out, long value) {
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%ld", value);
+    out.append(digits, length);
+}
+
+// Listings are cut into pages of at most LIST_PAGE_SIZE entries, so neither
+// end holds a whole large group in one reply. A listing command may end with
+// "<cursor> [<limit>]"; every page but the last ends with "NEXT <cursor>",
+// the cursor to send for the following page. Cursors are entry IDs, so a page
+// boundary stays put while entries are added around it.
+static bool parse_page(const Request& request, size_t index, long& cursor, long& limit) {
+    cursor = 0;
+    limit = LIST_PAGE_SIZE;
+    if (request.size() > index && (!parse_long(request.view(index), cursor) || cursor > NO_NAME)) return false;
+    if (request.size() > index + 1) {
+        if (!parse_long(request.view(index + 1), limit) || limit == 0) return false;
+        limit = std::min(limit, static_cast<long>(LIST_PAGE_SIZE));
+    }
+    return true;
+}
+
+static void append_hex(std::string& out, const std::string& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        unsigned char byte = static_cast<unsigned char>(bytes[i]);
+        out += digits[byte >> 4];
+        out += digits[byte & 0x0F];
+    }
+}
+
+// Sets the bits named by a piece list such as "0,4,7-12" in bitfield. Returns
+// how many were not set before, or -1 if the list is malformed or names a
+// piece past piece_count.
+static long apply_piece_list(const StrView& list, long piece_count, std::string& bitfield) {
+    long added = 0;
+    size_t i = 0;
+    while (i <= list.size) {
+        size_t end = i;
+        while (end < list.size && list.data[end] != ',') end++;
+        const char* dash = static_cast<const char*>(memchr(list.data + i, '-', end - i));
+        long first, last;
+        if (dash == NULL) {
+            if (!parse_long(StrView(list.data + i, end - i), first)) return -1;
+            last = first;
+        } else if (!parse_long(StrView(list.data + i, dash - list.data - i), first) ||
+                   !parse_long(StrView(dash + 1, list.data + end - dash - 1), last) || last < first) {
+            return -1;
+        }
+        if (last >= piece_count) return -1;
+        
+        for (long piece = first; piece <= last; ++piece) {
+            unsigned char mask = 0x80 >> (piece % 8);
+            if (!(bitfield[piece / 8] & mask)) {
+                bitfield[piece / 8] |= mask;
+                added++;
+            }
+        }
+        i = end + 1;
+    }
+    return added;
+}
+
+static long count_pieces(const std::string& bitfield) {
+    long held = 0;
+    for (size_t i = 0; i < bitfield.size(); ++i) {
+        held += __builtin_popcount(static_cast<unsigned char>(bitfield[i]));
+    }
+    return held;
+}
+
+static size_t hash_command(const char* data, size_t length) {
+    size_t hash = 2166136261u;          // FNV-1a
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+void Tracker::register_command(const char* name, CommandHandler handler, bool mutates, size_t group_arg) {
+    size_t length = strlen(name);
+    size_t slot = hash_command(name, length) & (COMMAND_TABLE_SIZE - 1);
+    while (command_table[slot].name != NULL) {
+        slot = (slot + 1) & (COMMAND_TABLE_SIZE - 1);
+    }
+    command_table[slot].name = name;
+    command_table[slot].length = length;
+    command_table[slot].handler = handler;
+    command_table[slot].mutates = mutates;
+    command_table[slot].group_arg = group_arg;
+    command_stats.push_back(std::unique_ptr<CommandStats>(new CommandStats()));
+    command_table[slot].stats = command_stats.back().get();
+}
+
+const CommandEntry* Tracker::find_command(const StrView& name) const {
+    size_t slot = hash_command(name.data, name.size) & (COMMAND_TABLE_SIZE - 1);
+    while (command_table[slot].name != NULL) {
+        const CommandEntry& entry = command_table[slot];
+        if (entry.length == name.size && memcmp(entry.name, name.data, name.size) == 0) {
+            return &entry;
+        }
+        slot = (slot + 1) & (COMMAND_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+void Tracker::process_command(const char* data, size_t length, const StrView& blob, const std::string& client_ip, int client_port, std::string& out) {
+    // One Request per thread: its scratch strings keep their capacity
+    static thread_local Request request;
+    request.count = tokenize(data, length, request.tokens, MAX_COMMAND_TOKENS);
+    request.client_ip = &client_ip;
+    request.client_port = client_port;
+    request.blob = blob;
+    
+    if (request.count == 0) {
+        out += "ERROR: Empty command\n";
+        return;
+    }
+    
+    // Each handler takes only the shard/group locks it needs
+    const CommandEntry* command = find_command(request.tokens[0]);
+    if (command == NULL) {
+        out += "ERROR: Unknown command\n";
+        return;
+    }
+    
+    // Service time is sampled: two clock reads cost about as much as a cached
+    // DOWNLOAD_FILE, so only 1 in METRICS_SAMPLE_EVERY commands per thread is timed
+    static thread_local unsigned sample_counter = 0;
+    bool timed = sample_counter++ % METRICS_SAMPLE_EVERY == 0;
+    uint64_t started = timed ? monotonic_ns() : 0;
+    size_t reply_start = out.size();
+    
+    // A group is served by its shard alone. Only the primary changes state;
+    // backups relay writes to it. A tracker handing over to its replacement
+    // relays everything there.
+    bool local = begin_local_change();
+    if (!route_group(*command, request, out)) {
+        // out redirects the client to the group's shard
+    } else if (!local) {
+        if (!forward_command(data, length, blob, out)) {
+            out += "ERROR: Tracker restarting, retry later\n";
+        }
+    } else if (command->mutates && replicating && current_role() != ROLE_PRIMARY) {
+        if (forwarded_request) {
+            out += "ERROR: Not the primary tracker\n";
+        } else if (!forward_command(data, length, blob, out)) {
+            out += "ERROR: Primary tracker unavailable, retry later\n";
+        }
+    } else {
+        request_lsn = 0;
+        (this->*command->handler)(request, out);
+        
+        // Group commit: the reply goes out only once the change is on disk
+        if (request_lsn != 0 && persistent() && config.wal_sync == WAL_SYNC_COMMIT && !wal.wait_durable(request_lsn)) {
+            out.resize(reply_start);
+            out += "ERROR: Could not persist change\n";
+        }
+    }
+    if (local) end_local_change();
+    
+    CommandStats& stats = *command->stats;
+    stats.calls.fetch_add(1, std::memory_order_relaxed);
+    if (out.compare(reply_start, 5, "ERROR") == 0) stats.errors.fetch_add(1, std::memory_order_relaxed);
+    if (timed) stats.service.record(monotonic_ns() - started);
+}
+
+//=================================================================================================
+// COMMAND HANDLERS
+//=================================================================================================
+
+void Tracker::handle_create_user(const Request& request, std::string& out) {
+    if (request.size() < 3) {
+        out += "ERROR: Invalid CREATE_USER command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    const std::string& password = request.arg(2);
+    
+    // Names are interned for good, so only once the user is known to be new
+    NameId id = user_names.find(user_id);
+    if (id != NO_NAME) {
+        UserShard& shard = user_shard(id);
+        ReadGuard lock(shard.lock);
+        if (find_user(shard, id) != NULL) {
+            out += "ERROR: User already exists\n";
+            return;
+        }
+    } else {
+        id = user_names.intern(user_id);
+        if (id == NO_NAME) {
+            out += "ERROR: Too many users\n";
+            return;
+        }
+    }
+    
+    {
+        UserShard& shard = user_shard(id);
+        WriteGuard lock(shard.lock);
+        
+        User& user = user_slot(shard, id);
+        if (user.exists) {
+            out += "ERROR: User already exists\n";
+            return;
+        }
+        
+        user.exists = true;
+        user.password = password;
+        user.port = 0;
+        user.online = false;
+        if (logs_changes()) log_record(user_record(WAL_USER_CREATE, user_id, user));
+    }
+    
+    TLOG(LOG_INFO, GREEN "✓ User created: %s" RESET, user_id.c_str());
+    out += "SUCCESS: User created\n";
+}
+
+void Tracker::handle_login(const Request& request, std::string& out) {
+    if (request.size() < 5) {
+        out += "ERROR: Invalid LOGIN command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    long port;
+    if (!parse_long(request.view(4), port)) {
+        out += "ERROR: Invalid port\n";
+        return;
+    }
+    StrView password = request.view(2);
+    StrView ip = request.view(3);
+    
+    TLOG(LOG_DEBUG, BLUE "📝 Login attempt: %s from %.*s:%ld" RESET, user_id.c_str(), (int)ip.size, ip.data, port);
+    
+    NameId id = user_names.find(user_id);
+    {
+        UserShard& shard = user_shard(id);
+        WriteGuard lock(shard.lock);
+        
+        User* user = find_user(shard, id);
+        if (user == NULL) {
+            out += "ERROR: User not found\n";
+            return;
+        }
+        
+        if (user->password.size() != password.size ||
+            memcmp(user->password.data(), password.data, password.size) != 0) {
+            out += "ERROR: Invalid password\n";
+            return;
+        }
+        
+        user->online = true;
+        user->ip.assign(ip.data, ip.size);
+        user->port = port;
+        renew_lease(*user, id);
+        if (logs_changes()) log_record(user_record(WAL_USER_SESSION, user_id, *user));
+    }
+    user_peers_changed(id);
+    
+    TLOG(LOG_INFO, GREEN "✓ %s logged in successfully at %.*s:%ld" RESET, user_id.c_str(), (int)ip.size, ip.data, port);
+    out += "SUCCESS: Login successful\n";
+}
+
+void Tracker::handle_create_group(const Request& request, std::string& out) {
+    if (request.size() < 3) {
+        out += "ERROR: Invalid CREATE_GROUP command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    const std::string& group_id = request.arg(2);
+    NameId user = user_names.find(user_id);
+    
+    if (!is_online(user)) {
+        out += "ERROR: User not logged in\n";
+        return;
+    }
+    
+    if (find_group(group_names.find(group_id))) {
+        out += "ERROR: Group already exists\n";
+        return;
+    }
+    
+    NameId id = group_names.intern(group_id);
+    if (id == NO_NAME) {
+        out += "ERROR: Too many groups\n";
+        return;
+    }
+    {
+        WriteGuard lock(groups_lock);
+        if (id < groups.size() && groups[id]) {
+            out += "ERROR: Group already exists\n";
+            return;
+        }
+        
+        if (id >= groups.size()) groups.resize(id + 1);
+        std::shared_ptr<GroupSlot> slot = std::make_shared<GroupSlot>(&lock_waits[LOCK_GROUP]);
+        slot->group.id = id;
+        slot->group.owner = user;
+        slot->group.members.insert(user);
+        groups[id] = slot;
+        if (logs_changes()) log_record(group_record(WAL_GROUP_CREATE, group_id, user_id));
+    }
+    
+    {
+        UserShard& shard = user_shard(user);
+        WriteGuard lock(shard.lock);
+        User* found = find_user(shard, user);
+        if (found != NULL) {
+            found->groups.insert(id);
+        }
+    }
+    
+    TLOG(LOG_INFO, GREEN "✓ Group created: %s by %s" RESET, group_id.c_str(), user_id.c_str());
+    out += "SUCCESS: Group created\n";
+}
+
+void Tracker::handle_join_group(const Request& request, std::string& out) {
+    if (request.size() < 3) {
+        out += "ERROR: Invalid JOIN_GROUP command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    const std::string& group_id = request.arg(2);
+    NameId user = user_names.find(user_id);
+    
+    if (!is_online(user)) {
+        out += "ERROR: User not logged in\n";
+        return;
+    }
+    
+    std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+    if (!slot) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    
+    WriteGuard lock(slot->lock);
+    if (slot->moved) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    Group& group = slot->group;
+    
+    if (group.members.contains(user)) {
+        out += "ERROR: Already a member\n";
+        return;
+    }
+    
+    if (group.pending_requests.insert(user)) publish_event(group, EVENT_REQUEST_PENDING, user, NO_NAME, group.owner);
+    if (logs_changes()) log_record(group_record(WAL_GROUP_PENDING, group_id, user_id, true));
+    out += "SUCCESS: Join request sent\n";
+}
+
+void Tracker::handle_leave_group(const Request& request, std::string& out) {
+    if (request.size() < 3) {
+        out += "ERROR: Invalid LEAVE_GROUP command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    const std::string& group_id = request.arg(2);
+    NameId user = user_names.find(user_id);
+    
+    if (!is_online(user)) {
+        out += "ERROR: User not logged in\n";
+        return;
+    }
+    
+    std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+    if (!slot) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    
+    WriteGuard lock(slot->lock);
+    if (slot->moved) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    Group& group = slot->group;
+    
+    if (!group.members.erase(user)) {
+        out += "ERROR: Not a member\n";
+        return;
+    }
+    if (logs_changes()) log_record(group_record(WAL_GROUP_MEMBER, group_id, user_id, false));
+    group.peers_changed();
+    publish_event(group, EVENT_MEMBER_LEFT, user);
+    
+    if (group.owner == user && !group.members.empty()) {
+        group.owner = group.members.front();
+        if (logs_changes()) log_record(group_record(WAL_GROUP_OWNER, group_id, user_names.name(group.owner)));
+    }
+    
+    // Only the leaver's own files in this group are visited
+    static thread_local std::vector<FileShare> shares;
+    shares.clear();
+    take_shares(user, group.id, shares);
+    for (const FileShare& share : shares) {
+        if (drop_share(group, share.file, user) && logs_changes()) {
+            log_record(unshare_record(group_id, file_names.name(share.file), user_id));
+        }
+    }
+    
+    {
+        UserShard& shard = user_shard(user);
+        WriteGuard user_lock(shard.lock);
+        User* found = find_user(shard, user);
+        if (found != NULL) {
+            found->groups.erase(group.id);
+        }
+    }
+    
+    out += "SUCCESS: Left group\n";
+}
+
+void Tracker::handle_list_groups(const Request& request, std::string& out) {
+    long cursor, limit;
+    if (!parse_page(request, 1, cursor, limit)) {
+        out += "ERROR: Invalid page\n";
+        return;
+    }
+    
+    // Groups are listed in creation order, i.e. by ID
+    ReadGuard lock(groups_lock);
+    long listed = 0;
+    for (size_t id = cursor; id < groups.size(); ++id) {
+        const std::shared_ptr<GroupSlot>& slot = groups[id];
+        if (!slot) continue;
+        if (listed == limit) {
+            out += "NEXT ";
+            append_number(out, id);
+            out += '\n';
+            break;
+        }
+        ReadGuard group_lock(slot->lock);
+        const Group& group = slot->group;
+        out += group_names.name(group.id);
+        out += " (Owner: ";
+        out += user_names.name(group.owner);
+        out += ", Members: ";
+        append_number(out, group.members.size());
+        out += ")\n";
+        listed++;
+    }
+    
+    if (listed == 0) {
+        out += "No groups available\n";
+    }
+}
+
+void Tracker::handle_list_requests(const Request& request, std::string& out) {
+    if (request.size() < 3) {
+        out += "ERROR: Invalid LIST_REQUESTS command\n";
+        return;
+    }
+    
+    NameId user = user_names.find(request.arg(1));
+    
+    if (!is_online(user)) {
+        out += "ERROR: User not logged in\n";
+        return;
+    }
+    
+    std::shared_ptr<GroupSlot> slot = find_group(group_names.find(request.arg(2)));
+    if (!slot) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    
+    ReadGuard lock(slot->lock);
+    const Group& group = slot->group;
+    
+    if (group.owner != user) {
+        out += "ERROR: Not group owner\n";
+        return;
+    }
+    
+    if (group.pending_requests.empty()) {
+        out += "No pending requests\n";
+        return;
+    }
+    
+    for (NameId pending : group.pending_requests) {
+        out += user_names.name(pending);
+        out += '\n';
+    }
+}
+
+void Tracker::handle_accept_request(const Request& request, std::string& out) {
+    if (request.size() < 4) {
+        out += "ERROR: Invalid ACCEPT_REQUEST command\n";
+        return;
+    }
+    
+    const std::string& group_id = request.arg(2);
+    const std::string& user_id = request.arg(3);
+    NameId owner = user_names.find(request.arg(1));
+    NameId user = user_names.find(user_id);
+    
+    if (!is_online(owner)) {
+        out += "ERROR: Owner not logged in\n";
+        return;
+    }
+    
+    std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+    if (!slot) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    
+    WriteGuard lock(slot->lock);
+    if (slot->moved) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    Group& group = slot->group;
+    
+    if (group.owner != owner) {
+        out += "ERROR: Not group owner\n";
+        return;
+    }
+    
+    if (!group.pending_requests.erase(user)) {
+        out += "ERROR: No pending request from user\n";
+        return;
+    }
+    
+    group.members.insert(user);
+    publish_event(group, EVENT_MEMBER_JOINED, user);
+    if (logs_changes()) {
+        log_record(group_record(WAL_GROUP_PENDING, group_id, user_id, false));
+        log_record(group_record(WAL_GROUP_MEMBER, group_id, user_id, true));
+    }
+    
+    {
+        UserShard& shard = user_shard(user);
+        WriteGuard user_lock(shard.lock);
+        User* found = find_user(shard, user);
+        if (found != NULL) {
+            found->groups.insert(group.id);
+        }
+    }
+    
+    out += "SUCCESS: Request accepted\n";
+}
+
+void Tracker::handle_list_files(const Request& request, std::string& out) {
+    if (request.size() < 3) {
+        out += "ERROR: Invalid LIST_FILES command\n";
+        return;
+    }
+    
+    long cursor, limit;
+    if (!parse_page(request, 3, cursor, limit)) {
+        out += "ERROR: Invalid page\n";
+        return;
+    }
+    
+    NameId user = user_names.find(request.arg(1));
+    
+    if (!is_online(user)) {
+        out += "ERROR: User not logged in\n";
+        return;
+    }
+    
+    std::shared_ptr<GroupSlot> slot = find_group(group_names.find(request.arg(2)));
+    if (!slot) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    
+    ReadGuard lock(slot->lock);
+    const Group& group = slot->group;
+    
+    if (!group.members.contains(user)) {
+        out += "ERROR: Not a group member\n";
+        return;
+    }
+    
+    std::vector<SharedFile>::const_iterator it = group.files_from(cursor);
+    if (it == group.shared_files.end()) {
+        out += "No files shared in this group\n";
+        return;
+    }
+    
+    for (long listed = 0; it != group.shared_files.end(); ++it, ++listed) {
+        if (listed == limit) {
+            out += "NEXT ";
+            append_number(out, it->file);
+            out += '\n';
+            break;
+        }
+        const SharedFile& shared = *it;
+        out += file_names.name(shared.file);
+        out += " (Shared by: ";
+        for (IdSet::const_iterator seeder = shared.seeders.begin(); seeder != shared.seeders.end(); ++seeder) {
+            if (seeder != shared.seeders.begin()) out += ", ";
+            out += user_names.name(*seeder);
+        }
+        out += ")\n";
+    }
+}
+
+// One search match with what the reply shows about it
+struct RankedHit {
+    SearchHit hit;
+    size_t seeders;
+    size_t name_length;
+    long file_size;                     // -1 if the file has no catalog entry
+};
+
+static bool ranks_before(const RankedHit& a, const RankedHit& b) {
+    if (a.hit.match != b.hit.match) return a.hit.match < b.hit.match;
+    if (a.seeders != b.seeders) return a.seeders > b.seeders;
+    if (a.name_length != b.name_length) return a.name_length < b.name_length;
+    return a.hit.file != b.hit.file ? a.hit.file < b.hit.file : a.hit.group < b.hit.group;
+}
+
+static bool hit_group_before(const SearchHit& a, const SearchHit& b) {
+    return a.group != b.group ? a.group < b.group : a.file < b.file;
+}
+
+// SEARCH <user> <query> [<limit>]: files whose name contains query, ignoring
+// case, in the groups the user belongs to. Exact and prefix matches rank
+// first, then matches at a word start, then the rest; within each, more
+// seeders and then shorter names rank higher.
+void Tracker::handle_search(const Request& request, std::string& out) {
+    if (request.size() < 3) {
+        out += "ERROR: Invalid SEARCH command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    StrView query_view = request.view(2);
+    long limit = SEARCH_DEFAULT_LIMIT;
+    if (request.size() >= 4 && (!parse_long(request.view(3), limit) || limit <= 0)) {
+        out += "ERROR: Invalid limit\n";
+        return;
+    }
+    if (limit > SEARCH_MAX_LIMIT) limit = SEARCH_MAX_LIMIT;
+    
+    NameId user = user_names.find(user_id);
+    static thread_local IdSet visible;
+    {
+        if (user == NO_NAME) {
+            out += "ERROR: User not logged in\n";
+            return;
+        }
+        UserShard& shard = user_shard(user);
+        ReadGuard lock(shard.lock);
+        const User* found = find_user(shard, user);
+        if (found == NULL || !found->online) {
+            out += "ERROR: User not logged in\n";
+            return;
+        }
+        visible = found->groups;
+    }
+    
+    static thread_local std::string query;
+    query.assign(query_view.data, query_view.size);
+    for (size_t i = 0; i < query.size(); ++i) query[i] = fold_case(query[i]);
+    
+    static thread_local std::vector<SearchHit> hits;
+    hits.clear();
+    search_index.search(query, visible, limit * SEARCH_CANDIDATES_PER_RESULT, hits);
+    
+    // Seeder counts and sizes, taking each group's lock once
+    static thread_local std::vector<RankedHit> ranked;
+    ranked.clear();
+    std::sort(hits.begin(), hits.end(), hit_group_before);
+    for (size_t first = 0, last = 0; first < hits.size(); first = last) {
+        for (last = first + 1; last < hits.size() && hits[last].group == hits[first].group; ++last) {}
+        std::shared_ptr<GroupSlot> slot = find_group(hits[first].group);
+        if (!slot) continue;
+        
+        ReadGuard lock(slot->lock);
+        const Group& group = slot->group;
+        if (!group.members.contains(user)) continue;
+        for (size_t i = first; i < last; ++i) {
+            const SharedFile* shared = group.find_file(hits[i].file);
+            if (shared == NULL) continue;
+            RankedHit entry = { hits[i], shared->seeders.size(), file_names.name(hits[i].file).size(), -1 };
+            if (!shared->file_hash.empty()) {
+                FileShard& shard = file_shard(shared->file_hash);
+                ReadGuard file_lock(shard.lock);
+                std::map<std::string, FileEntry>::const_iterator it = shard.files.find(shared->file_hash);
+                if (it != shard.files.end()) entry.file_size = it->second.file_size;
+            }
+            ranked.push_back(entry);
+        }
+    }
+    
+    if (ranked.empty()) {
+        out += "No matching files\n";
+        return;
+    }
+    
+    size_t shown = std::min(ranked.size(), static_cast<size_t>(limit));
+    std::partial_sort(ranked.begin(), ranked.begin() + shown, ranked.end(), ranks_before);
+    for (size_t i = 0; i < shown; ++i) {
+        const RankedHit& entry = ranked[i];
+        out += file_names.name(entry.hit.file);
+        out += " (Group: ";
+        out += group_names.name(entry.hit.group);
+        out += ", Size: ";
+        if (entry.file_size >= 0) {
+            append_number(out, entry.file_size);
+            out += " bytes";
+        } else {
+            out += "unknown";
+        }
+        out += ", Seeders: ";
+        append_number(out, entry.seeders);
+        out += ")\n";
+    }
+}
+
+void Tracker::handle_upload_file(const Request& request, std::string& out) {
+    if (request.size() < 7) {
+        TLOG(LOG_WARN, RED "❌ Invalid UPLOAD_FILE token count: %zu" RESET, request.size());
+        out += "ERROR: Invalid UPLOAD_FILE command - insufficient parameters\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    const std::string& group_id = request.arg(2);
+    const std::string& filename = request.arg(3);
+    const std::string& file_hash = request.arg(4);
+    StrView piece_hashes_str = request.view(5);     // hex SHA1s, or a placeholder when the blob carries them
+    
+    long file_size;
+    if (!parse_long(request.view(6), file_size)) {
+        TLOG(LOG_WARN, RED "❌ Invalid file size: %.*s" RESET, (int)request.view(6).size, request.view(6).data);
+        out += "ERROR: Invalid file size\n";
+        return;
+    }
+    
+    // Calculate file size in different units for display
+    double file_size_mb = file_size / (1024.0 * 1024.0);
+    double file_size_gb = file_size_mb / 1024.0;
+    bool show_gb = file_size_gb >= 1.0;
+    
+    // Estimate number of pieces
+    long estimated_pieces = (file_size + PIECE_SIZE - 1) / PIECE_SIZE;
+    
+    TLOG_SAMPLED(LOG_INFO, BOLD MAGENTA "📤 Upload request: " RESET "👤 %s 👥 %s 📁 %s 📊 %ld bytes (%.2f %s) 🔐 %.16s... 🧩 %zu hash bytes, ~%ld pieces",
+                 user_id.c_str(), group_id.c_str(), filename.c_str(), file_size,
+                 show_gb ? file_size_gb : file_size_mb, show_gb ? "GB" : "MB",
+                 file_hash.c_str(), request.blob.size ? request.blob.size : piece_hashes_str.size, estimated_pieces);
+    
+    // Validate user and group
+    NameId user = user_names.find(user_id);
+    if (!is_online(user)) {
+        TLOG(LOG_WARN, RED "❌ User not logged in: %s" RESET, user_id.c_str());
+        out += "ERROR: User not logged in\n";
+        return;
+    }
+    
+    std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+    if (!slot) {
+        TLOG(LOG_WARN, RED "❌ Group not found: %s" RESET, group_id.c_str());
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    
+    // Digests are decoded before taking any lock. "?" with no blob sends none:
+    // the content is expected to be in the catalog already.
+    bool reuse_content = request.blob.size == 0 && piece_hashes_str == "?";
+    std::string piece_digests;
+    if (request.blob.size > 0) {
+        // Raw digests in the frame's blob: one per piece, nothing else accepted
+        if (request.blob.size % PIECE_DIGEST_SIZE != 0 ||
+            static_cast<long>(request.blob.size / PIECE_DIGEST_SIZE) != estimated_pieces) {
+            TLOG(LOG_WARN, RED "❌ Piece digests for %s: %zu bytes for %ld pieces" RESET,
+                 filename.c_str(), request.blob.size, estimated_pieces);
+            out += "ERROR: Piece hashes do not match file size\n";
+            return;
+        }
+        piece_digests.assign(request.blob.data, request.blob.size);
+    } else if (!reuse_content && !decode_hex_digests(piece_hashes_str.data, piece_hashes_str.size, piece_digests)) {
+        // Truncated fragments from older clients cannot verify a piece; keep none
+        TLOG(LOG_WARN, YELLOW "⚠ %s: piece hashes are not full SHA1s, not stored" RESET, filename.c_str());
+    }
+    
+    bool known_content = false;
+    size_t stored_hashes = 0;
+    size_t entry_bytes = 0;
+    {
+        WriteGuard lock(slot->lock);
+        if (slot->moved) {
+            out += "ERROR: Group not found\n";
+            return;
+        }
+        Group& group = slot->group;
+        
+        if (!group.members.contains(user)) {
+            TLOG(LOG_WARN, RED "❌ User not in group: %s" RESET, user_id.c_str());
+            out += "ERROR: Not a group member\n";
+            return;
+        }
+        
+        // Catalog entry first: a mismatch must not leave a half-made share
+        {
+            FileShard& shard = file_shard(file_hash);
+            WriteGuard file_lock(shard.lock);
+            std::map<std::string, FileEntry>::iterator it = shard.files.find(file_hash);
+            known_content = it != shard.files.end() && !it->second.piece_digests.empty();
+            if (reuse_content && !known_content) {
+                out += "ERROR: Unknown content, send piece hashes\n";
+                return;
+            }
+            if (known_content && it->second.file_size != file_size) {
+                TLOG(LOG_WARN, RED "❌ %s: %ld bytes, known content %.16s... has %ld" RESET,
+                     filename.c_str(), file_size, file_hash.c_str(), it->second.file_size);
+                out += "ERROR: File size does not match known content\n";
+                return;
+            }
+            if (known_content && !piece_digests.empty() && piece_digests != it->second.piece_digests) {
+                TLOG(LOG_WARN, RED "❌ %s: piece hashes differ from known content %.16s..." RESET,
+                     filename.c_str(), file_hash.c_str());
+                out += "ERROR: Piece hashes do not match known content\n";
+                return;
+            }
+            
+            if (!known_content) {
+                FileEntry& stored = it != shard.files.end() ? it->second : shard.files[file_hash];
+                stored.file_hash = file_hash;
+                stored.file_size = file_size;
+                stored.piece_digests.swap(piece_digests);
+                if (stored.owner.empty()) stored.owner = user_id;
+                if (logs_changes()) log_record(file_record(stored, group_id, filename));
+                stored_hashes = stored.piece_count();
+                entry_bytes = stored.memory_usage();
+            } else {
+                stored_hashes = it->second.piece_count();
+                entry_bytes = it->second.memory_usage();
+            }
+        }
+        
+        // Add user to the list of users who have this file (avoid duplicates)
+        SharedFile& shared = share_file(group, file_names.intern(filename));
+        if (shared.seeders.insert(user)) {
+            FileShare share = { group.id, shared.file };
+            index_share(user, share);
+            publish_event(group, EVENT_SEEDER_JOINED, user, shared.file);
+            if (logs_changes()) log_record(share_record(group_id, filename, user_id));
+        }
+        
+        // Size the piece index to this file; the uploader is a full seeder now
+        PieceAvailability& availability = shared.pieces;
+        if (availability.piece_count != estimated_pieces) {
+            availability.piece_count = estimated_pieces;
+            availability.holders.clear();
+            if (logs_changes()) log_record(piece_count_record(group_id, filename, estimated_pieces));
+        } else if (availability.holders.erase(user) > 0) {
+            if (logs_changes()) log_record(piece_record(group_id, filename, user_id, std::string()));
+        }
+        
+        if (shared.file_hash != file_hash) {
+            link_content(group, shared, file_hash);
+            if (logs_changes()) log_record(link_record(group_id, filename, file_hash));
+        }
+        group.peers_changed();
+    }
+    
+    // Success message with detailed stats
+    TLOG(LOG_INFO, BOLD GREEN "✅ Upload stored: " RESET GREEN "📁 %s 📊 %.2f %s (%ld bytes) 🧩 %zu/%ld piece hashes 🧠 %zu bytes 👥 %s%s" RESET,
+         filename.c_str(), show_gb ? file_size_gb : file_size_mb, show_gb ? "GB" : "MB", file_size,
+         stored_hashes, estimated_pieces, entry_bytes, group_id.c_str(), known_content ? " ♻ known content" : "");
+    
+    out += known_content ? "SUCCESS: Large file uploaded successfully (content already known)\n"
+                         : "SUCCESS: Large file uploaded successfully\n";
+}
+
+void Tracker::handle_download_file(const Request& request, std::string& out) {
+    if (request.size() < 4) {
+        out += "ERROR: Invalid DOWNLOAD_FILE command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    const std::string& group_id = request.arg(2);
+    const std::string& filename = request.arg(3);
+    bool with_pieces = false;
+    bool with_sources = false;
+    for (size_t i = 4; i < request.size(); ++i) {
+        if (request.view(i) == "PIECES") with_pieces = true;
+        else if (request.view(i) == "SOURCES") with_sources = true;
+    }
+    
+    TLOG_SAMPLED(LOG_INFO, BLUE "📥 Download request for %s from %s" RESET, filename.c_str(), user_id.c_str());
+    
+    NameId user = user_names.find(user_id);
+    if (!is_online(user)) {
+        out += "ERROR: User not logged in\n";
+        return;
+    }
+    
+    std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+    if (!slot) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    
+    // Other groups sharing the same content, looked up after this group's lock is released
+    static thread_local std::vector<FileShare> other_shares;
+    static thread_local std::vector<NameId> listed;
+    other_shares.clear();
+    listed.clear();
+    std::string file_hash;
+    size_t reply_start = out.size();
+    
+    {
+        // Group lock is held while peer addresses are read (group -> user shard order)
+        ReadGuard lock(slot->lock);
+        const Group& group = slot->group;
+        
+        if (!group.members.contains(user)) {
+            out += "ERROR: Not a group member\n";
+            return;
+        }
+        
+        const SharedFile* shared = group.find_file(file_names.find(filename));
+        if (shared == NULL) {
+            out += "ERROR: File not found in group\n";
+            return;
+        }
+        
+        // Serve the cached reply while it is current; otherwise build it once and
+        // let identical requests wait for that build
+        PeerListCache& cache = *shared->peer_list;
+        int variant = with_pieces ? 1 : 0;
+        uint64_t version = group.peers_version.load(std::memory_order_acquire);
+        bool cached = false;
+        {
+            std::unique_lock<std::mutex> cache_lock(cache.mutex);
+            while (cache.version[variant] != version && cache.building[variant]) {
+                cache.built.wait(cache_lock);
+            }
+            if (cache.version[variant] == version) {
+                out += cache.reply[variant];
+                cached = true;
+            } else {
+                cache.building[variant] = true;
+            }
+        }
+        
+        if (!cached) {
+            static thread_local std::string reply;
+            reply.clear();
+            build_peer_list(*shared, with_pieces, reply);
+            
+            {
+                std::lock_guard<std::mutex> cache_lock(cache.mutex);
+                cache.reply[variant] = reply;
+                cache.version[variant] = version;
+                cache.building[variant] = false;
+            }
+            cache.built.notify_all();
+            out += reply;
+        }
+        
+        if (with_sources && !shared->file_hash.empty()) {
+            file_hash = shared->file_hash;
+            listed.assign(shared->seeders.begin(), shared->seeders.end());
+            listed.push_back(user);
+            FileShard& shard = file_shard(file_hash);
+            ReadGuard file_lock(shard.lock);
+            std::map<std::string, FileEntry>::const_iterator it = shard.files.find(file_hash);
+            if (it != shard.files.end()) {
+                FileShare self = { group.id, shared->file };
+                for (const FileShare& share : it->second.shares) {
+                    if (!(share == self)) other_shares.push_back(share);
+                }
+            }
+        }
+    }
+    
+    if (other_shares.empty()) return;
+    static thread_local std::string sources;
+    sources.clear();
+    append_sources(file_hash, other_shares, listed, sources);
+    if (sources.empty()) return;
+    
+    // Holders elsewhere turn "no online peers" into a usable list
+    if (out.compare(reply_start, 6, "ERROR:") == 0) {
+        out.resize(reply_start);
+        out += "PEERS:\n";
+    }
+    out += sources;
+}
+
+// Lists online seeders of the same content in other groups, one
+// "SOURCE <ip> <port> <user> <filename>" line each, skipping users already in
+// listed. Takes each group's lock in turn; caller holds none.
+void Tracker::append_sources(const std::string& file_hash, const std::vector<FileShare>& shares,
+                             std::vector<NameId>& listed, std::string& out) {
+    for (const FileShare& share : shares) {
+        std::shared_ptr<GroupSlot> slot = find_group(share.group);
+        if (!slot) continue;
+        ReadGuard lock(slot->lock);
+        const Group& group = slot->group;
+        const SharedFile* shared = group.find_file(share.file);
+        if (shared == NULL || shared->file_hash != file_hash) continue;
+        
+        for (NameId seeder : shared->seeders) {
+            if (!group.members.contains(seeder)) continue;
+            if (std::find(listed.begin(), listed.end(), seeder) != listed.end()) continue;
+            UserShard& shard = user_shard(seeder);
+            ReadGuard user_lock(shard.lock);
+            const User* peer = find_user(shard, seeder);
+            if (peer == NULL || !peer->online) continue;
+            
+            out += "SOURCE ";
+            out += peer->ip;
+            out += ' ';
+            append_number(out, peer->port);
+            out += ' ';
+            out += user_names.name(seeder);
+            out += ' ';
+            out += file_names.name(share.file);
+            out += '\n';
+            listed.push_back(seeder);
+        }
+    }
+}
+
+// Serializes the DOWNLOAD_FILE reply for a shared file. Caller holds the group lock.
+void Tracker::build_peer_list(const SharedFile& shared, bool with_pieces, std::string& out) {
+    const std::string& filename = file_names.name(shared.file);
+    // Build peer list with correct format
+    size_t reply_start = out.size();
+    out += "PEERS: ";
+    int peer_count = 0;
+    
+    for (NameId seeder : shared.seeders) {
+        UserShard& shard = user_shard(seeder);
+        ReadGuard user_lock(shard.lock);
+        const User* peer = find_user(shard, seeder);
+        if (peer != NULL && peer->online) {
+            // Format: IP PORT USERNAME (space-separated)
+            out += peer->ip;
+            out += ' ';
+            append_number(out, peer->port);
+            out += ' ';
+            out += user_names.name(seeder);
+            out += ' ';
+            peer_count++;
+            
+            TLOG(LOG_DEBUG, GREEN "✓ Added peer: %s (%s:%d)" RESET, user_names.name(seeder).c_str(), peer->ip.c_str(), peer->port);
+        } else {
+            TLOG(LOG_DEBUG, YELLOW "⚠ Peer offline: %s" RESET, user_names.name(seeder).c_str());
+        }
+    }
+    
+    if (peer_count == 0 && !with_pieces) {
+        out.resize(reply_start);
+        out += "ERROR: No online peers available\n";
+        return;
+    }
+    
+    // Remove trailing space and add newline
+    out[out.size() - 1] = '\n';
+    
+    // Partial holders: "PIECES <count>" then "HOLDER <ip> <port> <user> <hex bitfield>" each
+    int holder_count = 0;
+    if (with_pieces) {
+        out += "PIECES ";
+        append_number(out, shared.pieces.piece_count);
+        out += '\n';
+        
+        for (const auto& holder : shared.pieces.holders) {
+            UserShard& shard = user_shard(holder.first);
+            ReadGuard user_lock(shard.lock);
+            const User* peer = find_user(shard, holder.first);
+            if (peer == NULL || !peer->online) continue;
+            
+            out += "HOLDER ";
+            out += peer->ip;
+            out += ' ';
+            append_number(out, peer->port);
+            out += ' ';
+            out += user_names.name(holder.first);
+            out += ' ';
+            append_hex(out, holder.second);
+            out += '\n';
+            holder_count++;
+        }
+        
+        if (peer_count == 0 && holder_count == 0) {
+            out.resize(reply_start);
+            out += "ERROR: No online peers available\n";
+            return;
+        }
+    }
+    
+    TLOG_SAMPLED(LOG_INFO, CYAN "📤 Peer list for %s rebuilt: %d peer(s) and %d partial holder(s)" RESET,
+                 filename.c_str(), peer_count, holder_count);
+}
+
+void Tracker::handle_have(const Request& request, std::string& out) {
+    if (request.size() < 5) {
+        out += "ERROR: Invalid HAVE command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    const std::string& group_id = request.arg(2);
+    const std::string& filename = request.arg(3);
+    
+    NameId user = user_names.find(user_id);
+    if (!is_online(user)) {
+        out += "ERROR: User not logged in\n";
+        return;
+    }
+    
+    std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+    if (!slot) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    
+    WriteGuard lock(slot->lock);
+    if (slot->moved) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    Group& group = slot->group;
+    
+    if (!group.members.contains(user)) {
+        out += "ERROR: Not a group member\n";
+        return;
+    }
+    
+    SharedFile* shared = group.find_file(file_names.find(filename));
+    if (shared == NULL) {
+        out += "ERROR: File not found in group\n";
+        return;
+    }
+    
+    IdSet& seeders = shared->seeders;
+    if (seeders.contains(user)) {
+        out += "SUCCESS: Already seeding\n";
+        return;
+    }
+    
+    PieceAvailability& availability = shared->pieces;
+    if (availability.piece_count == 0) {
+        out += "ERROR: Piece count unknown for file\n";
+        return;
+    }
+    
+    // The delta is applied to a copy so a malformed list leaves no trace
+    static thread_local std::string bitfield;
+    auto holder_it = availability.holders.find(user);
+    if (holder_it != availability.holders.end()) {
+        bitfield = holder_it->second;
+    } else {
+        bitfield.assign((availability.piece_count + 7) / 8, '\0');
+    }
+    
+    long added = apply_piece_list(request.view(4), availability.piece_count, bitfield);
+    if (added < 0) {
+        out += "ERROR: Invalid piece list\n";
+        return;
+    }
+    long held = count_pieces(bitfield);
+    
+    if (held == availability.piece_count) {
+        // A complete copy: the downloader becomes an ordinary seeder
+        if (holder_it != availability.holders.end()) availability.holders.erase(holder_it);
+        FileShare share = { group.id, shared->file };
+        index_share(user, share);
+        if (seeders.insert(user)) publish_event(group, EVENT_SEEDER_JOINED, user, shared->file);
+        group.peers_changed();
+        if (logs_changes()) {
+            log_record(share_record(group_id, filename, user_id));
+            log_record(piece_record(group_id, filename, user_id, std::string()));
+        }
+        TLOG(LOG_INFO, GREEN "🌱 %s now seeds %s" RESET, user_id.c_str(), filename.c_str());
+        out += "SUCCESS: File complete, now seeding\n";
+        return;
+    }
+    
+    if (added > 0) {
+        if (holder_it == availability.holders.end()) {
+            holder_it = availability.holders.insert(std::make_pair(user, bitfield)).first;
+            FileShare share = { group.id, shared->file };
+            index_share(user, share);
+        } else {
+            holder_it->second = bitfield;
+        }
+        group.peers_changed();
+        if (logs_changes()) log_record(piece_record(group_id, filename, user_id, holder_it->second));
+    }
+    
+    out += "SUCCESS: Holding ";
+    append_number(out, held);
+    out += " of ";
+    append_number(out, availability.piece_count);
+    out += " pieces\n";
+}
+
+// Stops sharing everything the user shares, one group lock at a time. The
+// work is bounded by the user's share index, not by the size of the catalog.
+void Tracker::drop_user_shares(NameId user, const std::string& user_id) {
+    static thread_local std::vector<FileShare> shares;
+    shares.clear();
+    take_shares(user, NO_NAME, shares);
+    
+    size_t dropped = 0;
+    for (size_t first = 0, last = 0; first < shares.size(); first = last) {
+        // Shares come sorted by group
+        for (last = first + 1; last < shares.size() && shares[last].group == shares[first].group; ++last) {}
+        std::shared_ptr<GroupSlot> slot = find_group(shares[first].group);
+        if (!slot) continue;
+        
+        WriteGuard lock(slot->lock);
+        if (slot->moved) continue;
+        for (size_t i = first; i < last; ++i) {
+            if (!drop_share(slot->group, shares[i].file, user)) continue;
+            dropped++;
+            if (logs_changes()) {
+                log_record(unshare_record(group_names.name(shares[i].group), file_names.name(shares[i].file), user_id));
+            }
+        }
+    }
+    
+    if (dropped > 0) {
+        TLOG(LOG_INFO, YELLOW "🛑 %s stopped sharing %zu file(s)" RESET, user_id.c_str(), dropped);
+    }
+}
+
+void Tracker::handle_stop_share(const Request& request, std::string& out) {
+    if (request.size() < 4) {
+        out += "ERROR: Invalid STOP_SHARE command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    const std::string& group_id = request.arg(2);
+    const std::string& filename = request.arg(3);
+    
+    NameId user = user_names.find(user_id);
+    if (!is_online(user)) {
+        out += "ERROR: User not logged in\n";
+        return;
+    }
+    
+    std::shared_ptr<GroupSlot> slot = find_group(group_names.find(group_id));
+    if (!slot) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    
+    WriteGuard lock(slot->lock);
+    if (slot->moved) {
+        out += "ERROR: Group not found\n";
+        return;
+    }
+    Group& group = slot->group;
+    
+    FileShare share = { group.id, file_names.find(filename) };
+    if (group.find_file(share.file) == NULL) {
+        out += "ERROR: File not found in group\n";
+        return;
+    }
+    if (!drop_share(group, share.file, user)) {
+        out += "ERROR: Not sharing this file\n";
+        return;
+    }
+    index_share(user, share, false);
+    if (logs_changes()) log_record(unshare_record(group_id, filename, user_id));
+    
+    TLOG(LOG_INFO, YELLOW "🛑 %s stopped sharing %s in %s" RESET, user_id.c_str(), filename.c_str(), group_id.c_str());
+    out += "SUCCESS: Stopped sharing\n";
+}
+
+void Tracker::handle_logout(const Request& request, std::string& out) {
+    if (request.size() < 2) {
+        out += "ERROR: Invalid LOGOUT command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    NameId id = user_names.find(user_id);
+    bool found = false;
+    {
+        UserShard& shard = user_shard(id);
+        WriteGuard lock(shard.lock);
+        User* user = find_user(shard, id);
+        if (user != NULL) {
+            user->online = false;
+            user->lease_lapsed = false;
+            found = true;
+            if (logs_changes()) log_record(user_record(WAL_USER_SESSION, user_id, *user));
+        }
+    }
+    
+    if (found) {
+        drop_user_shares(id, user_id);
+        user_peers_changed(id);
+        TLOG(LOG_INFO, YELLOW "👋 User logged out: %s" RESET, user_id.c_str());
+    }
+    
+    out += "SUCCESS: Logged out\n";
+}
+
+void Tracker::handle_heartbeat(const Request& request, std::string& out) {
+    if (request.size() < 2) {
+        out += "ERROR: Invalid HEARTBEAT command\n";
+        return;
+    }
+    
+    const std::string& user_id = request.arg(1);
+    NameId id = user_names.find(user_id);
+    bool revived = false;
+    {
+        UserShard& shard = user_shard(id);
+        WriteGuard lock(shard.lock);
+        User* user = find_user(shard, id);
+        if (user == NULL) {
+            out += "ERROR: User not found\n";
+            return;
+        }
+        
+        // A client that was only silent for a while (not logged out) comes back
+        // at its last address without logging in again
+        if (!user->online) {
+            if (!user->lease_lapsed) {
+                out += "ERROR: User not logged in\n";
+                return;
+            }
+            user->online = true;
+            revived = true;
+            if (logs_changes()) log_record(user_record(WAL_USER_SESSION, user_id, *user));
+        }
+        renew_lease(*user, id);
+    }
+    
+    if (revived) {
+        user_peers_changed(id);
+        TLOG(LOG_INFO, GREEN "💓 %s is back online" RESET, user_id.c_str());
+    }
+    
+    if (config.lease_seconds <= 0) {
+        out += "SUCCESS: Leases disabled\n";
+        return;
+    }
+    out += "SUCCESS: Lease renewed for ";
+    append_number(out, config.lease_seconds);
+    out += " seconds\n";
+}
+
+//=================================================================================================
+// REPLICATION (see replication.h)
+//=================================================================================================
+
+TrackerRole Tracker::current_role() {
+    std::lock_guard<std::mutex> lock(role_mutex);
+    return role;
+}
+
+// "<ROLE> <term> <lsn> <primary tracker number>"
+void Tracker::describe_role(std::string& out) {
+    std::lock_guard<std::mutex> lock(role_mutex);
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> log_lock(log_mutex);
+        lsn = last_lsn;
+    }
+    out += role_name(role);
+    out += ' ';
+    append_number(out, term);
+    out += ' ';
+    append_number(out, lsn);
+    out += ' ';
+    append_number(out, role == ROLE_STARTING ? -1 : primary_number);
+}
+
+bool Tracker::probe_role(const TrackerPeer& peer, std::string& reply) {
+    int fd = connect_tracker(peer.ip, peer.port);
+    if (fd < 0) return false;
+    set_socket_timeouts(fd, REPL_PING_MS);
+    
+    Frame frame;
+    bool ok = send_frame(fd, MSG_REPLICATE, "ROLE") && recv_frame(fd, frame) && frame.type == MSG_REPLICATE;
+    close(fd);
+    if (ok) reply = frame.text;
+    return ok;
+}
+
+void Tracker::replication_loop() {
+    while (!replication_stopping) {
+        if (handing_off) {
+            // The new tracker takes over our role; no elections meanwhile
+            std::this_thread::sleep_for(std::chrono::milliseconds(REPL_PING_MS / 10));
+            continue;
+        }
+        TrackerRole current = current_role();
+        if (current == ROLE_STARTING) {
+            elect();
+            continue;
+        }
+        
+        if (current == ROLE_BACKUP) {
+            int number;
+            {
+                std::lock_guard<std::mutex> lock(role_mutex);
+                number = primary_number;
+            }
+            for (const auto& peer : other_trackers) {
+                if (peer.number == number) follow_primary(peer);
+            }
+            // The stream ended: the primary is gone (or was never reachable)
+            std::lock_guard<std::mutex> lock(role_mutex);
+            if (role == ROLE_BACKUP) role = ROLE_STARTING;
+            continue;
+        }
+        
+        // Primary: step down if another primary won a later term (e.g. this
+        // tracker was cut off while a backup took over)
+        for (int i = 0; i < 10 && !replication_stopping; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(REPL_PING_MS / 10));
+        }
+        for (const auto& peer : other_trackers) {
+            std::string reply;
+            if (!probe_role(peer, reply)) continue;
+            char peer_role[16];
+            unsigned long long peer_term;
+            if (sscanf(reply.c_str(), "%15s %llu", peer_role, &peer_term) != 2 || strcmp(peer_role, "PRIMARY") != 0) continue;
+            
+            std::lock_guard<std::mutex> lock(role_mutex);
+            if (peer_term > term || (peer_term == term && peer.number < tracker_number)) {
+                TLOG(LOG_WARN, YELLOW "⚠ Tracker %d is primary for term %llu; stepping down" RESET, peer.number, peer_term);
+                role = ROLE_STARTING;
+                break;
+            }
+        }
+    }
+}
+
+// Follows a live primary if there is one. Otherwise the reachable tracker with
+// the most recent state (term, then LSN, then lowest number) promotes itself,
+// so a tracker restarting empty never takes over from one holding the catalog.
+void Tracker::elect() {
+    for (int attempt = 0; !replication_stopping; ++attempt) {
+        uint64_t my_term, my_lsn;
+        {
+            std::lock_guard<std::mutex> lock(role_mutex);
+            my_term = term;
+        }
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            my_lsn = last_lsn;
+        }
+        
+        const TrackerPeer* primary = NULL;
+        unsigned long long primary_term = 0;
+        unsigned long long highest_term = my_term;
+        bool better_candidate = false;
+        
+        for (const auto& peer : other_trackers) {
+            std::string reply;
+            if (!probe_role(peer, reply)) continue;
+            char peer_role[16];
+            unsigned long long peer_term, peer_lsn;
+            if (sscanf(reply.c_str(), "%15s %llu %llu", peer_role, &peer_term, &peer_lsn) != 3) continue;
+            
+            highest_term = std::max(highest_term, peer_term);
+            if (strcmp(peer_role, "PRIMARY") == 0) {
+                if (primary == NULL || peer_term > primary_term) {
+                    primary = &peer;
+                    primary_term = peer_term;
+                }
+            } else if (peer_term > my_term || (peer_term == my_term && peer_lsn > my_lsn) ||
+                       (peer_term == my_term && peer_lsn == my_lsn && peer.number < tracker_number)) {
+                better_candidate = true;
+            }
+        }
+        
+        if (primary != NULL) {
+            std::lock_guard<std::mutex> lock(role_mutex);
+            role = ROLE_BACKUP;
+            primary_number = primary->number;
+            TLOG(LOG_INFO, CYAN "🔗 Following primary tracker %d (term %llu)" RESET, primary->number, primary_term);
+            return;
+        }
+        
+        // Give a better-placed tracker a few seconds to take over before stepping in
+        if (!better_candidate || attempt >= REPL_TIMEOUT_MS / 250) {
+            promote(highest_term);
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+}
+
+void Tracker::promote(uint64_t seen_term) {
+    std::lock_guard<std::mutex> lock(role_mutex);
+    {
+        std::lock_guard<std::mutex> log_lock(log_mutex);
+        promotion_lsn = last_lsn;
+    }
+    previous_term = term;
+    term = std::max(term, seen_term) + 1;
+    role = ROLE_PRIMARY;
+    primary_number = tracker_number;
+    save_term();
+    
+    TLOG(LOG_INFO, BOLD GREEN "👑 Tracker %d is now primary (term %llu, lsn %llu)" RESET, tracker_number,
+         static_cast<unsigned long long>(term), static_cast<unsigned long long>(promotion_lsn));
+}
+
+// Backup side: applies the primary's stream until it ends.
+void Tracker::follow_primary(const TrackerPeer& peer) {
+    int fd = connect_tracker(peer.ip, peer.port);
+    if (fd < 0) return;
+    set_socket_timeouts(fd, REPL_TIMEOUT_MS);
+    
+    std::string subscribe = "SUBSCRIBE ";
+    {
+        std::lock_guard<std::mutex> lock(role_mutex);
+        std::lock_guard<std::mutex> log_lock(log_mutex);
+        subscribe += std::to_string(tracker_number) + " " + std::to_string(term) + " " + std::to_string(last_lsn);
+    }
+    
+    Frame frame;
+    std::string ack;
+    unsigned long long value = 0;
+    bool ok = send_frame(fd, MSG_REPLICATE, subscribe);
+    while (ok && !replication_stopping && recv_frame(fd, frame) && frame.type == MSG_REPLICATE) {
+        const std::string& kind = frame.text;
+        
+        // Handing off: stop here, the new tracker resumes from our last record
+        if (!begin_local_change()) break;
+        
+        if (kind.compare(0, 4, "LOG ") == 0 || kind == "LOG") {
+            uint64_t applied = 0;
+            ok = wal_for_each_record(frame.blob.data(), frame.blob.size(), [&](const char* sealed, size_t length, WalReader& record) {
+                apply_record(record);
+                std::lock_guard<std::mutex> lock(log_mutex);
+                append_record(sealed, length, record.lsn);
+                applied = record.lsn;
+            });
+            if (applied != 0) {
+                {
+                    std::lock_guard<std::mutex> lock(applied_mutex);
+                    applied_lsn = applied;
+                }
+                applied_cv.notify_all();
+                ack = "ACK " + std::to_string(applied);
+                ok = ok && send_frame(fd, MSG_REPLICATE, ack);
+            }
+        } else if (kind == "STATE") {
+            ok = wal_for_each_record(frame.blob.data(), frame.blob.size(), [&](const char*, size_t, WalReader& record) {
+                apply_record(record);
+            });
+        } else if (sscanf(kind.c_str(), "SYNCED %llu", &value) == 1) {
+            // The copy covers everything through this LSN; the log restarts after it
+            {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                last_lsn = value;
+                replication_log.reset(value + 1);
+                if (persistent()) wal.reset(value + 1);
+            }
+            if (persistent() && !write_snapshot()) {
+                TLOG(LOG_ERROR, RED "❌ Could not snapshot state copied from the primary" RESET);
+            }
+            {
+                std::lock_guard<std::mutex> lock(applied_mutex);
+                applied_lsn = value;
+            }
+            applied_cv.notify_all();
+            TLOG(LOG_INFO, GREEN "✓ Full copy from tracker %d complete (lsn %llu)" RESET, peer.number, value);
+        } else if (sscanf(kind.c_str(), "RESET %llu", &value) == 1) {
+            reset_state();
+            std::lock_guard<std::mutex> lock(role_mutex);
+            term = value;
+            save_term();
+            TLOG(LOG_INFO, CYAN "🔄 Receiving a full copy of the state from tracker %d" RESET, peer.number);
+        } else if (sscanf(kind.c_str(), "RESUME %llu", &value) == 1) {
+            std::lock_guard<std::mutex> lock(role_mutex);
+            term = value;
+            save_term();
+            TLOG(LOG_INFO, CYAN "🔄 Catching up from tracker %d" RESET, peer.number);
+        }
+        // PING: nothing to do, it only proves the primary is alive
+        end_local_change();
+    }
+    close(fd);
+    TLOG(LOG_WARN, YELLOW "⚠ Lost replication stream from tracker %d" RESET, peer.number);
+}
+
+// Primary side: streams records to one backup until it disconnects.
+void Tracker::serve_backup(int fd, const std::string& subscribe, const std::string& backup_ip) {
+    int backup_number;
+    unsigned long long backup_term, backup_lsn;
+    if (sscanf(subscribe.c_str(), "SUBSCRIBE %d %llu %llu", &backup_number, &backup_term, &backup_lsn) != 3) return;
+    set_socket_timeouts(fd, REPL_TIMEOUT_MS);
+    
+    // Resume only if the backup's last record is part of our history and still retained
+    bool resume;
+    uint64_t my_term;
+    {
+        std::lock_guard<std::mutex> lock(role_mutex);
+        if (role != ROLE_PRIMARY) return;
+        my_term = term;
+        std::lock_guard<std::mutex> log_lock(log_mutex);
+        resume = backup_lsn <= last_lsn &&
+                 (backup_term == term || (backup_term == previous_term && backup_lsn <= promotion_lsn));
+    }
+    resume = resume && replication_log.covers(backup_lsn);
+    
+    uint64_t position = backup_lsn;
+    std::string batch;
+    if (resume) {
+        if (!send_frame(fd, MSG_REPLICATE, "RESUME " + std::to_string(my_term))) return;
+    } else {
+        if (!send_frame(fd, MSG_REPLICATE, "RESET " + std::to_string(my_term))) return;
+        {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            position = last_lsn;
+        }
+        // Records logged while copying are streamed afterwards; replaying them is harmless
+        bool ok = true;
+        dump_state([&](WalRecord& record) {
+            batch += record.seal(0);
+            if (ok && batch.size() >= REPL_BATCH_BYTES) {
+                ok = send_frame(fd, MSG_REPLICATE, "STATE", batch);
+                batch.clear();
+            }
+        });
+        if (!ok || (!batch.empty() && !send_frame(fd, MSG_REPLICATE, "STATE", batch)) ||
+            !send_frame(fd, MSG_REPLICATE, "SYNCED " + std::to_string(position))) {
+            return;
+        }
+    }
+    TLOG(LOG_INFO, GREEN "🔗 Backup tracker %d (%s) %s from lsn %llu" RESET, backup_number, backup_ip.c_str(),
+         resume ? "resuming" : "copied", static_cast<unsigned long long>(position));
+    
+    // Batches go out as soon as records exist; acknowledgements are only read
+    // opportunistically, never waited for
+    FrameDecoder acks;
+    Frame ack;
+    unsigned long long acked = 0;
+    char chunk[512];
+    while (!replication_stopping && !handed_over && current_role() == ROLE_PRIMARY) {
+        batch.clear();
+        if (!replication_log.read_after(position, batch, REPL_BATCH_BYTES, REPL_PING_MS)) {
+            TLOG(LOG_WARN, YELLOW "⚠ Backup tracker %d fell too far behind; it will recopy" RESET, backup_number);
+            break;
+        }
+        bool sent = batch.empty() ? send_frame(fd, MSG_REPLICATE, "PING " + std::to_string(position))
+                                  : send_frame(fd, MSG_REPLICATE, "LOG", batch);
+        if (!sent) break;
+        
+        ssize_t n;
+        while ((n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0) {
+            acks.feed(chunk, n);
+        }
+        if (n == 0) break;
+        while (acks.next(ack)) {
+            sscanf(ack.text.c_str(), "ACK %llu", &acked);
+        }
+    }
+    TLOG(LOG_WARN, YELLOW "⚠ Backup tracker %d disconnected (acknowledged lsn %llu)" RESET, backup_number, acked);
+}
+
+// One connection to the primary per thread, reused across forwarded commands.
+struct ForwardConnection {
+    int fd;
+    int tracker;
+    
+    ForwardConnection() : fd(-1), tracker(-1) {}
+    ~ForwardConnection() { if (fd >= 0) close(fd); }
+};
+
+// Backup side: runs a write on the primary and answers only once the
+// resulting records have been applied here, so the client reads its own write.
+bool Tracker::forward_command(const char* data, size_t length, const StrView& blob, std::string& out) {
+    static thread_local ForwardConnection connection;
+    
+    // While handing off, the new tracker on our own port is the target. It is
+    // reached at our listed address, which it admits as a tracker's without a
+    // cluster key.
+    TrackerPeer successor;
+    const TrackerPeer* primary = NULL;
+    int number;
+    if (handing_off) {
+        successor.number = number = tracker_number;
+        successor.ip = "127.0.0.1";
+        std::shared_ptr<const ShardMap> map = current_shards();
+        for (const TrackerPeer& peer : map->shards[map->self].trackers) {
+            if (peer.number == tracker_number) successor.ip = peer.ip;
+        }
+        successor.port = port;
+        primary = &successor;
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(role_mutex);
+            if (role != ROLE_BACKUP) return false;
+            number = primary_number;
+        }
+        for (const auto& peer : other_trackers) {
+            if (peer.number == number) primary = &peer;
+        }
+        if (primary == NULL) return false;
+    }
+    
+    static thread_local Frame reply;
+    static thread_local std::string command;
+    static thread_local std::string payload;
+    command.assign(data, length);
+    payload.assign(blob.data, blob.size);
+    bool ok = false;
+    for (int attempt = 0; attempt < 2 && !ok; ++attempt) {
+        if (connection.fd < 0 || connection.tracker != number) {
+            if (connection.fd >= 0) close(connection.fd);
+            connection.fd = connect_tracker(primary->ip, primary->port);
+            connection.tracker = number;
+            if (connection.fd < 0) return false;
+            set_socket_timeouts(connection.fd, REPL_FORWARD_TIMEOUT_MS);
+        }
+        ok = send_frame(connection.fd, MSG_FORWARD, command, payload) && recv_frame(connection.fd, reply) && reply.type == MSG_REPLY;
+        if (!ok) {
+            close(connection.fd);
+            connection.fd = -1;
+        }
+    }
+    if (!ok) return false;
+    
+    uint64_t lsn = 0;
+    if (reply.blob.size() == sizeof(lsn)) {
+        lsn = get_u64(reply.blob.data());
+    }
+    if (primary == &successor) {
+        // Nothing is applied here any more; a backup that forwarded to us waits instead
+        request_lsn = lsn;
+    } else if (lsn != 0) {
+        std::unique_lock<std::mutex> lock(applied_mutex);
+        applied_cv.wait_for(lock, std::chrono::milliseconds(REPL_FORWARD_TIMEOUT_MS), [this, lsn] { return applied_lsn >= lsn; });
+    }
+    out += reply.text;
+    return true;
+}
+
+// The term survives restarts (with --data-dir) so a backup can resume
+// instead of recopying everything.
+void Tracker::load_term() {
+    if (!persistent()) return;
+    std::ifstream file(config.data_dir + "/term");
+    unsigned long long saved_term = 0, saved_previous = 0, saved_promotion = 0;
+    if (file >> saved_term >> saved_previous >> saved_promotion) {
+        term = saved_term;
+        previous_term = saved_previous;
+        promotion_lsn = saved_promotion;
+    }
+}
+
+// Caller holds role_mutex.
+void Tracker::save_term() {
+    if (!persistent()) return;
+    std::string temp_path = config.data_dir + "/term.tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        file << term << " " << previous_term << " " << promotion_lsn << "\n";
+    }
+    if (rename(temp_path.c_str(), (config.data_dir + "/term").c_str()) != 0) {
+        TLOG(LOG_ERROR, RED "❌ Failed to save replication term: %s" RESET, strerror(errno));
+    }
+}
+
+//=================================================================================================
+// METRICS (see metrics.h)
+//=================================================================================================
+
+static const char* lock_kind_names[LOCK_KINDS] = { "group_directory", "group", "user_shard", "file_shard", "names", "search" };
+
+// Approximate heap use of tracker state: element and string capacities, not allocator overhead.
+struct Tracker::StateSizes {
+    size_t users, online_users, user_bytes;
+    size_t groups, shared_files, group_bytes;
+    size_t files, file_bytes;
+    size_t search_names, search_bytes;
+    
+    StateSizes() : users(0), online_users(0), user_bytes(0), groups(0), shared_files(0), group_bytes(0),
+                   files(0), file_bytes(0), search_names(0), search_bytes(0) {}
+};
+
+void Tracker::measure_state(StateSizes& sizes) {
+    for (int i = 0; i < USER_SHARDS; ++i) {
+        ReadGuard lock(user_shards[i].lock);
+        const std::vector<User>& users = user_shards[i].users;
+        sizes.user_bytes += users.capacity() * sizeof(User);
+        for (const User& user : users) {
+            if (!user.exists) continue;
+            sizes.users++;
+            if (user.online) sizes.online_users++;
+            sizes.user_bytes += user.password.capacity() + user.ip.capacity() + user.groups.capacity() * sizeof(NameId) +
+                                user.shares.capacity() * sizeof(uint64_t);
+        }
+    }
+    
+    {
+        ReadGuard lock(groups_lock);
+        sizes.group_bytes += groups.capacity() * sizeof(std::shared_ptr<GroupSlot>);
+        for (const auto& slot : groups) {
+            if (!slot) continue;
+            ReadGuard group_lock(slot->lock);
+            const Group& group = slot->group;
+            sizes.groups++;
+            sizes.shared_files += group.shared_files.size();
+            sizes.group_bytes += sizeof(GroupSlot) + (group.members.capacity() + group.pending_requests.capacity()) * sizeof(NameId) +
+                                 group.shared_files.capacity() * sizeof(SharedFile);
+            for (const SharedFile& shared : group.shared_files) {
+                sizes.group_bytes += shared.seeders.capacity() * sizeof(NameId) + sizeof(PeerListCache) + shared.file_hash.capacity();
+                for (const auto& holder : shared.pieces.holders) {
+                    sizes.group_bytes += sizeof(holder) + holder.second.capacity();
+                }
+            }
+        }
+    }
+    
+    for (int i = 0; i < FILE_SHARDS; ++i) {
+        ReadGuard lock(file_shards[i].lock);
+        for (const auto& entry : file_shards[i].files) {
+            sizes.files++;
+            sizes.file_bytes += entry.first.capacity() + entry.second.memory_usage();
+        }
+    }
+    
+    sizes.search_names = search_index.size();
+    sizes.search_bytes = search_index.memory_usage();
+}
+
+// Reads "<key>: <number>" from a /proc status file; 0 if absent.
+static unsigned long proc_status_value(const char* key) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    size_t length = strlen(key);
+    while (std::getline(status, line)) {
+        if (line.compare(0, length, key) == 0 && line.size() > length && line[length] == ':') {
+            return strtoul(line.c_str() + length + 1, NULL, 10);
+        }
+    }
+    return 0;
+}
+
+// Commands in name order, for stable output
+static void sorted_commands(const CommandEntry* table, std::vector<const CommandEntry*>& commands) {
+    for (size_t i = 0; i < COMMAND_TABLE_SIZE; ++i) {
+        if (table[i].name != NULL) commands.push_back(&table[i]);
+    }
+    std::sort(commands.begin(), commands.end(), [](const CommandEntry* a, const CommandEntry* b) {
+        return strcmp(a->name, b->name) < 0;
+    });
+}
+
+// Prometheus text exposition format, served by the HTTP endpoint.
+void Tracker::append_metrics(std::string& out) {
+    char line[1024];
+    std::vector<const CommandEntry*> commands;
+    sorted_commands(command_table, commands);
+    std::unique_ptr<LatencyHistogram::Snapshot> snapshot(new LatencyHistogram::Snapshot());
+    
+    out += "# HELP tracker_commands_total Commands served.\n# TYPE tracker_commands_total counter\n";
+    for (const CommandEntry* command : commands) {
+        snprintf(line, sizeof(line), "tracker_commands_total{command=\"%s\"} %llu\n", command->name,
+                 static_cast<unsigned long long>(command->stats->calls.load()));
+        out += line;
+    }
+    out += "# HELP tracker_command_errors_total Commands answered with an ERROR reply.\n# TYPE tracker_command_errors_total counter\n";
+    for (const CommandEntry* command : commands) {
+        snprintf(line, sizeof(line), "tracker_command_errors_total{command=\"%s\"} %llu\n", command->name,
+                 static_cast<unsigned long long>(command->stats->errors.load()));
+        out += line;
+    }
+    out += "# HELP tracker_command_duration_seconds Time from dispatch to a complete, durable reply (sampled).\n"
+           "# TYPE tracker_command_duration_seconds histogram\n";
+    for (const CommandEntry* command : commands) {
+        command->stats->service.snapshot(*snapshot);
+        append_prometheus_histogram(out, "tracker_command_duration_seconds",
+                                    std::string("command=\"") + command->name + "\"", *snapshot);
+    }
+    out += "# HELP tracker_lock_wait_seconds Time blocked acquiring a contended lock.\n"
+           "# TYPE tracker_lock_wait_seconds histogram\n";
+    for (int kind = 0; kind < LOCK_KINDS; ++kind) {
+        lock_waits[kind].snapshot(*snapshot);
+        append_prometheus_histogram(out, "tracker_lock_wait_seconds",
+                                    std::string("lock=\"") + lock_kind_names[kind] + "\"", *snapshot);
+    }
+    
+    StateSizes sizes;
+    measure_state(sizes);
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        lsn = last_lsn;
+    }
+    double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count();
+    snprintf(line, sizeof(line),
+             "# TYPE tracker_uptime_seconds gauge\ntracker_uptime_seconds %.3f\n"
+             "# TYPE tracker_role gauge\ntracker_role{role=\"%s\"} 1\n"
+             "# TYPE tracker_connections gauge\ntracker_connections %d\n"
+             "# TYPE tracker_threads gauge\ntracker_threads %lu\n"
+             "# TYPE tracker_resident_bytes gauge\ntracker_resident_bytes %lu\n",
+             uptime, role_name(current_role()), active_connections.load(), proc_status_value("Threads"),
+             proc_status_value("VmRSS") * 1024);
+    out += line;
+    snprintf(line, sizeof(line),
+             "# TYPE tracker_users gauge\ntracker_users{state=\"registered\"} %zu\ntracker_users{state=\"online\"} %zu\n"
+             "# TYPE tracker_groups gauge\ntracker_groups %zu\n"
+             "# TYPE tracker_shared_files gauge\ntracker_shared_files %zu\n"
+             "# TYPE tracker_files gauge\ntracker_files %zu\n",
+             sizes.users, sizes.online_users, sizes.groups, sizes.shared_files, sizes.files);
+    out += line;
+    snprintf(line, sizeof(line),
+             "# TYPE tracker_subscribers gauge\ntracker_subscribers %zu\n"
+             "# HELP tracker_events_total Group events published, and sent (once per subscriber).\n"
+             "# TYPE tracker_events_total counter\ntracker_events_total{stage=\"published\"} %llu\n"
+             "tracker_events_total{stage=\"sent\"} %llu\n",
+             subscriber_count.load(), static_cast<unsigned long long>(events_published.load()),
+             static_cast<unsigned long long>(events_sent.load()));
+    out += line;
+    snprintf(line, sizeof(line),
+             "# HELP tracker_groups_moved_total Groups moved to (out) or received from (in) other shards.\n"
+             "# TYPE tracker_groups_moved_total counter\ntracker_groups_moved_total{direction=\"out\"} %llu\n"
+             "tracker_groups_moved_total{direction=\"in\"} %llu\n",
+             static_cast<unsigned long long>(groups_moved_out.load()), static_cast<unsigned long long>(groups_moved_in.load()));
+    out += line;
+    snprintf(line, sizeof(line),
+             "# HELP tracker_state_bytes Approximate heap bytes held by tracker state.\n# TYPE tracker_state_bytes gauge\n"
+             "tracker_state_bytes{map=\"users\"} %zu\ntracker_state_bytes{map=\"groups\"} %zu\ntracker_state_bytes{map=\"files\"} %zu\n"
+             "tracker_state_bytes{map=\"search\"} %zu\n",
+             sizes.user_bytes, sizes.group_bytes, sizes.file_bytes, sizes.search_bytes);
+    out += line;
+    snprintf(line, sizeof(line),
+             "# TYPE tracker_interned_names gauge\ntracker_interned_names{table=\"users\"} %zu\n"
+             "tracker_interned_names{table=\"groups\"} %zu\ntracker_interned_names{table=\"files\"} %zu\n",
+             user_names.size(), group_names.size(), file_names.size());
+    out += line;
+    snprintf(line, sizeof(line),
+             "# TYPE tracker_log_lsn gauge\ntracker_log_lsn %llu\n"
+             "# TYPE tracker_log_lines_dropped_total counter\ntracker_log_lines_dropped_total %lu\n",
+             static_cast<unsigned long long>(lsn), Logger::instance().dropped_lines());
+    out += line;
+}
+
+// STATS: the same figures for a person, with latency percentiles in microseconds.
+void Tracker::handle_stats(const Request& request, std::string& out) {
+    (void)request;
+    char line[256];
+    StateSizes sizes;
+    measure_state(sizes);
+    long uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started_at).count();
+    
+    snprintf(line, sizeof(line), "Tracker %d (%s), up %ld s, %d connection(s), %lu thread(s), %lu KB resident\n",
+             tracker_number, role_name(current_role()), uptime, active_connections.load(),
+             proc_status_value("Threads"), proc_status_value("VmRSS"));
+    out += line;
+    snprintf(line, sizeof(line), "Users: %zu (%zu online), %zu KB\nGroups: %zu, %zu shared file(s), %zu KB\nFiles: %zu, %zu KB\n"
+             "Search index: %zu file(s), %zu KB\n",
+             sizes.users, sizes.online_users, sizes.user_bytes / 1024, sizes.groups, sizes.shared_files,
+             sizes.group_bytes / 1024, sizes.files, sizes.file_bytes / 1024, sizes.search_names, sizes.search_bytes / 1024);
+    out += line;
+    snprintf(line, sizeof(line), "Subscribers: %zu, %llu event(s) published, %llu sent\n", subscriber_count.load(),
+             static_cast<unsigned long long>(events_published.load()), static_cast<unsigned long long>(events_sent.load()));
+    out += line;
+    if (sharded) {
+        std::shared_ptr<const ShardMap> map = current_shards();
+        snprintf(line, sizeof(line), "Shard: '%s' (%d of %zu), %llu group(s) moved out, %llu in\n",
+                 map->shards[map->self].name.c_str(), map->self + 1, map->shards.size(),
+                 static_cast<unsigned long long>(groups_moved_out.load()), static_cast<unsigned long long>(groups_moved_in.load()));
+        out += line;
+    }
+    
+    std::unique_ptr<LatencyHistogram::Snapshot> snapshot(new LatencyHistogram::Snapshot());
+    std::vector<const CommandEntry*> commands;
+    sorted_commands(command_table, commands);
+    snprintf(line, sizeof(line), "%-16s %10s %8s %9s %9s %9s\n", "Command", "Calls", "Errors", "p50 us", "p99 us", "max us");
+    out += line;
+    for (const CommandEntry* command : commands) {
+        uint64_t calls = command->stats->calls.load();
+        if (calls == 0) continue;
+        // Latency comes from the sampled requests (1 in METRICS_SAMPLE_EVERY), which may not include any yet
+        command->stats->service.snapshot(*snapshot);
+        if (snapshot->count == 0) {
+            snprintf(line, sizeof(line), "%-16s %10llu %8llu %9s %9s %9s\n", command->name,
+                     static_cast<unsigned long long>(calls),
+                     static_cast<unsigned long long>(command->stats->errors.load()), "-", "-", "-");
+        } else {
+            snprintf(line, sizeof(line), "%-16s %10llu %8llu %9.1f %9.1f %9.1f\n", command->name,
+                     static_cast<unsigned long long>(calls),
+                     static_cast<unsigned long long>(command->stats->errors.load()),
+                     snapshot->quantile(0.5) / 1e3, snapshot->quantile(0.99) / 1e3, snapshot->largest / 1e3);
+        }
+        out += line;
+    }
+    
+    snprintf(line, sizeof(line), "%-16s %10s %8s %9s %9s %9s\n", "Lock wait", "Waits", "", "p50 us", "p99 us", "max us");
+    out += line;
+    for (int kind = 0; kind < LOCK_KINDS; ++kind) {
+        lock_waits[kind].snapshot(*snapshot);
+        snprintf(line, sizeof(line), "%-16s %10llu %8s %9.1f %9.1f %9.1f\n", lock_kind_names[kind],
+                 static_cast<unsigned long long>(snapshot->count), "",
+                 snapshot->quantile(0.5) / 1e3, snapshot->quantile(0.99) / 1e3, snapshot->largest / 1e3);
+        out += line;
+    }
+}
+
+bool Tracker::start_metrics_server() {
+    if (metrics_socket < 0) {
+        metrics_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (metrics_socket < 0) return false;
+        
+        int opt = 1;
+        setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(config.metrics_port);
+        if (bind(metrics_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(metrics_socket, 16) < 0) {
+            std::cerr << RED << "Failed to open metrics port " << config.metrics_port << ": " << strerror(errno) << RESET << std::endl;
+            return false;
+        }
+    }
+    
+    metrics_thread = std::thread(&Tracker::metrics_loop, this);
+    std::cout << BLUE << "ℹ Metrics at http://0.0.0.0:" << config.metrics_port << "/metrics" << RESET << std::endl;
+    return true;
+}
+
+// Minimal HTTP/1.0 server: one scrape at a time, connection closed after each reply.
+void Tracker::metrics_loop() {
+    std::string request;
+    std::string body;
+    std::string response;
+    char buffer[1024];
+    
+    while (!metrics_stopping) {
+        struct pollfd pfd;
+        pfd.fd = metrics_socket;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 500) != 1) continue;
+        int fd = accept4(metrics_socket, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        set_socket_timeouts(fd, 1000);
+        
+        request.clear();
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) break;
+            request.append(buffer, n);
+        }
+        
+        body.clear();
+        const char* status = "200 OK";
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+            append_metrics(body);
+        } else {
+            status = "404 Not Found";
+            body = "Try /metrics\n";
+        }
+        response = "HTTP/1.0 ";
+        response += status;
+        response += "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ";
+        response += std::to_string(body.size());
+        response += "\r\nConnection: close\r\n\r\n";
+        response += body;
+        send_all(fd, response.data(), response.size());
+        close(fd);
+    }
+}
+
+//=================================================================================================
+// SESSION LEASES (see timer_wheel.h)
+//=================================================================================================
+
+// Caller holds the user's shard write lock. Queues a lease timer unless the
+// user already has one; a timer that fires early is pushed back to the
+// current deadline then, so a heartbeat is just a store.
+void Tracker::renew_lease(User& user, NameId id) {
+    if (config.lease_seconds <= 0) return;
+    user.lease_expires = lease_tick() + static_cast<uint64_t>(config.lease_seconds) * 1000 / LEASE_TICK_MS;
+    user.lease_lapsed = false;
+    if (user.lease_timer == 0) {
+        std::lock_guard<std::mutex> lock(lease_mutex);
+        user.lease_timer = lease_wheel.schedule(user.lease_expires, id);
+    }
+}
+
+// Gives every online user a fresh lease (at startup and on promotion: their
+// heartbeats may have gone to another tracker until now).
+void Tracker::start_leases() {
+    {
+        std::lock_guard<std::mutex> lock(lease_mutex);
+        lease_wheel.reset(lease_tick());
+    }
+    size_t count = 0;
+    for (int i = 0; i < USER_SHARDS; ++i) {
+        UserShard& shard = user_shards[i];
+        WriteGuard lock(shard.lock);
+        for (size_t index = 0; index < shard.users.size(); ++index) {
+            User& user = shard.users[index];
+            user.lease_timer = 0;
+            if (!user.exists || !user.online) continue;
+            renew_lease(user, index * USER_SHARDS + i);
+            count++;
+        }
+    }
+    TLOG(LOG_INFO, CYAN "💓 Leases started for %zu online user(s), %d s each" RESET, count, config.lease_seconds);
+}
+
+void Tracker::expire_lease(NameId id, uint64_t due, uint64_t now) {
+    const std::string& user_id = user_names.name(id);
+    {
+        UserShard& shard = user_shard(id);
+        WriteGuard lock(shard.lock);
+        User* user = find_user(shard, id);
+        if (user == NULL || user->lease_timer != due) return;     // superseded timer
+        if (!user->online) {
+            user->lease_timer = 0;
+            return;
+        }
+        if (user->lease_expires > now) {
+            std::lock_guard<std::mutex> lease_lock(lease_mutex);
+            user->lease_timer = lease_wheel.schedule(user->lease_expires, id);
+            return;
+        }
+        user->online = false;
+        user->lease_lapsed = true;
+        user->lease_timer = 0;
+        if (logs_changes()) log_record(user_record(WAL_USER_SESSION, user_id, *user));
+    }
+    user_peers_changed(id);
+    TLOG(LOG_INFO, YELLOW "⌛ Lease expired, %s is offline" RESET, user_id.c_str());
+}
+
+// Only the primary expires leases; backups learn of it from the log.
+void Tracker::lease_loop() {
+    std::vector<std::pair<uint32_t, uint64_t>> fired;
+    bool primary = false;
+    while (!lease_stopping) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(LEASE_TICK_MS));
+        if (current_role() != ROLE_PRIMARY) {
+            primary = false;
+            continue;
+        }
+        if (!begin_local_change()) {
+            // Handing off: if the new tracker fails, leases restart from scratch
+            primary = false;
+            continue;
+        }
+        if (!primary) {
+            start_leases();
+            primary = true;
+        }
+        
+        uint64_t now = lease_tick();
+        fired.clear();
+        {
+            std::lock_guard<std::mutex> lock(lease_mutex);
+            lease_wheel.advance(now, fired);
+        }
+        for (const auto& timer : fired) {
+            expire_lease(timer.first, timer.second, now);
+        }
+        end_local_change();
+    }
+}
+
+//=================================================================================================
+// GROUP EVENTS (see events.h)
+//=================================================================================================
+
+// Queues an event for the group's subscribers. Caller holds the group's lock;
+// in a group nobody listens to, this is one atomic load.
+void Tracker::publish_event(const Group& group, EventKind kind, NameId user, NameId file, NameId audience) {
+    if (group.listeners.load(std::memory_order_relaxed) == 0) return;
+    GroupEvent event(kind, group.id, user);
+    event.file = file;
+    event.audience = audience;
+    event_queue.publish(event);
+    events_published.fetch_add(1, std::memory_order_relaxed);
+}
+
+// A closed connection stops listening. Called with no locks held.
+void Tracker::end_subscriptions(const std::shared_ptr<Connection>& conn) {
+    bool subscribed;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        subscribed = conn->subscribed;
+    }
+    if (!subscribed) return;
+    GroupEvent event(EVENT_UNSUBSCRIBE, NO_NAME, NO_NAME);
+    event.connection = conn;
+    event_queue.publish(event);
+}
+
+// Subscriptions to groups were removed from the table: stop publishing to
+// groups that nobody listens to any more. Event thread only.
+void Tracker::release_listeners(std::vector<NameId>& left) {
+    for (NameId group : left) {
+        std::shared_ptr<GroupSlot> slot = find_group(group);
+        if (slot) slot->group.listeners.fetch_sub(1, std::memory_order_relaxed);
+    }
+    left.clear();
+    subscriber_count.store(subscriptions.connections(), std::memory_order_relaxed);
+}
+
+static void append_event(std::string& out, const GroupEvent& event, const NameTable& group_names,
+                         const NameTable& user_names, const NameTable& file_names) {
+    out += "EVENT ";
+    out += group_names.name(event.group);
+    out += ' ';
+    out += event_kind_name(event.kind);
+    if (event.file != NO_NAME) {
+        out += ' ';
+        out += file_names.name(event.file);
+    }
+    if (event.user != NO_NAME) {
+        out += ' ';
+        out += user_names.name(event.user);
+    }
+    out += '\n';
+}
+
+// Moves a subscriber's batch to its connection and writes what the socket
+// takes; a reactor connection's I/O thread sends the rest. unsent is set when
+// a thread-per-connection socket still has events to send (or its thread is
+// busy replying), to be retried. Returns false once the connection is gone.
+bool Tracker::write_events(Subscriber& subscriber, bool& unsent) {
+    unsent = false;
+    std::shared_ptr<Connection> conn = subscriber.connection.lock();
+    if (!conn) return false;
+    
+    std::unique_lock<std::mutex> lock(conn->mutex, std::defer_lock);
+    if (conn->loop_index >= 0) {
+        lock.lock();
+    } else if (!lock.try_lock()) {
+        unsent = true;
+        return true;
+    }
+    if (conn->fd < 0) return false;
+    
+    if (!subscriber.batch.empty()) {
+        if (conn->out_buffer.size() + subscriber.batch.size() > EVENT_MAX_BACKLOG) {
+            TLOG(LOG_WARN, YELLOW "⚠ Dropping subscriber %s:%d, %zu bytes of events unread" RESET,
+                 conn->ip.c_str(), conn->port, conn->out_buffer.size());
+            shutdown(conn->fd, SHUT_RDWR);
+            return false;
+        }
+        if (subscriber.framed) {
+            size_t mark = begin_frame(conn->out_buffer, MSG_EVENT);
+            conn->out_buffer += subscriber.batch;
+            end_frame(conn->out_buffer, mark);
+        } else {
+            conn->out_buffer += subscriber.batch;
+        }
+        subscriber.batch.clear();
+    }
+    
+    if (!drain_output(*conn)) {
+        shutdown(conn->fd, SHUT_RDWR);
+        return false;
+    }
+    if (conn->loop_index >= 0) {
+        arm_events(io_loops[conn->loop_index]->epoll_fd, *conn, !conn->out_buffer.empty());
+    } else {
+        unsent = !conn->out_buffer.empty();
+    }
+    return true;
+}
+
+// Drains the event queue: formats each event once per subscriber it is for,
+// then writes every subscriber's events at once. Table changes wait until the
+// events before them are written.
+void Tracker::event_loop() {
+    std::vector<GroupEvent> events;
+    std::vector<std::shared_ptr<Subscriber>> queued;    // subscribers with a batch or unsent bytes
+    std::vector<std::shared_ptr<Subscriber>> still_queued;
+    std::vector<std::weak_ptr<Connection>> leaving;
+    std::vector<NameId> left;
+    
+    auto write_queued = [&]() {
+        still_queued.clear();
+        for (const std::shared_ptr<Subscriber>& subscriber : queued) {
+            bool unsent;
+            if (!write_events(*subscriber, unsent)) {
+                subscriber->batch.clear();
+                subscriptions.unsubscribe(subscriber->connection, NO_NAME, left);
+            } else if (unsent) {
+                still_queued.push_back(subscriber);
+                continue;
+            }
+            subscriber->queued = false;
+        }
+        queued.swap(still_queued);
+        release_listeners(left);
+    };
+    
+    while (event_queue.take(events, std::chrono::milliseconds(queued.empty() ? 1000 : EVENT_RETRY_MS))) {
+        for (const GroupEvent& event : events) {
+            if (event.kind == EVENT_HANG_UP) {
+                // Their clients resubscribe with the new tracker; closing
+                // makes each connection unsubscribe as usual
+                write_queued();
+                leaving.clear();
+                subscriptions.list_connections(leaving);
+                for (const std::weak_ptr<Connection>& connection : leaving) {
+                    std::shared_ptr<Connection> conn = connection.lock();
+                    if (!conn) continue;
+                    std::lock_guard<std::mutex> lock(conn->mutex);
+                    if (conn->fd >= 0) shutdown(conn->fd, SHUT_RDWR);
+                }
+                leaving.clear();
+                continue;
+            }
+            if (event.kind == EVENT_SUBSCRIBE || event.kind == EVENT_UNSUBSCRIBE) {
+                write_queued();
+                if (event.kind == EVENT_UNSUBSCRIBE) {
+                    subscriptions.unsubscribe(event.connection, event.group, left);
+                } else if (!subscriptions.subscribe(event)) {
+                    left.push_back(event.group);            // already listening: undo the handler's count
+                }
+                release_listeners(left);
+                continue;
+            }
+            
+            std::vector<SubscriptionTable::Listener>* listeners = subscriptions.listeners(event.group);
+            if (listeners == NULL) continue;
+            for (SubscriptionTable::Listener& listener : *listeners) {
+                Subscriber& subscriber = *listener.subscriber;
+                if (event.audience != NO_NAME) {
+                    if (subscriber.user != event.audience) continue;
+                } else if (!listener.member) {
+                    // Pending: only its own acceptance, which makes it a member
+                    if (event.kind != EVENT_MEMBER_JOINED || event.user != subscriber.user) continue;
+                    listener.member = true;
+                }
+                if (event.kind == EVENT_MEMBER_LEFT && event.user == subscriber.user) {
+                    leaving.push_back(subscriber.connection);
+                }
+                append_event(subscriber.batch, event, group_names, user_names, file_names);
+                events_sent.fetch_add(1, std::memory_order_relaxed);
+                if (!subscriber.queued) {
+                    subscriber.queued = true;
+                    queued.push_back(listener.subscriber);
+                }
+            }
+            
+            // A member who left hears that much, then nothing more of the group
+            for (const std::weak_ptr<Connection>& connection : leaving) {
+                subscriptions.unsubscribe(connection, event.group, left);
+            }
+            leaving.clear();
+            release_listeners(left);
+        }
+        write_queued();
+    }
+}
+
+// SUBSCRIBE <user> [<group>]: this connection hears of changes to the group,
+// or to every group the user belongs to. Members get every event; a user whose
+// join request is pending hears only of its acceptance until then.
+void Tracker::handle_subscribe(const Request& request, std::string& out) {
+    if (request.size() < 2) {
+        out += "ERROR: Invalid SUBSCRIBE command\n";
+        return;
+    }
+    if (serving_connection == NULL || forwarded_request) {
+        out += "ERROR: SUBSCRIBE needs a client connection\n";
+        return;
+    }
+    
+    NameId user = user_names.find(request.arg(1));
+    if (!is_online(user)) {
+        out += "ERROR: User not logged in\n";
+        return;
+    }
+    
+    static thread_local std::vector<NameId> group_ids;
+    group_ids.clear();
+    if (request.size() >= 3) {
+        NameId group = group_names.find(request.arg(2));
+        if (!find_group(group)) {
+            out += "ERROR: Group not found\n";
+            return;
+        }
+        group_ids.push_back(group);
+    } else {
+        UserShard& shard = user_shard(user);
+        ReadGuard lock(shard.lock);
+        User* found = find_user(shard, user);
+        if (found != NULL) group_ids.assign(found->groups.begin(), found->groups.end());
+    }
+    
+    const std::shared_ptr<Connection>& conn = *serving_connection;
+    size_t subscribed = 0;
+    for (NameId id : group_ids) {
+        std::shared_ptr<GroupSlot> slot = find_group(id);
+        if (!slot) continue;
+        ReadGuard lock(slot->lock);
+        Group& group = slot->group;
+        bool member = group.members.contains(user);
+        if (!member && !group.pending_requests.contains(user)) continue;
+        
+        // Counted under the group lock, so every change made after this
+        // command is published, and queued behind the subscription
+        group.listeners.fetch_add(1, std::memory_order_relaxed);
+        GroupEvent event(EVENT_SUBSCRIBE, id, user);
+        event.member = member;
+        event.framed = serving_framed;
+        event.connection = conn;
+        event_queue.publish(event);
+        subscribed++;
+    }
+    
+    if (subscribed == 0) {
+        out += "ERROR: Not a member\n";
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        conn->subscribed = true;
+    }
+    out += "SUCCESS: Subscribed to ";
+    append_number(out, subscribed);
+    out += " group(s)\n";
+}
+
+// UNSUBSCRIBE <user> [<group>]: stop listening to the group, or to all of them.
+void Tracker::handle_unsubscribe(const Request& request, std::string& out) {
+    if (request.size() < 2) {
+        out += "ERROR: Invalid UNSUBSCRIBE command\n";
+        return;
+    }
+    if (serving_connection == NULL || forwarded_request) {
+        out += "ERROR: UNSUBSCRIBE needs a client connection\n";
+        return;
+    }
+    
+    NameId group = NO_NAME;
+    if (request.size() >= 3) {
+        group = group_names.find(request.arg(2));
+        if (!find_group(group)) {
+            out += "ERROR: Group not found\n";
+            return;
+        }
+    }
+    GroupEvent event(EVENT_UNSUBSCRIBE, group, user_names.find(request.arg(1)));
+    event.connection = *serving_connection;
+    event_queue.publish(event);
+    out += "SUCCESS: Unsubscribed\n";
+}
+
+//=================================================================================================
+// SHARDING (see sharding.h)
+//=================================================================================================
+
+// False when the group belongs to another shard; out then holds the REDIRECT.
+// A group still here (not moved yet) is served here whatever the ring says.
+bool Tracker::route_group(const CommandEntry& command, const Request& request, std::string& out) {
+    if (!sharded || command.group_arg == 0 || request.size() <= command.group_arg) return true;
+    const StrView& group = request.tokens[command.group_arg];
+    std::shared_ptr<const ShardMap> map = current_shards();
+    int owner = map->owner(group.data, group.size);
+    if (owner == map->self || find_group(group_names.find(group.data, group.size))) return true;
+    
+    out += "REDIRECT ";
+    out.append(group.data, group.size);
+    for (const TrackerPeer& peer : map->shards[owner].trackers) {
+        out += ' ';
+        out += peer.ip;
+        out += ':';
+        append_number(out, peer.port);
+    }
+    out += '\n';
+    return false;
+}
+
+// Forgets a group that moved to another shard: its shares, catalog links,
+// search entries and memberships. Caller holds the group's write lock and has
+// taken it out of the directory.
+void Tracker::drop_group(Group& group) {
+    for (SharedFile& shared : group.shared_files) {
+        FileShare share = { group.id, shared.file };
+        for (NameId seeder : shared.seeders) index_share(seeder, share, false);
+        for (const auto& holder : shared.pieces.holders) index_share(holder.first, share, false);
+        link_content(group, shared, std::string());
+        search_index.remove(shared.file, group.id);
+    }
+    group.shared_files.clear();
+    
+    std::vector<NameId> users(group.members.begin(), group.members.end());
+    users.push_back(group.owner);
+    for (NameId user : users) {
+        if (user == NO_NAME) continue;
+        UserShard& shard = user_shard(user);
+        WriteGuard lock(shard.lock);
+        User* found = find_user(shard, user);
+        if (found != NULL) found->groups.erase(group.id);
+    }
+    group.members.clear();
+    group.pending_requests.clear();
+    group.peers_changed();
+}
+
+// Appends a user's account and session as records, sealed for sending.
+void Tracker::append_account(NameId user, std::string& records) {
+    if (user == NO_NAME) return;
+    const std::string& user_id = user_names.name(user);
+    UserShard& shard = user_shard(user);
+    ReadGuard lock(shard.lock);
+    User* found = find_user(shard, user);
+    if (found == NULL) return;
+    records += user_record(WAL_USER_CREATE, user_id, *found).seal(0);
+    records += user_record(WAL_USER_SESSION, user_id, *found).seal(0);
+}
+
+// Sends one group to the shard the ring now gives it. The group stays here,
+// read-locked, until the target has committed the whole import: reads are
+// still served, and commands that change it wait. It then leaves the
+// directory, so later commands for it are redirected, and commands that
+// waited on it find it moved.
+MoveResult Tracker::move_group(NameId id, const ShardMap& map, std::vector<int>& connections) {
+    const std::string& group_id = group_names.name(id);
+    int target = map.owner(group_id);
+    std::shared_ptr<GroupSlot> slot = find_group(id);
+    if (!slot) return MOVE_DONE;                // gone meanwhile
+    
+    MoveResult result = MOVE_REFUSED;
+    {
+        ReadGuard lock(slot->lock);
+        const Group& group = slot->group;
+        
+        // The accounts the group refers to, then the group, then its catalog entries
+        std::string records;
+        IdSet users;
+        users.insert(group.owner);
+        for (NameId member : group.members) users.insert(member);
+        for (NameId pending : group.pending_requests) users.insert(pending);
+        for (const SharedFile& shared : group.shared_files) {
+            for (NameId seeder : shared.seeders) users.insert(seeder);
+            for (const auto& holder : shared.pieces.holders) users.insert(holder.first);
+        }
+        for (NameId user : users) append_account(user, records);
+        dump_group(group, [&records](WalRecord& record) { records += record.seal(0); });
+        for (const SharedFile& shared : group.shared_files) {
+            if (shared.file_hash.empty()) continue;
+            FileShard& shard = file_shard(shared.file_hash);
+            ReadGuard file_lock(shard.lock);
+            std::map<std::string, FileEntry>::const_iterator it = shard.files.find(shared.file_hash);
+            if (it != shard.files.end()) {
+                records += file_record(it->second, group_id, file_names.name(shared.file)).seal(0);
+            }
+        }
+        
+        std::string reply;
+        if (send_import(map, target, records, connections, reply)) {
+            // Still read-locked, so no writer has slipped in since the copy
+            slot->moved = true;
+            result = MOVE_DONE;
+        } else {
+            TLOG(LOG_WARN, YELLOW "⚠ Shard '%s' did not take group %s: %s" RESET,
+                 map.shards[target].name.c_str(), group_id.c_str(), reply.empty() ? "unreachable" : reply.c_str());
+        }
+    }
+    if (result != MOVE_DONE) return result;
+    
+    {
+        WriteGuard lock(groups_lock);
+        if (id < groups.size() && groups[id] == slot) groups[id].reset();
+    }
+    {
+        WriteGuard lock(slot->lock);
+        drop_group(slot->group);
+        if (logs_changes()) log_record(drop_record(group_id));
+    }
+    // The drop must be on disk before the group is gone for good
+    if (request_lsn != 0 && persistent()) wal.wait_durable(request_lsn);
+    return result;
+}
+
+// Sends records to the primary of a shard, reusing (or opening)
+// connections[shard]. Records that do not fit one frame go in numbered
+// batches, which the target applies together on the last one; after a lost
+// connection or a backup's answer, the next tracker of the shard gets every
+// batch again. True once the target has applied them all; reply holds the
+// last answer.
+bool Tracker::send_import(const ShardMap& map, int shard, const std::string& records, std::vector<int>& connections, std::string& reply) {
+    // Cut at record boundaries
+    std::vector<size_t> ends;
+    for (size_t pos = 0; pos < records.size(); ) {
+        size_t end = pos;
+        while (end < records.size() && (end == pos || end - pos < REPL_BATCH_BYTES)) {
+            uint32_t length;
+            memcpy(&length, records.data() + end, sizeof(length));
+            end += WAL_RECORD_HEADER + length;
+        }
+        ends.push_back(end);
+        pos = end;
+    }
+    if (ends.empty()) return true;
+    
+    // The cached connection first, then each tracker of the shard in turn
+    Frame answer;
+    const std::vector<TrackerPeer>& trackers = map.shards[shard].trackers;
+    for (size_t attempt = 0; attempt <= trackers.size(); ++attempt) {
+        int& fd = connections[shard];
+        if (attempt > 0) {
+            if (fd >= 0) close(fd);
+            const TrackerPeer& peer = trackers[attempt - 1];
+            fd = connect_tracker(peer.ip, peer.port);
+            if (fd < 0) continue;
+            set_socket_timeouts(fd, REPL_FORWARD_TIMEOUT_MS);
+        }
+        if (fd < 0) continue;
+        
+        bool sent = true;
+        for (size_t batch = 0; batch < ends.size() && sent; ++batch) {
+            size_t pos = batch == 0 ? 0 : ends[batch - 1];
+            std::string header = "IMPORT " + map.shards[map.self].name;
+            if (ends.size() > 1) header += " " + std::to_string(batch + 1) + "/" + std::to_string(ends.size());
+            if (!send_frame(fd, MSG_MIGRATE, header, records.substr(pos, ends[batch] - pos)) ||
+                !recv_frame(fd, answer) || answer.type != MSG_MIGRATE) {
+                close(fd);
+                fd = -1;
+                reply.clear();
+                sent = false;
+                break;
+            }
+            reply = answer.text;
+            while (!reply.empty() && reply.back() == '\n') reply.pop_back();
+            sent = reply.compare(0, 7, "SUCCESS") == 0;
+            // A backup says so; another answer is final
+            if (!sent && reply.find("Not the primary") == std::string::npos) return false;
+        }
+        if (sent) return true;
+    }
+    return false;
+}
+
+// A shard new to tracker_info.txt receives every account before any group,
+// so that members of moved groups can log in there.
+bool Tracker::send_accounts(const ShardMap& map, int shard, std::vector<int>& connections) {
+    std::string records;
+    std::string reply;
+    size_t accounts = 0;
+    for (int i = 0; i < USER_SHARDS; ++i) {
+        {
+            ReadGuard lock(user_shards[i].lock);
+            const std::vector<User>& users = user_shards[i].users;
+            for (size_t index = 0; index < users.size(); ++index) {
+                if (!users[index].exists) continue;
+                const std::string& user_id = user_names.name(index * USER_SHARDS + i);
+                records += user_record(WAL_USER_CREATE, user_id, users[index]).seal(0);
+                records += user_record(WAL_USER_SESSION, user_id, users[index]).seal(0);
+                accounts++;
+            }
+        }
+        // Sent with no lock held
+        if (records.size() >= REPL_BATCH_BYTES || i == USER_SHARDS - 1) {
+            if (!send_import(map, shard, records, connections, reply)) {
+                TLOG(LOG_WARN, YELLOW "⚠ Could not send accounts to shard '%s': %s" RESET,
+                     map.shards[shard].name.c_str(), reply.empty() ? "unreachable" : reply.c_str());
+                return false;
+            }
+            records.clear();
+        }
+    }
+    TLOG(LOG_INFO, CYAN "👥 Sent %zu account(s) to shard '%s'" RESET, accounts, map.shards[shard].name.c_str());
+    return true;
+}
+
+// Moves every group the ring gives to another shard. Returns false if some
+// have to wait for the next check.
+bool Tracker::rebalance(const ShardMap& map, std::vector<int>& connections) {
+    std::vector<NameId> misplaced;
+    {
+        ReadGuard lock(groups_lock);
+        for (size_t id = 0; id < groups.size(); ++id) {
+            if (groups[id] && map.owner(group_names.name(id)) != map.self) misplaced.push_back(id);
+        }
+    }
+    if (misplaced.empty()) return true;
+    
+    auto started = std::chrono::steady_clock::now();
+    TLOG(LOG_INFO, CYAN "🚚 Moving %zu group(s) to other shards" RESET, misplaced.size());
+    std::vector<bool> refused(map.shards.size(), false);
+    size_t moved = 0;
+    for (NameId id : misplaced) {
+        int target = map.owner(group_names.name(id));
+        if (shard_stopping || current_role() != ROLE_PRIMARY) break;
+        if (refused[target]) continue;          // tried again at the next check
+        if (!begin_local_change()) break;
+        MoveResult result = move_group(id, map, connections);
+        end_local_change();
+        if (result == MOVE_DONE) moved++;
+        if (result == MOVE_REFUSED) refused[target] = true;
+    }
+    groups_moved_out += moved;
+    
+    long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+    TLOG(LOG_INFO, GREEN "✓ Moved %zu of %zu group(s) in %ld ms" RESET, moved, misplaced.size(), elapsed_ms);
+    return moved == misplaced.size();
+}
+
+// Watches tracker_info.txt. After a change the primary sends the accounts to
+// shards new to the file, then moves away the groups that now belong
+// elsewhere. Whatever could not be done is retried at the next check.
+void Tracker::shard_loop() {
+    struct stat info;
+    struct timespec loaded = {0, 0};
+    if (stat(tracker_file.c_str(), &info) == 0) loaded = info.st_mtim;
+    std::vector<std::string> unsynced;          // shards still owed the accounts
+    bool misplaced = true;                      // groups may belong elsewhere
+    
+    while (!shard_stopping) {
+        for (int waited = 0; waited < SHARD_CHECK_MS && !shard_stopping; waited += 100) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        if (shard_stopping) break;
+        
+        if (stat(tracker_file.c_str(), &info) == 0 &&
+            (info.st_mtim.tv_sec != loaded.tv_sec || info.st_mtim.tv_nsec != loaded.tv_nsec)) {
+            loaded = info.st_mtim;
+            std::shared_ptr<ShardMap> map = std::make_shared<ShardMap>();
+            if (!read_shard_map(tracker_file, tracker_number, *map)) {
+                TLOG(LOG_WARN, YELLOW "⚠ %s no longer lists tracker %d, keeping the current shards" RESET,
+                     tracker_file.c_str(), tracker_number);
+                continue;
+            }
+            std::shared_ptr<const ShardMap> old = current_shards();
+            
+            // Replicas are connected at startup only
+            const std::vector<TrackerPeer>& now = map->shards[map->self].trackers;
+            const std::vector<TrackerPeer>& before = old->shards[old->self].trackers;
+            bool replicas_changed = now.size() != before.size();
+            for (size_t i = 0; i < now.size() && !replicas_changed; ++i) {
+                replicas_changed = now[i].number != before[i].number || now[i].ip != before[i].ip || now[i].port != before[i].port;
+            }
+            if (replicas_changed) {
+                TLOG(LOG_WARN, YELLOW "⚠ The trackers of this shard changed in %s; restart them to replicate with the new ones" RESET,
+                     tracker_file.c_str());
+            }
+            
+            for (const Shard& shard : map->shards) {
+                bool known = false;
+                for (const Shard& previous : old->shards) known = known || previous.name == shard.name;
+                if (!known) unsynced.push_back(shard.name);
+            }
+            sharded = map->shards.size() > 1;
+            std::atomic_store(&shard_map, std::shared_ptr<const ShardMap>(map));
+            misplaced = true;
+            TLOG(LOG_INFO, CYAN "🗺️  Reloaded %s: %zu shard(s)" RESET, tracker_file.c_str(), map->shards.size());
+        }
+        
+        // The primary moves groups; backups follow its log
+        if ((!misplaced && unsynced.empty()) || current_role() != ROLE_PRIMARY) continue;
+        std::shared_ptr<const ShardMap> map = current_shards();
+        std::vector<int> connections(map->shards.size(), -1);
+        for (size_t i = 0; i < unsynced.size(); ) {
+            int shard = 0;
+            while (shard < static_cast<int>(map->shards.size()) && map->shards[shard].name != unsynced[i]) ++shard;
+            if (shard == static_cast<int>(map->shards.size()) || shard == map->self || send_accounts(*map, shard, connections)) {
+                unsynced.erase(unsynced.begin() + i);
+            } else {
+                ++i;
+            }
+        }
+        // Members must be able to log in where their groups go
+        if (unsynced.empty()) misplaced = !rebalance(*map, connections);
+        for (int fd : connections) {
+            if (fd >= 0) close(fd);
+        }
+    }
+}
+
+// IMPORT <shard> [<batch>/<batches>]: records another shard sends along with
+// a group (see sharding.h). Each batch is checked on arrival and kept until
+// the last one, which applies them all as this tracker's own changes; the
+// answer goes out once they are durable. Batch 1 discards any earlier batches
+// from the same shard, and the others must follow on its connection, so an
+// import cut short leaves nothing behind.
+void Tracker::import_records(const Frame& request, std::string& out) {
+    if (request.text.compare(0, 7, "IMPORT ") != 0) {
+        out += "ERROR: Unknown request\n";
+        return;
+    }
+    std::string source = request.text.substr(7);
+    int batch = 1, batches = 1;
+    size_t space = source.find(' ');
+    if (space != std::string::npos) {
+        if (sscanf(source.c_str() + space + 1, "%d/%d", &batch, &batches) != 2 || batch < 1 || batch > batches) {
+            out += "ERROR: Invalid IMPORT batch\n";
+            return;
+        }
+        source.resize(space);
+    }
+    if (!begin_local_change()) {
+        out += "ERROR: Tracker restarting, retry later\n";
+        return;
+    }
+    if (current_role() != ROLE_PRIMARY) {
+        end_local_change();
+        out += "ERROR: Not the primary tracker\n";
+        return;
+    }
+    
+    // Only accounts and the kinds of record move_group sends, and every group
+    // they touch must be one our own copy of the file gives to this shard
+    std::shared_ptr<const ShardMap> map = current_shards();
+    const char* data = request.blob.data();
+    size_t length = request.blob.size();
+    std::string refused;
+    int foreign_type = 0;
+    bool damaged = false;
+    bool intact = wal_for_each_record(data, length, [&](const char*, size_t, WalReader& record) {
+        if (!refused.empty() || foreign_type != 0 || damaged) return;
+        WalReader fields = record;
+        switch (record.type) {
+            case WAL_USER_CREATE:
+            case WAL_USER_SESSION:
+                return;
+            case WAL_FILE_PUT:
+                fields.next();              // hash, filename, owner, then the group
+                fields.next();
+                fields.next();
+                break;
+            case WAL_GROUP_CREATE:
+            case WAL_GROUP_OWNER:
+            case WAL_GROUP_MEMBER:
+            case WAL_GROUP_PENDING:
+            case WAL_GROUP_SHARE:
+            case WAL_FILE_PIECES:
+            case WAL_PIECE_HAVE:
+            case WAL_FILE_LINK:
+                break;
+            default:
+                foreign_type = record.type;
+                return;
+        }
+        std::string group_id = fields.next();
+        if (!fields.ok()) damaged = true;
+        else if (map->owner(group_id) != map->self) refused = group_id;
+    });
+    
+    std::string staged;                     // the earlier batches, once this is the last
+    {
+        std::lock_guard<std::mutex> lock(import_mutex);
+        StagedImport& import = staged_imports[source];
+        uint64_t connection = serving_connection != NULL ? (*serving_connection)->id : 0;
+        if (batch == 1) {
+            import.records.clear();
+            import.batches = 0;
+            import.connection = connection;
+        }
+        bool in_order = batch == import.batches + 1 && connection == import.connection;
+        if (!intact || damaged || !refused.empty() || foreign_type != 0 || !in_order) {
+            staged_imports.erase(source);
+            end_local_change();
+            if (!intact || damaged) out += "ERROR: Damaged records\n";
+            else if (foreign_type != 0) out += "ERROR: Records of type " + std::to_string(foreign_type) + " are not imported\n";
+            else if (!refused.empty()) out += "ERROR: Group " + refused + " belongs to another shard here\n";
+            else out += "ERROR: Import batch out of order\n";
+            return;
+        }
+        if (batch < batches) {
+            import.records.append(data, length);
+            import.batches = batch;
+            end_local_change();
+            out += "SUCCESS: Staged batch ";
+            append_number(out, batch);
+            out += " of ";
+            append_number(out, batches);
+            out += '\n';
+            return;
+        }
+        staged.swap(import.records);
+        staged_imports.erase(source);
+    }
+    if (!staged.empty()) {
+        staged.append(data, length);
+        data = staged.data();
+        length = staged.size();
+    }
+    
+    // Accounts already known here keep their state: their sessions reach this
+    // shard directly. Everything else is set as sent.
+    static thread_local WalRecord copy;
+    IdSet created;                          // accounts new to this shard
+    size_t groups_added = 0;
+    request_lsn = 0;
+    wal_for_each_record(data, length, [&](const char* sealed, size_t sealed_length, WalReader& record) {
+        if (record.type == WAL_USER_CREATE || record.type == WAL_USER_SESSION) {
+            WalReader peek = record;
+            std::string user_id = peek.next();
+            NameId id = user_names.find(user_id);
+            if (record.type == WAL_USER_CREATE) {
+                if (id != NO_NAME) {
+                    UserShard& shard = user_shard(id);
+                    ReadGuard lock(shard.lock);
+                    if (find_user(shard, id) != NULL) return;
+                }
+                apply_record(record);
+                created.insert(user_names.find(user_id));
+            } else {
+                if (id == NO_NAME || !created.contains(id)) return;
+                apply_record(record);
+                UserShard& shard = user_shard(id);
+                WriteGuard lock(shard.lock);
+                User* user = find_user(shard, id);
+                if (user != NULL && user->online) renew_lease(*user, id);
+            }
+        } else {
+            if (record.type == WAL_GROUP_CREATE) groups_added++;
+            apply_record(record);
+        }
+        if (logs_changes()) {
+            copy.assign(sealed, sealed_length);
+            log_record(copy);
+        }
+    });
+    groups_moved_in += groups_added;
+    
+    bool durable = request_lsn == 0 || !persistent() || wal.wait_durable(request_lsn);
+    end_local_change();
+    if (!durable) {
+        out += "ERROR: Could not persist change\n";
+        return;
+    }
+    out += "SUCCESS: Imported ";
+    append_number(out, groups_added);
+    out += " group(s)\n";
+}
+
+//=================================================================================================
+// HOT RESTART (see handoff.h)
+//=================================================================================================
+
+// Counts a state change made by this process; false once it is handing off.
+bool Tracker::begin_local_change() {
+    local_changes++;
+    if (!handing_off) return true;
+    local_changes--;
+    return false;
+}
+
+static int bound_port(int fd) {
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    if (getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &length) != 0) return -1;
+    return ntohs(addr.sin_port);
+}
+
+// New tracker: receives the running tracker's sockets and state. It keeps
+// serving until finish_take_over() says we are ready.
+bool Tracker::take_over() {
+    auto started = std::chrono::steady_clock::now();
+    set_socket_timeouts(handoff_peer, HANDOFF_TIMEOUT_MS);
+    std::cout << YELLOW << "🔁 Taking over from the tracker running at " << config.handoff_path << RESET << std::endl;
+    
+    Frame frame;
+    int fds[HANDOFF_MAX_LISTENERS];
+    int count = 0;
+    if (!send_frame(handoff_peer, MSG_HANDOFF, "HANDOFF") ||
+        !recv_frame_with_fds(handoff_peer, frame, fds, HANDOFF_MAX_LISTENERS, count) ||
+        frame.type != MSG_HANDOFF || frame.text.compare(0, 10, "LISTENERS ") != 0 || count < 1) {
+        for (int i = 0; i < count; ++i) close(fds[i]);
+        std::cerr << RED << "The running tracker did not hand over its socket" << RESET << std::endl;
+        return false;
+    }
+    server_socket = fds[0];
+    if (count > 1) {
+        // Its metrics port, kept only if ours is the same
+        if (config.metrics_port > 0 && bound_port(fds[1]) == config.metrics_port) metrics_socket = fds[1];
+        else close(fds[1]);
+    }
+    
+    unsigned long records = 0;
+    char handed_role[16];
+    unsigned long long handed_term = 0, handed_previous = 0, handed_promotion = 0, handed_lsn = 0;
+    bool ok = false;
+    while (recv_frame(handoff_peer, frame) && frame.type == MSG_HANDOFF) {
+        if (frame.text == "STATE") {
+            wal_for_each_record(frame.blob.data(), frame.blob.size(), [&](const char*, size_t, WalReader& record) {
+                apply_record(record);
+                records++;
+            });
+            continue;
+        }
+        ok = sscanf(frame.text.c_str(), "HANDED %15s %llu %llu %llu %llu", handed_role, &handed_term,
+                    &handed_previous, &handed_promotion, &handed_lsn) == 5;
+        break;
+    }
+    if (!ok) {
+        std::cerr << RED << "The running tracker did not hand over its state" << RESET << std::endl;
+        return false;
+    }
+    
+    // A primary stays primary in the same term, so its backups resume; anything else looks for one
+    last_lsn = handed_lsn;
+    term = handed_term;
+    previous_term = handed_previous;
+    promotion_lsn = handed_promotion;
+    if (strcmp(handed_role, "PRIMARY") != 0) role = ROLE_STARTING;
+    
+    if (!config.data_dir.empty()) {
+        const std::string& dir = config.data_dir;
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::cerr << RED << "Failed to create data directory " << dir << ": " << strerror(errno) << RESET << std::endl;
+            return false;
+        }
+        if (!wal.open(dir, last_lsn + 1, config.wal_sync)) {
+            std::cerr << RED << "Failed to open write-ahead log in " << dir << ": " << strerror(errno) << RESET << std::endl;
+            return false;
+        }
+        snapshot_thread = std::thread(&Tracker::snapshot_loop, this);
+    }
+    
+    long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+    std::cout << GREEN << "✓ Received " << records << " record(s) through lsn " << handed_lsn << " in "
+              << elapsed_ms << " ms" << RESET << std::endl;
+    return true;
+}
+
+// New tracker, about to accept: the old one stops and drains once it hears
+// we are ready. Without its answer it may have carried on, so we must not.
+bool Tracker::finish_take_over() {
+    Frame frame;
+    bool ok = send_frame(handoff_peer, MSG_HANDOFF, "READY") && recv_frame(handoff_peer, frame) &&
+              frame.type == MSG_HANDOFF && frame.text == "DRAINING";
+    close(handoff_peer);
+    handoff_peer = -1;
+    if (!ok) {
+        std::cerr << RED << "The running tracker did not let go of port " << port << RESET << std::endl;
+        return false;
+    }
+    std::cout << GREEN << "✓ Took over port " << port << " without closing it" << RESET << std::endl;
+    return true;
+}
+
+// Old tracker, on the accept thread: hands the listening sockets and the
+// state to a new tracker. True once it is up; false if it failed, in which
+// case this tracker carries on as if nothing happened.
+bool Tracker::hand_off(int peer) {
+    auto started = std::chrono::steady_clock::now();
+    set_socket_timeouts(peer, HANDOFF_TIMEOUT_MS);
+    Frame frame;
+    if (!recv_frame(peer, frame) || frame.type != MSG_HANDOFF || frame.text != "HANDOFF") {
+        close(peer);
+        return false;
+    }
+    TLOG(LOG_INFO, CYAN "🔁 A new tracker is taking over; pausing changes" RESET);
+    
+    // From here on commands go to the new tracker, which answers them once it is up
+    handing_off = true;
+    while (local_changes > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        lsn = last_lsn;
+    }
+    bool ok = !persistent() || wal.wait_durable(lsn);
+    
+    int fds[HANDOFF_MAX_LISTENERS] = { server_socket, metrics_socket };
+    int count = metrics_socket >= 0 ? 2 : 1;
+    ok = ok && send_frame_with_fds(peer, MSG_HANDOFF, "LISTENERS " + std::to_string(count), fds, count);
+    
+    std::string batch;
+    unsigned long records = 0;
+    if (ok) {
+        dump_state([&](WalRecord& record) {
+            batch += record.seal(0);
+            records++;
+            if (ok && batch.size() >= REPL_BATCH_BYTES) {
+                ok = send_frame(peer, MSG_HANDOFF, "STATE", batch);
+                batch.clear();
+            }
+        });
+    }
+    ok = ok && (batch.empty() || send_frame(peer, MSG_HANDOFF, "STATE", batch));
+    
+    std::string handed = "HANDED ";
+    {
+        std::lock_guard<std::mutex> lock(role_mutex);
+        handed += role_name(role);
+        handed += " " + std::to_string(term) + " " + std::to_string(previous_term) + " " + std::to_string(promotion_lsn);
+    }
+    handed += " " + std::to_string(lsn);
+    ok = ok && send_frame(peer, MSG_HANDOFF, handed) && recv_frame(peer, frame) &&
+         frame.type == MSG_HANDOFF && frame.text == "READY" && send_frame(peer, MSG_HANDOFF, "DRAINING");
+    close(peer);
+    
+    if (!ok) {
+        handing_off = false;
+        TLOG(LOG_ERROR, RED "❌ The new tracker did not take over; carrying on" RESET);
+        return false;
+    }
+    handed_over = true;
+    
+    // Subscribers reconnect to the new tracker; metrics are its to serve
+    event_queue.publish(GroupEvent(EVENT_HANG_UP, NO_NAME, NO_NAME));
+    metrics_stopping = true;
+    
+    long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+    TLOG(LOG_INFO, BOLD GREEN "🔁 Handed over to the new tracker: %lu records through lsn %llu in %ld ms" RESET,
+         records, static_cast<unsigned long long>(lsn), elapsed_ms);
+    return true;
+}
+
+// Old tracker, after a handoff: commands on the connections still open are
+// forwarded to the new tracker until their clients close them.
+void Tracker::drain_connections() {
+    TLOG(LOG_INFO, CYAN "🔁 Draining %d connection(s), for up to %d s" RESET, active_connections.load(), config.drain_seconds);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config.drain_seconds);
+    while (active_connections > 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (active_connections > 0) {
+        TLOG(LOG_WARN, YELLOW "⚠ Closing %d connection(s) still open after %d s" RESET, active_connections.load(), config.drain_seconds);
+    } else {
+        TLOG(LOG_INFO, GREEN "✓ All connections drained" RESET);
+    }
+    running = false;
+}
+
+// Tools that link tracker.cpp (see microbench.cpp) provide their own main()
+#ifndef TRACKER_NO_MAIN
+
+static void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " <tracker_info.txt> <tracker_number> [options]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --reactor              Use the epoll reactor instead of a thread per client" << std::endl;
+    std::cerr << "  --backlog=N            Listen backlog (default " << DEFAULT_LISTEN_BACKLOG << ")" << std::endl;
+    std::cerr << "  --io-threads=N         Reactor I/O threads (default " << DEFAULT_IO_THREADS << ")" << std::endl;
+    std::cerr << "  --workers=N            Reactor worker threads (default " << DEFAULT_WORKER_THREADS << ")" << std::endl;
+    std::cerr << "  --queue=N              Max queued connections awaiting a worker (default " << DEFAULT_WORKER_QUEUE << ")" << std::endl;
+    std::cerr << "  --idle-timeout=SEC     Close connections idle this long, 0 = never (default " << DEFAULT_IDLE_TIMEOUT << ")" << std::endl;
+    std::cerr << "  --log-level=LEVEL      debug, info, warn, error or off (default info)" << std::endl;
+    std::cerr << "  --log-sample=N         Log 1 in N per-request lines, 0 = none (default 1)" << std::endl;
+    std::cerr << "  --data-dir=DIR         Persist state (write-ahead log + snapshots) in DIR" << std::endl;
+    std::cerr << "  --wal-sync=MODE        commit: reply after fsync, async: fsync every 10ms (default commit)" << std::endl;
+    std::cerr << "  --snapshot-every=N     Snapshot after N logged changes, 0 = never (default " << DEFAULT_SNAPSHOT_EVERY << ")" << std::endl;
+    std::cerr << "  --standalone           Do not replicate with the other trackers" << std::endl;
+    std::cerr << "  --lease=SEC            Take clients offline after SEC without a heartbeat, 0 = never (default " << DEFAULT_LEASE_SECONDS << ")" << std::endl;
+    std::cerr << "  --metrics-port=PORT    Serve Prometheus metrics over HTTP on PORT (default off)" << std::endl;
+    std::cerr << "  --trace=FILE           Record client commands to FILE for tracker/trace_replay" << std::endl;
+    std::cerr << "  --handoff=PATH         Hot restart: take over from the tracker listening at PATH, then listen there" << std::endl;
+    std::cerr << "  --drain=SEC            After handing over, keep serving open connections up to SEC (default " << DEFAULT_DRAIN_SECONDS << ")" << std::endl;
+    std::cerr << "  --cluster-key=FILE     Trackers prove they belong to the cluster with the key in FILE" << std::endl;
+}
+
+static bool parse_option(const std::string& arg, TrackerConfig& config) {
+    size_t eq = arg.find('=');
+    std::string name = arg.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    
+    try {
+        if (name == "--reactor" && value.empty()) {
+            config.mode = MODE_REACTOR;
+        } else if (name == "--backlog") {
+            config.listen_backlog = std::stoi(value);
+        } else if (name == "--io-threads") {
+            config.io_threads = std::stoi(value);
+        } else if (name == "--workers") {
+            config.worker_threads = std::stoi(value);
+        } else if (name == "--queue") {
+            config.worker_queue_limit = std::stoul(value);
+        } else if (name == "--idle-timeout") {
+            config.idle_timeout_seconds = std::stoi(value);
+        } else if (name == "--log-level") {
+            return parse_log_level(value, config.log_level);
+        } else if (name == "--log-sample") {
+            config.log_sample_every = std::stoul(value);
+        } else if (name == "--data-dir" && !value.empty()) {
+            config.data_dir = value;
+        } else if (name == "--wal-sync") {
+            if (value == "commit") config.wal_sync = WAL_SYNC_COMMIT;
+            else if (value == "async") config.wal_sync = WAL_SYNC_ASYNC;
+            else return false;
+        } else if (name == "--snapshot-every") {
+            config.snapshot_every = std::stoul(value);
+        } else if (name == "--standalone" && value.empty()) {
+            config.replication = false;
+        } else if (name == "--lease") {
+            config.lease_seconds = std::stoi(value);
+        } else if (name == "--metrics-port") {
+            config.metrics_port = std::stoi(value);
+        } else if (name == "--trace" && !value.empty()) {
+            config.trace_path = value;
+        } else if (name == "--handoff" && !value.empty()) {
+            config.handoff_path = value;
+        } else if (name == "--drain") {
+            config.drain_seconds = std::stoi(value);
+        } else if (name == "--cluster-key" && !value.empty()) {
+            // Read from a file so the key stays out of the process list
+            std::ifstream key_file(value);
+            std::getline(key_file, config.cluster_key);
+            while (!config.cluster_key.empty() && isspace(static_cast<unsigned char>(config.cluster_key.back()))) {
+                config.cluster_key.pop_back();
+            }
+            if (config.cluster_key.empty()) return false;
+        } else {
+            return false;
+        }
+    } catch (const std::exception& e) {
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    std::string tracker_file(argv[1]);
     int tracker_number = std::stoi(argv[2]);
     
+    TrackerConfig config;
+    for (int i = 3; i < argc; ++i) {
+        if (!parse_option(argv[i], config)) {
+            std::cerr << "Unknown or invalid option: " << argv[i] << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
     std::ifstream file(tracker_file);
     if (!file.is_open()) {
         std::cerr << "Failed to open tracker info file" << std::endl;
@@ -686,12 +4953,20 @@ int main(int argc, char* argv[]) {
         return 1;
     }
     
-    Tracker tracker(port, tracker_number);
+    Tracker tracker(port, tracker_number, config);
     if (!tracker.initialize(tracker_file)) {
         std::cerr << "Failed to initialize tracker" << std::endl;
         return 1;
     }
     
     tracker.run();
+    if (tracker.handed_off()) {
+        // Threads of connections cut short may still be running; the new tracker owns the state now
+        Logger::instance().flush();
+        std::cout << std::flush;
+        _exit(0);
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+#endif // TRACKER_NO_MAIN
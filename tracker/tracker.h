@@ -12,41 +12,431 @@
 #include <sstream>
 #include <algorithm>
 #include <cstring>
+#include <cerrno>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <signal.h>
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <condition_variable>
+#include <chrono>
+#include "protocol.h"
+#include "rwlock.h"
+#include "logger.h"
+#include "wal.h"
+#include "replication.h"
+#include "intern.h"
+#include "timer_wheel.h"
+#include "metrics.h"
+#include "trace.h"
+#include "search.h"
+#include "events.h"
+#include "handoff.h"
+#include "sharding.h"
 
 #define MAX_BUFFER_SIZE 65536
 #define MAX_CLIENTS 100
 
+// Reactor defaults (overridable from the command line)
+#define DEFAULT_LISTEN_BACKLOG 1024
+#define DEFAULT_IO_THREADS 2
+#define DEFAULT_WORKER_THREADS 4
+#define DEFAULT_WORKER_QUEUE 4096
+#define DEFAULT_IDLE_TIMEOUT 300
+#define MAX_COMMAND_SIZE (16 * 1024 * 1024)
+#define READ_CHUNK_SIZE 4096
+
+// Command parsing
+#define MAX_COMMAND_TOKENS 16
+#define COMMAND_TABLE_SIZE 64           // power of two, well above the command count
+#define LIST_PAGE_SIZE 1000             // most entries in one LIST_FILES/LIST_GROUPS reply
+
+// Session leases
+#define DEFAULT_LEASE_SECONDS 60        // clients heartbeat every third of this
+#define LEASE_TICK_MS 250               // lease timer resolution
+
+// Metrics
+#define METRICS_SAMPLE_EVERY 8          // time 1 in N commands per thread
+
+// Persistence
+#define DEFAULT_SNAPSHOT_EVERY 100000   // WAL records between snapshots
+
+// Files
+#define PIECE_SIZE 524288               // 512KB, as cut by the client
+#define PIECE_DIGEST_SIZE 20            // raw SHA1 of one piece
+
+// Lock striping for tracker state
+#define USER_SHARDS 64
+#define FILE_SHARDS 64
+
+// Users, groups and files are identified by interned IDs (see intern.h);
+// names are looked up in the tracker's NameTables.
+
+// A shared file, named by its group and file name
+struct FileShare {
+    NameId group;
+    NameId file;
+    
+    bool operator==(const FileShare& other) const { return group == other.group && file == other.file; }
+};
+
+// Set of shares as a sorted vector of (group << 32 | file) keys. A group's
+// shares are contiguous, so they can be taken out in one range.
+class ShareSet {
+private:
+    std::vector<uint64_t> keys;
+    
+    static uint64_t key(const FileShare& share) { return static_cast<uint64_t>(share.group) << 32 | share.file; }
+    
+public:
+    bool insert(const FileShare& share) {
+        uint64_t k = key(share);
+        std::vector<uint64_t>::iterator it = std::lower_bound(keys.begin(), keys.end(), k);
+        if (it != keys.end() && *it == k) return false;
+        keys.insert(it, k);
+        return true;
+    }
+    
+    bool erase(const FileShare& share) {
+        uint64_t k = key(share);
+        std::vector<uint64_t>::iterator it = std::lower_bound(keys.begin(), keys.end(), k);
+        if (it == keys.end() || *it != k) return false;
+        keys.erase(it);
+        return true;
+    }
+    
+    // Moves the shares in group (every share for NO_NAME) to out
+    void take(NameId group, std::vector<FileShare>& out) {
+        std::vector<uint64_t>::iterator first = keys.begin(), last = keys.end();
+        if (group != NO_NAME) {
+            first = std::lower_bound(keys.begin(), keys.end(), static_cast<uint64_t>(group) << 32);
+            last = std::lower_bound(first, keys.end(), (static_cast<uint64_t>(group) + 1) << 32);
+        }
+        for (std::vector<uint64_t>::iterator it = first; it != last; ++it) {
+            FileShare share = { static_cast<NameId>(*it >> 32), static_cast<NameId>(*it) };
+            out.push_back(share);
+        }
+        keys.erase(first, last);
+    }
+    
+    size_t size() const { return keys.size(); }
+    size_t capacity() const { return keys.capacity(); }
+};
+
 struct User {
-    std::string user_id;
+    bool exists;                        // the slot holds a registered user
     std::string password;
     std::string ip;
     int port;
     bool online;
-    std::set<std::string> groups;
+    IdSet groups;
+    ShareSet shares;                    // files seeded or partly held, possibly a few no longer are
+    uint64_t lease_expires;             // lease tick the session lasts until without a heartbeat
+    uint64_t lease_timer;               // tick of this user's pending lease timer, 0 if none
+    bool lease_lapsed;                  // went offline because the lease ran out, not by LOGOUT
+    
+    User() : exists(false), port(0), online(false), lease_expires(0), lease_timer(0), lease_lapsed(false) {}
+};
+
+// Pieces held by members still downloading a file; users holding the whole
+// file are its seeders instead. Bit i of a bitfield is set when piece i is
+// held (byte i / 8, most significant bit first).
+struct PieceAvailability {
+    long piece_count;
+    std::map<NameId, std::string> holders;          // user -> (piece_count + 7) / 8 bytes
+    
+    PieceAvailability() : piece_count(0) {}
+};
+
+// Serialized DOWNLOAD_FILE reply for one shared file, kept until the group's
+// peer version moves past the one it was built at. One request rebuilds a stale
+// reply; identical requests arriving meanwhile wait for it instead of
+// rebuilding it too. Index 0 is the plain reply, 1 the one with PIECES.
+#define NO_PEER_VERSION UINT64_MAX
+
+struct PeerListCache {
+    std::mutex mutex;
+    std::condition_variable built;
+    uint64_t version[2];                // group peer version reply was built at
+    bool building[2];
+    std::string reply[2];
+    
+    PeerListCache() {
+        version[0] = version[1] = NO_PEER_VERSION;
+        building[0] = building[1] = false;
+    }
+};
+
+struct SharedFile {
+    NameId file;
+    std::string file_hash;              // catalog entry for its content, empty if never uploaded with one
+    IdSet seeders;                      // users holding the whole file
+    PieceAvailability pieces;
+    std::shared_ptr<PeerListCache> peer_list;
 };
 
 struct Group {
-    std::string group_id;
-    std::string owner;
-    std::set<std::string> members;
-    std::set<std::string> pending_requests;
-    std::map<std::string, std::vector<std::string>> shared_files;
+    NameId id;
+    NameId owner;
+    IdSet members;
+    IdSet pending_requests;
+    std::vector<SharedFile> shared_files;   // sorted by file ID
+    
+    // Bumped after every change that can alter a DOWNLOAD_FILE reply: seeders,
+    // partial holders, membership, or a member's session (login/logout).
+    std::atomic<uint64_t> peers_version;
+    std::atomic<uint32_t> listeners;    // SUBSCRIBE-d connections; events are only published if any
+    
+    Group() : id(NO_NAME), owner(NO_NAME), peers_version(0), listeners(0) {}
+    
+    void peers_changed() { peers_version.fetch_add(1, std::memory_order_release); }
+    
+    const SharedFile* find_file(NameId file) const {
+        std::vector<SharedFile>::const_iterator it = std::lower_bound(shared_files.begin(), shared_files.end(), file, file_before);
+        return it != shared_files.end() && it->file == file ? &*it : NULL;
+    }
+    SharedFile* find_file(NameId file) {
+        return const_cast<SharedFile*>(static_cast<const Group*>(this)->find_file(file));
+    }
+    // First shared file whose ID is not below file
+    std::vector<SharedFile>::const_iterator files_from(NameId file) const {
+        return std::lower_bound(shared_files.begin(), shared_files.end(), file, file_before);
+    }
+    SharedFile& add_file(NameId file) {
+        std::vector<SharedFile>::iterator it = std::lower_bound(shared_files.begin(), shared_files.end(), file, file_before);
+        if (it == shared_files.end() || it->file != file) {
+            it = shared_files.insert(it, SharedFile());
+            it->file = file;
+            it->peer_list = std::make_shared<PeerListCache>();
+        }
+        return *it;
+    }
+    void remove_file(NameId file) {
+        std::vector<SharedFile>::iterator it = std::lower_bound(shared_files.begin(), shared_files.end(), file, file_before);
+        if (it != shared_files.end() && it->file == file) shared_files.erase(it);
+    }
+    
+private:
+    static bool file_before(const SharedFile& shared, NameId file) { return shared.file < file; }
 };
 
+// Content catalog entry, keyed by whole-file hash. Content shared in several
+// groups, or under several names, has one entry that every share points to
+// (SharedFile::file_hash), so its piece digests are stored and sent only once.
 struct FileEntry {
-    std::string filename;
     std::string file_hash;
-    std::vector<std::string> piece_hashes;
+    std::string piece_digests;          // PIECE_DIGEST_SIZE bytes per piece, back to back
     long file_size;
-    std::string owner;
-    std::string group_id;
+    std::string owner;                  // first uploader
+    std::vector<FileShare> shares;      // dropped with the last share
+    
+    FileEntry() : file_size(0) {}
+    
+    size_t piece_count() const { return piece_digests.size() / PIECE_DIGEST_SIZE; }
+    
+    // Bytes this entry occupies, counting string capacity rather than length
+    size_t memory_usage() const {
+        return sizeof(FileEntry) + file_hash.capacity() + piece_digests.capacity() + owner.capacity() +
+               shares.capacity() * sizeof(FileShare);
+    }
+};
+
+// Non-owning view of a token inside a received command (std::string_view is C++17).
+struct StrView {
+    const char* data;
+    size_t size;
+    
+    StrView() : data(""), size(0) {}
+    StrView(const char* data, size_t size) : data(data), size(size) {}
+    
+    bool operator==(const char* literal) const {
+        return strncmp(data, literal, size) == 0 && literal[size] == '\0';
+    }
+    std::string str() const { return std::string(data, size); }
+};
+
+// A tokenized command. Tokens point into the caller's receive buffer; arg()
+// copies one into a scratch string whose capacity is kept between requests,
+// so map lookups by name do not allocate once a thread is warmed up.
+struct Request {
+    StrView tokens[MAX_COMMAND_TOKENS];
+    size_t count;
+    const std::string* client_ip;
+    int client_port;
+    StrView blob;                       // binary payload of a framed command, if any
+    mutable std::string scratch[MAX_COMMAND_TOKENS];
+    
+    Request() : count(0), client_ip(NULL), client_port(0) {}
+    
+    size_t size() const { return count; }
+    StrView view(size_t i) const { return tokens[i]; }
+    const std::string& arg(size_t i) const {
+        scratch[i].assign(tokens[i].data, tokens[i].size);
+        return scratch[i];
+    }
+};
+
+// FIFO of decoded commands for one connection. Drained slots are reused (with
+// their string capacity) instead of freed, so steady traffic does not allocate.
+struct CommandQueue {
+    std::vector<Frame> slots;
+    size_t head;
+    size_t tail;
+    
+    CommandQueue() : head(0), tail(0) {}
+    
+    bool empty() const { return head == tail; }
+    size_t size() const { return tail - head; }
+    Frame& front() { return slots[head]; }
+    void pop() { if (++head == tail) head = tail = 0; }
+    void clear() { head = tail = 0; }
+    
+    // Slot the next command is decoded into; commit() makes it visible.
+    Frame& next_slot() {
+        if (tail == slots.size() && head > 0) {
+            for (size_t i = head; i < tail; ++i) {
+                std::swap(slots[i - head], slots[i]);
+            }
+            tail -= head;
+            head = 0;
+        }
+        if (tail == slots.size()) {
+            slots.push_back(Frame());
+        }
+        return slots[tail];
+    }
+    void commit() { tail++; }
+};
+
+// Tracker state is split into independently locked pieces. To stay
+// deadlock-free a thread acquires them only in this order, holding at most one
+// lock of each kind at a time:
+//   groups_lock -> GroupSlot::lock -> UserShard::lock -> FileShard::lock
+// The NameTable and SearchIndex locks are innermost and may be taken while
+// holding any of these.
+struct UserShard {
+    RWLock lock;
+    std::vector<User> users;            // user ID u lives at users[u / USER_SHARDS]
+};
+
+struct GroupSlot {
+    RWLock lock;
+    Group group;
+    std::atomic<bool> moved;            // now served by another shard; writers re-check it under the lock
+    
+    explicit GroupSlot(LatencyHistogram* lock_waits) : moved(false) { lock.track_waits(lock_waits); }
+};
+
+struct FileShard {
+    RWLock lock;
+    std::map<std::string, FileEntry> files;
+};
+
+enum ServerMode {
+    MODE_THREADED,      // one detached thread per connection (original behaviour)
+    MODE_REACTOR        // epoll I/O threads + bounded worker pool
+};
+
+struct TrackerConfig {
+    ServerMode mode;
+    int listen_backlog;
+    int io_threads;
+    int worker_threads;
+    size_t worker_queue_limit;
+    int idle_timeout_seconds;       // 0 disables idle reaping
+    LogLevel log_level;
+    unsigned log_sample_every;      // per-request log lines: keep 1 in N
+    std::string data_dir;           // empty keeps all state in memory only
+    WalSyncMode wal_sync;
+    unsigned long snapshot_every;   // 0 disables snapshots
+    bool replication;               // replicate with the other trackers in tracker_info.txt
+    int lease_seconds;              // 0: sessions last until LOGOUT
+    int metrics_port;               // 0: no HTTP metrics endpoint
+    std::string trace_path;         // empty: do not record commands
+    std::string handoff_path;       // Unix socket for hot restarts, empty: none (see handoff.h)
+    int drain_seconds;              // after a handoff, how long existing connections may stay
+    std::string cluster_key;        // shared by the trackers, empty: trust tracker_info.txt addresses
+    
+    TrackerConfig() : mode(MODE_THREADED), listen_backlog(DEFAULT_LISTEN_BACKLOG),
+                      io_threads(DEFAULT_IO_THREADS), worker_threads(DEFAULT_WORKER_THREADS),
+                      worker_queue_limit(DEFAULT_WORKER_QUEUE), idle_timeout_seconds(DEFAULT_IDLE_TIMEOUT),
+                      log_level(LOG_INFO), log_sample_every(1), wal_sync(WAL_SYNC_COMMIT),
+                      snapshot_every(DEFAULT_SNAPSHOT_EVERY), replication(true),
+                      lease_seconds(DEFAULT_LEASE_SECONDS), metrics_port(0), drain_seconds(DEFAULT_DRAIN_SECONDS) {}
+};
+
+// Per-connection state owned by one I/O loop. Buffers only grow as far as the
+// largest command/reply seen on that connection, so idle clients cost a few
+// hundred bytes instead of a thread stack plus a 64KB heap buffer.
+// Replies are framed whenever the client's requests are (see protocol.h).
+struct Connection {
+    int fd;
+    uint64_t id;                        // connection number in command traces
+    std::string ip;
+    int port;
+    int loop_index;                     // -1 for a thread-per-connection client
+    FrameDecoder decoder;               // reassembles commands across recv() boundaries
+    std::string out_buffer;
+    CommandQueue pending;               // complete commands not yet executed
+    bool busy;                          // a worker currently owns this connection
+    bool want_write;                    // EPOLLOUT is armed
+    bool subscribed;                    // listens to group events (see events.h), never idle
+    bool cluster_peer;                  // sent the cluster key (see replication.h)
+    std::chrono::steady_clock::time_point last_active;
+    std::mutex mutex;
+    
+    Connection() : fd(-1), id(0), port(0), loop_index(0), decoder(MAX_COMMAND_SIZE), busy(false), want_write(false),
+                   subscribed(false), cluster_peer(false) {}
+};
+
+struct IoLoop {
+    int epoll_fd;
+    std::thread thread;
+    std::map<int, std::shared_ptr<Connection>> connections;
+    std::mutex mutex;
+    
+    IoLoop() : epoll_fd(-1) {}
+};
+
+class Tracker;
+typedef void (Tracker::*CommandHandler)(const Request& request, std::string& out);
+
+// Per-command counters, updated lock-free by every request
+struct CommandStats {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> errors;       // replies starting with "ERROR"
+    LatencyHistogram service;           // ns from dispatch to a complete (durable) reply, sampled
+    
+    CommandStats() : calls(0), errors(0) {}
+};
+
+struct CommandEntry {
+    const char* name;
+    size_t length;
+    CommandHandler handler;
+    bool mutates;                       // changes state: runs on the primary only
+    size_t group_arg;                   // token naming the group the command is about, 0 if none
+    CommandStats* stats;
+};
+
+// Lock kinds whose contended acquisitions are timed (see RWLock::track_waits)
+enum LockKind {
+    LOCK_GROUP_DIRECTORY,
+    LOCK_GROUP,
+    LOCK_USER_SHARD,
+    LOCK_FILE_SHARD,
+    LOCK_NAMES,
+    LOCK_SEARCH,
+    LOCK_KINDS
 };
 
 class Tracker {
@@ -54,36 +444,238 @@ private:
     int port;
     int tracker_number;
     int server_socket;
-    std::vector<std::string> other_trackers;
-    std::map<std::string, User> users;
-    std::map<std::string, Group> groups;
-    std::map<std::string, FileEntry> files;
-    std::mutex tracker_mutex;
-    bool running;
-    
-    std::vector<std::string> split_string(const std::string& str, char delimiter);
-    std::string process_command(const std::string& command, const std::string& client_ip, int client_port);
-    
-    std::string handle_create_user(const std::vector<std::string>& tokens);
-    std::string handle_login(const std::vector<std::string>& tokens, const std::string& client_ip, int client_port);
-    std::string handle_create_group(const std::vector<std::string>& tokens);
-    std::string handle_join_group(const std::vector<std::string>& tokens);
-    std::string handle_leave_group(const std::vector<std::string>& tokens);
-    std::string handle_list_groups(const std::vector<std::string>& tokens);
-    std::string handle_list_requests(const std::vector<std::string>& tokens);
-    std::string handle_accept_request(const std::vector<std::string>& tokens);
-    std::string handle_list_files(const std::vector<std::string>& tokens);
-    std::string handle_upload_file(const std::vector<std::string>& tokens);
-    std::string handle_download_file(const std::vector<std::string>& tokens);
-    std::string handle_logout(const std::vector<std::string>& tokens);
+    TrackerConfig config;
+    std::vector<TrackerPeer> other_trackers;
+    NameTable user_names;
+    NameTable group_names;
+    NameTable file_names;
+    UserShard user_shards[USER_SHARDS];
+    RWLock groups_lock;                 // guards the group directory, not group contents
+    std::vector<std::shared_ptr<GroupSlot>> groups;     // by group ID; null until created
+    FileShard file_shards[FILE_SHARDS];
+    SearchIndex search_index;           // names of shared files (see search.h)
+    std::atomic<bool> running;
+    
+    // Reactor state
+    std::vector<std::unique_ptr<IoLoop>> io_loops;
+    std::vector<std::thread> workers;
+    std::deque<std::shared_ptr<Connection>> work_queue;
+    std::mutex work_mutex;
+    std::condition_variable work_cv;
+    std::atomic<int> active_connections;
+    
+    void run_threaded();
+    void run_reactor();
+    void io_loop(IoLoop* loop);
+    void worker_loop();
+    bool submit_work(const std::shared_ptr<Connection>& conn);
+    void register_connection(int client_socket, const std::string& client_ip, int client_port);
+    void on_readable(IoLoop* loop, const std::shared_ptr<Connection>& conn);
+    void flush_connection(IoLoop* loop, const std::shared_ptr<Connection>& conn);
+    void close_connection(IoLoop* loop, const std::shared_ptr<Connection>& conn);
+    void reap_idle_connections(IoLoop* loop);
+    
+    UserShard& user_shard(NameId user);
+    FileShard& file_shard(const std::string& file_hash);
+    std::shared_ptr<GroupSlot> find_group(NameId group);
+    bool is_online(NameId user);
+    void user_peers_changed(NameId user);
+    void build_peer_list(const SharedFile& shared, bool with_pieces, std::string& out);
+    SharedFile& share_file(Group& group, NameId file);
+    void link_content(Group& group, SharedFile& shared, const std::string& file_hash);
+    void index_share(NameId user, const FileShare& share, bool present = true);
+    void take_shares(NameId user, NameId group, std::vector<FileShare>& out);
+    bool drop_share(Group& group, NameId file, NameId user);
+    void drop_user_shares(NameId user, const std::string& user_id);
+    void append_sources(const std::string& file_hash, const std::vector<FileShare>& shares,
+                        std::vector<NameId>& listed, std::string& out);
+    
+    // Persistence and replication: mutations are logged under the lock that
+    // guards them, so the log order per object matches the order they were
+    // applied in. log_mutex hands out LSNs and orders the WAL and the
+    // replication stream identically.
+    std::mutex log_mutex;
+    uint64_t last_lsn;
+    WriteAheadLog wal;
+    std::atomic<unsigned long> records_since_snapshot;
+    std::thread snapshot_thread;
+    std::mutex snapshot_mutex;
+    std::condition_variable snapshot_cv;
+    bool snapshot_requested;
+    bool snapshot_stopping;
+    
+    bool persistent() const { return wal.is_open(); }
+    bool logs_changes() const { return wal.is_open() || replicating; }
+    void log_record(WalRecord& record);
+    void append_record(const char* sealed, size_t length, uint64_t lsn);
+    void apply_record(WalReader& record);
+    void reset_state();
+    template <typename Emit> void dump_state(Emit emit);
+    bool recover();
+    bool write_snapshot();
+    void snapshot_loop();
+    
+    // Replication (see replication.h). role/term/primary are guarded by role_mutex.
+    bool replicating;
+    ReplicationLog replication_log;
+    std::mutex role_mutex;
+    TrackerRole role;
+    uint64_t term;
+    uint64_t previous_term;             // term this tracker followed before its promotion
+    uint64_t promotion_lsn;             // last LSN of previous_term in our history
+    int primary_number;
+    std::atomic<uint64_t> applied_lsn;  // backups: last record applied from the primary
+    std::mutex applied_mutex;
+    std::condition_variable applied_cv;
+    std::thread replication_thread;
+    std::atomic<bool> replication_stopping;
+    
+    TrackerRole current_role();
+    void describe_role(std::string& out);
+    bool probe_role(const TrackerPeer& peer, std::string& reply);
+    void replication_loop();
+    void elect();
+    void promote(uint64_t seen_term);
+    void follow_primary(const TrackerPeer& peer);
+    void serve_backup(int fd, const std::string& subscribe, const std::string& backup_ip);
+    bool forward_command(const char* data, size_t length, const StrView& blob, std::string& out);
+    void load_term();
+    void save_term();
+    
+    // Session leases: the primary takes a user offline when no LOGIN or
+    // HEARTBEAT renewed their lease in time. lease_mutex guards lease_wheel
+    // and is innermost (taken while holding a UserShard lock).
+    std::mutex lease_mutex;
+    TimerWheel lease_wheel;
+    std::thread lease_thread;
+    std::atomic<bool> lease_stopping;
+    
+    void renew_lease(User& user, NameId id);
+    void start_leases();
+    void expire_lease(NameId id, uint64_t due, uint64_t now);
+    void lease_loop();
+    
+    // Metrics (see metrics.h): STATS and the optional HTTP endpoint read these
+    std::vector<std::unique_ptr<CommandStats>> command_stats;
+    LatencyHistogram lock_waits[LOCK_KINDS];
+    std::chrono::steady_clock::time_point started_at;
+    int metrics_socket;
+    std::thread metrics_thread;
+    std::atomic<bool> metrics_stopping;
+    
+    struct StateSizes;
+    void measure_state(StateSizes& sizes);
+    void append_metrics(std::string& out);
+    bool start_metrics_server();
+    void metrics_loop();
+    
+    // Group events (see events.h): handlers publish under the group lock and
+    // event_thread writes them out. subscriptions is used by event_thread only.
+    EventQueue event_queue;
+    SubscriptionTable subscriptions;
+    std::thread event_thread;
+    std::atomic<uint64_t> events_published;
+    std::atomic<uint64_t> events_sent;          // one per event per subscriber it went to
+    std::atomic<size_t> subscriber_count;       // connections listening, as of the last table change
+    
+    void publish_event(const Group& group, EventKind kind, NameId user, NameId file = NO_NAME, NameId audience = NO_NAME);
+    void end_subscriptions(const std::shared_ptr<Connection>& conn);
+    void release_listeners(std::vector<NameId>& groups);
+    bool write_events(Subscriber& subscriber, bool& unsent);
+    void event_loop();
+    
+    // Command trace (see trace.h)
+    TraceWriter trace;
+    std::atomic<uint64_t> next_connection_id;
+    void trace_command(uint64_t connection, const Frame& request);
+    bool admit_frame(Connection& conn, const Frame& frame);
+    bool is_tracker_address(const std::string& ip);
+    int connect_tracker(const std::string& ip, int port);
+    
+    // Hot restart (see handoff.h). While handing off, nothing changes state
+    // here: local_changes counts the commands and background work that do.
+    int handoff_socket;                 // listens at config.handoff_path
+    int handoff_peer;                   // new tracker: the old one, until it is draining
+    std::atomic<bool> handing_off;      // commands go to the new tracker
+    std::atomic<bool> handed_over;      // the new tracker is up; drain and exit
+    std::atomic<int> local_changes;
+    
+    bool begin_local_change();
+    void end_local_change() { local_changes--; }
+    bool take_over();
+    bool finish_take_over();
+    bool hand_off(int peer);
+    void drain_connections();
+    
+    // Sharding (see sharding.h). shard_map is replaced whole when
+    // tracker_info.txt changes, so readers take it with std::atomic_load.
+    std::string tracker_file;
+    std::shared_ptr<const ShardMap> shard_map;
+    std::atomic<bool> sharded;          // more than one shard: group commands are routed
+    std::thread shard_thread;
+    std::atomic<bool> shard_stopping;
+    std::atomic<uint64_t> groups_moved_out;
+    std::atomic<uint64_t> groups_moved_in;
+    std::mutex import_mutex;
+    std::map<std::string, StagedImport> staged_imports;    // by source shard; guarded by import_mutex
+    
+    std::shared_ptr<const ShardMap> current_shards() const { return std::atomic_load(&shard_map); }
+    bool route_group(const CommandEntry& command, const Request& request, std::string& out);
+    void shard_loop();
+    bool rebalance(const ShardMap& map, std::vector<int>& connections);
+    MoveResult move_group(NameId id, const ShardMap& map, std::vector<int>& connections);
+    bool send_accounts(const ShardMap& map, int shard, std::vector<int>& connections);
+    bool send_import(const ShardMap& map, int shard, const std::string& records, std::vector<int>& connections, std::string& reply);
+    void import_records(const Frame& request, std::string& out);
+    void drop_group(Group& group);
+    void append_account(NameId user, std::string& records);
+    template <typename Emit> void dump_group(const Group& group, Emit emit);
+    
+    // Runs one decoded frame (command, forwarded command or role query) and
+    // appends the complete reply, framed if the peer frames its messages.
+    void serve_frame(const Frame& request, const std::string& client_ip, int client_port, bool framed, std::string& out);
+    int detach_connection(IoLoop* loop, const std::shared_ptr<Connection>& conn);
+    
+    // O(1) command dispatch: open-addressed table keyed by the command word
+    CommandEntry command_table[COMMAND_TABLE_SIZE];
+    void register_command(const char* name, CommandHandler handler, bool mutates, size_t group_arg = 0);
+    const CommandEntry* find_command(const StrView& name) const;
+    
+    void process_command(const char* data, size_t length, const StrView& blob, const std::string& client_ip, int client_port, std::string& out);
+    
+    void handle_create_user(const Request& request, std::string& out);
+    void handle_login(const Request& request, std::string& out);
+    void handle_create_group(const Request& request, std::string& out);
+    void handle_join_group(const Request& request, std::string& out);
+    void handle_leave_group(const Request& request, std::string& out);
+    void handle_list_groups(const Request& request, std::string& out);
+    void handle_list_requests(const Request& request, std::string& out);
+    void handle_accept_request(const Request& request, std::string& out);
+    void handle_list_files(const Request& request, std::string& out);
+    void handle_search(const Request& request, std::string& out);
+    void handle_upload_file(const Request& request, std::string& out);
+    void handle_download_file(const Request& request, std::string& out);
+    void handle_have(const Request& request, std::string& out);
+    void handle_stop_share(const Request& request, std::string& out);
+    void handle_subscribe(const Request& request, std::string& out);
+    void handle_unsubscribe(const Request& request, std::string& out);
+    void handle_heartbeat(const Request& request, std::string& out);
+    void handle_stats(const Request& request, std::string& out);
+    void handle_logout(const Request& request, std::string& out);
     
 public:
-    Tracker(int port, int tracker_number);
+    Tracker(int port, int tracker_number, const TrackerConfig& config = TrackerConfig());
     ~Tracker();
     
     bool initialize(const std::string& tracker_file);
     void run();
+    bool handed_off() const { return handed_over; }
     void handle_client(int client_socket, const std::string& client_ip, int client_port);
+    
+    // Runs one command and appends the reply to out (used by both server
+    // modes and by the microbenchmark). blob is the command's binary payload.
+    void execute_command(const char* data, size_t length, const std::string& client_ip, int client_port, std::string& out,
+                         const StrView& blob = StrView());
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,559 @@
+// Synthetic load generator and capacity benchmark for a running tracker.
+//
+// Opens one TCP connection per simulated client and populates the tracker
+// with users, groups and shared files, sending pipelined batches. It then runs
+// a closed loop of LOGIN / UPLOAD_FILE / LIST_FILES / DOWNLOAD_FILE (and, when
+// weighted in, SEARCH) in a weighted mix. It reports throughput, p50/p99/p999 latency per command, and
+// the tracker's resident memory after each phase (read with STATS).
+//
+//   make tracker_bench
+//   ./tracker tracker_info.txt 0 --standalone --reactor --lease=0 --log-level=warn &
+//   ./tracker_bench --users=1000000 --files=10000000 --file-size=1M
+//
+// Names are prefixed with "bench_", so a populated tracker can be measured
+// again with --skip-setup.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "protocol.h"
+#include "metrics.h"
+
+#define PIECE_SIZE (512 * 1024)
+#define PIECE_DIGEST_SIZE 20
+
+#define SETUP_BATCH_COMMANDS 64
+#define SETUP_BATCH_BYTES (4 * 1024 * 1024)     // bounds a batch of large uploads
+#define SETUP_CHUNK 1024                        // items a client claims at a time
+
+//=================================================================================================
+// CONFIGURATION
+//=================================================================================================
+
+enum Operation { OP_LOGIN, OP_UPLOAD, OP_LIST, OP_DOWNLOAD, OP_SEARCH, OP_COUNT };
+
+static const char* const operation_names[OP_COUNT] = { "LOGIN", "UPLOAD_FILE", "LIST_FILES", "DOWNLOAD_FILE", "SEARCH" };
+static const char* const operation_keys[OP_COUNT] = { "login", "upload", "list", "download", "search" };
+
+struct BenchConfig {
+    std::string host;
+    int port;
+    int clients;
+    long users;
+    long groups;
+    long files;
+    long file_size;
+    int duration;
+    int weights[OP_COUNT];
+    bool skip_setup;
+
+    BenchConfig() : host("127.0.0.1"), port(8080), clients(16), users(10000), groups(100), files(10000),
+                    file_size(20L << 30), duration(10), skip_setup(false) {
+        weights[OP_LOGIN] = 5;
+        weights[OP_UPLOAD] = 5;
+        weights[OP_LIST] = 20;
+        weights[OP_DOWNLOAD] = 70;
+        weights[OP_SEARCH] = 0;
+    }
+
+    long piece_count() const { return (file_size + PIECE_SIZE - 1) / PIECE_SIZE; }
+};
+
+static void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --tracker=IP:PORT   tracker to load (default 127.0.0.1:8080)\n"
+              << "  --clients=N         concurrent connections (default 16)\n"
+              << "  --users=N           users to register and log in (default 10000)\n"
+              << "  --groups=N          groups, users are spread over them (default 100)\n"
+              << "  --files=N           shared files, spread over the groups (default 10000)\n"
+              << "  --file-size=BYTES   size of every file, K/M/G suffixes allowed (default 20G,\n"
+              << "                      40960 piece hashes; the tracker keeps 20 bytes per piece)\n"
+              << "  --duration=SEC      length of the mixed phase (default 10)\n"
+              << "  --mix=SPEC          weights of the mixed phase\n"
+              << "                      (default login:5,upload:5,list:20,download:70; search:N\n"
+              << "                      looks up \"f\" and the leading digits of a file number)\n"
+              << "  --skip-setup        reuse users, groups and files from an earlier run\n";
+}
+
+static bool parse_count(const char* text, long& value) {
+    char* end;
+    errno = 0;
+    value = strtol(text, &end, 10);
+    if (errno != 0 || end == text || value < 0) return false;
+    switch (*end) {
+        case 'K': case 'k': value <<= 10; end++; break;
+        case 'M': case 'm': value <<= 20; end++; break;
+        case 'G': case 'g': value <<= 30; end++; break;
+        default: break;
+    }
+    return *end == '\0';
+}
+
+static bool parse_mix(const char* spec, int weights[OP_COUNT]) {
+    for (int op = 0; op < OP_COUNT; ++op) weights[op] = 0;
+    std::string text(spec);
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.size();
+        std::string item = text.substr(start, end - start);
+        size_t colon = item.find(':');
+        long weight;
+        if (colon == std::string::npos || !parse_count(item.c_str() + colon + 1, weight)) return false;
+        int op = 0;
+        while (op < OP_COUNT && item.compare(0, colon, operation_keys[op]) != 0) op++;
+        if (op == OP_COUNT) return false;
+        weights[op] = weight;
+        start = end + 1;
+    }
+    int total = 0;
+    for (int op = 0; op < OP_COUNT; ++op) total += weights[op];
+    return total > 0;
+}
+
+static bool parse_option(const char* arg, BenchConfig& config) {
+    long value;
+    if (strncmp(arg, "--tracker=", 10) == 0) {
+        const char* colon = strrchr(arg + 10, ':');
+        if (colon == NULL || !parse_count(colon + 1, value) || value == 0 || value > 65535) return false;
+        config.host.assign(arg + 10, colon - (arg + 10));
+        config.port = value;
+        return true;
+    }
+    if (strncmp(arg, "--clients=", 10) == 0) {
+        if (!parse_count(arg + 10, value) || value == 0 || value > 4096) return false;
+        config.clients = value;
+        return true;
+    }
+    if (strncmp(arg, "--users=", 8) == 0) return parse_count(arg + 8, config.users) && config.users > 0;
+    if (strncmp(arg, "--groups=", 9) == 0) return parse_count(arg + 9, config.groups) && config.groups > 0;
+    if (strncmp(arg, "--files=", 8) == 0) return parse_count(arg + 8, config.files);
+    if (strncmp(arg, "--file-size=", 12) == 0) return parse_count(arg + 12, config.file_size) && config.file_size > 0;
+    if (strncmp(arg, "--duration=", 11) == 0) {
+        if (!parse_count(arg + 11, value) || value == 0) return false;
+        config.duration = value;
+        return true;
+    }
+    if (strncmp(arg, "--mix=", 6) == 0) return parse_mix(arg + 6, config.weights);
+    if (strcmp(arg, "--skip-setup") == 0) {
+        config.skip_setup = true;
+        return true;
+    }
+    return false;
+}
+
+//=================================================================================================
+// NAMES
+//
+// User u belongs to group u % groups, whose owner is user g; file f lives in
+// group f % groups and is first shared by one of that group's members.
+//=================================================================================================
+
+static void append_number(std::string& out, long value) {
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%ld", value);
+    out.append(digits, length);
+}
+
+static void append_user(std::string& out, long u) {
+    out += "bench_u";
+    append_number(out, u);
+}
+
+static void append_group(std::string& out, long g) {
+    out += "bench_g";
+    append_number(out, g);
+}
+
+static void append_file(std::string& out, long f) {
+    out += "bench_f";
+    append_number(out, f);
+    out += ".bin";
+}
+
+static void append_login(std::string& out, long u) {
+    out += "LOGIN ";
+    append_user(out, u);
+    out += " secret 127.0.0.1 ";
+    append_number(out, 10000 + u % 50000);
+}
+
+static void append_upload(std::string& out, long u, long g, long f, long file_size) {
+    char hash[48];
+    snprintf(hash, sizeof(hash), "%040lx", static_cast<unsigned long>(f) * 2654435761ul);
+    out += "UPLOAD_FILE ";
+    append_user(out, u);
+    out += ' ';
+    append_group(out, g);
+    out += ' ';
+    append_file(out, f);
+    out += ' ';
+    out += hash;
+    out += " - ";
+    append_number(out, file_size);
+}
+
+//=================================================================================================
+// CONNECTION
+//=================================================================================================
+
+class BenchClient {
+private:
+    int fd;
+    std::string batch;
+    size_t pending;
+    Frame reply;
+
+public:
+    BenchClient() : fd(-1), pending(0) {}
+    ~BenchClient() { if (fd >= 0) close(fd); }
+
+    bool connect_to(const BenchConfig& config) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(config.port);
+        if (inet_pton(AF_INET, config.host.c_str(), &address.sin_addr) != 1) return false;
+        return connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    }
+
+    void queue(const std::string& command, const std::string& blob = std::string()) {
+        append_frame(batch, MSG_COMMAND, command, blob);
+        pending++;
+    }
+
+    size_t queued() const { return pending; }
+    size_t queued_bytes() const { return batch.size(); }
+
+    // Sends the queued commands and reads their replies. Returns the number of
+    // replies that were errors, or -1 if the connection failed.
+    long flush() {
+        long errors = 0;
+        bool sent = send_all(fd, batch.data(), batch.size());
+        batch.clear();
+        for (; sent && pending > 0; --pending) {
+            if (!recv_frame(fd, reply)) return -1;
+            if (reply.text.compare(0, 5, "ERROR") == 0) errors++;
+        }
+        if (!sent) return -1;
+        return errors;
+    }
+
+    // One command, one reply (the reply text stays in last_reply()).
+    bool call(const std::string& command, const std::string& blob = std::string()) {
+        queue(command, blob);
+        return flush() >= 0;
+    }
+
+    const std::string& last_reply() const { return reply.text; }
+};
+
+static unsigned long tracker_rss_kb(const BenchConfig& config) {
+    BenchClient client;
+    if (!client.connect_to(config) || !client.call("STATS")) return 0;
+    const std::string& stats = client.last_reply();
+    size_t end = stats.find(" KB resident");
+    if (end == std::string::npos) return 0;
+    size_t start = stats.rfind(' ', end - 1);
+    return strtoul(stats.c_str() + start + 1, NULL, 10);
+}
+
+//=================================================================================================
+// SETUP PHASES
+//=================================================================================================
+
+// Appends the commands for item i of a phase to client's batch.
+typedef void (*SetupStep)(const BenchConfig& config, long i, const std::string& digests, BenchClient& client);
+
+static void setup_user(const BenchConfig&, long u, const std::string&, BenchClient& client) {
+    std::string command("CREATE_USER ");
+    append_user(command, u);
+    command += " secret";
+    client.queue(command);
+    command.clear();
+    append_login(command, u);
+    client.queue(command);
+}
+
+static void setup_group(const BenchConfig&, long g, const std::string&, BenchClient& client) {
+    std::string command("CREATE_GROUP ");
+    append_user(command, g);
+    command += ' ';
+    append_group(command, g);
+    client.queue(command);
+}
+
+// Users past the owners join their group and are accepted by its owner
+static void setup_member(const BenchConfig& config, long u, const std::string&, BenchClient& client) {
+    long g = u % config.groups;
+    if (u == g) return;
+    std::string command("JOIN_GROUP ");
+    append_user(command, u);
+    command += ' ';
+    append_group(command, g);
+    client.queue(command);
+    command.assign("ACCEPT_REQUEST ");
+    append_user(command, g);
+    command += ' ';
+    append_group(command, g);
+    command += ' ';
+    append_user(command, u);
+    client.queue(command);
+}
+
+static void setup_file(const BenchConfig& config, long f, const std::string& digests, BenchClient& client) {
+    long g = f % config.groups;
+    long members = (config.users - g + config.groups - 1) / config.groups;
+    long u = g + (f / config.groups) % members * config.groups;
+    std::string command;
+    append_upload(command, u, g, f, config.file_size);
+    client.queue(command, digests);
+}
+
+static void run_setup_phase(const BenchConfig& config, const char* name, long items, SetupStep step,
+                            const std::string& digests) {
+    std::atomic<long> next(0);
+    std::atomic<long> commands(0);
+    std::atomic<long> errors(0);
+    std::atomic<bool> failed(false);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < config.clients; ++c) {
+        threads.push_back(std::thread([&]() {
+            BenchClient client;
+            if (!client.connect_to(config)) {
+                failed = true;
+                return;
+            }
+            long sent = 0;
+            long first;
+            while (!failed && (first = next.fetch_add(SETUP_CHUNK)) < items) {
+                long last = std::min(items, first + SETUP_CHUNK);
+                for (long i = first; i < last; ++i) {
+                    step(config, i, digests, client);
+                    if (client.queued() >= SETUP_BATCH_COMMANDS || client.queued_bytes() >= SETUP_BATCH_BYTES || i + 1 == last) {
+                        sent += client.queued();
+                        long batch_errors = client.flush();
+                        if (batch_errors < 0) {
+                            failed = true;
+                            break;
+                        }
+                        errors += batch_errors;
+                    }
+                }
+            }
+            commands += sent;
+        }));
+    }
+    for (std::thread& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (failed) {
+        std::cerr << "Lost the connection to " << config.host << ":" << config.port << " during " << name << std::endl;
+        exit(1);
+    }
+    char line[200];
+    snprintf(line, sizeof(line), "  %-8s %10ld items %10ld commands %8.2f s %10.0f cmd/s %8ld errors  tracker RSS %lu MB",
+             name, items, commands.load(), seconds, commands.load() / seconds, errors.load(),
+             tracker_rss_kb(config) / 1024);
+    std::cout << line << std::endl;
+}
+
+//=================================================================================================
+// MIXED PHASE
+//=================================================================================================
+
+struct OperationStats {
+    std::atomic<long> count;
+    std::atomic<long> errors;
+    LatencyHistogram latency;
+
+    OperationStats() : count(0), errors(0) {}
+};
+
+static inline uint64_t next_random(uint64_t& state) {
+    state ^= state << 13;                       // xorshift64
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static void run_mix_client(const BenchConfig& config, int index, const std::string& digests,
+                           const std::atomic<bool>& stopping, OperationStats* stats, std::atomic<bool>& failed) {
+    BenchClient client;
+    if (!client.connect_to(config)) {
+        failed = true;
+        return;
+    }
+
+    int total_weight = 0;
+    for (int op = 0; op < OP_COUNT; ++op) total_weight += config.weights[op];
+    uint64_t random = 0x9E3779B97F4A7C15ull * (index + 1);
+    std::string command;
+    std::string no_blob;
+
+    while (!stopping) {
+        int pick = next_random(random) % total_weight;
+        int op = 0;
+        while (pick >= config.weights[op]) pick -= config.weights[op++];
+
+        long u = next_random(random) % config.users;
+        long g = u % config.groups;
+        long per_group = config.files / config.groups + (g < config.files % config.groups);
+        long f = per_group > 0 ? g + static_cast<long>(next_random(random) % per_group) * config.groups : -1;
+        if (f < 0 && (op == OP_UPLOAD || op == OP_DOWNLOAD || op == OP_SEARCH)) op = OP_LIST;
+
+        command.clear();
+        switch (op) {
+            case OP_LOGIN:
+                append_login(command, u);
+                break;
+            case OP_UPLOAD:
+                append_upload(command, u, g, f, config.file_size);
+                break;
+            case OP_LIST:
+                command += "LIST_FILES ";
+                append_user(command, u);
+                command += ' ';
+                append_group(command, g);
+                break;
+            case OP_SEARCH: {
+                // "f" and 1-4 leading digits: matches a word inside many names
+                char digits[24];
+                int length = snprintf(digits, sizeof(digits), "%ld", f);
+                command += "SEARCH ";
+                append_user(command, u);
+                command += " f";
+                command.append(digits, 1 + next_random(random) % std::min(length, 4));
+                break;
+            }
+            default:
+                command += "DOWNLOAD_FILE ";
+                append_user(command, u);
+                command += ' ';
+                append_group(command, g);
+                command += ' ';
+                append_file(command, f);
+                break;
+        }
+
+        uint64_t start = monotonic_ns();
+        client.queue(command, op == OP_UPLOAD ? digests : no_blob);
+        long errors = client.flush();
+        if (errors < 0) {
+            failed = true;
+            return;
+        }
+        stats[op].latency.record(monotonic_ns() - start);
+        stats[op].count++;
+        stats[op].errors += errors;
+    }
+}
+
+static void print_latency_row(const char* name, long count, long errors, double seconds,
+                              const LatencyHistogram::Snapshot& snapshot) {
+    char line[200];
+    snprintf(line, sizeof(line), "  %-14s %10ld %8ld %12.0f %10.1f %10.1f %10.1f %10.1f", name, count, errors,
+             count / seconds, snapshot.quantile(0.50) / 1e3, snapshot.quantile(0.99) / 1e3,
+             snapshot.quantile(0.999) / 1e3, snapshot.largest / 1e3);
+    std::cout << line << std::endl;
+}
+
+static void run_mix_phase(const BenchConfig& config, const std::string& digests) {
+    std::vector<OperationStats> stats(OP_COUNT);
+    std::atomic<bool> stopping(false);
+    std::atomic<bool> failed(false);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < config.clients; ++c) {
+        threads.push_back(std::thread(run_mix_client, std::cref(config), c, std::cref(digests),
+                                      std::cref(stopping), stats.data(), std::ref(failed)));
+    }
+    while (!failed && std::chrono::steady_clock::now() - start < std::chrono::seconds(config.duration)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    stopping = true;
+    for (std::thread& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (failed) {
+        std::cerr << "Lost the connection to " << config.host << ":" << config.port << " during the mix" << std::endl;
+        exit(1);
+    }
+
+    // Totals go through one histogram that merges every operation's records
+    std::unique_ptr<LatencyHistogram::Snapshot> snapshot(new LatencyHistogram::Snapshot);
+    std::unique_ptr<LatencyHistogram::Snapshot> all(new LatencyHistogram::Snapshot);
+    memset(all.get(), 0, sizeof(*all));
+    long count = 0;
+    long errors = 0;
+
+    std::cout << "  Command             Calls   Errors        req/s     p50 us     p99 us    p999 us     max us" << std::endl;
+    for (int op = 0; op < OP_COUNT; ++op) {
+        if (config.weights[op] == 0) continue;
+        stats[op].latency.snapshot(*snapshot);
+        print_latency_row(operation_names[op], stats[op].count, stats[op].errors, seconds, *snapshot);
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) all->counts[i] += snapshot->counts[i];
+        all->count += snapshot->count;
+        all->total += snapshot->total;
+        all->largest = std::max(all->largest, snapshot->largest);
+        count += stats[op].count;
+        errors += stats[op].errors;
+    }
+    print_latency_row("TOTAL", count, errors, seconds, *all);
+    std::cout << "  Tracker RSS after the mix: " << tracker_rss_kb(config) / 1024 << " MB" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        if (!parse_option(argv[i], config)) {
+            std::cerr << "Unknown or invalid option: " << argv[i] << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.groups > config.users) config.groups = config.users;
+
+    // Every file carries the same digests: the tracker stores them per file either way
+    std::string digests(config.piece_count() * PIECE_DIGEST_SIZE, '\0');
+    for (size_t i = 0; i < digests.size(); ++i) digests[i] = static_cast<char>(i * 131 + 7);
+
+    std::cout << "Tracker benchmark against " << config.host << ":" << config.port << ": " << config.clients
+              << " clients, " << config.users << " users, " << config.groups << " groups, " << config.files
+              << " files of " << config.file_size << " bytes (" << config.piece_count() << " piece hashes)" << std::endl;
+
+    unsigned long rss = tracker_rss_kb(config);
+    if (rss == 0) {
+        std::cerr << "No STATS reply from " << config.host << ":" << config.port << std::endl;
+        return 1;
+    }
+    std::cout << "  Tracker RSS before: " << rss / 1024 << " MB" << std::endl;
+
+    if (!config.skip_setup) {
+        run_setup_phase(config, "users", config.users, setup_user, digests);
+        run_setup_phase(config, "groups", config.groups, setup_group, digests);
+        run_setup_phase(config, "members", config.users, setup_member, digests);
+        run_setup_phase(config, "files", config.files, setup_file, digests);
+    }
+    run_mix_phase(config, digests);
+    return 0;
+}
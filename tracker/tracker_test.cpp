@@ -0,0 +1,205 @@
+// Regression tests for the tracker.
+//
+// Share bookkeeping is checked in-process through Tracker::execute_command()
+// (no sockets, logging off). The hot restart drain runs two ./tracker
+// processes on a free port, with tracker_info listing a non-loopback address
+// of this host; it is skipped when the host has none.
+//
+//   make test
+
+#include "tracker.h"
+#include <cstdlib>
+#include <ifaddrs.h>
+#include <sys/wait.h>
+
+static int failures = 0;
+
+#define CHECK(condition, detail) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << "FAIL " << __FUNCTION__ << ":" << __LINE__ << ": " << #condition \
+                      << " (" << (detail) << ")" << std::endl; \
+            ++failures; \
+        } \
+    } while (0)
+
+static std::string run(Tracker& tracker, const std::string& command) {
+    std::string out;
+    tracker.execute_command(command.data(), command.size(), "127.0.0.1", 0, out);
+    return out;
+}
+
+static bool succeeds(const std::string& reply) {
+    return reply.compare(0, 7, "SUCCESS") == 0 || reply.compare(0, 5, "PEERS") == 0;
+}
+
+//=================================================================================================
+// SHARES
+//=================================================================================================
+
+// A user who completes a file with HAVE seeds it until they log out.
+static void test_have_then_logout() {
+    TrackerConfig config;
+    config.log_level = LOG_OFF;
+    Tracker tracker(0, 0, config);
+
+    const char* setup[] = {
+        "CREATE_USER alice pw", "LOGIN alice pw 127.0.0.1 9001", "CREATE_GROUP alice g1",
+        "UPLOAD_FILE alice g1 f.txt abcdef0123456789 aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa 1000",
+        "CREATE_USER bob pw", "LOGIN bob pw 127.0.0.1 9002", "JOIN_GROUP bob g1", "ACCEPT_REQUEST alice g1 bob",
+    };
+    for (const char* command : setup) {
+        std::string reply = run(tracker, command);
+        CHECK(succeeds(reply), command + std::string(" -> ") + reply);
+    }
+
+    std::string reply = run(tracker, "HAVE bob g1 f.txt 0");
+    CHECK(reply == "SUCCESS: File complete, now seeding\n", reply);
+    reply = run(tracker, "DOWNLOAD_FILE alice g1 f.txt");
+    CHECK(reply.find(" 9002 bob") != std::string::npos, reply);
+
+    reply = run(tracker, "LOGOUT bob");
+    CHECK(succeeds(reply), reply);
+    // Back online, bob has shared nothing since logging out
+    reply = run(tracker, "LOGIN bob pw 127.0.0.1 9002");
+    CHECK(succeeds(reply), reply);
+    reply = run(tracker, "DOWNLOAD_FILE alice g1 f.txt");
+    CHECK(reply.find("bob") == std::string::npos, reply);
+}
+
+//=================================================================================================
+// HOT RESTART
+//=================================================================================================
+
+// An IPv4 address of this host other than loopback, or "" if there is none.
+static std::string host_address() {
+    struct ifaddrs* list;
+    if (getifaddrs(&list) != 0) return std::string();
+    std::string found;
+    for (struct ifaddrs* entry = list; entry != NULL && found.empty(); entry = entry->ifa_next) {
+        if (entry->ifa_addr == NULL || entry->ifa_addr->sa_family != AF_INET) continue;
+        struct in_addr addr = reinterpret_cast<struct sockaddr_in*>(entry->ifa_addr)->sin_addr;
+        if ((ntohl(addr.s_addr) >> 24) == 127) continue;
+        char text[INET_ADDRSTRLEN];
+        if (inet_ntop(AF_INET, &addr, text, sizeof(text)) != NULL) found = text;
+    }
+    freeifaddrs(list);
+    return found;
+}
+
+// A port nothing listens on right now.
+static int free_port() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    int port = -1;
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0 &&
+        getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &length) == 0) {
+        port = ntohs(addr.sin_port);
+    }
+    close(fd);
+    return port;
+}
+
+static pid_t start_tracker(const std::string& tracker_file, const std::string& handoff_path) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = ::open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        std::string handoff = "--handoff=" + handoff_path;
+        execl("./tracker", "tracker", tracker_file.c_str(), "0", handoff.c_str(), "--drain=5", (char*)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stop_tracker(pid_t pid) {
+    if (pid <= 0) return;
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+static int connect_retrying(int port) {
+    for (int attempt = 0; attempt < 50; ++attempt) {
+        int fd = connect_with_timeout("127.0.0.1", port, 1000);
+        if (fd >= 0) {
+            set_socket_timeouts(fd, 10000);
+            return fd;
+        }
+        usleep(100000);
+    }
+    return -1;
+}
+
+static std::string call(int fd, const std::string& command) {
+    Frame reply;
+    if (!send_frame(fd, MSG_COMMAND, command) || !recv_frame(fd, reply)) return "(no reply)";
+    return reply.text;
+}
+
+// Commands on a connection left with the old tracker are forwarded to the new
+// one, which must admit them although tracker_info lists no loopback address.
+static void test_drain_forwards_to_successor() {
+    std::string ip = host_address();
+    int port = free_port();
+    if (ip.empty() || port < 0) {
+        std::cout << "SKIP " << __FUNCTION__ << ": no non-loopback IPv4 address" << std::endl;
+        return;
+    }
+    char dir[] = "/tmp/tracker_test.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        CHECK(false, strerror(errno));
+        return;
+    }
+    std::string tracker_file = std::string(dir) + "/tracker_info.txt";
+    std::string handoff_path = std::string(dir) + "/handoff.sock";
+    {
+        std::ofstream file(tracker_file);
+        file << ip << ":" << port << "\n";
+    }
+
+    pid_t old_tracker = start_tracker(tracker_file, handoff_path);
+    int fd = connect_retrying(port);
+    CHECK(fd >= 0, "old tracker did not start");
+    pid_t new_tracker = -1;
+    if (fd >= 0) {
+        std::string reply = call(fd, "CREATE_USER alice pw");
+        CHECK(succeeds(reply), reply);
+
+        new_tracker = start_tracker(tracker_file, handoff_path);
+        sleep(2);                           // the handoff, then the old tracker drains
+        reply = call(fd, "CREATE_USER bob pw");
+        CHECK(succeeds(reply), reply);
+        reply = call(fd, "LOGIN alice pw 127.0.0.1 9001");
+        CHECK(succeeds(reply), reply);
+        close(fd);
+
+        // The new tracker holds what the drained connection changed
+        fd = connect_retrying(port);
+        reply = fd >= 0 ? call(fd, "CREATE_USER bob pw") : "(no connection)";
+        CHECK(reply == "ERROR: User already exists\n", reply);
+        if (fd >= 0) close(fd);
+    }
+    stop_tracker(new_tracker);
+    stop_tracker(old_tracker);
+    unlink(tracker_file.c_str());
+    unlink(handoff_path.c_str());
+    rmdir(dir);
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    test_have_then_logout();
+    test_drain_forwards_to_successor();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All tracker tests passed" << std::endl;
+    return 0;
+}
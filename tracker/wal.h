@@ -0,0 +1,460 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+//=================================================================================================
+// WRITE-AHEAD LOG
+//
+// Every state mutation is appended as a record:
+//
+//   u32 length   bytes of body
+//   u32 crc32    of body
+//   body         u64 lsn, u8 WalRecordType, fields (u32 length + bytes each)
+//
+// (integers little-endian, host order on the machines we run on). Records are
+// buffered in memory and a single flusher thread writes and fdatasync()s them
+// in batches, so concurrent requests share one fsync (group commit). The log
+// is split into segments named after their first LSN; a snapshot written in
+// the same record format lets every segment it covers be deleted.
+//=================================================================================================
+
+#define WAL_RECORD_HEADER 8
+#define WAL_MAX_RECORD (64u * 1024 * 1024)
+#define SNAPSHOT_MAGIC "AOSSNAP1"
+
+enum WalRecordType {
+    WAL_USER_CREATE = 1,        // user, password
+    WAL_USER_SESSION = 2,       // user, online, ip, port
+    WAL_GROUP_CREATE = 3,       // group, owner
+    WAL_GROUP_OWNER = 4,        // group, owner
+    WAL_GROUP_MEMBER = 5,       // group, user, present
+    WAL_GROUP_PENDING = 6,      // group, user, present
+    WAL_GROUP_SHARE = 7,        // group, filename, user
+    WAL_FILE_PUT_V1 = 8,        // read only: hash, filename, owner, group, size, piece count, hex pieces...
+    WAL_FILE_PIECES = 9,        // group, filename, piece count
+    WAL_PIECE_HAVE = 10,        // group, filename, user, bitfield (empty: no longer tracked)
+    WAL_FILE_PUT = 11,          // hash, filename, owner, group, size, piece digests
+    WAL_FILE_LINK = 12,         // group, filename, hash (empty: no content)
+    WAL_GROUP_UNSHARE = 13,     // group, filename, user
+    WAL_GROUP_DROP = 14         // group: it moved to another shard
+};
+
+enum WalSyncMode {
+    WAL_SYNC_COMMIT,            // replies wait until their records are on disk
+    WAL_SYNC_ASYNC              // fsync in the background; a crash may lose the last few ms
+};
+
+inline uint32_t wal_crc32(const char* data, size_t length) {
+    static uint32_t table[256];
+    static bool table_ready = [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)table_ready;
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Builds one record in a reusable buffer (header and LSN are filled in on append).
+class WalRecord {
+private:
+    std::string bytes;
+
+public:
+    void begin(WalRecordType type) {
+        bytes.assign(WAL_RECORD_HEADER + sizeof(uint64_t), '\0');
+        bytes.push_back(static_cast<char>(type));
+    }
+    void add(const char* data, size_t length) {
+        uint32_t field_length = length;
+        bytes.append(reinterpret_cast<const char*>(&field_length), sizeof(field_length));
+        bytes.append(data, length);
+    }
+    void add(const std::string& value) { add(value.data(), value.size()); }
+    // Takes over a sealed record, to be sealed again under a new LSN
+    void assign(const char* sealed, size_t length) { bytes.assign(sealed, length); }
+    void add_u64(uint64_t value) {
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    // Stamps the LSN and framing; the result is ready to be written out.
+    const std::string& seal(uint64_t lsn) {
+        uint32_t length = bytes.size() - WAL_RECORD_HEADER;
+        memcpy(&bytes[WAL_RECORD_HEADER], &lsn, sizeof(lsn));
+        uint32_t crc = wal_crc32(bytes.data() + WAL_RECORD_HEADER, length);
+        memcpy(&bytes[0], &length, sizeof(length));
+        memcpy(&bytes[4], &crc, sizeof(crc));
+        return bytes;
+    }
+};
+
+// Cursor over the body of one record read back from disk.
+class WalReader {
+private:
+    const char* data;
+    size_t size;
+    size_t pos;
+    bool valid;
+
+public:
+    uint64_t lsn;
+    WalRecordType type;
+
+    WalReader(const char* data, size_t size) : data(data), size(size), pos(0), valid(true), lsn(0), type(WAL_USER_CREATE) {
+        uint8_t raw_type = 0;
+        if (size < sizeof(lsn) + 1) {
+            valid = false;
+            return;
+        }
+        memcpy(&lsn, data, sizeof(lsn));
+        raw_type = static_cast<uint8_t>(data[sizeof(lsn)]);
+        type = static_cast<WalRecordType>(raw_type);
+        pos = sizeof(lsn) + 1;
+    }
+
+    bool ok() const { return valid; }
+
+    std::string next() {
+        uint32_t length;
+        if (!valid || size - pos < sizeof(length)) {
+            valid = false;
+            return std::string();
+        }
+        memcpy(&length, data + pos, sizeof(length));
+        pos += sizeof(length);
+        if (size - pos < length) {
+            valid = false;
+            return std::string();
+        }
+        pos += length;
+        return std::string(data + pos - length, length);
+    }
+
+    uint64_t next_u64() {
+        uint64_t value = 0;
+        if (!valid || size - pos < sizeof(value)) {
+            valid = false;
+            return 0;
+        }
+        memcpy(&value, data + pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    }
+};
+
+// Reads framed records from fd until EOF or the first torn/corrupt record.
+// Calls apply(WalReader&) for each good one; returns the offset just past the
+// last good record so a torn tail can be truncated away.
+template <typename Apply>
+inline off_t wal_read_records(int fd, off_t offset, Apply apply) {
+    std::string buffer;
+    char chunk[65536];
+    size_t consumed = 0;
+    bool eof = false;
+
+    while (true) {
+        while (!eof && buffer.size() - consumed < WAL_RECORD_HEADER) {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) eof = true; else buffer.append(chunk, n);
+        }
+        if (buffer.size() - consumed < WAL_RECORD_HEADER) break;
+
+        uint32_t length, crc;
+        memcpy(&length, buffer.data() + consumed, sizeof(length));
+        memcpy(&crc, buffer.data() + consumed + 4, sizeof(crc));
+        if (length > WAL_MAX_RECORD) break;
+
+        while (!eof && buffer.size() - consumed < WAL_RECORD_HEADER + length) {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) eof = true; else buffer.append(chunk, n);
+        }
+        if (buffer.size() - consumed < WAL_RECORD_HEADER + length) break;
+
+        const char* record = buffer.data() + consumed + WAL_RECORD_HEADER;
+        if (wal_crc32(record, length) != crc) break;
+
+        WalReader reader(record, length);
+        if (!reader.ok()) break;
+        apply(reader);
+
+        consumed += WAL_RECORD_HEADER + length;
+        offset += WAL_RECORD_HEADER + length;
+        if (consumed > (1u << 20)) {
+            buffer.erase(0, consumed);
+            consumed = 0;
+        }
+    }
+    return offset;
+}
+
+// Walks sealed records packed back to back in memory (a replication batch).
+// apply(raw, raw_length, reader) gets each record with its framing so it can be
+// logged verbatim. Returns false if the buffer holds a damaged record.
+template <typename Apply>
+inline bool wal_for_each_record(const char* data, size_t length, Apply apply) {
+    size_t pos = 0;
+    while (pos < length) {
+        uint32_t record_length, crc;
+        if (length - pos < WAL_RECORD_HEADER) return false;
+        memcpy(&record_length, data + pos, sizeof(record_length));
+        memcpy(&crc, data + pos + 4, sizeof(crc));
+        if (length - pos - WAL_RECORD_HEADER < record_length) return false;
+
+        const char* body = data + pos + WAL_RECORD_HEADER;
+        if (wal_crc32(body, record_length) != crc) return false;
+        WalReader reader(body, record_length);
+        if (!reader.ok()) return false;
+        apply(data + pos, WAL_RECORD_HEADER + record_length, reader);
+        pos += WAL_RECORD_HEADER + record_length;
+    }
+    return true;
+}
+
+inline std::string wal_segment_name(uint64_t first_lsn) {
+    char name[64];
+    snprintf(name, sizeof(name), "wal-%020llu.log", static_cast<unsigned long long>(first_lsn));
+    return name;
+}
+
+// Segments in the directory, ordered by first LSN.
+inline std::vector<std::pair<uint64_t, std::string>> wal_list_segments(const std::string& dir) {
+    std::vector<std::pair<uint64_t, std::string>> segments;
+    DIR* handle = opendir(dir.c_str());
+    if (handle == NULL) return segments;
+    while (struct dirent* entry = readdir(handle)) {
+        unsigned long long first_lsn;
+        char suffix[8];
+        if (sscanf(entry->d_name, "wal-%20llu.%7s", &first_lsn, suffix) == 2 && strcmp(suffix, "log") == 0) {
+            segments.push_back(std::make_pair(static_cast<uint64_t>(first_lsn), dir + "/" + entry->d_name));
+        }
+    }
+    closedir(handle);
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+inline bool wal_sync_directory(const std::string& dir) {
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+inline bool wal_write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+class WriteAheadLog {
+private:
+    std::string dir;
+    WalSyncMode sync_mode;
+    int fd;
+
+    // Guarded by mutex
+    std::mutex mutex;
+    std::condition_variable flush_cv;
+    std::condition_variable durable_cv;
+    std::string pending;                // sealed records not yet written
+    uint64_t appended_lsn;
+    uint64_t durable_lsn;
+    bool failed;
+    bool stopping;
+
+    // Serialises file I/O between the flusher and rotate(); taken before mutex
+    std::mutex io_mutex;
+    std::thread flusher;
+
+    WriteAheadLog(const WriteAheadLog&);
+    WriteAheadLog& operator=(const WriteAheadLog&);
+
+    bool open_segment(uint64_t first_lsn) {
+        std::string path = dir + "/" + wal_segment_name(first_lsn);
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        return fd >= 0 && wal_sync_directory(dir);
+    }
+
+    // Caller holds io_mutex. Writes out everything appended so far.
+    void flush_pending() {
+        std::string batch;
+        uint64_t batch_lsn;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch.swap(pending);
+            batch_lsn = appended_lsn;
+        }
+        bool ok = true;
+        if (!batch.empty()) {
+            ok = wal_write_all(fd, batch.data(), batch.size()) && fdatasync(fd) == 0;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ok) failed = true;
+        if (ok && batch_lsn > durable_lsn) durable_lsn = batch_lsn;
+        durable_cv.notify_all();
+    }
+
+    void flusher_loop() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (sync_mode == WAL_SYNC_COMMIT) {
+                    flush_cv.wait(lock, [this] { return stopping || !pending.empty(); });
+                } else {
+                    flush_cv.wait_for(lock, std::chrono::milliseconds(10), [this] { return stopping; });
+                }
+                if (stopping && pending.empty()) return;
+            }
+            std::lock_guard<std::mutex> io_lock(io_mutex);
+            flush_pending();
+        }
+    }
+
+public:
+    WriteAheadLog() : sync_mode(WAL_SYNC_COMMIT), fd(-1), appended_lsn(0), durable_lsn(0), failed(false), stopping(false) {}
+
+    ~WriteAheadLog() { close(); }
+
+    // Starts a fresh segment whose first record will carry first_lsn.
+    bool open(const std::string& directory, uint64_t first_lsn, WalSyncMode mode) {
+        dir = directory;
+        sync_mode = mode;
+        appended_lsn = first_lsn - 1;
+        durable_lsn = first_lsn - 1;
+        if (!open_segment(first_lsn)) return false;
+        flusher = std::thread(&WriteAheadLog::flusher_loop, this);
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        flush_cv.notify_one();
+        if (flusher.joinable()) flusher.join();
+        if (fd >= 0) {
+            std::lock_guard<std::mutex> io_lock(io_mutex);
+            flush_pending();
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    bool is_open() const { return fd >= 0; }
+
+    // Queues a sealed record. LSNs are assigned by the caller in increasing
+    // order (so a backup can log records under the primary's LSNs). Cheap: no
+    // I/O happens here.
+    void append(const char* sealed, size_t length, uint64_t lsn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.append(sealed, length);
+        appended_lsn = lsn;
+        if (sync_mode == WAL_SYNC_COMMIT) flush_cv.notify_one();
+    }
+
+    // Blocks until the record with this LSN is on disk. False if the log failed.
+    bool wait_durable(uint64_t lsn) {
+        std::unique_lock<std::mutex> lock(mutex);
+        durable_cv.wait(lock, [this, lsn] { return durable_lsn >= lsn || failed; });
+        return durable_lsn >= lsn;
+    }
+
+    uint64_t last_lsn() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return appended_lsn;
+    }
+
+    // Seals the current segment and starts a new one. Returns the last LSN
+    // in the sealed segment: a snapshot taken after this call covers it.
+    uint64_t rotate() {
+        std::lock_guard<std::mutex> io_lock(io_mutex);
+        flush_pending();
+
+        // Anything appended from here on lands in the new segment
+        uint64_t boundary;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            boundary = appended_lsn;
+            if (!pending.empty()) {
+                std::string batch;
+                batch.swap(pending);
+                if (!wal_write_all(fd, batch.data(), batch.size())) failed = true;
+            }
+        }
+        bool ok = fdatasync(fd) == 0;
+        ::close(fd);
+        ok = open_segment(boundary + 1) && ok;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ok) failed = true;
+        if (!failed && boundary > durable_lsn) durable_lsn = boundary;
+        durable_cv.notify_all();
+        return boundary;
+    }
+
+    // Discards the whole log and restarts it at first_lsn (used when a backup
+    // replaces its state wholesale; write a snapshot right after).
+    bool reset(uint64_t first_lsn) {
+        std::lock_guard<std::mutex> io_lock(io_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.clear();
+            appended_lsn = first_lsn - 1;
+            durable_lsn = first_lsn - 1;
+        }
+        ::close(fd);
+        std::vector<std::pair<uint64_t, std::string>> segments = wal_list_segments(dir);
+        for (size_t i = 0; i < segments.size(); ++i) {
+            unlink(segments[i].second.c_str());
+        }
+        bool ok = open_segment(first_lsn);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ok) failed = true;
+        return ok;
+    }
+
+    // Deletes segments that hold only records up to lsn.
+    void remove_segments_through(uint64_t lsn) {
+        std::vector<std::pair<uint64_t, std::string>> segments = wal_list_segments(dir);
+        for (size_t i = 0; i + 1 < segments.size(); ++i) {
+            if (segments[i + 1].first <= lsn + 1) {
+                unlink(segments[i].second.c_str());
+            }
+        }
+    }
+};
+
+#endif // WAL_H